@@ -0,0 +1,116 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+// Helpers the benchmarks share: timing, starting the programs they measure
+// and writing their input files. Each bench is a single file, so these are
+// static inline, and a bench defines BENCH_NAME (for error messages) and
+// the feature macros it needs before including this.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#ifndef DEFAULT_MB
+#define DEFAULT_MB 2048 // Size of the input file
+#endif
+#define LINE_LENGTH 80  // Of the lines write_source() writes
+#define ROUNDS 3        // Each case is timed this many times and the fastest kept
+
+extern char **environ;
+
+static inline double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void die(const char *what) {
+    fprintf(stderr, BENCH_NAME ": %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+// Start argv with stdout on out_fd, or on /dev/null if out_fd is -1, and
+// close_fd closed in the child unless it is -1. Returns -1 with errno set
+// if it cannot be started.
+static inline pid_t spawn_stdout(char **argv, int out_fd, int close_fd) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (out_fd == -1) {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    } else {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    }
+    if (close_fd != -1) posix_spawn_file_actions_addclose(&actions, close_fd);
+    pid_t pid;
+    int error = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return pid;
+}
+
+// Wait for pid; its exit status, 128 + the signal if it was killed
+static inline int wait_status(pid_t pid) {
+    int status;
+    if (waitpid(pid, &status, 0) == -1) return 128;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Run argv with stdout on /dev/null; returns its exit status
+static inline int run(char **argv) {
+    pid_t pid = spawn_stdout(argv, -1, -1);
+    if (pid == -1) die(argv[0]);
+    return wait_status(pid);
+}
+
+// Run argv with stdout to a pipe this process drains; returns the bytes it
+// wrote, and the lines in *lines unless that is NULL
+static inline long long run_piped(char **argv, long long *lines) {
+    int fds[2];
+    if (pipe(fds) == -1) die("pipe");
+    pid_t pid = spawn_stdout(argv, fds[1], fds[0]);
+    close(fds[1]);
+    if (pid == -1) die(argv[0]);
+    static char buffer[1 << 20];
+    long long bytes = 0;
+    if (lines) *lines = 0;
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+        bytes += n;
+        for (ssize_t i = 0; lines && i < n; i++) *lines += buffer[i] == '\n';
+    }
+    close(fds[0]);
+    wait_status(pid);
+    return bytes;
+}
+
+// Fill path with size bytes: a 1 MB block made by fill over and over, or
+// LINE_LENGTH-character lines of letters if fill is NULL
+static inline void write_source(const char *path, long long size, void (*fill)(char *block, size_t size)) {
+    FILE *file = fopen(path, "w");
+    if (!file) die(path);
+    static char block[1 << 20];
+    if (fill) {
+        fill(block, sizeof(block));
+    } else {
+        for (size_t i = 0; i < sizeof(block); i++) {
+            block[i] = (i + 1) % LINE_LENGTH == 0 ? '\n' : 'a' + (char)(i * 7 % 26);
+        }
+    }
+    for (long long left = size; left > 0; left -= sizeof(block)) {
+        size_t n = left < (long long)sizeof(block) ? (size_t)left : sizeof(block);
+        if (fwrite(block, 1, n, file) != n) die(path);
+    }
+    if (fclose(file) == EOF) die(path);
+}
+
+#endif // BENCH_UTIL_H
@@ -0,0 +1,95 @@
+// xsh's cat against GNU cat, end to end: each runs as its own process on a
+// page-cached file, plain, with -n and with -A, writing into a pipe that
+// this process drains, and into a file.
+//
+//   cat_bench XSHELL [MB] [directory]
+//
+// Writes a file of MB megabytes (default 2048) of 80-character lines with a
+// tab and a high byte in each, in directory (default /tmp), then times every
+// case ROUNDS times after a warm-up run, keeping the fastest. The two cats'
+// output must be the same length.
+
+#define _DEFAULT_SOURCE
+#define BENCH_NAME "cat_bench"
+
+#include "bench_util.h"
+
+// Lines with a tab and a high byte in each, for -A to show
+static void fill_lines(char *block, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        size_t column = (i + 1) % LINE_LENGTH;
+        block[i] = column == 0 ? '\n' : column == 20 ? '\t' : column == 40 ? (char)0xe9 : 'a' + (char)(i * 7 % 26);
+    }
+}
+
+// Run argv with stdout to a pipe, or to the file output if not NULL;
+// returns the bytes it wrote
+static long long run_to(char **argv, const char *output) {
+    if (!output) return run_piped(argv, NULL);
+    int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) die(output);
+    pid_t pid = spawn_stdout(argv, fd, -1);
+    close(fd);
+    if (pid == -1) die(argv[0]);
+    wait_status(pid);
+    struct stat st;
+    if (stat(output, &st) == -1) die(output);
+    return st.st_size;
+}
+
+// Best MB/s of argv over ROUNDS, its output length in *bytes
+static double best_rate(char **argv, const char *output, long long size, long long *bytes) {
+    double best = 0;
+    *bytes = run_to(argv, output); // Warm-up
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now_s();
+        run_to(argv, output);
+        double seconds = now_s() - start;
+        double rate = size / seconds / (1024 * 1024);
+        if (rate > best) best = rate;
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: cat_bench XSHELL [MB] [directory]\n");
+        return 2;
+    }
+    const char *xshell = argv[1];
+    long long mb = argc > 2 ? atoll(argv[2]) : DEFAULT_MB;
+    const char *directory = argc > 3 ? argv[3] : "/tmp";
+    if (mb < 1) mb = DEFAULT_MB;
+    long long size = mb * 1024 * 1024;
+
+    char source[4096], output[4096 + 16];
+    snprintf(source, sizeof(source), "%s/cat_bench.%d", directory, (int)getpid());
+    snprintf(output, sizeof(output), "%s.out", source);
+    write_source(source, size, fill_lines);
+
+    static const char *options[] = {"", "-n", "-A"};
+    printf("%lld MB, MB/s (best of %d)\n", mb, ROUNDS);
+    printf("%-8s %12s %12s %12s %12s\n", "Options", "xsh pipe", "GNU pipe", "xsh file", "GNU file");
+    for (size_t i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        char command[8192];
+        snprintf(command, sizeof(command), "cat %s '%s'", options[i], source);
+        char *xsh_argv[] = {(char *)xshell, "-c", command, NULL};
+        char *gnu_argv[] = {"cat", options[i][0] ? (char *)options[i] : "--", source, NULL};
+
+        long long xsh_bytes, gnu_bytes, bytes;
+        double xsh_pipe = best_rate(xsh_argv, NULL, size, &xsh_bytes);
+        double gnu_pipe = best_rate(gnu_argv, NULL, size, &gnu_bytes);
+        if (xsh_bytes != gnu_bytes) {
+            fprintf(stderr, "cat_bench: cat %s: xsh wrote %lld bytes, GNU cat %lld\n", options[i], xsh_bytes,
+                    gnu_bytes);
+            return 1;
+        }
+        double xsh_file = best_rate(xsh_argv, output, size, &bytes);
+        double gnu_file = best_rate(gnu_argv, output, size, &bytes);
+        printf("%-8s %12.0f %12.0f %12.0f %12.0f\n", options[i][0] ? options[i] : "(none)", xsh_pipe, gnu_pipe,
+               xsh_file, gnu_file);
+    }
+    unlink(output);
+    unlink(source);
+    return 0;
+}
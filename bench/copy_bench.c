@@ -0,0 +1,135 @@
+// Copy throughput of cat's data path: the old stdio loop (fgets() and
+// fputs() of up to 1024-byte lines) against the kernel fast paths of
+// src/fastcopy.c and GNU cat, into a file and into a pipe.
+//
+//   copy_bench [MB] [directory]
+//
+// Writes a text file of MB megabytes (default 2048) in directory (default
+// /tmp), then copies it each way, keeping the best of ROUNDS runs. The source stays in the page cache and the
+// copies are not synced (only what the previous copy left dirty is, before
+// the next starts), so the numbers are the cost of moving the bytes rather
+// than the disk's. The pipe cases are drained by a thread that reads
+// into a buffer, the same for every writer.
+
+#define _DEFAULT_SOURCE
+#define BENCH_NAME "copy_bench"
+
+#include "bench_util.h"
+#include "fastcopy.h"
+#include <pthread.h>
+#include <stdint.h>
+
+// The old cat loop
+static void copy_stdio(const char *source, int out_fd) {
+    FILE *in = fopen(source, "r");
+    FILE *out = fdopen(dup(out_fd), "w");
+    if (!in || !out) die("stdio copy");
+    char line[1024];
+    while (fgets(line, sizeof(line), in)) {
+        if (fputs(line, out) == EOF) break;
+    }
+    fclose(in);
+    fclose(out);
+}
+
+static void copy_fast(const char *source, int out_fd) {
+    int in_fd = open(source, O_RDONLY);
+    if (in_fd == -1 || fastcopy_fd(in_fd, out_fd) == -1) die("fast copy");
+    close(in_fd);
+}
+
+static void copy_gnu_cat(const char *source, int out_fd) {
+    char *args[] = {"cat", (char *)source, NULL};
+    pid_t pid = spawn_stdout(args, out_fd, -1);
+    if (pid == -1) die("cat");
+    wait_status(pid);
+}
+
+static void *drain_pipe(void *arg) {
+    int fd = *(int *)arg;
+    long long total = 0;
+    char *buffer = malloc(FASTCOPY_BUFSIZE);
+    ssize_t n;
+    while (buffer && (n = read(fd, buffer, FASTCOPY_BUFSIZE)) > 0) total += n;
+    free(buffer);
+    close(fd);
+    return (void *)(intptr_t)total;
+}
+
+// Seconds to copy source into a new file, or into a pipe if target is NULL.
+// Checks that every byte arrived.
+static double time_copy(void (*copy)(const char *, int), const char *source, const char *target,
+                        long long size) {
+    int out_fd, read_fd = -1;
+    pthread_t drainer;
+    if (target) {
+        out_fd = open(target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd == -1) die(target);
+    } else {
+        int fds[2];
+        if (pipe(fds) == -1) die("pipe");
+        read_fd = fds[0];
+        out_fd = fds[1];
+        fcntl(read_fd, F_SETFD, FD_CLOEXEC);
+        pthread_create(&drainer, NULL, drain_pipe, &read_fd);
+    }
+
+    sync(); // Writeback of the previous copy would throttle this one
+    double start = now_s();
+    copy(source, out_fd);
+    close(out_fd);
+    long long copied;
+    if (target) {
+        struct stat st;
+        copied = stat(target, &st) == 0 ? (long long)st.st_size : -1;
+    } else {
+        void *total;
+        pthread_join(drainer, &total);
+        copied = (intptr_t)total;
+    }
+    double seconds = now_s() - start;
+
+    if (copied != size) {
+        fprintf(stderr, "copy_bench: copied %lld of %lld bytes\n", copied, size);
+        exit(1);
+    }
+    if (target) unlink(target);
+    return seconds;
+}
+
+int main(int argc, char **argv) {
+    long long mb = argc > 1 ? atoll(argv[1]) : DEFAULT_MB;
+    const char *directory = argc > 2 ? argv[2] : "/tmp";
+    if (mb < 1) mb = DEFAULT_MB;
+    long long size = mb * 1024 * 1024;
+
+    char source[4096], target[4096];
+    snprintf(source, sizeof(source), "%s/copy_bench.%d.src", directory, (int)getpid());
+    snprintf(target, sizeof(target), "%s/copy_bench.%d.dst", directory, (int)getpid());
+    write_source(source, size, NULL);
+
+    struct {
+        const char *label;
+        void (*copy)(const char *, int);
+    } ways[] = {
+        {"stdio lines (old cat)", copy_stdio},
+        {"fastcopy", copy_fast},
+        {"GNU cat", copy_gnu_cat},
+    };
+
+    printf("%lld MB\n", mb);
+    printf("%-24s %14s %14s\n", "Copy", "file (MB/s)", "pipe (MB/s)");
+    for (size_t i = 0; i < sizeof(ways) / sizeof(ways[0]); i++) {
+        double to_file = 0, to_pipe = 0;
+        for (int round = 0; round < ROUNDS; round++) {
+            double seconds = time_copy(ways[i].copy, source, target, size);
+            if (round == 0 || seconds < to_file) to_file = seconds;
+            seconds = time_copy(ways[i].copy, source, NULL, size);
+            if (round == 0 || seconds < to_pipe) to_pipe = seconds;
+        }
+        printf("%-24s %14.0f %14.0f\n", ways[i].label, mb / to_file, mb / to_pipe);
+    }
+
+    unlink(source);
+    return 0;
+}
@@ -0,0 +1,141 @@
+// cp against coreutils cp: a tree of many small files (copied with -r and
+// -rp) and one large file.
+//
+//   cp_bench XSHELL [files] [MB] [directory]
+//
+// Builds a tree of files (default 100000) small files, 100 to a directory,
+// and a file of MB megabytes (default 10240) in directory (default /tmp),
+// then times `XSHELL -c "cp ..."` and coreutils cp on each, keeping the best
+// of ROUNDS runs. Dirty pages are synced before each run and the copy is
+// removed after it, untimed. Both cps reflink where the filesystem allows,
+// in which case the large file measures that rather than data movement.
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700 // For nftw()
+#define BENCH_NAME "cp_bench"
+#define DEFAULT_MB 10240
+
+#include "bench_util.h"
+#include <ftw.h>
+
+#define DEFAULT_FILES 100000
+#define FILES_PER_DIR 100
+#define SMALL_FILE_MAX 8192
+
+static void remove_tree(const char *path) {
+    char *argv[] = {"rm", "-rf", (char *)path, NULL};
+    run(argv);
+}
+
+static void write_file(const char *path, const char *data, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || write(fd, data, size) != (ssize_t)size || close(fd) == -1) die(path);
+}
+
+static void make_tree(const char *root, long files) {
+    static char data[SMALL_FILE_MAX];
+    for (size_t i = 0; i < sizeof(data); i++) data[i] = 'a' + (char)(i * 7 % 26);
+    char path[4096 + 64];
+    if (mkdir(root, 0755) == -1) die(root);
+    for (long i = 0; i < files; i++) {
+        if (i % FILES_PER_DIR == 0) {
+            snprintf(path, sizeof(path), "%s/d%ld", root, i / FILES_PER_DIR);
+            if (mkdir(path, 0755) == -1) die(path);
+        }
+        snprintf(path, sizeof(path), "%s/d%ld/f%ld", root, i / FILES_PER_DIR, i);
+        write_file(path, data, (size_t)(i * 397 % SMALL_FILE_MAX) + 1);
+    }
+}
+
+static long long counted_files;
+static long long counted_bytes;
+
+static int count_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)path;
+    (void)ftw;
+    if (type == FTW_F) {
+        counted_files++;
+        counted_bytes += st->st_size;
+    }
+    return 0;
+}
+
+static void count(const char *path) {
+    counted_files = counted_bytes = 0;
+    if (nftw(path, count_entry, 64, FTW_PHYS) == -1) die(path);
+}
+
+// Best time of ROUNDS runs of argv, which copies source to target. Checks
+// the copy has as many files and bytes as the source.
+static double time_copy(char **argv, const char *source, const char *target) {
+    count(source);
+    long long files = counted_files, bytes = counted_bytes;
+    double best = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        remove_tree(target);
+        sync();
+        double start = now_s();
+        int status = run(argv);
+        double seconds = now_s() - start;
+        count(target);
+        if (status != 0 || counted_files != files || counted_bytes != bytes) {
+            fprintf(stderr, "cp_bench: %s: exit %d, copied %lld of %lld files, %lld of %lld bytes\n", argv[0],
+                    status, counted_files, files, counted_bytes, bytes);
+            exit(1);
+        }
+        if (round == 0 || seconds < best) best = seconds;
+    }
+    remove_tree(target);
+    return best;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: cp_bench XSHELL [files] [MB] [directory]\n");
+        return 2;
+    }
+    const char *xshell = argv[1];
+    long files = argc > 2 ? atol(argv[2]) : DEFAULT_FILES;
+    long long mb = argc > 3 ? atoll(argv[3]) : DEFAULT_MB;
+    const char *directory = argc > 4 ? argv[4] : "/tmp";
+    if (files < 1) files = DEFAULT_FILES;
+    if (mb < 1) mb = DEFAULT_MB;
+
+    char tree[4096], large[4096], target[4096];
+    snprintf(tree, sizeof(tree), "%s/cp_bench.%d.tree", directory, (int)getpid());
+    snprintf(large, sizeof(large), "%s/cp_bench.%d.large", directory, (int)getpid());
+    snprintf(target, sizeof(target), "%s/cp_bench.%d.copy", directory, (int)getpid());
+    make_tree(tree, files);
+    write_source(large, mb * 1024 * 1024, NULL);
+
+    struct {
+        const char *label;
+        const char *flags;
+        const char *source;
+    } cases[] = {
+        {"tree (-r)", "-r", tree},
+        {"tree (-rp)", "-rp", tree},
+        {"large file", "", large},
+    };
+
+    printf("%ld files, %lld MB file\n", files, mb);
+    printf("%-14s %12s %12s\n", "Copy", "xsh cp (s)", "GNU cp (s)");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        char command[3 * 4096];
+        snprintf(command, sizeof(command), "cp %s '%s' '%s'", cases[i].flags, cases[i].source, target);
+        char *xsh_argv[] = {(char *)xshell, "-c", command, NULL};
+        char *gnu_argv[] = {"cp", (char *)cases[i].flags, (char *)cases[i].source, target, NULL};
+        if (!cases[i].flags[0]) {
+            gnu_argv[1] = (char *)cases[i].source;
+            gnu_argv[2] = target;
+            gnu_argv[3] = NULL;
+        }
+        double xsh = time_copy(xsh_argv, cases[i].source, target);
+        double gnu = time_copy(gnu_argv, cases[i].source, target);
+        printf("%-14s %12.3f %12.3f\n", cases[i].label, xsh, gnu);
+    }
+
+    remove_tree(tree);
+    unlink(large);
+    return 0;
+}
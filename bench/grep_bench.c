@@ -0,0 +1,190 @@
+// grep -r over a tree of logs: xsh's grep against GNU grep and ripgrep (when
+// installed), and for literals the old fgets() and strstr() loop run in
+// this process.
+//
+//   grep_bench XSHELL [files] [MB per file] [directory]
+//
+// Writes files (default 64) logs of MB (default 16) each in directory
+// (default /tmp), then times each search ROUNDS times after a warm-up run,
+// so the tree is in the page cache, keeping the fastest. Output goes to a
+// pipe drained by this process, and the matching lines of every tool are
+// counted and must agree.
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700 // For nftw()
+#define BENCH_NAME "grep_bench"
+#define DEFAULT_MB 16
+
+#include "bench_util.h"
+#include <ctype.h>
+#include <ftw.h>
+
+#define DEFAULT_FILES 64
+
+// Log lines: mostly INFO requests, one in 1000 an ERROR with a timeout
+static void write_log(const char *path, long long size, unsigned seed) {
+    FILE *file = fopen(path, "w");
+    if (!file) die(path);
+    static const char *paths[] = {"/api/v1/items", "/api/v1/users", "/healthz", "/api/v2/orders", "/static/app.js"};
+    long long written = 0;
+    for (unsigned long n = 0; written < size; n++) {
+        unsigned r = (unsigned)(n * 2654435761u + seed);
+        int length;
+        if (r % 1000 == 7) {
+            length = fprintf(file, "2026-10-17T03:%02u:%02u.%03uZ host-%02u api[%u]: ERROR upstream Timeout after %ums "
+                             "path=%s/%u\n", r / 7 % 60, r / 11 % 60, r % 1000, r % 32, 1000 + r % 9000,
+                             1000 + r % 4000, paths[r % 5], r % 100000);
+        } else {
+            length = fprintf(file, "2026-10-17T03:%02u:%02u.%03uZ host-%02u api[%u]: INFO request id=%08x path=%s/%u "
+                             "status=%u latency_ms=%u\n", r / 7 % 60, r / 11 % 60, r % 1000, r % 32,
+                             1000 + r % 9000, r, paths[r % 5], r % 100000, r % 50 ? 200 : 404, r % 997);
+        }
+        if (length < 0) die(path);
+        written += length;
+    }
+    if (fclose(file) == EOF) die(path);
+}
+
+// Run argv with stdout to a pipe; returns the number of lines it printed
+static long long run_counting(char **argv) {
+    long long lines;
+    run_piped(argv, &lines);
+    return lines;
+}
+
+// The old grep: 1024-byte fgets() chunks and strstr(), or a tolower() loop
+static const char *old_pattern;
+static int old_fold;
+static long long old_lines;
+
+static const char *old_strcasestr(const char *haystack, const char *needle) {
+    for (; *haystack; haystack++) {
+        const char *h = haystack, *n = needle;
+        while (*h && *n && tolower((unsigned char)*h) == tolower((unsigned char)*n)) {
+            h++;
+            n++;
+        }
+        if (!*n) return haystack;
+    }
+    return NULL;
+}
+
+static int old_grep_file(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)ftw;
+    if (type != FTW_F) return 0;
+    FILE *file = fopen(path, "r");
+    if (!file) die(path);
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        if (old_fold ? old_strcasestr(line, old_pattern) != NULL : strstr(line, old_pattern) != NULL) old_lines++;
+    }
+    fclose(file);
+    return 0;
+}
+
+typedef struct {
+    const char *label;
+    const char *pattern;
+    int fold;
+    int regex; // -E rather than a literal
+} search_t;
+
+static double best_of(char **argv, long long *lines) {
+    double best = 0;
+    *lines = run_counting(argv); // Warm-up
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now_s();
+        long long counted = run_counting(argv);
+        double seconds = now_s() - start;
+        if (counted != *lines) {
+            fprintf(stderr, "grep_bench: %s printed %lld lines, then %lld\n", argv[0], *lines, counted);
+            exit(1);
+        }
+        if (round == 0 || seconds < best) best = seconds;
+    }
+    return best;
+}
+
+static int installed(const char *command) {
+    char *argv[] = {(char *)command, "--version", NULL};
+    pid_t pid = spawn_stdout(argv, -1, -1);
+    return pid != -1 && wait_status(pid) == 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: grep_bench XSHELL [files] [MB per file] [directory]\n");
+        return 2;
+    }
+    const char *xshell = argv[1];
+    long files = argc > 2 ? atol(argv[2]) : DEFAULT_FILES;
+    long long mb = argc > 3 ? atoll(argv[3]) : DEFAULT_MB;
+    const char *directory = argc > 4 ? argv[4] : "/tmp";
+    if (files < 1) files = DEFAULT_FILES;
+    if (mb < 1) mb = DEFAULT_MB;
+
+    char tree[4096];
+    snprintf(tree, sizeof(tree), "%s/grep_bench.%d", directory, (int)getpid());
+    if (mkdir(tree, 0755) == -1) die(tree);
+    for (long i = 0; i < files; i++) {
+        char path[4096 + 32];
+        snprintf(path, sizeof(path), "%s/%s", tree, i % 2 ? "api" : "worker");
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/%s/%ld.log", tree, i % 2 ? "api" : "worker", i);
+        write_log(path, mb * 1024 * 1024, (unsigned)i * 977u);
+    }
+    int have_rg = installed("rg");
+
+    search_t searches[] = {
+        {"rare literal", "ERROR", 0, 0},
+        {"rare, -i", "timeout after", 1, 0},
+        {"common literal", "status=404", 0, 0},
+        {"regex", "ERROR.*Timeout after [0-9]+ms", 0, 1},
+        {"regex, -i", "(timeout|refused) after 4[0-9]{3}", 1, 1},
+        {"regex, no lit.", "[0-9]{3}Z host-(07|13)", 0, 1},
+    };
+
+    printf("%ld files of %lld MB\n", files, mb);
+    printf("%-16s %10s %10s %10s %10s %10s\n", "Search", "lines", "xsh (s)", "GNU (s)", "rg (s)", "old (s)");
+    for (size_t i = 0; i < sizeof(searches) / sizeof(searches[0]); i++) {
+        const search_t *search = &searches[i];
+        char command[4096 + 256];
+        snprintf(command, sizeof(command), "grep -r%s %s'%s' '%s'", search->regex ? "E" : "",
+                 search->fold ? "-i " : "", search->pattern, tree);
+        char *xsh_argv[] = {(char *)xshell, "-c", command, NULL};
+        char *gnu_argv[] = {"grep", search->regex ? "-rE" : "-rF", search->fold ? "-i" : "-s",
+                            (char *)search->pattern, tree, NULL};
+        char *rg_argv[] = {"rg", "--no-heading", "--no-line-number", search->regex ? "-s" : "-F",
+                           search->fold ? "-i" : "-s", (char *)search->pattern, tree, NULL};
+
+        long long xsh_lines, gnu_lines, rg_lines = -1;
+        double xsh = best_of(xsh_argv, &xsh_lines);
+        double gnu = best_of(gnu_argv, &gnu_lines);
+        double rg = have_rg ? best_of(rg_argv, &rg_lines) : 0;
+
+        double old = 0;
+        if (!search->regex) {
+            old_pattern = search->pattern;
+            old_fold = search->fold;
+            old_lines = 0;
+            double start = now_s();
+            if (nftw(tree, old_grep_file, 16, FTW_PHYS) == -1) die(tree);
+            old = now_s() - start;
+        }
+
+        if (gnu_lines != xsh_lines || (have_rg && rg_lines != xsh_lines)) {
+            fprintf(stderr, "grep_bench: %s: xsh found %lld lines, GNU grep %lld, rg %lld\n", search->label,
+                    xsh_lines, gnu_lines, rg_lines);
+            return 1;
+        }
+        char rg_time[32], old_time[32];
+        snprintf(rg_time, sizeof(rg_time), have_rg ? "%.3f" : "-", rg);
+        snprintf(old_time, sizeof(old_time), search->regex ? "-" : "%.3f", old);
+        printf("%-16s %10lld %10.3f %10.3f %10s %10s\n", search->label, xsh_lines, xsh, gnu, rg_time, old_time);
+    }
+
+    char *rm_argv[] = {"rm", "-rf", tree, NULL};
+    run(rm_argv);
+    return 0;
+}
@@ -0,0 +1,90 @@
+// Launch latency against heap size: fork() + execvp() versus the shell's
+// posix_spawn launcher (src/launch.c).
+//
+//   launch_bench [launches] [heap MB ...]   (heap sizes in ascending order)
+//
+// For each heap size the benchmark allocates and touches that much memory,
+// as the history, analytics and editor state of a long session would, then
+// times starting and reaping /bin/true both ways.
+
+#define _DEFAULT_SOURCE
+
+#include "launch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define DEFAULT_LAUNCHES 200
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static pid_t launch_with_fork(char *const args[]) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execvp(args[0], args);
+        _exit(127);
+    }
+    return pid;
+}
+
+// Mean microseconds to start and reap one child
+static double time_launches(pid_t (*launch)(char *const args[]), char *const args[], int launches) {
+    double start = now_us();
+    for (int i = 0; i < launches; i++) {
+        pid_t pid = launch(args);
+        if (pid < 0) {
+            perror("launch_bench");
+            exit(1);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+    }
+    return (now_us() - start) / launches;
+}
+
+static pid_t launch_with_spawn(char *const args[]) {
+    return launch_process(args, NULL, -1);
+}
+
+int main(int argc, char **argv) {
+    static const int default_sizes[] = {0, 64, 256, 1024};
+    int launches = argc > 1 ? atoi(argv[1]) : DEFAULT_LAUNCHES;
+    int size_count = argc > 2 ? argc - 2 : (int)(sizeof(default_sizes) / sizeof(default_sizes[0]));
+    if (launches < 1) launches = DEFAULT_LAUNCHES;
+
+    char *args[] = {"/bin/true", NULL};
+    char *heap = NULL;
+    size_t heap_size = 0;
+
+    printf("%8s %16s %16s %8s\n", "Heap MB", "fork+exec (us)", "posix_spawn (us)", "Speedup");
+    for (int i = 0; i < size_count; i++) {
+        int mb = argc > 2 ? atoi(argv[i + 2]) : default_sizes[i];
+        size_t size = (size_t)(mb > 0 ? mb : 0) * 1024 * 1024;
+
+        // Grow the heap and touch every page so it is really mapped
+        if (size > heap_size) {
+            char *grown = realloc(heap, size);
+            if (!grown) {
+                fprintf(stderr, "launch_bench: cannot allocate %d MB\n", mb);
+                break;
+            }
+            heap = grown;
+            memset(heap + heap_size, 1, size - heap_size);
+            heap_size = size;
+        }
+
+        double forked = time_launches(launch_with_fork, args, launches);
+        double spawned = time_launches(launch_with_spawn, args, launches);
+        printf("%8d %16.1f %16.1f %7.1fx\n", mb, forked, spawned, forked / spawned);
+    }
+
+    free(heap);
+    return 0;
+}
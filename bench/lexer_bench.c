@@ -0,0 +1,536 @@
+// Command line parsing: the token-array parser the shell used before
+// (tokenize_with_operators + parse_command_line, copied below with only its
+// crash on a redirection without a file name fixed) against the grammar
+// parser in src/parser.c and its parse cache.
+//
+//   lexer_bench [corpus] [iterations]
+//
+// Every line of the corpus (bench/lexer_corpus.txt by default; blank lines
+// and lines starting with # are skipped) is parsed both ways and the
+// resulting commands compared field by field. Lines starting with "~ " are
+// ones the two parse differently on purpose, and are only timed: the old
+// parser split quoted parts off the word around them and treated quoted
+// operators as operators, accepted empty commands and trailing |, && and
+// ||, took an operator after a redirection (2>&1) as its file name, and
+// split "2>" off the end of a word.
+//
+// Then each parser runs over the whole corpus `iterations` times, the new
+// one resetting its arena after every line as the executor's callers do.
+// Last, lines that fit in the parse cache are run through parse_cached()
+// again and again, as when commands are rerun from history.
+
+#define _DEFAULT_SOURCE
+
+#include "parser.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_CORPUS "bench/lexer_corpus.txt"
+#define DEFAULT_ITERATIONS 2000
+#define MAX_LINES 4096
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// --- Token-array parser, as in src/execute.c before the arena parser ---
+
+// Create a new command structure
+static command_t *legacy_create_command(void) {
+    command_t *cmd = malloc(sizeof(command_t));
+    if (!cmd) {
+        fprintf(stderr, "xsh: allocation error for command\n");
+        return NULL;
+    }
+    
+    cmd->args = NULL;
+    cmd->input_redir.type = REDIR_NONE;
+    cmd->input_redir.filename = NULL;
+    cmd->output_redir.type = REDIR_NONE;
+    cmd->output_redir.filename = NULL;
+    cmd->error_redir.type = REDIR_NONE;
+    cmd->error_redir.filename = NULL;
+    cmd->operator = CMD_SIMPLE;
+    cmd->next = NULL;
+    
+    return cmd;
+}
+
+// Free a command structure
+static void legacy_free_command(command_t *cmd) {
+    if (!cmd) return;
+    
+    if (cmd->args) {
+        for (int i = 0; cmd->args[i] != NULL; i++) {
+            free(cmd->args[i]);
+        }
+        free(cmd->args);
+    }
+    
+    if (cmd->input_redir.filename) {
+        free(cmd->input_redir.filename);
+    }
+    if (cmd->output_redir.filename) {
+        free(cmd->output_redir.filename);
+    }
+    if (cmd->error_redir.filename) {
+        free(cmd->error_redir.filename);
+    }
+    
+    free(cmd);
+}
+
+// Free a pipeline structure
+static void legacy_free_pipeline(pipeline_t *pipeline) {
+    if (!pipeline) return;
+    
+    command_t *cmd = pipeline->commands;
+    while (cmd) {
+        command_t *next = cmd->next;
+        legacy_free_command(cmd);
+        cmd = next;
+    }
+    
+    free(pipeline);
+}
+
+// Parse redirection operators and update command
+static int legacy_parse_redirection(command_t *cmd, char *token, char *next_token) {
+    if (strcmp(token, "<") == 0) {
+        if (!next_token) {
+            fprintf(stderr, "xsh: syntax error: expected filename after '<'\n");
+            return -1;
+        }
+        cmd->input_redir.type = REDIR_IN;
+        cmd->input_redir.filename = strdup(next_token);
+        return 1; // Consumed next token
+    } else if (strcmp(token, ">") == 0) {
+        if (!next_token) {
+            fprintf(stderr, "xsh: syntax error: expected filename after '>'\n");
+            return -1;
+        }
+        cmd->output_redir.type = REDIR_OUT;
+        cmd->output_redir.filename = strdup(next_token);
+        return 1;
+    } else if (strcmp(token, ">>") == 0) {
+        if (!next_token) {
+            fprintf(stderr, "xsh: syntax error: expected filename after '>>'\n");
+            return -1;
+        }
+        cmd->output_redir.type = REDIR_APPEND;
+        cmd->output_redir.filename = strdup(next_token);
+        return 1;
+    } else if (strcmp(token, "2>") == 0) {
+        if (!next_token) {
+            fprintf(stderr, "xsh: syntax error: expected filename after '2>'\n");
+            return -1;
+        }
+        cmd->error_redir.type = REDIR_ERR;
+        cmd->error_redir.filename = strdup(next_token);
+        return 1;
+    }
+    return 0; // Not a redirection operator
+}
+
+// Enhanced tokenization function that handles operators
+static char **legacy_tokenize(char *line, int *token_count) {
+    int bufsize = 64;
+    int position = 0;
+    char **tokens = malloc(bufsize * sizeof(char*));
+    
+    if (!tokens) {
+        fprintf(stderr, "xsh: allocation error\n");
+        return NULL;
+    }
+    
+    char *line_copy = strdup(line);
+    char *ptr = line_copy;
+    
+    while (*ptr) {
+        // Skip whitespace
+        while (*ptr && (*ptr == ' ' || *ptr == '\t' || *ptr == '\n' || *ptr == '\r')) {
+            ptr++;
+        }
+        
+        if (!*ptr) break;
+        
+        char *start = ptr;
+        
+        // Handle quoted strings
+        if (*ptr == '"' || *ptr == '\'') {
+            char quote = *ptr++;
+            start = ptr;
+            while (*ptr && *ptr != quote) ptr++;
+            if (*ptr == quote) {
+                *ptr = '\0';
+                tokens[position] = strdup(start);
+                ptr++;
+            } else {
+                fprintf(stderr, "xsh: unterminated quote\n");
+                free(tokens);
+                free(line_copy);
+                return NULL;
+            }
+        }
+        // Handle multi-character operators
+        else if (strncmp(ptr, "&&", 2) == 0) {
+            tokens[position] = strdup("&&");
+            ptr += 2;
+        }
+        else if (strncmp(ptr, "||", 2) == 0) {
+            tokens[position] = strdup("||");
+            ptr += 2;
+        }
+        else if (strncmp(ptr, ">>", 2) == 0) {
+            tokens[position] = strdup(">>");
+            ptr += 2;
+        }
+        else if (strncmp(ptr, "2>", 2) == 0) {
+            tokens[position] = strdup("2>");
+            ptr += 2;
+        }
+        // Handle single-character operators
+        else if (*ptr == '|' || *ptr == '<' || *ptr == '>' || *ptr == ';' || *ptr == '&') {
+            char op[2] = {*ptr, '\0'};
+            tokens[position] = strdup(op);
+            ptr++;
+        }
+        // Handle regular words
+        else {
+            start = ptr;
+            while (*ptr && !isspace(*ptr) && *ptr != '|' && *ptr != '<' && 
+                   *ptr != '>' && *ptr != ';' && *ptr != '&' && 
+                   strncmp(ptr, "||", 2) != 0 && strncmp(ptr, ">>", 2) != 0 && 
+                   strncmp(ptr, "2>", 2) != 0) {
+                ptr++;
+            }
+            
+            if (ptr > start) {
+                int len = ptr - start;
+                char *word = malloc(len + 1);
+                strncpy(word, start, len);
+                word[len] = '\0';
+                tokens[position] = word;
+            } else {
+                continue;
+            }
+        }
+        
+        position++;
+        
+        // Resize if needed
+        if (position >= bufsize) {
+            bufsize *= 2;
+            tokens = realloc(tokens, bufsize * sizeof(char*));
+            if (!tokens) {
+                fprintf(stderr, "xsh: allocation error\n");
+                free(line_copy);
+                return NULL;
+            }
+        }
+    }
+    
+    tokens[position] = NULL;
+    *token_count = position;
+    free(line_copy);
+    return tokens;
+}
+
+// Parse command line into pipeline structure
+static pipeline_t *legacy_parse(char **tokens, int token_count) {
+    if (!tokens || token_count == 0) return NULL;
+    
+    pipeline_t *pipeline = malloc(sizeof(pipeline_t));
+    if (!pipeline) {
+        fprintf(stderr, "xsh: allocation error for pipeline\n");
+        return NULL;
+    }
+    
+    pipeline->commands = NULL;
+    command_t *current_cmd = NULL;
+    command_t *last_cmd = NULL;
+    
+    int i = 0;
+    while (i < token_count) {
+        // Create new command
+        current_cmd = legacy_create_command();
+        if (!current_cmd) {
+            legacy_free_pipeline(pipeline);
+            return NULL;
+        }
+        
+        // Link to pipeline
+        if (!pipeline->commands) {
+            pipeline->commands = current_cmd;
+        } else {
+            last_cmd->next = current_cmd;
+        }
+        
+        // Parse arguments for current command
+        int arg_count = 0;
+        int arg_capacity = 16;
+        current_cmd->args = malloc(arg_capacity * sizeof(char*));
+        
+        if (!current_cmd->args) {
+            fprintf(stderr, "xsh: allocation error for args\n");
+            legacy_free_pipeline(pipeline);
+            return NULL;
+        }
+        
+        // Parse tokens for this command until we hit an operator
+        while (i < token_count) {
+            char *token = tokens[i];
+            char *next_token = (i + 1 < token_count) ? tokens[i + 1] : NULL;
+            
+            // Check for operators
+            if (strcmp(token, "|") == 0) {
+                current_cmd->operator = CMD_PIPE;
+                i++;
+                break;
+            } else if (strcmp(token, "&&") == 0) {
+                current_cmd->operator = CMD_AND;
+                i++;
+                break;
+            } else if (strcmp(token, "||") == 0) {
+                current_cmd->operator = CMD_OR;
+                i++;
+                break;
+            } else if (strcmp(token, ";") == 0) {
+                current_cmd->operator = CMD_SEMICOLON;
+                i++;
+                break;
+            } else if (strcmp(token, "&") == 0) {
+                current_cmd->operator = CMD_BACKGROUND;
+                i++;
+                break;
+            }
+            // Check for redirections
+            else {
+                int redir_result = legacy_parse_redirection(current_cmd, token, next_token);
+                if (redir_result == -1) {
+                    current_cmd->args[arg_count] = NULL; // Was missing: freed garbage
+                    legacy_free_pipeline(pipeline);
+                    return NULL;
+                } else if (redir_result == 1) {
+                    // Consumed redirection operator and filename
+                    i += 2;
+                    continue;
+                }
+                
+                // Regular argument
+                if (arg_count >= arg_capacity - 1) {
+                    arg_capacity *= 2;
+                    current_cmd->args = realloc(current_cmd->args, arg_capacity * sizeof(char*));
+                    if (!current_cmd->args) {
+                        fprintf(stderr, "xsh: allocation error for args realloc\n");
+                        legacy_free_pipeline(pipeline);
+                        return NULL;
+                    }
+                }
+                
+                current_cmd->args[arg_count] = strdup(token);
+                arg_count++;
+                i++;
+            }
+        }
+        
+        // Null-terminate args array
+        current_cmd->args[arg_count] = NULL;
+        
+        // If no operator was found, this is the last command. A trailing &
+        // still sends it to the background.
+        if (i >= token_count && current_cmd->operator != CMD_BACKGROUND) {
+            current_cmd->operator = CMD_SIMPLE;
+        }
+        
+        last_cmd = current_cmd;
+        
+        // Break if we've processed all tokens
+        if (i >= token_count) break;
+    }
+    
+    return pipeline;
+}
+
+// Old parse of a line, as xsh_loop did it: tokenize, parse, free the tokens
+static pipeline_t *legacy_parse_line(const char *line) {
+    int token_count;
+    char **tokens = legacy_tokenize((char *)line, &token_count);
+    if (!tokens) return NULL;
+    pipeline_t *pipeline = legacy_parse(tokens, token_count);
+    for (int i = 0; i < token_count; i++) {
+        free(tokens[i]);
+    }
+    free(tokens);
+    return pipeline;
+}
+
+// --- Comparison ---
+
+static int same_string(const char *a, const char *b) {
+    if (!a || !b) return a == b;
+    return strcmp(a, b) == 0;
+}
+
+static int same_redirection(const redirection_t *a, const redirection_t *b) {
+    return a->type == b->type && same_string(a->filename, b->filename);
+}
+
+static int same_pipeline(const pipeline_t *a, const pipeline_t *b) {
+    if (!a || !b) return a == b;
+    const command_t *x = a->commands;
+    const command_t *y = b->commands;
+    for (; x && y; x = x->next, y = y->next) {
+        int i = 0;
+        for (; x->args[i] && y->args[i]; i++) {
+            if (strcmp(x->args[i], y->args[i]) != 0) return 0;
+        }
+        if (x->args[i] || y->args[i]) return 0;
+        if (x->operator != y->operator ||
+            !same_redirection(&x->input_redir, &y->input_redir) ||
+            !same_redirection(&x->output_redir, &y->output_redir) ||
+            !same_redirection(&x->error_redir, &y->error_redir)) {
+            return 0;
+        }
+    }
+    return x == y;
+}
+
+static void print_pipeline(const char *label, const pipeline_t *pipeline) {
+    printf("  %s:", label);
+    if (!pipeline) {
+        printf(" (error)\n");
+        return;
+    }
+    for (const command_t *cmd = pipeline->commands; cmd; cmd = cmd->next) {
+        printf(" [");
+        for (int i = 0; cmd->args[i]; i++) {
+            printf(i ? " '%s'" : "'%s'", cmd->args[i]);
+        }
+        if (cmd->input_redir.filename) printf(" <%s", cmd->input_redir.filename);
+        if (cmd->output_redir.filename) printf(" >%s", cmd->output_redir.filename);
+        if (cmd->error_redir.filename) printf(" 2>%s", cmd->error_redir.filename);
+        printf("] op=%d", cmd->operator);
+    }
+    printf("\n");
+}
+
+static int load_corpus(const char *path, char **lines, int *differs) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+    int count = 0;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    while (count < MAX_LINES && (length = getline(&line, &size, file)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+        if (length == 0 || line[0] == '#') continue;
+        differs[count] = strncmp(line, "~ ", 2) == 0;
+        lines[count] = strdup(differs[count] ? line + 2 : line);
+        count++;
+    }
+    free(line);
+    fclose(file);
+    return count;
+}
+
+int main(int argc, char **argv) {
+    const char *corpus = argc > 1 ? argv[1] : DEFAULT_CORPUS;
+    int iterations = argc > 2 ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+    if (iterations < 1) iterations = DEFAULT_ITERATIONS;
+
+    static char *lines[MAX_LINES];
+    static int differs[MAX_LINES];
+    int count = load_corpus(corpus, lines, differs);
+    if (count == 0) {
+        fprintf(stderr, "lexer_bench: %s: no command lines\n", corpus);
+        return 1;
+    }
+
+    // Both parsers report syntax errors on stderr; the corpus has a few
+    int saved_stderr = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd != -1) dup2(null_fd, STDERR_FILENO);
+
+    arena_t arena = ARENA_INIT;
+    int mismatches = 0;
+    int skipped = 0;
+    for (int i = 0; i < count; i++) {
+        if (differs[i]) {
+            skipped++;
+            continue;
+        }
+        pipeline_t *old_parse = legacy_parse_line(lines[i]);
+        pipeline_t *new_parse = parse_line(&arena, lines[i]);
+        if (!same_pipeline(old_parse, new_parse)) {
+            printf("mismatch: %s\n", lines[i]);
+            print_pipeline("old", old_parse);
+            print_pipeline("new", new_parse);
+            mismatches++;
+        }
+        legacy_free_pipeline(old_parse);
+        arena_reset(&arena);
+    }
+    printf("%d command lines from %s, %d compared, %d mismatches\n",
+           count, corpus, count - skipped, mismatches);
+
+    double start = now_us();
+    for (int n = 0; n < iterations; n++) {
+        for (int i = 0; i < count; i++) {
+            legacy_free_pipeline(legacy_parse_line(lines[i]));
+        }
+    }
+    double old_ns = (now_us() - start) * 1000.0 / ((double)iterations * count);
+
+    size_t warm_allocations = arena.allocations;
+    start = now_us();
+    for (int n = 0; n < iterations; n++) {
+        for (int i = 0; i < count; i++) {
+            parse_line(&arena, lines[i]);
+            arena_reset(&arena);
+        }
+    }
+    double new_ns = (now_us() - start) * 1000.0 / ((double)iterations * count);
+
+    int cached = count < PARSE_CACHE_ENTRIES ? count : PARSE_CACHE_ENTRIES;
+    for (int i = 0; i < cached; i++) {
+        parse_cached(lines[i]);
+    }
+    start = now_us();
+    for (int n = 0; n < iterations; n++) {
+        for (int i = 0; i < cached; i++) {
+            parse_cached(lines[i]);
+        }
+    }
+    double cached_ns = (now_us() - start) * 1000.0 / ((double)iterations * cached);
+
+    if (null_fd != -1) {
+        dup2(saved_stderr, STDERR_FILENO);
+        close(null_fd);
+    }
+
+    printf("%-28s %10s\n", "parser", "ns/line");
+    printf("%-28s %10.0f\n", "token array (malloc)", old_ns);
+    printf("%-28s %10.0f  (%.1fx)\n", "grammar parser (arena)", new_ns, old_ns / new_ns);
+    printf("%-28s %10.0f  (%.1fx, first %d lines)\n", "parse cache hit", cached_ns, old_ns / cached_ns, cached);
+    printf("arena chunk allocations while timing: %zu\n", arena.allocations - warm_allocations);
+
+    arena_free(&arena);
+    parse_cache_cleanup();
+    for (int i = 0; i < count; i++) {
+        free(lines[i]);
+    }
+    return mismatches ? 1 : 0;
+}
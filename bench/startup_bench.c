@@ -0,0 +1,121 @@
+// Startup-to-exit time of the shell in each mode: an interactive start that
+// reads end of input right away, against -c commands and a script file, the
+// way cron jobs and CI steps run it.
+//
+//   startup_bench xshell [runs]
+//
+// Each run spawns the shell with stdin from /dev/null and its output thrown
+// away, and waits for it to exit. HOME points at a scratch directory, so the
+// shell's config and history files come and go with the benchmark.
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700 // For nftw()
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define DEFAULT_RUNS 50
+#define SCRIPT_LINES 100
+
+extern char **environ;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Run args to completion with stdin, stdout and stderr on /dev/null.
+// Returns its exit status, or -1 if it could not be started.
+static int run(char *const args[]) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+    pid_t pid;
+    int error = posix_spawn(&pid, args[0], &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0) return -1;
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1) return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Mean milliseconds from spawning args to reaping it, after one warm-up run
+static double time_runs(char *const args[], int runs, int *status) {
+    *status = run(args);
+    double start = now_us();
+    for (int i = 0; i < runs; i++) run(args);
+    return (now_us() - start) / runs / 1000.0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st; (void)flag; (void)ftw;
+    return remove(path);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: startup_bench xshell [runs]\n");
+        return 2;
+    }
+    char *shell = argv[1];
+    int runs = argc > 2 ? atoi(argv[2]) : DEFAULT_RUNS;
+    if (runs < 1) runs = DEFAULT_RUNS;
+
+    char home[] = "/tmp/xsh_startup_bench.XXXXXX";
+    if (!mkdtemp(home)) {
+        perror("startup_bench: mkdtemp");
+        return 1;
+    }
+    setenv("HOME", home, 1);
+
+    // A script of builtin commands, so the time is the shell's own
+    char script[sizeof(home) + 16];
+    snprintf(script, sizeof(script), "%s/bench.xsh", home);
+    FILE *file = fopen(script, "w");
+    if (!file) {
+        perror("startup_bench: script");
+        return 1;
+    }
+    fprintf(file, "#!%s\n# startup_bench script\n", shell);
+    for (int i = 0; i < SCRIPT_LINES; i++) {
+        fprintf(file, "echo line %d && cd .\n", i);
+    }
+    fclose(file);
+
+    char script_label[64];
+    snprintf(script_label, sizeof(script_label), "script, %d lines", SCRIPT_LINES);
+
+    struct {
+        const char *label;
+        char *args[4];
+    } cases[] = {
+        {"interactive, end of input", {shell, NULL}},
+        {"-c builtin", {shell, "-c", "cd .", NULL}},
+        {"-c /bin/true", {shell, "-c", "/bin/true", NULL}},
+        {script_label, {shell, script, NULL}},
+        {"/bin/sh -c /bin/true", {"/bin/sh", "-c", "/bin/true", NULL}},
+    };
+
+    printf("%-28s %12s %8s\n", "Mode", "Time (ms)", "Status");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (access(cases[i].args[0], X_OK) != 0) continue;
+        int status;
+        double ms = time_runs(cases[i].args, runs, &status);
+        printf("%-28s %12.2f %8d\n", cases[i].label, ms, status);
+    }
+
+    nftw(home, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+    return 0;
+}
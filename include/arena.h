@@ -0,0 +1,35 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for data that dies together, such as everything parsed from
+// one command line. Allocations are never freed one by one; arena_reset()
+// drops them all at once and keeps the memory for the next use, so a loop
+// that resets its arena each iteration stops calling malloc once the arena
+// is big enough for its largest iteration.
+
+#define ARENA_CHUNK_SIZE 4096 // Smallest chunk the arena allocates
+
+typedef struct arena_chunk arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t *chunks; // Newest chunk first
+    size_t allocations;    // Chunks allocated so far
+} arena_t;
+
+#define ARENA_INIT {NULL, 0}
+
+// Allocate size bytes aligned for any type. Returns NULL if out of memory.
+void *arena_alloc(arena_t *arena, size_t size);
+
+// NUL-terminated copy of the first length bytes of str
+char *arena_strndup(arena_t *arena, const char *str, size_t length);
+
+// Free everything allocated so far, keeping memory for the next allocations
+void arena_reset(arena_t *arena);
+
+// Release the arena's memory
+void arena_free(arena_t *arena);
+
+#endif // ARENA_H
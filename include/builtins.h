@@ -14,27 +14,47 @@ int xsh_num_builtins(void);
 int xsh_builtin_exists(const char *command);
 int xsh_execute_builtin(char **args);
 
+// Exit status of the last builtin run on this thread (0 = success). Builtins
+// defined outside builtins.c report theirs with xsh_builtin_set_status().
+int xsh_builtin_status(void);
+void xsh_builtin_set_status(int status);
+
+// Bytes the last builtin run on this thread wrote to its output, for
+// pipestat; -1 when unknown. Builtins that count theirs report the total
+// with xsh_builtin_set_written().
+long long xsh_builtin_written(void);
+void xsh_builtin_set_written(long long bytes);
+
+// Returns 1 if the builtin may run on a pipeline worker thread, i.e. it only
+// uses its arguments and the streams below
+int xsh_builtin_is_threadable(const char *command);
+
+// Streams of builtins that can run on a worker thread. Each thread has its
+// own; NULL (the default) selects stdin, stdout or stderr.
+void xsh_builtin_set_streams(FILE *in, FILE *out, FILE *err);
+FILE *xsh_builtin_stdin(void);
+FILE *xsh_builtin_stdout(void);
+FILE *xsh_builtin_stderr(void);
+
 // Prototypes for built-in command functions
 int xsh_cd(char **args);
 int xsh_help(char **args);
 int xsh_exit(char **args);
 int xsh_pwd(char **args);
 int xsh_ls(char **args);
-int xsh_grep(char **args);
 int xsh_echo(char **args);
 int xsh_mkdir(char **args);
 int xsh_touch(char **args);
 int xsh_client(char **args); // Note: Planned to move to a separate network module
 int xsh_clear(char **args);
-int xsh_cp(char **args);
 int xsh_mv(char **args);
 int xsh_rm(char **args);
-int xsh_cat(char **args);
 int xsh_manifesto(char **args);
 int xsh_history(char **args); // Note: History management might be expanded into its own module
 int xsh_stats(char **args); // Enhanced history analytics
 int xsh_analytics(char **args); // Performance analytics display
 int xsh_cleardata(char **args); // Clear analytics data
+int xsh_hash(char **args); // Command path hash
 int xsh_xnet(char **args);
 int xsh_xproj(char **args);
 int xsh_xnote(char **args);
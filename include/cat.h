@@ -0,0 +1,19 @@
+#ifndef CAT_H
+#define CAT_H
+
+// cat: without options each file goes to the output with fastcopy_fd(),
+// in the kernel where it can (splice() to a pipe, sendfile() or
+// copy_file_range() to a file) and through one page-aligned buffer where it
+// cannot, as to a terminal. Bytes come out as they are: NULs, lines of any
+// length and a last line without a newline alike.
+//
+// -n and -A (and -v, -E, -T, of which -A is made) read into an aligned
+// buffer and format into one output buffer shared by all the files, written
+// when full and at the end; numbering carries on from file to file.
+
+#define CAT_BUFSIZE (128 * 1024) // Read size when formatting
+#define CAT_OUTPUT (256 * 1024)  // Formatted output kept before it is written
+
+int xsh_cat(char **args);
+
+#endif // CAT_H
@@ -0,0 +1,34 @@
+#ifndef CMDHASH_H
+#define CMDHASH_H
+
+// Command hash, like the `hash` table of other shells: command names mapped
+// to the executable PATH resolves them to, so launching a command does not
+// walk PATH with a failed exec per directory. Names are resolved lazily on
+// first use. The table is flushed when PATH changes, and a single entry is
+// dropped when executing its path fails with ENOENT. Only absolute PATH
+// directories are remembered, since relative ones depend on the cwd.
+
+#define CMDHASH_DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin" // Used when PATH is unset
+
+// Resolve a command name (no directory part) to the executable PATH finds
+// first. Returns a path owned by the table, valid until the table changes,
+// or NULL if there is none. count_hit records a use of the command, as a
+// launch does.
+const char *cmdhash_lookup(const char *name, int count_hit);
+
+// Forget one remembered command, or all of them
+void cmdhash_forget(const char *name);
+void cmdhash_clear(void);
+
+// Add every executable on PATH to the table, once per PATH value, and
+// return the number of entries. Entries are numbered from 0; completion
+// walks them with cmdhash_name().
+int cmdhash_fill(void);
+const char *cmdhash_name(int index);
+
+// Print the remembered commands with their hit counts
+void cmdhash_display(void);
+
+void cmdhash_cleanup(void);
+
+#endif // CMDHASH_H
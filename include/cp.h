@@ -0,0 +1,17 @@
+#ifndef CP_H
+#define CP_H
+
+// cp: files are copied with fastcopy_file() (a reflink where the filesystem
+// shares extents, else copy_file_range(), keeping holes). With -r the calling
+// thread walks the source tree, creating directories and symbolic links,
+// while a workpool copies the files it queues, so the walk's metadata work
+// overlaps the data copies. Directory modes and times are set last, once
+// nothing more is written into them.
+
+#define CP_WORKERS_MIN 4       // Workers even on one CPU, as they mostly wait on I/O
+#define CP_PROGRESS_DELAY_MS 1000   // Copies shorter than this show no progress
+#define CP_PROGRESS_INTERVAL_MS 250
+
+int xsh_cp(char **args);
+
+#endif // CP_H
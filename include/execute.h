@@ -9,7 +9,8 @@ typedef enum {
     CMD_PIPE,        // Command with pipe |
     CMD_AND,         // Command with &&
     CMD_OR,          // Command with ||
-    CMD_SEMICOLON    // Command with ;
+    CMD_SEMICOLON,   // Command with ;
+    CMD_BACKGROUND   // Command with & (the list before it runs as a background job)
 } cmd_operator_t;
 
 // Redirection types
@@ -43,9 +44,37 @@ typedef struct {
     int command_count;              // Number of commands
 } pipeline_t;
 
+// Resources used by the child processes of one command line, summed over
+// every process reaped (max_rss_kb is the largest single process)
+typedef struct {
+    long user_time_us;           // User CPU time
+    long sys_time_us;            // System CPU time
+    long max_rss_kb;             // Peak resident set size
+    long voluntary_switches;     // Voluntary context switches
+    long involuntary_switches;   // Involuntary context switches
+} command_usage_t;
+
+#define PIPESTAT_MAX_STAGES 16 // Stages measured per pipeline
+#define PIPESTAT_NAME_SIZE 24  // Command name kept per stage, terminator included
+
+// What one stage of a pipeline did, measured when it exited. A stage that
+// is not on a CPU is waiting: for its pipes, the disk or the scheduler, so
+// the stage that stalls least, with the highest CPU time to wall time
+// ratio, is the one the others wait for.
+typedef struct {
+    int status;              // Exit status, 128 + signal if killed
+    long long wall_us;       // From the start of the pipeline to the stage's exit
+    long long cpu_us;        // User plus system CPU time
+    long long bytes_written; // A process's to all its descriptors, a builtin's to its output; -1 if unknown
+    char name[PIPESTAT_NAME_SIZE]; // Command name, without its directory
+} stage_stat_t;
+
+typedef struct {
+    int stage_count; // Stages in the pipeline; the first PIPESTAT_MAX_STAGES are measured
+    stage_stat_t stages[PIPESTAT_MAX_STAGES];
+} pipeline_stat_t;
+
 // Function prototypes
-int xsh_launch(char **args);
-pipeline_t *parse_command_line(char **tokens, int token_count);
 int execute_pipeline(pipeline_t *pipeline);
 void free_pipeline(pipeline_t *pipeline);
 command_t *create_command(void);
@@ -55,8 +84,6 @@ void restore_redirections(void);
 int execute_simple_command(command_t *cmd);
 int execute_piped_commands(command_t *commands, int num_commands);
 int contains_operators(const char *str);
-char **tokenize_with_operators(char *line, int *token_count);
-int parse_redirection(command_t *cmd, char *token, char *next_token);
 
 // Platform-specific functions
 #ifdef _WIN32
@@ -70,4 +97,18 @@ char *find_executable_windows(const char *command);
 // Global variable to track command exit status
 extern int last_command_exit_status;
 
+// Set by exit when it runs in the shell process; execute_pipeline() then
+// runs nothing more and the shell stops
+extern int shell_exit_requested;
+
+// Resource usage accumulated since the last reset_command_usage()
+extern command_usage_t last_command_usage;
+void reset_command_usage(void);
+
+// Stages of the last job that finished in the foreground, kept until the
+// next one does (pipestat shows them). last_pipeline_stat_current says
+// whether it finished since the last reset_command_usage().
+extern pipeline_stat_t last_pipeline_stat;
+extern int last_pipeline_stat_current;
+
 #endif // EXECUTE_H
@@ -0,0 +1,41 @@
+#ifndef FASTCOPY_H
+#define FASTCOPY_H
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+// Whole-descriptor copies that keep the data in the kernel. What the two
+// descriptors are decides how: copy_file_range() between regular files (a
+// reflink or server-side copy where the filesystem supports it), splice()
+// when either side is a pipe, sendfile() from a regular file to anything
+// else. Whatever the kernel refuses falls back to read() and write() through
+// one large buffer, continuing from where the kernel copy stopped.
+
+#define FASTCOPY_BUFSIZE (128 * 1024) // Read/write fallback buffer
+#define FASTCOPY_CHUNK (1L << 30)     // Most a single kernel copy call asks for
+#define FASTCOPY_FILE_CHUNK (64L << 20) // Most fastcopy_file() copies between progress updates
+#define FASTCOPY_ALIGN 4096           // Buffers start on a page boundary
+
+// Copy from in_fd's current offset to its end into out_fd. Returns the
+// number of bytes copied, or -1 with errno set; bytes already written stay
+// written.
+long long fastcopy_fd(int in_fd, int out_fd);
+
+// fastcopy_fd() to the descriptor under a stream, after writing out what
+// the stream has buffered so the order of the output is kept
+long long fastcopy_to_stream(int in_fd, FILE *out);
+
+// Copy the whole regular file in_fd, size bytes long, into the empty regular
+// file out_fd. Tries a reflink first (FICLONE: the copy shares the source's
+// extents until either is written), then copy_file_range() and finally
+// pread() and pwrite(). Holes in a sparse source are skipped rather than
+// written as zeros. Adds the bytes copied to *progress as it goes if
+// progress is not NULL. Returns the bytes copied, or -1 with errno set.
+long long fastcopy_file(int in_fd, int out_fd, long long size, atomic_llong *progress);
+
+// A buffer for read() and write() aligned to FASTCOPY_ALIGN, so the kernel
+// copies whole pages into and out of it. NULL if out of memory.
+void *fastcopy_buffer(size_t size);
+void fastcopy_buffer_free(void *buffer);
+
+#endif // FASTCOPY_H
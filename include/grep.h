@@ -0,0 +1,24 @@
+#ifndef GREP_H
+#define GREP_H
+
+// grep: regular files are mapped into memory and searched whole with
+// memsearch_find(), a line only being looked at once the pattern is found
+// in it. Pipes and stdin are read in large chunks cut at the last newline,
+// so lines of any length stay whole. With -r the calling thread walks the
+// directories while a workpool searches the files; each file's output is
+// written in one piece, in the order the files finish.
+//
+// With -E or -P the pattern is compiled once into an xregex whose required
+// literal memsearch looks for; the regex's DFA only runs on the lines the
+// literal is in, or on every line if it has none.
+//
+// A file with a NUL byte among its first GREP_BINARY_PROBE bytes, or in a
+// matching line, is binary: only "Binary file ... matches" is printed.
+
+#define GREP_CHUNK (256 * 1024)       // Read size for pipes and stdin
+#define GREP_BINARY_PROBE 65536       // Leading bytes checked for NUL
+#define GREP_OUTPUT_FLUSH (64 * 1024) // Output kept per file before it is written
+
+int xsh_grep(char **args);
+
+#endif // GREP_H
@@ -2,54 +2,79 @@
 #define HISTORY_H
 
 #include "xsh.h" // For XSH_HISTORY_SIZE
+#include "execute.h" // For command_usage_t and pipeline_stat_t
+#include "intern.h" // For intern_id_t
 #include <time.h>
 
 #define HISTORY_FILE_NAME ".xshell_history"
-#define HISTORY_METADATA_FILE ".xshell_history_meta.json"
-#define MAX_HISTORY_FILE_SIZE 10000
+#define HISTORY_METADATA_FILE ".xshell_history_journal"
+#define HISTORY_LEGACY_METADATA_FILE ".xshell_history_meta.json" // Imported once if the journal is missing
+#define MAX_HISTORY_FILE_SIZE 100000
+#define HISTORY_JOURNAL_MAX_RECORDS 100000 // Journal is compacted back to this many records
+#define HISTORY_JOURNAL_SYNC_INTERVAL 32   // Records appended between fsyncs
+#define HISTORY_PATTERNS_FILE ".xshell_patterns"
+#define MAX_COMMAND_PATTERNS 20000 // Learned n-grams kept; the least used are evicted beyond this
+#define PATTERN_DECAY_HALF_LIFE (14 * 24 * 3600) // Seconds for a pattern's weight to halve
+#define HISTORY_STATS_FILE ".xshell_command_stats"
+#define DURATION_SUB_BUCKETS 16 // Linear buckets per power of two (~6% resolution)
+#define DURATION_BUCKETS (DURATION_SUB_BUCKETS * 28) // Durations up to 2^31 ms
 #define COMMAND_FREQUENCY_THRESHOLD 3
 #define MAX_COMMAND_CONTEXT 5
 #define MAX_COMPLETION_SUGGESTIONS 20
+#define COMPLETION_HISTORY_SCAN_LIMIT 1024 // Recent history entries scanned per completion
+#define COMMAND_SCORE_DECAY (7.0 * 24 * 3600) // Seconds for a command's recency weight to fall by 1/e
 
-// Enhanced command history entry with metadata
+// Enhanced command history entry with metadata. Strings are interned IDs
+// (see intern.h), so entries are fixed-size and own no memory.
 typedef struct {
-    char *command;
-    time_t timestamp;
-    char *cwd;  // Current working directory when command was executed
-    int exit_code;  // Exit code of the command
-    long execution_time_ms;  // How long the command took to execute
-    char *context[MAX_COMMAND_CONTEXT];  // Previous commands (for context-aware completion)
+    intern_id_t command;
+    intern_id_t cwd;  // Current working directory when command was executed
+    intern_id_t context[MAX_COMMAND_CONTEXT];  // Previous commands (for context-aware completion)
     int context_count;
+    int exit_code;  // Exit code of the command
+    time_t timestamp;
+    long execution_time_ms;  // How long the command took to execute (wall clock)
+    command_usage_t usage;  // CPU, memory and context switches of its child processes
+    intern_id_t stages;  // Per-stage statistics of a pipeline (pipestat.h text), INTERN_NONE if none
 } history_entry_t;
 
 // Enhanced command frequency tracking structure
 typedef struct {
-    char *command;
+    intern_id_t command; // Interned command name
     int frequency;
     time_t last_used;
     time_t first_used;
-    double score; // Weighted score based on frequency and recency
+    double score; // Weighted score based on frequency and recency (see calculate_command_scores)
+    double frecency; // Use count decayed to last_used
+    double rank_key; // log(score) shifted by a time-dependent constant; orders commands without refreshing
     double success_rate; // Percentage of successful executions
     long avg_execution_time; // Average execution time
-    char **common_contexts; // Common previous commands
-    int context_count;
+    double mean_execution_time; // Exact running mean (ms), updated with Welford's method
+    double m2_execution_time; // Sum of squared deviations from the mean
+    unsigned int *duration_histogram; // DURATION_BUCKETS log-linear buckets, allocated on first sample
+    long long total_user_time_us; // Child CPU time summed over measured executions
+    long long total_sys_time_us;
+    long max_rss_kb; // Largest resident set size seen
+    int measured_executions; // Executions timed into the aggregates above
     int total_executions;
     int successful_executions;
 } command_stat_t;
 
 // Command sequence pattern for context-aware completion
 typedef struct {
-    char *sequence[MAX_COMMAND_CONTEXT];
+    intern_id_t sequence[MAX_COMMAND_CONTEXT]; // Interned preceding commands, oldest first
     int sequence_length;
-    char *next_command;
+    intern_id_t next_command; // INTERN_NONE marks a pattern being evicted
     int frequency;
     time_t last_used;
     double confidence; // Confidence score for the pattern
+    double weight; // Frequency decayed by age; used for ranking and eviction
+    unsigned long context_hash; // Hash of sequence, shared by patterns with the same context
+    int next_in_context; // Next pattern with the same context, or -1
 } command_pattern_t;
 
 // External declarations for history variables and functions
 // Definitions will be in history.c
-extern char *history[XSH_HISTORY_SIZE];
 extern int history_count;
 extern history_entry_t *enhanced_history;
 extern int enhanced_history_count;
@@ -63,16 +88,30 @@ extern int command_patterns_capacity;
 
 // Function prototypes for history.c
 void add_to_history(const char *line);
-void add_to_enhanced_history(const char *command, const char *cwd, int exit_code, long execution_time_ms);
-void display_history(void);
+const char *history_get(int index);
+void add_to_enhanced_history(const char *command, const char *cwd, int exit_code, long execution_time_ms,
+                             const command_usage_t *usage, const pipeline_stat_t *stages);
+void display_history(int limit);
+long history_search_backward(const char *query, long before, char **match);
 int init_history_system(void);
 void cleanup_history_system(void);
+void history_set_recording(int enabled); // Whether commands run are recorded and learned from
 int load_history_from_file(void);
 int save_history_to_file(void);
 int load_enhanced_history(void);
 int save_enhanced_history(void);
 char* get_history_file_path(void);
 char* get_history_metadata_file_path(void);
+char* get_history_patterns_file_path(void);
+int load_command_patterns(void);
+int save_command_patterns(void);
+char* get_history_stats_file_path(void);
+int load_command_timing_stats(void);
+int save_command_timing_stats(void);
+
+// Hash-indexed command statistics; handles are indices into command_stats
+int command_stats_find(const char *command);
+int command_stats_intern(const char *command);
 
 // Smart completion functions
 void update_command_stats(const char *command);
@@ -89,7 +128,10 @@ char** get_recent_commands(int *count);
 char** get_successful_commands(const char *partial, int *match_count);
 char** get_directory_based_suggestions(const char *partial, int *match_count);
 double calculate_command_relevance_score(const char *command, const char *partial);
-void learn_from_command_execution(const char *command, int success, long execution_time);
+void learn_from_command_execution(const char *command, int success, long execution_time,
+                                  const command_usage_t *usage);
+double command_duration_stddev(const command_stat_t *stat);
+long command_duration_percentile(const command_stat_t *stat, double percentile);
 void analyze_command_patterns(void);
 
 // Performance and usage analytics
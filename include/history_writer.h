@@ -0,0 +1,77 @@
+#ifndef HISTORY_WRITER_H
+#define HISTORY_WRITER_H
+
+#include <stddef.h>
+
+#define HISTORY_WRITER_QUEUE_SIZE 1024       // Records in flight; must be a power of two
+#define HISTORY_WRITER_FLUSH_TIMEOUT_MS 2000 // Longest the shell waits on a slow disk
+#define HISTORY_WRITER_SUBMIT_TIMEOUT_MS 200  // Longest a record waits for room in a full queue
+#define HISTORY_WRITER_RANGES 1024           // Written ranges awaiting pickup; power of two
+
+// Files the background writer appends to
+typedef enum {
+    HISTORY_WRITER_HISTORY = 0, // Plain history file
+    HISTORY_WRITER_JOURNAL,     // Enhanced history journal
+    HISTORY_WRITER_TARGETS
+} history_writer_target_t;
+
+// Identity of a file on disk, to notice when another session replaced it
+typedef struct {
+    unsigned long long device;
+    unsigned long long inode;
+} history_file_id_t;
+
+// Bytes [start, end) of a target file that this session appended
+typedef struct {
+    history_file_id_t file;
+    long start;
+    long end;
+} history_written_range_t;
+
+// Advisory whole-file lock shared between sessions. Returns 0 when taken;
+// with wait = 0 it fails instead of blocking if another session holds it.
+int history_file_lock(int fd, int exclusive, int wait);
+void history_file_unlock(int fd);
+
+// Identity of an open file or a path. Both fail on platforms where files
+// cannot be replaced while open, so a replacement is never reported there.
+int history_file_identity(int fd, history_file_id_t *id);
+int history_path_identity(const char *path, history_file_id_t *id);
+int history_file_id_equal(const history_file_id_t *a, const history_file_id_t *b);
+
+// Start the writer thread. Without it, records are written synchronously.
+int history_writer_start(void);
+
+// Returns 1 while the writer thread is running
+int history_writer_active(void);
+
+// Open a target file for appending, creating it if needed. Every append takes
+// the file lock, reopens the path if another session replaced the file, and
+// terminates a record torn by a session that died mid-write. Records are
+// fsynced every sync_interval records (0 = never) when written synchronously,
+// and after every batch by the thread. Only open or close a target with the
+// queue drained, i.e. after history_writer_flush() succeeded.
+int history_writer_open_target(history_writer_target_t target, const char *path, int sync_interval);
+void history_writer_close_target(history_writer_target_t target);
+
+// Take the next range this session appended to target, in file order.
+// Returns 0 once there are none left.
+int history_writer_take_written(history_writer_target_t target, history_written_range_t *range);
+
+// Queue a record for appending. Takes ownership of the malloc'd record.
+// If the queue stays full for HISTORY_WRITER_SUBMIT_TIMEOUT_MS, the record
+// is dropped with a warning.
+void history_writer_submit(history_writer_target_t target, char *record, size_t length);
+
+// Wait until every record submitted so far is written. Returns 0 on success,
+// -1 if the writer did not catch up within timeout_ms.
+int history_writer_flush(int timeout_ms);
+
+// Flush, then force every target to stable storage
+int history_writer_sync(int timeout_ms);
+
+// Flush and stop the writer thread. Returns -1 if it is stuck past timeout_ms,
+// in which case it is left running and still owns the target files.
+int history_writer_stop(int timeout_ms);
+
+#endif // HISTORY_WRITER_H
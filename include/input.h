@@ -18,9 +18,12 @@
 #define ESC_SEQUENCE 27
 #endif
 
+// Control keys
+#define CTRL_G_KEY 7  // Abort reverse search
+#define CTRL_R_KEY 18 // Reverse incremental history search
+
 // Function prototypes for input.c
 char *xsh_read_line(void);
-char **xsh_split_line(char *line);
 char** find_matches(const char* partial, int* match_count);
 void display_matches(char** matches, int match_count);
 char* complete_command(const char* partial);
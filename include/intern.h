@@ -0,0 +1,41 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Interned strings. Each distinct string is stored once in an append-only
+// arena and referred to by a 32-bit ID, so records that repeat the same
+// commands and directories hold IDs instead of their own copies. Strings live
+// until intern_cleanup(); their pointers never move.
+typedef uint32_t intern_id_t;
+
+#define INTERN_NONE 0                 // ID meaning "no string"
+#define INTERN_CHUNK_SIZE (64 * 1024) // Arena grows in chunks of this size
+
+// Memory held by the interning arena
+typedef struct {
+    size_t strings;      // Distinct strings interned
+    size_t string_bytes; // Bytes of string data, terminators included
+    size_t arena_bytes;  // Bytes reserved by arena chunks
+    size_t index_bytes;  // ID table and hash index
+    size_t allocations;  // Allocator calls made by the arena so far
+} intern_stats_t;
+
+// ID of a string, interning it on first sight. Returns INTERN_NONE for NULL
+// or on allocation failure.
+intern_id_t intern_string(const char *str);
+
+// ID of a string if it has been interned, else INTERN_NONE
+intern_id_t intern_lookup(const char *str);
+
+// The string for an ID, or NULL for INTERN_NONE and unknown IDs
+const char *intern_str(intern_id_t id);
+
+// Number of IDs handed out plus one; every valid ID is below this
+intern_id_t intern_id_limit(void);
+
+void intern_get_stats(intern_stats_t *stats);
+void intern_cleanup(void);
+
+#endif // INTERN_H
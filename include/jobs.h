@@ -0,0 +1,71 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "xsh.h" // For pid_t
+
+// Job control. Every external command and pipeline runs as a job: one entry
+// per pipeline stage, each a child process or a builtin on a shell thread.
+// When the shell is interactive, a job gets its own process group and the
+// terminal while it runs in the foreground, so Ctrl-Z and Ctrl-C reach the
+// job instead of the shell. Children are reaped from a SIGCHLD handler that
+// only writes to a self-pipe; the shell collects state changes whenever the
+// pipe is readable, whether it is waiting for a job or for a key.
+
+typedef struct job job_t;
+
+// Set up reaping and, on a terminal, job control. Call once at startup.
+void jobs_init(void);
+// Forget the parent's jobs in a forked child that runs commands itself
+void jobs_init_subshell(void);
+void jobs_cleanup(void);
+int jobs_control_enabled(void);
+
+// Descriptor that becomes readable when a child or stage thread changes
+// state, or -1 if there is none; jobs_reap() then collects the changes
+int jobs_event_fd(void);
+void jobs_reap(void);
+
+// Report jobs that finished or stopped since the last prompt. Finished jobs
+// that outlived their command line are recorded in history here.
+void jobs_notify(void);
+
+// Whether a job was sent to the background or stopped since the last call,
+// in which case the job records itself in history when it finishes
+int jobs_take_detached(void);
+
+#ifndef _WIN32
+// Build a job of stage_count stages. Stages that are never started count as
+// failed with status 1. job_process_group() is the group to start the next
+// process in: -1 without job control, 0 for a new group, else the job's.
+job_t *job_create(const char *command, int stage_count, int background);
+pid_t job_process_group(const job_t *job);
+// command is the stage's args[0], kept as its name for pipestat
+void job_set_process(job_t *job, int stage, pid_t pid, const char *command);
+void job_set_thread(job_t *job, int stage, const char *command);
+// Called by a stage thread when its builtin has returned, with the bytes it
+// wrote (-1 if unknown); also measures the thread's CPU time
+void job_thread_done(job_t *job, int stage, int status, long long bytes_written);
+// Called once the job is finished, before it is freed (e.g. to join threads)
+void job_set_finish(job_t *job, void (*finish)(void *data), void *data);
+
+// Start tracking a built job. A foreground job is waited for and its exit
+// status returned (128 + signal if it stopped); a background job returns 0.
+int job_run(job_t *job);
+
+// In a forked child: join the job's process group and restore the signals
+// the shell ignores
+void job_child_setup(pid_t pgid);
+
+// Add a child reaped outside the job table to the current line's usage
+struct rusage;
+void jobs_add_usage(const struct rusage *ru);
+#endif
+
+// Job control builtins
+int xsh_jobs(char **args);
+int xsh_fg(char **args);
+int xsh_bg(char **args);
+int xsh_wait(char **args);
+int xsh_disown(char **args);
+
+#endif // JOBS_H
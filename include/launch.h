@@ -0,0 +1,27 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#ifndef _WIN32
+#include <sys/types.h> // For pid_t
+
+// Process launcher for external commands. fork() copies the shell's page
+// tables, so its cost grows with the heap that history, analytics and the
+// editor keep; posix_spawn() starts the child without copying the address
+// space (glibc uses clone(CLONE_VM | CLONE_VFORK)). Windows already launches
+// through CreateProcess and does not use this module.
+
+// Start args[0], searched for in PATH, as a child process. fds[i] is the
+// descriptor to install as stdin, stdout and stderr (-1 or NULL to inherit).
+// Every other descriptor the child must not keep has to be close-on-exec.
+// pgid is the process group to put the child in (0 for a new group led by
+// the child, -1 to stay in the shell's). The child starts with default
+// handling of the signals the shell ignores for job control.
+// Returns the child's pid, or -1 with errno set if it could not be started,
+// including when args[0] cannot be executed.
+pid_t launch_process(char *const args[], const int fds[3], pid_t pgid);
+
+// Mark a descriptor close-on-exec so launched children do not inherit it
+int launch_set_cloexec(int fd);
+#endif
+
+#endif // LAUNCH_H
@@ -0,0 +1,37 @@
+#ifndef MEMSEARCH_H
+#define MEMSEARCH_H
+
+#include <stddef.h>
+
+// Substring search over a buffer, for grep. The needle is looked for by its
+// two rarest bytes, going by a fixed table of how common bytes are in text
+// and logs. A byte rare enough is found with memchr(). Otherwise, with SSE2,
+// 16 positions at a time are tested for both bytes at their offsets, and
+// only positions where both are present are compared in full. Without SSE2
+// the rarest byte is found with memchr() anyway, or, when folding case, the
+// needle is skipped along with Boyer-Moore-Horspool.
+//
+// Case folding is ASCII only and goes through a table, never tolower().
+
+typedef struct {
+    unsigned char *needle; // Case-folded if fold is set
+    size_t length;
+    int fold;
+    size_t rare_offset[2]; // Offsets of the two rarest needle bytes
+    int rare_frequency;    // How common the rarest of them is, from 0 to 255
+    size_t skip[256];      // Horspool shift for the byte under the needle's last position
+} memsearch_t;
+
+// ASCII lower case of c
+extern const unsigned char memsearch_fold_table[256];
+#define MEMSEARCH_FOLD(c) (memsearch_fold_table[(unsigned char)(c)])
+
+// Prepare a search for length bytes of needle. Returns 0, or -1 if out of
+// memory. An empty needle matches at every position.
+int memsearch_init(memsearch_t *search, const char *needle, size_t length, int fold);
+void memsearch_free(memsearch_t *search);
+
+// First occurrence of the needle in [haystack, end), or NULL
+const char *memsearch_find(const memsearch_t *search, const char *haystack, const char *end);
+
+#endif // MEMSEARCH_H
@@ -0,0 +1,21 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Parallel fan-out, like `xargs -P` or GNU parallel: one command template run
+// once per input, up to a fixed number of jobs at a time. Each job's stdout
+// and stderr are buffered and printed whole when it finishes (or in input
+// order with -k), so the output of concurrent jobs never interleaves.
+//
+// Jobs occupy a fixed pool of slots, so thousands of inputs never mean more
+// than -j children at once. A template that is a plain external command is
+// started with posix_spawn and a builtin is called in a forked copy of the
+// shell, both with the substituted words as they are. A template with
+// operators is parsed again in the forked shell, with every input quoted so
+// that it stays one word of text.
+
+#define PARALLEL_MAX_SLOTS 256      // Upper bound for -j
+#define PARALLEL_FAILURES_LISTED 10 // Failed jobs named in the summary
+
+int xsh_parallel(char **args);
+
+#endif // PARALLEL_H
@@ -0,0 +1,73 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "arena.h"
+#include "execute.h" // For pipeline_t and command_t
+
+// Command line lexer and parser. The lexer walks the line once and returns
+// tokens as slices of it, so lexing allocates nothing. The parser pulls
+// tokens one at a time and builds the pipeline in an arena; the caller
+// releases the whole parse with one arena_reset().
+//
+// Grammar, parsed by recursive descent:
+//
+//   line        := list? END
+//   list        := and_or ((';' | '&') and_or)* (';' | '&')?
+//   and_or      := pipeline (('&&' | '||') pipeline)*
+//   pipeline    := command ('|' command)*
+//   command     := (word | redirection)+
+//   redirection := ('<' | '>' | '>>' | '2>') word
+//   word        := (plain text | 'single quoted' | "double quoted")+
+//
+// The tree is stored the way the executor walks it: the commands in line
+// order, each with the operator that joins it to the next. Quoted parts are
+// joined to the text around them and lose their quotes; operator characters
+// inside quotes are plain text. 2> is a redirection only at the start of a
+// word.
+
+typedef enum {
+    TOKEN_END,          // End of the line
+    TOKEN_WORD,         // Word, quotes still in the slice
+    TOKEN_PIPE,         // |
+    TOKEN_AND,          // &&
+    TOKEN_OR,           // ||
+    TOKEN_SEMICOLON,    // ;
+    TOKEN_BACKGROUND,   // &
+    TOKEN_REDIR_IN,     // <
+    TOKEN_REDIR_OUT,    // >
+    TOKEN_REDIR_APPEND, // >>
+    TOKEN_REDIR_ERR,    // 2>
+    TOKEN_ERROR         // Unterminated quote
+} token_type_t;
+
+typedef struct {
+    token_type_t type;
+    const char *start; // Slice of the line; not NUL-terminated
+    size_t length;
+    int quoted;        // Word contains quotes to remove
+} token_t;
+
+typedef struct {
+    const char *pos; // Next character to read
+} lexer_t;
+
+void lexer_init(lexer_t *lexer, const char *line);
+token_t lexer_next(lexer_t *lexer);
+
+// Parse a line into a pipeline allocated from arena. A blank line gives a
+// pipeline without commands. Returns NULL after reporting a syntax error.
+pipeline_t *parse_line(arena_t *arena, const char *line);
+
+// Parsed lines are cached by their text, since a parse depends on nothing
+// else: running a line from history again skips the parser. The cache holds
+// PARSE_CACHE_ENTRIES lines, each in an arena that is reused for the line
+// that replaces it when it is the least recently used.
+#define PARSE_CACHE_ENTRIES 64
+
+// Parse a line, or take its parse from the cache. The pipeline belongs to
+// the cache: it must not be modified and stays valid until the next call.
+// Returns NULL after reporting a syntax error; errors are not cached.
+pipeline_t *parse_cached(const char *line);
+void parse_cache_cleanup(void);
+
+#endif // PARSER_H
@@ -0,0 +1,31 @@
+#ifndef PIPESTAT_H
+#define PIPESTAT_H
+
+#include "execute.h" // For pipeline_stat_t
+#include <stddef.h>
+
+// Per-stage pipeline statistics as text, the form enhanced history keeps
+// them in:
+//
+//   <stage_count>:<stage> <stage> ...
+//   stage := <status>,<wall_us>,<cpu_us>,<bytes_written>,<name>
+//
+// Only the measured stages are listed. Spaces and commas in a name are
+// stored as underscores; bytes_written is -1 when unknown.
+
+#define PIPESTAT_TEXT_SIZE (PIPESTAT_MAX_STAGES * (4 * 21 + PIPESTAT_NAME_SIZE) + 16)
+
+// Format stat into text. Returns 0, or -1 if size is too small.
+int pipestat_format(const pipeline_stat_t *stat, char *text, size_t size);
+
+// Parse text written by pipestat_format(). Returns 0 for well-formed text.
+int pipestat_parse(const char *text, pipeline_stat_t *stat);
+
+// Stage with the highest CPU time to wall time ratio, which stalled least
+// and so is the one the other stages wait for; -1 if there is none (a
+// single stage, or no CPU time measured)
+int pipestat_bottleneck(const pipeline_stat_t *stat);
+
+int xsh_pipestat(char **args);
+
+#endif // PIPESTAT_H
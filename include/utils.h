@@ -2,6 +2,8 @@
 #define UTILS_H
 
 #include "xsh.h" // For useconds_t (on POSIX) and other common defs
+#include <stddef.h>
+#include <stdint.h>
 
 // Function prototype for utils.c
 // Standardized to take delay in milliseconds
@@ -9,14 +11,24 @@ void print_slow(const char *text, unsigned int delay_ms);
 
 char* build_prompt(void);
 
-// Function prototype for case-insensitive string search
-char *strcasestr_custom(const char *haystack, const char *needle);
-
-// Helper function to process a single stream (file or stdin) for grep
-void process_grep_stream(FILE *fp, const char *pattern, int case_insensitive, const char *filename_to_print);
+// Monotonic wall clock in microseconds, for timing commands
+long long get_monotonic_time_us(void);
 
 // Function prototype for recursive removal
 int remove_recursively_internal(const char *path);
 int create_file_with_content(const char *path, const char *content);
 
+// 64-bit FNV-1a hash of length bytes, for the shell's hash tables. Inline
+// since the tables hash on every lookup, and so modules linked without the
+// rest of the shell (the lexer and launch benchmarks) can use it.
+static inline uint64_t xsh_hash_bytes(const void *data, size_t length) {
+    const unsigned char *p = data;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
 #endif // UTILS_H
@@ -0,0 +1,62 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+// A fixed pool of worker threads fed through one bounded queue, for builtins
+// that walk a directory tree on the calling thread and hand each file to the
+// pool (cp -r, grep -r). Items are the callers' own structs with a
+// workpool_item_t as their first member, so queueing one allocates nothing
+// more. Once WORKPOOL_QUEUE_LIMIT items wait, submitting blocks until the
+// workers catch up, which bounds the memory a huge tree takes.
+
+#define WORKPOOL_WORKERS_MAX 16
+#define WORKPOOL_QUEUE_LIMIT 4096 // Items queued ahead of the workers before submitting waits
+
+// dir/name in a malloc'd string, adding no slash when dir already ends with
+// one or is empty. Returns NULL if out of memory.
+char *workpool_path_join(const char *dir, const char *name);
+
+#ifndef _WIN32
+#include <pthread.h>
+
+typedef struct workpool_item {
+    struct workpool_item *next;
+} workpool_item_t;
+
+// Handles one item and frees it. local is what worker_start returned for the
+// worker running it, or NULL.
+typedef void (*workpool_run_t)(void *context, void *local, workpool_item_t *item);
+
+typedef struct {
+    workpool_run_t run;
+    void *context;
+    void *(*worker_start)(void *context);            // Optional per-worker state for run
+    void (*worker_stop)(void *context, void *local); // Frees it when the worker exits
+
+    pthread_t workers[WORKPOOL_WORKERS_MAX];
+    int worker_count; // 0 until started, and if no thread could be created
+    pthread_mutex_t lock;
+    pthread_cond_t queued;  // An item was queued, or the pool is stopping
+    pthread_cond_t drained; // The queue fell below WORKPOOL_QUEUE_LIMIT
+    workpool_item_t *head;
+    workpool_item_t *tail;
+    int queue_length;
+    int stopping;
+} workpool_t;
+
+// Set up a pool without workers; set worker_start and worker_stop after this
+// if run needs them
+void workpool_init(workpool_t *pool, workpool_run_t run, void *context);
+
+// Start up to count workers, at most WORKPOOL_WORKERS_MAX. Returns how many
+// are running.
+int workpool_start(workpool_t *pool, long count);
+
+// Queue an item for the workers. Returns -1 without taking it if the pool
+// has none, in which case the caller handles it itself.
+int workpool_submit(workpool_t *pool, workpool_item_t *item);
+
+// Let the workers finish everything queued, join them and release the pool
+void workpool_stop(workpool_t *pool);
+#endif
+
+#endif // WORKPOOL_H
@@ -0,0 +1,49 @@
+#ifndef XREGEX_H
+#define XREGEX_H
+
+#include <stddef.h>
+
+// Regular expressions for grep -E and -P: POSIX ERE (alternation, groups,
+// bracket expressions with [:class:] names, * + ? {m,n}, ^ and $) plus a
+// PCRE-like subset: \d \w \s and their negations, (?:...), (?i), \xHH and
+// lazy or possessive quantifiers, which cannot change whether a line
+// matches. Back-references and word boundaries are not supported.
+//
+// A pattern is parsed once into a Thompson NFA. Matching runs a DFA whose
+// states (sets of NFA states) are built the first time a byte leads to
+// them and kept, up to XREGEX_DFA_STATES, so each byte of a line costs one
+// table lookup. The DFA is separate from the compiled pattern so each
+// thread can have its own.
+//
+// Compiling also extracts the longest literal that every match contains,
+// which callers search for first so the DFA only runs on lines that have
+// it. When the whole pattern is that literal, no DFA is needed.
+
+#define XREGEX_MAX_STATES 20000 // NFA states, against patterns like (a{1000}){1000}
+#define XREGEX_MAX_REPEAT 1000  // Largest bound in {m,n}
+#define XREGEX_DFA_STATES 1024  // DFA states kept before the cache starts over
+#define XREGEX_LITERAL_MAX 64   // Longest required literal extracted
+
+typedef struct xregex xregex_t;
+typedef struct xregex_dfa xregex_dfa_t;
+
+// Compile pattern, ignoring ASCII case if fold is set; pcre selects -P's
+// reading of a quantifier followed by ? or + as lazy or possessive rather
+// than as a second quantifier. Returns NULL with a message in error on a
+// bad pattern or if out of memory.
+xregex_t *xregex_compile(const char *pattern, int fold, int pcre, char *error, size_t error_size);
+void xregex_free(xregex_t *re);
+
+// The literal every match contains, or NULL with *length 0 if there is
+// none. *fold is set if it is to be found ignoring case (it is then lower
+// case), and *exact when finding it anywhere is all the pattern does.
+const char *xregex_literal(const xregex_t *re, size_t *length, int *exact, int *fold);
+
+// A matcher for re, which must outlive it. Returns NULL if out of memory.
+xregex_dfa_t *xregex_dfa_new(const xregex_t *re);
+void xregex_dfa_free(xregex_dfa_t *dfa);
+
+// Whether the line [line, end), without its newline, has a match
+int xregex_dfa_match(xregex_dfa_t *dfa, const char *line, const char *end);
+
+#endif // XREGEX_H
@@ -25,8 +25,7 @@
 #define XSH_RL_BUFSIZE 1024
 #define XSH_MAXLINE 1024
 #define XSH_TOK_BUFSIZE 64
-#define XSH_TOK_DELIM " \t\r\n\a"
-#define XSH_HISTORY_SIZE 100
+#define XSH_HISTORY_SIZE 10000 // Default in-memory history capacity (config: history_size)
 #define TAB_KEY 9
 
 // Constants for network client (can be moved to a network specific header later)
@@ -47,15 +46,14 @@ void print_slow(const char *text, useconds_t delay);
 #endif
 
 
+// Whether the shell reads commands from a user (0 for -c and scripts)
+extern int xsh_interactive; // Definition will be in Xshell.c
+
 // Forward declarations for functions/variables in other modules
 extern char *builtin_str[]; // Definition will be in builtins.c
 int xsh_num_builtins(void);   // Definition will be in builtins.c
 
 extern int history_count;                 // Definition will be in history.c
-extern char *history[XSH_HISTORY_SIZE]; // Definition will be in history.c
-// void add_to_history(const char *line); // Example for history.c
-
-// Function prototype for xsh_execute (defined in Xshell.c)
-int xsh_execute(char **args);
+const char *history_get(int index);       // Definition will be in history.c
 
 #endif // XSH_H
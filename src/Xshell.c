@@ -11,7 +11,9 @@
 #include "history.h"
 #include "utils.h" // For print_slow, build_prompt
 #include "config.h" // For configuration management
-#include <time.h> // For clock timing
+#include "cmdhash.h" // For cmdhash_cleanup
+#include "jobs.h" // For job control
+#include "parser.h" // For parse_cached
 
 #ifdef _WIN32
 #include <windows.h> // For enabling ANSI escape codes
@@ -19,6 +21,13 @@
 #else
 #include <unistd.h> // For getcwd
 #endif
+#include <errno.h>
+
+// Whether commands come from a user at the prompt, or from -c or a script
+int xsh_interactive = 1;
+
+// Size of the read buffer for script files
+#define XSH_SCRIPT_BUFSIZE 65536
 
 void xsh_banner(void) {
     // Get terminal width (default to 80 if we can't determine it)
@@ -79,14 +88,15 @@ void xsh_banner(void) {
 // Main shell loop
 void xsh_loop(void) {
     char *line;
-    char **args;
     int status;
 
     do {
+        jobs_notify(); // Report jobs that finished or stopped in the meantime
         char *prompt = build_prompt(); // Get dynamic prompt
         printf("%s", prompt);
         fflush(stdout); // Ensure prompt is displayed immediately
         line = xsh_read_line();
+        if (!line) break; // End of input ends the shell like exit
         add_to_history(line); // Add command to history
         
         // Get current working directory for enhanced history
@@ -97,90 +107,144 @@ void xsh_loop(void) {
         getcwd(current_dir, sizeof(current_dir));
 #endif
         
-        // Record start time for execution timing
-        clock_t start_time = clock();
+        // Record start time on the monotonic clock; CPU and memory use of
+        // the children are accumulated by the executor as they are reaped
+        long long start_time = get_monotonic_time_us();
+        reset_command_usage();
+        status = 1; // 0 = exit shell, 1 = continue
         
-        // Check if line contains operators before splitting
-        if (contains_operators(line)) {
-            // Use advanced parsing for complex commands
-            int token_count;
-            char **tokens = tokenize_with_operators(line, &token_count);
-            if (tokens) {
-                pipeline_t *pipeline = parse_command_line(tokens, token_count);
-                if (pipeline) {
-                    int exit_status = execute_pipeline(pipeline);
-                    
-                    // Calculate execution time
-                    clock_t end_time = clock();
-                    long execution_time_ms = ((end_time - start_time) * 1000) / CLOCKS_PER_SEC;
-                    
-                    // Add to enhanced history with execution data
-                    add_to_enhanced_history(line, current_dir, exit_status, execution_time_ms);
-                    
-                    // Check if any command in the pipeline was 'exit'
-                    command_t *cmd = pipeline->commands;
-                    int should_exit = 0;
-                    while (cmd) {
-                        if (cmd->args && cmd->args[0] && strcmp(cmd->args[0], "exit") == 0) {
-                            should_exit = 1;
-                            break;
-                        }
-                        cmd = cmd->next;
-                    }
-                    free_pipeline(pipeline);
-                    status = should_exit ? 0 : 1; // 0 = exit shell, 1 = continue
-                } else {
-                    // Parse error
-                    add_to_enhanced_history(line, current_dir, -1, 0);
-                    status = 1; // Continue shell loop on parse error
-                }
-                
-                // Free tokens
-                for (int i = 0; i < token_count; i++) {
-                    free(tokens[i]);
-                }
-                free(tokens);
-            } else {
-                // Tokenization error
-                add_to_enhanced_history(line, current_dir, -1, 0);
-                status = 1; // Continue shell loop on tokenization error
-            }
-        } else {
-            // Simple command - use traditional parsing
-            args = xsh_split_line(line);
-            int exit_status = xsh_execute(args); // xsh_execute will handle builtins or launch
+        // Every line, from a lone command to a list of pipelines, goes
+        // through the parser; lines seen before come from its cache
+        pipeline_t *pipeline = parse_cached(line);
+        if (!pipeline) {
+            // Parse error
+            add_to_enhanced_history(line, current_dir, -1, 0, NULL, NULL);
+        } else if (pipeline->commands) {
+            int exit_status = execute_pipeline(pipeline);
             
             // Calculate execution time
-            clock_t end_time = clock();
-            long execution_time_ms = ((end_time - start_time) * 1000) / CLOCKS_PER_SEC;
+            long execution_time_ms = (long)((get_monotonic_time_us() - start_time) / 1000);
             
-            // Add to enhanced history with execution data
-            add_to_enhanced_history(line, current_dir, (exit_status == 1) ? 0 : exit_status, execution_time_ms);
+            // Add to enhanced history with execution data, unless a job
+            // took over the line and records itself when done
+            if (!jobs_take_detached()) {
+                add_to_enhanced_history(line, current_dir, exit_status, execution_time_ms,
+                                        &last_command_usage,
+                                        last_pipeline_stat_current ? &last_pipeline_stat : NULL);
+            }
             
-            status = exit_status;
-            free(args);
+            if (shell_exit_requested) {
+                status = 0;
+            }
         }
 
         free(line);
     } while (status);
 }
 
-// Execute command: checks for built-ins first, then launches external command
-int xsh_execute(char **args) {
-    if (args[0] == NULL) {
-        // An empty command was entered.
-        return 1; // Continue shell loop
+// Run one line of a -c command or script. Returns 1 to go on with the next
+// line, 0 if the line ran exit and -1 if it could not be parsed.
+static int xsh_run_line(arena_t *arena, const char *line) {
+    // Blank lines and comments, including a #! first line, do nothing
+    const char *p = line;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '\0' || *p == '#') return 1;
+
+    jobs_notify(); // Collect background jobs that finished
+    pipeline_t *pipeline = parse_line(arena, line);
+    int status = 1;
+    if (!pipeline) {
+        last_command_exit_status = 2;
+        status = -1;
+    } else if (pipeline->commands) {
+        execute_pipeline(pipeline);
+        if (shell_exit_requested) status = 0;
     }
+    // Scripts rarely repeat a line, so parse into one arena instead of
+    // going through the parse cache
+    arena_reset(arena);
+    return status;
+}
 
-    // Simple command - check for built-ins first
-    for (int i = 0; i < xsh_num_builtins(); i++) {
-        if (strcmp(args[0], builtin_str[i]) == 0) {
-            return (*builtin_func[i])(args);
+// Run the lines of a -c command. Returns the status of the last command.
+static int xsh_run_command(const char *command) {
+    arena_t arena = ARENA_INIT;
+    char *copy = strdup(command);
+    if (!copy) {
+        fprintf(stderr, "xsh: allocation error\n");
+        return 1;
+    }
+    char *line = copy;
+    while (line) {
+        char *newline = strchr(line, '\n');
+        if (newline) *newline = '\0';
+        if (xsh_run_line(&arena, line) != 1) break;
+        line = newline ? newline + 1 : NULL;
+    }
+    free(copy);
+    arena_free(&arena);
+    return last_command_exit_status;
+}
+
+// Read the next line of file into *line, growing it as needed, with the line
+// ending stripped. Returns 0, or -1 at end of file. fgets rather than getline,
+// which MinGW lacks.
+static int xsh_read_script_line(FILE *file, char **line, size_t *capacity) {
+    size_t length = 0;
+    for (;;) {
+        if (*capacity - length < 2) {
+            size_t grown = *capacity ? *capacity * 2 : 256;
+            char *bigger = realloc(*line, grown);
+            if (!bigger) return -1;
+            *line = bigger;
+            *capacity = grown;
+        }
+        if (!fgets(*line + length, (int)(*capacity - length), file)) {
+            if (length == 0) return -1;
+            break;
         }
+        length += strlen(*line + length);
+        if ((*line)[length - 1] == '\n') break;
     }
+    while (length > 0 && ((*line)[length - 1] == '\n' || (*line)[length - 1] == '\r')) {
+        (*line)[--length] = '\0';
+    }
+    return 0;
+}
 
-    // External command
-    return xsh_launch(args);
+// Run a script file line by line. Returns the status of the last command.
+static int xsh_run_script(const char *path) {
+#ifdef _WIN32
+    FILE *script = fopen(path, "r");
+#else
+    FILE *script = fopen(path, "re"); // Not inherited by the commands it runs
+#endif
+    if (!script) {
+        fprintf(stderr, "xsh: %s: %s\n", path, strerror(errno));
+        return 127;
+    }
+    setvbuf(script, NULL, _IOFBF, XSH_SCRIPT_BUFSIZE);
+
+    arena_t arena = ARENA_INIT;
+    char *line = NULL;
+    size_t capacity = 0;
+    unsigned long line_number = 0;
+    while (xsh_read_script_line(script, &line, &capacity) != -1) {
+        line_number++;
+        int status = xsh_run_line(&arena, line);
+        if (status == -1) {
+            fprintf(stderr, "xsh: %s: line %lu: script stopped\n", path, line_number);
+        }
+        if (status != 1) break;
+    }
+    free(line);
+    arena_free(&arena);
+    fclose(script);
+    return last_command_exit_status;
+}
+
+static void xsh_usage(void) {
+    fprintf(stderr, "Usage: Xshell [-c command | script]\n");
 }
 
 int main(int argc, char **argv) {
@@ -195,33 +259,67 @@ int main(int argc, char **argv) {
         }
     }
 #endif
+    // Xshell -c command or Xshell script: run without a user at the prompt
+    const char *command = NULL;
+    const char *script = NULL;
+    if (argc > 1) {
+        if (strcmp(argv[1], "-c") == 0 && argc == 3) {
+            command = argv[2];
+        } else if (argv[1][0] != '-' && argc == 2) {
+            script = argv[1];
+        } else {
+            xsh_usage();
+            return 2;
+        }
+        xsh_interactive = 0;
+    }
+
     // Load configuration files
     if (config_load_all_files() != 0) {
         fprintf(stderr, "Warning: Some configuration files could not be loaded, using defaults\n");
     }
     
-    // Initialize enhanced history system
-    if (init_history_system() != 0) {
+    // Initialize enhanced history system. Scripts and -c commands neither
+    // read nor add to it.
+    if (!xsh_interactive) {
+        history_set_recording(0);
+    } else if (init_history_system() != 0) {
         fprintf(stderr, "Warning: Failed to initialize history system\n");
     }
     
-    // Display startup banner if enabled
-    int startup_banner = config_get_bool(&xshell_config, "startup_banner", 1);
-    if (startup_banner) {
-        xsh_banner();
-    }
+    // Take over the terminal for job control and start reaping children
+    jobs_init();
+    
+    int exit_status;
+    if (command) {
+        exit_status = xsh_run_command(command);
+    } else if (script) {
+        exit_status = xsh_run_script(script);
+    } else {
+        // Display startup banner if enabled
+        int startup_banner = config_get_bool(&xshell_config, "startup_banner", 1);
+        if (startup_banner) {
+            xsh_banner();
+        }
 
-    // Run command loop.
-    xsh_loop();
+        // Run command loop.
+        xsh_loop();
+        exit_status = last_command_exit_status;
+    }
 
     // Perform any shutdown/cleanup.
     // Cleanup enhanced history system
-    cleanup_history_system();
+    jobs_cleanup();
+    if (xsh_interactive) {
+        cleanup_history_system();
+    }
+    cmdhash_cleanup();
+    parse_cache_cleanup();
     
     // Free configuration memory
     config_free(&xshell_config);
     config_free(&xcodex_config);
 
-    return EXIT_SUCCESS;
+    return exit_status;
 }
 
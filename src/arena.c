@@ -0,0 +1,76 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct arena_chunk {
+    arena_chunk_t *next;
+    size_t size;
+    size_t used;
+    _Alignas(max_align_t) unsigned char data[];
+};
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+static arena_chunk_t *arena_new_chunk(arena_t *arena, size_t size) {
+    if (size < ARENA_CHUNK_SIZE) size = ARENA_CHUNK_SIZE;
+    arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + size);
+    if (!chunk) return NULL;
+    arena->allocations++;
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    return chunk;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    arena_chunk_t *chunk = arena->chunks;
+    if (!chunk || chunk->size - chunk->used < size) {
+        // Grow geometrically so long lines need few chunks
+        size_t chunk_size = chunk ? chunk->size * 2 : ARENA_CHUNK_SIZE;
+        chunk = arena_new_chunk(arena, size > chunk_size ? size : chunk_size);
+        if (!chunk) return NULL;
+    }
+    void *memory = chunk->data + chunk->used;
+    chunk->used += size;
+    return memory;
+}
+
+char *arena_strndup(arena_t *arena, const char *str, size_t length) {
+    char *copy = arena_alloc(arena, length + 1);
+    if (!copy) return NULL;
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+void arena_reset(arena_t *arena) {
+    arena_chunk_t *chunk = arena->chunks;
+    if (!chunk) return;
+    if (!chunk->next) {
+        chunk->used = 0;
+        return;
+    }
+
+    // Several chunks were needed: replace them with one that holds them all
+    size_t total = 0;
+    while (chunk) {
+        arena_chunk_t *next = chunk->next;
+        total += chunk->size;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+    arena_new_chunk(arena, total);
+}
+
+void arena_free(arena_t *arena) {
+    arena_chunk_t *chunk = arena->chunks;
+    while (chunk) {
+        arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+}
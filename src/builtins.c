@@ -19,12 +19,20 @@
 #include "xcodex.h" // For xsh_xcodex (text editor command, POSIX only)
 #include "xcrypt.h" // For xsh_xcrypt (file encryption/decryption tool)
 #include "config.h" // For configuration management
+#include "cmdhash.h" // For the command path hash (hash)
+#include "jobs.h" // For the job control builtins
+#include "parallel.h" // For xsh_parallel
+#include "pipestat.h" // For xsh_pipestat
+#include "cp.h" // For xsh_cp
+#include "grep.h" // For xsh_grep
+#include "cat.h" // For xsh_cat
+#include "execute.h" // For last_command_exit_status
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h> // For chdir, getcwd (POSIX)
 #include <dirent.h> // For opendir, readdir, closedir (used indirectly by ls or completion)
-#include <ctype.h>  // For tolower (needed for case-insensitive grep)
+#include <errno.h>
 
 
 
@@ -33,7 +41,7 @@
 // Built-in command names
 char *builtin_str[] = {
     "cd", "pwd", "ls", "grep", "echo", "mkdir", "touch", "cp", "mv",
-    "rm", "cat", "xmanifesto", "xproj", "xnote", "xpass", "xeno", "xnet", "xscan", "xcodex", "xcrypt", "config", "history", "stats", "analytics", "cleardata", "help", "clear", "exit"
+    "rm", "cat", "xmanifesto", "xproj", "xnote", "xpass", "xeno", "xnet", "xscan", "xcodex", "xcrypt", "config", "history", "stats", "analytics", "cleardata", "hash", "jobs", "fg", "bg", "wait", "disown", "parallel", "pipestat", "help", "clear", "exit"
 };
 
 // Descriptions for built-in commands (for help)
@@ -63,6 +71,14 @@ char *builtin_desc[] = {
     "Show command statistics and analytics",
     "Display comprehensive performance analytics",
     "Clear all analytics and learning data",
+    "Remember or display command locations",
+    "List background and stopped jobs",
+    "Continue a job in the foreground",
+    "Continue stopped jobs in the background",
+    "Wait for jobs to finish",
+    "Stop tracking jobs",
+    "Run a command for many inputs in parallel",
+    "Show exit status and timing of each stage of the last pipeline",
     "Display help information about available commands",
     "Clear the terminal screen",
     "Exit the shell program"
@@ -73,14 +89,14 @@ char *builtin_usage[] = {
     "Usage: cd <directory>",
     "Usage: pwd",
     "Usage: ls [path]",
-    "Usage: grep [-i] <pattern> [file...]",
+    "Usage: grep [-E|-P|-F] [-i] [-n] [-c] [-l] [-r] <pattern> [file...]\nPrints lines containing pattern, from stdin without files. The pattern is a\nfixed string, or with -E an extended regular expression and with -P one that\nalso takes \\d \\w \\s, (?:...), (?i) and lazy quantifiers. -i ignores case,\n-n numbers lines, -c counts them, -l lists matching files and -r searches\ndirectories (the working directory without files) on a pool of threads.",
     "Usage: echo [string ...]",
     "Usage: mkdir <directory_name> [directory_name2] ...",
     "Usage: touch <file_name> [file_name2] ...",
-    "Usage: cp <source_file> <destination_file>",
+    "Usage: cp [-r] [-p] <source> <destination>\n       cp [-r] [-p] <source>... <directory>\nFiles are reflinked where the filesystem allows, holes in sparse files are\nkept, and -r copies trees with a pool of workers. -p preserves mode,\nownership and times. Progress is shown on a terminal for long copies.",
     "Usage: mv <source_file> <destination_file>",
     "Usage: rm <name1> [name2] ...",
-    "Usage: cat <file_name> [file_name2] ...",
+    "Usage: cat [-n] [-A] [-v] [-E] [-T] [file...]\nCopies files, or stdin without files or for -, to the output unchanged. -n\nnumbers lines; -A shows control bytes as ^X, high bytes as M-, tabs as ^I\nand line ends as $ (-v, -T and -E each do one part).",
     "Usage: xmanifesto",
     "Usage: xproj <project_type (c, py, web)> <project_name> [--git]",
     "Usage: xnote <command> [options]\nCommands:\n  add <name> \"<content>\" - Create a new note.\n  view <name>             - View a decrypted note.\n  lock <name>             - Encrypt a note with a password.\n  list                    - List all available notes.\n  delete <name>           - Delete a note.",
@@ -91,13 +107,21 @@ char *builtin_usage[] = {
     "Usage: xcodex <file_name>",
     "Usage: xcrypt <encrypt|decrypt> <input_file> <output_file>\nNote: 'encrypt' and 'decrypt' use the same symmetric XOR operation.",
     "Usage: config [command] [options]\nPopular commands:\n  show                 - Display current settings\n  get <setting>        - Get a setting value\n  set <setting> <val>  - Change a setting\n  save                 - Save changes to file\n  help                 - Show detailed help",
-    "Usage: history",
+    "Usage: history [count]",
     "Usage: stats [command_name]",
     "Usage: analytics",
     "Usage: cleardata",
+    "Usage: hash [-r] [-d name] [-t name] [name ...]",
+    "Usage: jobs [-l | -p] [job]\nJobs are %n, %+ (current), %- (previous), %prefix or %?text.",
+    "Usage: fg [job]",
+    "Usage: bg [job ...]",
+    "Usage: wait [job | pid ...]",
+    "Usage: disown [-a] [job ...]",
+    "Usage: parallel [-j jobs] [-k] [-a file] command [arg ...] [::: input ...]\nRuns command once per input (read from ::: words, -a file or stdin, one per\nline), replacing {} with the input or appending it. Output is printed per\njob as it finishes; -k prints it in input order.",
+    "Usage: pipestat [-s] [-h [count]]\nShows each stage of the last pipeline: exit status, wall and CPU time, time\nstalled on its neighbours and bytes written, marking the busiest stage. -s\nprints only the exit statuses; -h lists the last count pipelines in history\n(default 10) with their bottleneck stage.",
     "Usage: help [command]",
     "Usage: clear",
-    "Usage: exit"
+    "Usage: exit [status]\nWithout a status, exits with the status of the last command."
 };
 
 // Array of function pointers for built-in commands
@@ -105,9 +129,66 @@ int (*builtin_func[])(char **) = {
     &xsh_cd, &xsh_pwd, &xsh_ls, &xsh_grep, &xsh_echo, &xsh_mkdir, &xsh_touch,
     &xsh_cp, &xsh_mv, &xsh_rm, &xsh_cat, &xsh_manifesto, &xsh_xproj, &xsh_xnote,
     &xsh_xpass, &xsh_client, &xsh_xnet, &xsh_xscan, &xsh_xcodex, &xsh_xcrypt,
-    &xsh_config, &xsh_history, &xsh_stats, &xsh_analytics, &xsh_cleardata, &xsh_help, &xsh_clear, &xsh_exit
+    &xsh_config, &xsh_history, &xsh_stats, &xsh_analytics, &xsh_cleardata, &xsh_hash, &xsh_jobs, &xsh_fg, &xsh_bg, &xsh_wait, &xsh_disown, &xsh_parallel, &xsh_pipestat, &xsh_help, &xsh_clear, &xsh_exit
 };
 
+// Builtins that only touch their arguments and their own streams, so they can
+// run on a pipeline worker thread next to the shell instead of in a fork
+static const char *threadable_builtins[] = {"pwd", "ls", "grep", "echo", "cat"};
+
+// Streams of the builtin running on this thread (NULL = standard stream),
+// the exit status it reported and the bytes it wrote
+static _Thread_local FILE *builtin_in = NULL;
+static _Thread_local FILE *builtin_out = NULL;
+static _Thread_local FILE *builtin_err = NULL;
+static _Thread_local int builtin_status = 0;
+static _Thread_local long long builtin_written = -1;
+
+void xsh_builtin_set_streams(FILE *in, FILE *out, FILE *err) {
+    builtin_in = in;
+    builtin_out = out;
+    builtin_err = err;
+}
+
+FILE *xsh_builtin_stdin(void) {
+    return builtin_in ? builtin_in : stdin;
+}
+
+FILE *xsh_builtin_stdout(void) {
+    return builtin_out ? builtin_out : stdout;
+}
+
+FILE *xsh_builtin_stderr(void) {
+    return builtin_err ? builtin_err : stderr;
+}
+
+int xsh_builtin_status(void) {
+    return builtin_status;
+}
+
+void xsh_builtin_set_status(int status) {
+    builtin_status = status;
+}
+
+long long xsh_builtin_written(void) {
+    return builtin_written;
+}
+
+void xsh_builtin_set_written(long long bytes) {
+    builtin_written = bytes;
+}
+
+int xsh_builtin_is_threadable(const char *command) {
+    if (!command) return 0;
+    
+    for (size_t i = 0; i < sizeof(threadable_builtins) / sizeof(threadable_builtins[0]); i++) {
+        if (strcmp(command, threadable_builtins[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 int xsh_num_builtins() {
     return sizeof(builtin_str) / sizeof(char *);
 }
@@ -128,6 +209,7 @@ int xsh_builtin_exists(const char *command) {
 int xsh_execute_builtin(char **args) {
     if (!args || !args[0]) return 1;
     
+    builtin_status = 0;
     for (int i = 0; i < xsh_num_builtins(); i++) {
         if (strcmp(args[0], builtin_str[i]) == 0) {
             return (*builtin_func[i])(args);
@@ -141,9 +223,11 @@ int xsh_execute_builtin(char **args) {
 int xsh_cd(char **args) { 
     if (args[1] == NULL) {
         fprintf(stderr, "xsh: cd: missing argument\n");
+        builtin_status = 1;
     } else {
         if (chdir(args[1]) != 0) {
             perror("xsh: chdir failed");
+            builtin_status = 1;
         }
     }
     return 1;
@@ -156,15 +240,18 @@ int xsh_pwd(char **args) {
 #else
     if (getcwd(cwd, sizeof(cwd)) == NULL) {
 #endif
-        perror("xsh: pwd failed");
+        fprintf(xsh_builtin_stderr(), "xsh: pwd failed: %s\n", strerror(errno));
+        builtin_status = 1;
     } else {
-        printf("%s\n", cwd);
+        fprintf(xsh_builtin_stdout(), "%s\n", cwd);
     }
     return 1;
 }
 
 int xsh_ls(char **args) {
     const char *path_to_list = "."; // Default to current directory
+    FILE *out = xsh_builtin_stdout();
+    FILE *err = xsh_builtin_stderr();
 
     if (args[1] != NULL) {
         // If a path is provided, use it.
@@ -185,14 +272,16 @@ int xsh_ls(char **args) {
         if (current_len + 1 < XSH_MAXLINE) {
             strcat(searchPath, "*");
         } else {
-            fprintf(stderr, "xsh: ls: path too long to append wildcard: %s\n", path_to_list);
+            fprintf(err, "xsh: ls: path too long to append wildcard: %s\n", path_to_list);
+            builtin_status = 1;
             return 1;
         }
     } else {
         if (current_len + 2 < XSH_MAXLINE) { // Check space for '\*' and null terminator
             strcat(searchPath, "\\*");
         } else {
-            fprintf(stderr, "xsh: ls: path too long to append wildcard: %s\n", path_to_list);
+            fprintf(err, "xsh: ls: path too long to append wildcard: %s\n", path_to_list);
+            builtin_status = 1;
             return 1;
         }
     }
@@ -202,14 +291,15 @@ int xsh_ls(char **args) {
     if (hFind == INVALID_HANDLE_VALUE) {
         DWORD dwError = GetLastError();
         if (dwError != ERROR_FILE_NOT_FOUND) {
-            fprintf(stderr, "xsh: ls: cannot access '%s': ", path_to_list);
+            fprintf(err, "xsh: ls: cannot access '%s': ", path_to_list);
             LPVOID lpMsgBuf;
             FormatMessage(
                 FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
                 NULL, dwError, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
                 (LPTSTR) &lpMsgBuf, 0, NULL );
-            fprintf(stderr, "%s\n", (char*)lpMsgBuf);
+            fprintf(err, "%s\n", (char*)lpMsgBuf);
             LocalFree(lpMsgBuf);
+            builtin_status = 1;
         }
         // If ERROR_FILE_NOT_FOUND, it could be an empty or non-existent directory.
         // ls typically prints nothing for an empty directory and returns success.
@@ -220,7 +310,7 @@ int xsh_ls(char **args) {
         if (strcmp(findFileData.cFileName, ".") == 0 || strcmp(findFileData.cFileName, "..") == 0) {
             continue;
         }
-        printf("%s\n", findFileData.cFileName);
+        fprintf(out, "%s\n", findFileData.cFileName);
     } while (FindNextFile(hFind, &findFileData) != 0);
 
     FindClose(hFind);
@@ -231,8 +321,8 @@ int xsh_ls(char **args) {
 
     dir = opendir(path_to_list);
     if (dir == NULL) {
-        fprintf(stderr, "xsh: ls: cannot access '%s': ", path_to_list);
-        perror("");
+        fprintf(err, "xsh: ls: cannot access '%s': %s\n", path_to_list, strerror(errno));
+        builtin_status = 1;
         return 1;
     }
 
@@ -240,11 +330,11 @@ int xsh_ls(char **args) {
         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
             continue;
         }
-        printf("%s\n", entry->d_name);
+        fprintf(out, "%s\n", entry->d_name);
     }
 
     if (closedir(dir) == -1) {
-        perror("xsh: ls: closedir failed");
+        fprintf(err, "xsh: ls: closedir failed: %s\n", strerror(errno));
     }
 #endif
     return 1;
@@ -259,55 +349,6 @@ int xsh_clear(char **args) {
     return 1;
 }
 
-int xsh_cp(char **args) {
-    if (args[1] == NULL || args[2] == NULL) {
-        fprintf(stderr, "xsh: cp: missing source or destination file\n");
-        fprintf(stderr, "Usage: cp <source_file> <destination_file>\n");
-        return 1;
-    }
-
-    FILE *src_file, *dest_file;
-    int ch;
-
-    src_file = fopen(args[1], "rb");
-    if (src_file == NULL) {
-        fprintf(stderr, "xsh: cp: cannot open source file '%s': ", args[1]);
-        perror("");
-        return 1;
-    }
-
-    dest_file = fopen(args[2], "wb");
-    if (dest_file == NULL) {
-        fprintf(stderr, "xsh: cp: cannot open destination file '%s': ", args[2]);
-        perror("");
-        fclose(src_file);
-        return 1;
-    }
-
-    while ((ch = fgetc(src_file)) != EOF) {
-        fputc(ch, dest_file);
-    }
-
-    if (ferror(src_file)) {
-        fprintf(stderr, "xsh: cp: error reading source file '%s'\n", args[1]);
-    }
-    if (ferror(dest_file)) {
-        fprintf(stderr, "xsh: cp: error writing to destination file '%s'\n", args[2]);
-    }
-
-    if (fclose(src_file) == EOF) {
-        fprintf(stderr, "xsh: cp: error closing source file '%s': ", args[1]);
-        perror("");
-    }
-    if (fclose(dest_file) == EOF) {
-        fprintf(stderr, "xsh: cp: error closing destination file '%s': ", args[2]);
-        perror("");
-    } else {
-        printf("Copied '%s' to '%s'\n", args[1], args[2]);
-    }
-    return 1;
-}
-
 int xsh_mv(char **args) {
     if (args[1] == NULL || args[2] == NULL) {
         fprintf(stderr, "xsh: mv: missing source or destination file\n");
@@ -346,117 +387,15 @@ int xsh_rm(char **args) {
     return 1; // Continue shell loop
 }
 
-int xsh_cat(char **args) {
-    if (args[1] == NULL) {
-        fprintf(stderr, "xsh: cat: missing file operand\n");
-        fprintf(stderr, "Usage: cat <file_name> [file_name2] ...\n");
-        return 1;
-    }
-    for (int i = 1; args[i] != NULL; i++) {
-        FILE *fp = fopen(args[i], "r");
-        if (fp == NULL) {
-            fprintf(stderr, "xsh: cat: cannot open '%s': ", args[i]);
-            perror("");
-            continue; 
-        }
-        char line[XSH_MAXLINE];
-        while (fgets(line, sizeof(line), fp)) {
-            fputs(line, stdout);
-        }
-        printf("\n");
-        if (ferror(fp)) {
-            fprintf(stderr, "xsh: cat: error reading file '%s'\n", args[i]);
-        }
-        if (fclose(fp) == EOF) {
-            fprintf(stderr, "xsh: cat: error closing '%s': \n", args[i]);
-            perror("");
-        }
-    }
-    return 1;
-}
-
-
-int xsh_grep(char **args) {
-    int case_insensitive = 0;
-    char *pattern_arg = NULL;
-    int first_file_arg_index = -1;
-
-    if (args[1] == NULL) { // No arguments after "grep"
-        fprintf(stderr, "xsh: grep: missing pattern\nUsage: grep [-i] <pattern> [file...]\n");
-        return 1;
-    }
-
-    int current_arg_idx = 1;
-    // Parse options
-    while (args[current_arg_idx] != NULL && args[current_arg_idx][0] == '-' && strlen(args[current_arg_idx]) > 1) {
-        if (strcmp(args[current_arg_idx], "-i") == 0) {
-            case_insensitive = 1;
-            current_arg_idx++;
-        } else {
-            fprintf(stderr, "xsh: grep: unknown option %s\nUsage: grep [-i] <pattern> [file...]\n", args[current_arg_idx]);
-            return 1;
-        }
-    }
-
-    // Next argument is the pattern
-    if (args[current_arg_idx] == NULL) {
-        fprintf(stderr, "xsh: grep: missing pattern after options\nUsage: grep [-i] <pattern> [file...]\n");
-        return 1;
-    }
-    pattern_arg = args[current_arg_idx];
-    current_arg_idx++; // Move to where filenames would start
-    first_file_arg_index = current_arg_idx;
-
-    char *actual_pattern = pattern_arg;
-    char *allocated_quoted_pattern_buffer = NULL;
-    size_t pattern_len = strlen(pattern_arg);
-
-    if (pattern_len >= 2 && pattern_arg[0] == '"' && pattern_arg[pattern_len - 1] == '"') {
-        allocated_quoted_pattern_buffer = malloc(pattern_len - 1);
-        if (!allocated_quoted_pattern_buffer) {
-            fprintf(stderr, "xsh: grep: memory allocation error for pattern\n");
-            return 1;
-        }
-        strncpy(allocated_quoted_pattern_buffer, pattern_arg + 1, pattern_len - 2);
-        allocated_quoted_pattern_buffer[pattern_len - 2] = '\0';
-        actual_pattern = allocated_quoted_pattern_buffer;
-    }
-
-    int num_file_args = 0;
-    for (int i = first_file_arg_index; args[i] != NULL; i++) {
-        num_file_args++;
-    }
-    int print_filenames_flag = (num_file_args > 1);
-
-    if (args[first_file_arg_index] == NULL) { // No file arguments, read from stdin
-        process_grep_stream(stdin, actual_pattern, case_insensitive, NULL); // No filename to print for stdin
-    } else { // Process one or more files
-        for (int i = first_file_arg_index; args[i] != NULL; i++) {
-            FILE *fp = fopen(args[i], "r");
-            if (fp == NULL) {
-                fprintf(stderr, "xsh: grep: %s: \n", args[i]);
-                perror("");
-                continue; // Standard grep continues with other files
-            }
-            process_grep_stream(fp, actual_pattern, case_insensitive, print_filenames_flag ? args[i] : NULL);
-            if (fclose(fp) == EOF) {
-                fprintf(stderr, "xsh: grep: error closing %s: \n", args[i]);
-                perror("");
-            }
-        }
-    }
-
-    if (allocated_quoted_pattern_buffer) {
-        free(allocated_quoted_pattern_buffer);
-    }
-    return 1;
-}
-
 int xsh_echo(char **args) {
+    FILE *out = xsh_builtin_stdout();
+    long long written = 0;
     for (int i = 1; args[i] != NULL; i++) {
-        printf("%s%s", args[i], (args[i+1] != NULL ? " " : ""));
+        int n = fprintf(out, "%s%s", args[i], (args[i+1] != NULL ? " " : ""));
+        written = n < 0 || written == -1 ? -1 : written + n;
     }
-    printf("\n");
+    written = fputc('\n', out) == EOF || written == -1 ? -1 : written + 1;
+    xsh_builtin_set_written(written);
     return 1;
 }
 
@@ -587,15 +526,17 @@ int xsh_manifesto(char **args) {
 }
 
 // xsh_client is defined in network.c
-// xsh_history will be more fleshed out in history.c
+// xsh_history shows the whole history, or only the last N entries
 int xsh_history(char **args) {
-    if (history_count == 0) {
-        printf("No commands in history.\n");
-        return 1;
-    }
-    for (int i = 0; i < history_count; i++) {
-        printf("%d: %s\n", i + 1, history[i]);
+    int limit = 0;
+    if (args[1] != NULL) {
+        limit = atoi(args[1]);
+        if (limit <= 0) {
+            fprintf(stderr, "xsh: history: invalid count '%s'\n", args[1]);
+            return 1;
+        }
     }
+    display_history(limit);
     return 1;
 }
 
@@ -627,7 +568,20 @@ int xsh_help(char **args) {
 }
 
 int xsh_exit(char **args) {
-    printf("Exiting XShell. Goodbye!\n");
+    builtin_status = last_command_exit_status;
+    if (args[1]) {
+        char *end;
+        long status = strtol(args[1], &end, 10);
+        if (end == args[1] || *end != '\0') {
+            fprintf(stderr, "xsh: exit: %s: numeric argument required\n", args[1]);
+            status = 2;
+        }
+        builtin_status = (int)(status & 0xff);
+    }
+    shell_exit_requested = 1; // Stops the rest of the line too
+    if (xsh_interactive) {
+        printf("Exiting XShell. Goodbye!\n");
+    }
     return 0; // Signal to terminate the shell loop
 }
 
@@ -1191,3 +1145,40 @@ int xsh_cleardata(char **args) {
     return 1;
 }
 
+// Show or manage the command path hash
+int xsh_hash(char **args) {
+    if (args[1] == NULL) {
+        cmdhash_display();
+        return 1;
+    }
+
+    for (int i = 1; args[i] != NULL; i++) {
+        if (strcmp(args[i], "-r") == 0) {
+            cmdhash_clear();
+        } else if (strcmp(args[i], "-d") == 0 || strcmp(args[i], "-t") == 0) {
+            const char *name = args[i + 1];
+            if (name == NULL) {
+                fprintf(stderr, "xsh: hash: %s: option requires an argument\n", args[i]);
+                builtin_status = 1;
+                return 1;
+            }
+            if (args[i][1] == 'd') {
+                cmdhash_forget(name);
+            } else {
+                const char *path = cmdhash_lookup(name, 0);
+                if (path) {
+                    printf("%s\n", path);
+                } else {
+                    fprintf(stderr, "xsh: hash: %s: not found\n", name);
+                    builtin_status = 1;
+                }
+            }
+            i++;
+        } else if (strchr(args[i], '/') == NULL && cmdhash_lookup(args[i], 0) == NULL) {
+            fprintf(stderr, "xsh: hash: %s: not found\n", args[i]);
+            builtin_status = 1;
+        }
+    }
+    return 1;
+}
+
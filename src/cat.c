@@ -0,0 +1,328 @@
+#include "cat.h"
+#include "builtins.h"
+#include "fastcopy.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h> // For open, read, write, close
+#else
+#include <unistd.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CAT_USAGE "Usage: cat [-n] [-A] [-v] [-E] [-T] [file...]\n"
+#define CAT_NUMBER_SIZE 24 // Room for any line number, right-aligned, and its tab
+
+typedef struct {
+    int number;           // -n: number every line
+    int show_ends;        // -E: $ before each newline
+    int show_tabs;        // -T: tabs as ^I
+    int show_nonprinting; // -v: control bytes as ^X, high bytes as M-
+    unsigned char special[256]; // Bytes formatting has to look at
+    int newlines_only;    // Only newlines are special, so memchr() finds them
+
+    int out_fd;
+    char *input;
+    char *output;
+    size_t output_length;
+    char line_number[CAT_NUMBER_SIZE]; // The next line's "%6lld\t", counted up in place
+    int number_start;
+    int at_line_start;
+    int pending_cr;       // -E: a carriage return ended the last read
+    int write_errno;      // Set once a write fails; nothing more is written
+    long long written;    // Bytes written, -1 once a failed copy leaves it unknown
+} cat_t;
+
+static int write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, (unsigned)length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+// Write to the output, counting what was written
+static void cat_write(cat_t *c, const void *data, size_t length) {
+    if (c->write_errno) return;
+    if (write_all(c->out_fd, data, length) == -1) {
+        c->write_errno = errno;
+        c->written = -1;
+    } else if (c->written != -1) {
+        c->written += (long long)length;
+    }
+}
+
+static void cat_flush(cat_t *c) {
+    if (c->output_length > 0) cat_write(c, c->output, c->output_length);
+    c->output_length = 0;
+}
+
+static void cat_emit(cat_t *c, const void *data, size_t length) {
+    if (c->output_length + length > CAT_OUTPUT) {
+        cat_flush(c);
+        if (length > CAT_OUTPUT) {
+            cat_write(c, data, length);
+            return;
+        }
+    }
+    memcpy(c->output + c->output_length, data, length);
+    c->output_length += length;
+}
+
+// A special byte other than a newline, as -v and -T show it
+static void cat_emit_visible(cat_t *c, unsigned char ch) {
+    char shown[4];
+    size_t length = 0;
+    if (ch >= 128 && c->show_nonprinting) {
+        shown[length++] = 'M';
+        shown[length++] = '-';
+        ch -= 128;
+        // After M- control bytes, tab and newline too, take the ^ form
+        if (ch < 32 || ch == 127) {
+            shown[length++] = '^';
+            ch = ch == 127 ? '?' : ch + 64;
+        }
+    } else if (ch == 127 || ch < 32) {
+        shown[length++] = '^';
+        ch = ch == 127 ? '?' : ch + 64;
+    }
+    shown[length++] = (char)ch;
+    cat_emit(c, shown, length);
+}
+
+// With -E, as in GNU cat, a carriage return before a newline shows as ^M
+static void cat_emit_cr(cat_t *c, int before_newline) {
+    if (before_newline) cat_emit(c, "^M", 2);
+    else cat_emit(c, "\r", 1);
+}
+
+// Count the line number up a digit at a time, as GNU cat does, rather than
+// printing it again for every line
+static void cat_next_number(cat_t *c) {
+    int i = CAT_NUMBER_SIZE - 2;
+    while (c->line_number[i] == '9') c->line_number[i--] = '0';
+    c->line_number[i] = c->line_number[i] == ' ' ? '1' : c->line_number[i] + 1;
+    if (i < c->number_start) c->number_start = i;
+}
+
+// The first byte in [p, end) formatting has to look at. All of them are
+// below 32 or from 127 up, which SSE2 finds 16 bytes at a time.
+static const unsigned char *cat_next_special(const cat_t *c, const unsigned char *p, const unsigned char *end) {
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(32), del = _mm_set1_epi8(127);
+    for (; end - p >= 16; p += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+        // Signed, bytes from 128 up are below 32 too
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(bytes, space),
+                                                                _mm_cmpeq_epi8(bytes, del)));
+        for (; mask; mask &= mask - 1) {
+            const unsigned char *at = p + __builtin_ctz(mask);
+            if (c->special[*at]) return at;
+        }
+    }
+#endif
+    while (p < end && !c->special[*p]) p++;
+    return p;
+}
+
+static void cat_format(cat_t *c, const char *data, size_t size) {
+    const unsigned char *p = (const unsigned char *)data, *end = p + size;
+    if (c->pending_cr && size > 0) {
+        cat_emit_cr(c, *p == '\n');
+        c->pending_cr = 0;
+    }
+    while (p < end) {
+        if (c->at_line_start && c->number) {
+            cat_emit(c, c->line_number + c->number_start, CAT_NUMBER_SIZE - c->number_start);
+            cat_next_number(c);
+        }
+        c->at_line_start = 0;
+
+        const unsigned char *run = p;
+        if (c->newlines_only) {
+            p = memchr(p, '\n', (size_t)(end - p));
+            if (!p) p = end;
+        } else {
+            p = cat_next_special(c, p, end);
+        }
+        // Found by memchr(), a carriage return ending the run may be before
+        // a newline, here or at the start of the next read
+        size_t cr = c->newlines_only && c->show_ends && p > run && p[-1] == '\r';
+        cat_emit(c, run, (size_t)(p - run) - cr);
+        if (p == end) {
+            c->pending_cr = (int)cr;
+            break;
+        }
+
+        unsigned char ch = *p++;
+        if (ch == '\n') {
+            if (cr) cat_emit(c, "^M", 2);
+            if (c->show_ends) cat_emit(c, "$\n", 2);
+            else cat_emit(c, "\n", 1);
+            c->at_line_start = 1;
+        } else if (ch == '\r' && !c->show_nonprinting) {
+            if (p == end) c->pending_cr = 1;
+            else cat_emit_cr(c, *p == '\n');
+        } else {
+            cat_emit_visible(c, ch);
+        }
+    }
+}
+
+// Read fd to its end through the formatter. Returns -1 with errno set on a
+// read error.
+static int cat_formatted(cat_t *c, int fd) {
+    struct stat st;
+    // What a pipe or terminal gives is written before waiting for more
+    int interactive = fstat(fd, &st) == 0 && !S_ISREG(st.st_mode);
+    for (;;) {
+        if (interactive) cat_flush(c);
+        if (c->write_errno) return 0;
+        ssize_t n = read(fd, c->input, CAT_BUFSIZE);
+        if (n == 0) {
+            if (c->pending_cr) cat_emit_cr(c, 0);
+            c->pending_cr = 0;
+            return 0;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        cat_format(c, c->input, (size_t)n);
+    }
+}
+
+int xsh_cat(char **args) {
+    FILE *out = xsh_builtin_stdout();
+    FILE *err = xsh_builtin_stderr();
+    cat_t c;
+    memset(&c, 0, sizeof(c));
+
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *flag = args[i] + 1; *flag; flag++) {
+            switch (*flag) {
+            case 'n': c.number = 1; break;
+            case 'A': c.show_nonprinting = c.show_ends = c.show_tabs = 1; break;
+            case 'v': c.show_nonprinting = 1; break;
+            case 'E': c.show_ends = 1; break;
+            case 'T': c.show_tabs = 1; break;
+            default:
+                fprintf(err, "xsh: cat: invalid option -- '%c'\n" CAT_USAGE, *flag);
+                xsh_builtin_set_status(2);
+                return 1;
+            }
+        }
+    }
+    int formatting = c.number || c.show_ends || c.show_tabs || c.show_nonprinting;
+    if (formatting) {
+        c.special['\n'] = 1;
+        if (c.show_tabs) c.special['\t'] = 1;
+        if (c.show_ends) c.special['\r'] = 1;
+        for (int ch = 0; ch < 256 && c.show_nonprinting; ch++) {
+            if ((ch < 32 && ch != '\t' && ch != '\n') || ch >= 127) c.special[ch] = 1;
+        }
+        c.newlines_only = !c.show_tabs && !c.show_nonprinting;
+        c.input = fastcopy_buffer(CAT_BUFSIZE);
+        c.output = fastcopy_buffer(CAT_OUTPUT);
+        if (!c.input || !c.output) {
+            fprintf(err, "xsh: cat: memory allocation error\n");
+            fastcopy_buffer_free(c.input);
+            fastcopy_buffer_free(c.output);
+            xsh_builtin_set_status(1);
+            return 1;
+        }
+        c.at_line_start = 1;
+        memset(c.line_number, ' ', CAT_NUMBER_SIZE);
+        c.line_number[CAT_NUMBER_SIZE - 1] = '\t';
+        c.line_number[CAT_NUMBER_SIZE - 2] = '1';
+        c.number_start = CAT_NUMBER_SIZE - 7;
+    }
+
+#ifdef _WIN32
+    int open_flags = O_RDONLY | O_BINARY;
+#else
+    int open_flags = O_RDONLY | O_CLOEXEC;
+#endif
+    // Anything already in the stream goes first; from here on the
+    // descriptor under it is written directly
+    fflush(out);
+    c.out_fd = fileno(out);
+    struct stat out_stat;
+    int out_is_file = fstat(c.out_fd, &out_stat) == 0 && S_ISREG(out_stat.st_mode);
+
+    // Without files, or for "-", standard input
+    static char *standard_input[] = {"-", NULL};
+    char **files = args[i] ? &args[i] : standard_input;
+    int failed = 0;
+    long long copied;
+    for (int f = 0; files[f] && !c.write_errno; f++) {
+        int is_stdin = strcmp(files[f], "-") == 0;
+        const char *name = is_stdin ? "(standard input)" : files[f];
+        int fd = is_stdin ? fileno(xsh_builtin_stdin()) : open(files[f], open_flags);
+        if (fd == -1) {
+            fprintf(err, "xsh: cat: cannot open '%s': %s\n", name, strerror(errno));
+            failed = 1;
+            continue;
+        }
+        // Copying a file into itself would never reach its end
+        struct stat in_stat;
+        if (out_is_file && fstat(fd, &in_stat) == 0 &&
+            in_stat.st_dev == out_stat.st_dev && in_stat.st_ino == out_stat.st_ino) {
+            fprintf(err, "xsh: cat: '%s': input file is output file\n", name);
+            failed = 1;
+            if (!is_stdin) close(fd);
+            continue;
+        }
+
+        if (formatting) {
+            if (cat_formatted(&c, fd) == -1) {
+                fprintf(err, "xsh: cat: error reading '%s': %s\n", name, strerror(errno));
+                failed = 1;
+            }
+        } else if ((copied = fastcopy_fd(fd, c.out_fd)) != -1) {
+            // The data goes from file to file or pipe in the kernel when it can
+            if (c.written != -1) c.written += copied;
+        } else {
+            // What part of the file was copied before the error is not known
+            c.written = -1;
+            if (errno == EPIPE) {
+                c.write_errno = EPIPE;
+            } else {
+                fprintf(err, "xsh: cat: error copying '%s': %s\n", name, strerror(errno));
+                failed = 1;
+            }
+        }
+        if (!is_stdin) close(fd);
+    }
+
+    if (formatting) {
+        cat_flush(&c);
+        fastcopy_buffer_free(c.input);
+        fastcopy_buffer_free(c.output);
+    }
+    // A reader that went away is not an error
+    if (c.write_errno && c.write_errno != EPIPE) {
+        fprintf(err, "xsh: cat: write error: %s\n", strerror(c.write_errno));
+        failed = 1;
+    }
+    xsh_builtin_set_written(c.written);
+    xsh_builtin_set_status(failed ? 1 : 0);
+    return 1;
+}
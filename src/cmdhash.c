@@ -0,0 +1,296 @@
+#include "cmdhash.h"
+#include "utils.h" // For xsh_hash_bytes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define PATH_LIST_SEPARATOR ';'
+#define PATH_SEPARATOR "\\"
+#else
+#define PATH_LIST_SEPARATOR ':'
+#define PATH_SEPARATOR "/"
+#endif
+
+#define CMDHASH_PATH_MAX 1024
+
+typedef struct {
+    char *name;
+    char *path;
+    int hits;       // Launches through this entry
+    int remembered; // Looked up by name, so `hash` lists it
+} cmdhash_entry_t;
+
+static cmdhash_entry_t *entries = NULL;
+static int entry_count = 0;
+static int entry_capacity = 0;
+
+// Open-addressing index by name; slots hold entry handle + 1 (0 = empty)
+static int *entry_index = NULL;
+static int entry_index_capacity = 0; // Always a power of two
+
+static char *hashed_path = NULL; // PATH value the entries were resolved for
+static int path_scanned = 0;     // Every executable on hashed_path is in the table
+
+static unsigned long cmdhash_hash(const char *str) {
+    return (unsigned long)xsh_hash_bytes(str, strlen(str));
+}
+
+static void index_insert(int handle) {
+    unsigned long mask = entry_index_capacity - 1;
+    unsigned long slot = cmdhash_hash(entries[handle].name) & mask;
+    while (entry_index[slot] != 0) {
+        slot = (slot + 1) & mask; // Linear probing
+    }
+    entry_index[slot] = handle + 1;
+}
+
+static int index_rebuild(int new_capacity) {
+    int *new_index = calloc(new_capacity, sizeof(int));
+    if (!new_index) {
+        fprintf(stderr, "xsh: Failed to expand command hash\n");
+        return -1;
+    }
+    free(entry_index);
+    entry_index = new_index;
+    entry_index_capacity = new_capacity;
+    for (int i = 0; i < entry_count; i++) {
+        index_insert(i);
+    }
+    return 0;
+}
+
+static int find_entry(const char *name) {
+    if (entry_index_capacity == 0) return -1;
+    unsigned long mask = entry_index_capacity - 1;
+    unsigned long slot = cmdhash_hash(name) & mask;
+    while (entry_index[slot] != 0) {
+        int handle = entry_index[slot] - 1;
+        if (strcmp(entries[handle].name, name) == 0) return handle;
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+static int add_entry(const char *name, const char *path) {
+    // Keep the index at most half full so probe sequences stay short
+    if ((entry_count + 1) * 2 > entry_index_capacity) {
+        if (index_rebuild(entry_index_capacity ? entry_index_capacity * 2 : 256) != 0) return -1;
+    }
+    if (entry_count >= entry_capacity) {
+        int new_capacity = entry_capacity ? entry_capacity * 2 : 128;
+        cmdhash_entry_t *new_entries = realloc(entries, sizeof(cmdhash_entry_t) * new_capacity);
+        if (!new_entries) {
+            fprintf(stderr, "xsh: Failed to expand command hash\n");
+            return -1;
+        }
+        entries = new_entries;
+        entry_capacity = new_capacity;
+    }
+
+    cmdhash_entry_t *entry = &entries[entry_count];
+    entry->name = strdup(name);
+    entry->path = strdup(path);
+    if (!entry->name || !entry->path) {
+        free(entry->name);
+        free(entry->path);
+        return -1;
+    }
+    entry->hits = 0;
+    entry->remembered = 0;
+    index_insert(entry_count);
+    return entry_count++;
+}
+
+void cmdhash_clear(void) {
+    for (int i = 0; i < entry_count; i++) {
+        free(entries[i].name);
+        free(entries[i].path);
+    }
+    entry_count = 0;
+    if (entry_index) memset(entry_index, 0, sizeof(int) * entry_index_capacity);
+    path_scanned = 0;
+}
+
+void cmdhash_forget(const char *name) {
+    int handle = find_entry(name);
+    if (handle < 0) return;
+
+    // Move the last entry into the hole; removals are rare, so simply
+    // rebuild the index instead of keeping tombstones
+    free(entries[handle].name);
+    free(entries[handle].path);
+    entries[handle] = entries[--entry_count];
+    memset(entry_index, 0, sizeof(int) * entry_index_capacity);
+    for (int i = 0; i < entry_count; i++) {
+        index_insert(i);
+    }
+    path_scanned = 0; // The name may now resolve to a later directory
+}
+
+// Flush the table if PATH changed since it was filled
+static const char *current_path(void) {
+    const char *path = getenv("PATH");
+    if (!path) path = CMDHASH_DEFAULT_PATH;
+    if (!hashed_path || strcmp(hashed_path, path) != 0) {
+        cmdhash_clear();
+        free(hashed_path);
+        hashed_path = strdup(path);
+    }
+    return path;
+}
+
+static int is_absolute_dir(const char *dir, size_t length) {
+#ifdef _WIN32
+    if (length >= 2 && isalpha((unsigned char)dir[0]) && dir[1] == ':') return 1;
+    return length > 0 && (dir[0] == '\\' || dir[0] == '/');
+#else
+    return length > 0 && dir[0] == '/';
+#endif
+}
+
+#ifdef _WIN32
+static const char *executable_extensions[] = {".exe", ".com", ".bat", ".cmd"};
+
+static int has_executable_extension(const char *name) {
+    const char *dot = strrchr(name, '.');
+    if (!dot) return 0;
+    for (size_t i = 0; i < sizeof(executable_extensions) / sizeof(executable_extensions[0]); i++) {
+        if (_stricmp(dot, executable_extensions[i]) == 0) return 1;
+    }
+    return 0;
+}
+#endif
+
+static int is_executable_file(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return 0;
+#ifdef _WIN32
+    return has_executable_extension(path);
+#else
+    return (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) != 0;
+#endif
+}
+
+// Look for name in one PATH directory, writing the full path on success
+static int resolve_in_dir(const char *dir, size_t length, const char *name, char *out, size_t size) {
+    if (length == 0) {
+        dir = "."; // An empty PATH entry means the current directory
+        length = 1;
+    }
+    int n = snprintf(out, size, "%.*s" PATH_SEPARATOR "%s", (int)length, dir, name);
+    if (n < 0 || (size_t)n >= size) return 0;
+    if (is_executable_file(out)) return 1;
+#ifdef _WIN32
+    // Commands are usually named without their extension
+    for (size_t i = 0; i < sizeof(executable_extensions) / sizeof(executable_extensions[0]); i++) {
+        n = snprintf(out, size, "%.*s\\%s%s", (int)length, dir, name, executable_extensions[i]);
+        if (n > 0 && (size_t)n < size && is_executable_file(out)) return 1;
+    }
+#endif
+    return 0;
+}
+
+const char *cmdhash_lookup(const char *name, int count_hit) {
+    static char uncached[CMDHASH_PATH_MAX]; // Found in a relative PATH directory
+    if (!name || !*name) return NULL;
+
+    const char *path = current_path();
+    int handle = find_entry(name);
+    if (handle < 0) {
+        char resolved[CMDHASH_PATH_MAX];
+        const char *dir = path;
+        for (;;) {
+            const char *end = strchr(dir, PATH_LIST_SEPARATOR);
+            size_t length = end ? (size_t)(end - dir) : strlen(dir);
+            if (resolve_in_dir(dir, length, name, resolved, sizeof(resolved))) {
+                if (!is_absolute_dir(dir, length)) {
+                    memcpy(uncached, resolved, sizeof(uncached));
+                    return uncached;
+                }
+                handle = add_entry(name, resolved);
+                if (handle < 0) {
+                    memcpy(uncached, resolved, sizeof(uncached));
+                    return uncached;
+                }
+                break;
+            }
+            if (!end) return NULL;
+            dir = end + 1;
+        }
+    }
+
+    entries[handle].remembered = 1;
+    if (count_hit) entries[handle].hits++;
+    return entries[handle].path;
+}
+
+int cmdhash_fill(void) {
+    const char *path = current_path();
+    if (path_scanned) return entry_count;
+
+    // Earlier directories win, as in a lookup, so only add unknown names
+    char candidate[CMDHASH_PATH_MAX];
+    const char *dir = path;
+    for (;;) {
+        const char *end = strchr(dir, PATH_LIST_SEPARATOR);
+        size_t length = end ? (size_t)(end - dir) : strlen(dir);
+        if (is_absolute_dir(dir, length) && length < sizeof(candidate)) {
+            char dir_path[CMDHASH_PATH_MAX];
+            memcpy(dir_path, dir, length);
+            dir_path[length] = '\0';
+
+            DIR *d = opendir(dir_path);
+            if (d) {
+                struct dirent *entry;
+                while ((entry = readdir(d)) != NULL) {
+                    if (entry->d_name[0] == '.') continue;
+                    if (find_entry(entry->d_name) >= 0) continue;
+                    int n = snprintf(candidate, sizeof(candidate), "%s" PATH_SEPARATOR "%s", dir_path, entry->d_name);
+                    if (n < 0 || (size_t)n >= sizeof(candidate)) continue;
+                    if (is_executable_file(candidate)) {
+                        add_entry(entry->d_name, candidate);
+                    }
+                }
+                closedir(d);
+            }
+        }
+        if (!end) break;
+        dir = end + 1;
+    }
+
+    path_scanned = 1;
+    return entry_count;
+}
+
+const char *cmdhash_name(int index) {
+    if (index < 0 || index >= entry_count) return NULL;
+    return entries[index].name;
+}
+
+void cmdhash_display(void) {
+    int shown = 0;
+    for (int i = 0; i < entry_count; i++) {
+        if (!entries[i].remembered) continue;
+        if (shown++ == 0) printf("hits\tcommand\n");
+        printf("%4d\t%s\n", entries[i].hits, entries[i].path);
+    }
+    if (shown == 0) {
+        printf("hash: hash table empty\n");
+    }
+}
+
+void cmdhash_cleanup(void) {
+    cmdhash_clear();
+    free(entries);
+    free(entry_index);
+    free(hashed_path);
+    entries = NULL;
+    entry_index = NULL;
+    hashed_path = NULL;
+    entry_capacity = 0;
+    entry_index_capacity = 0;
+}
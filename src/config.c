@@ -3,6 +3,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include "xsh.h" /* For xsh_interactive */
 
 #ifdef _WIN32
 #include <direct.h>
@@ -354,7 +356,7 @@ int config_load_defaults(config_t *config, const char *type) {
     if (strcmp(type, "xshell") == 0) {
         config_set_with_type(config, "prompt", "xsh@{user}:{cwd}:{history}> ", CONFIG_TYPE_STRING, "Shell prompt format (supports {user}, {cwd}, {history} placeholders)");
         config_set_with_type(config, "prompt_style", "enhanced", CONFIG_TYPE_STRING, "Prompt style: 'simple', 'enhanced', or 'custom'");
-        config_set_with_type(config, "history_size", "100", CONFIG_TYPE_INT, "Maximum number of history entries (XSH_HISTORY_SIZE)");
+        config_set_with_type(config, "history_size", "10000", CONFIG_TYPE_INT, "Number of history entries kept in memory; older ones are paged from disk");
         config_set_with_type(config, "auto_complete", "true", CONFIG_TYPE_BOOL, "Enable tab auto-completion for commands");
         config_set_with_type(config, "case_sensitive", "false", CONFIG_TYPE_BOOL, "Case sensitive command matching");
         config_set_with_type(config, "color_output", "true", CONFIG_TYPE_BOOL, "Enable colored output in prompt");
@@ -433,6 +435,16 @@ int config_load_with_fallback(config_t *config, const char *config_file) {
     return -1;
 }
 
+/* Report which files were loaded, to a user at the prompt only: scripts and
+   -c commands keep their output to what their commands print */
+static void config_note(const char *format, ...) {
+    if (!xsh_interactive) return;
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
 /* Load all configuration files */
 int config_load_all_files(void) {
     int result = 0;
@@ -470,20 +482,20 @@ int config_load_all_files(void) {
         if (access(home_path, F_OK) == 0) {
             /* Config exists in home directory - load it (this will override defaults with user settings) */
             if (config_load_file(&xshell_config, home_path) == 0) {
-                printf("Loaded XShell config from %s\n", home_path);
+                config_note("Loaded XShell config from %s\n", home_path);
             } else {
                 fprintf(stderr, "Warning: Failed to load XShell config from %s\n", home_path);
             }
         } else if (access(XSHELL_CONFIG_FILE, F_OK) == 0) {
             /* Try current directory as fallback */
             if (config_load_file(&xshell_config, XSHELL_CONFIG_FILE) == 0) {
-                printf("Loaded XShell config from current directory: %s\n", XSHELL_CONFIG_FILE);
+                config_note("Loaded XShell config from current directory: %s\n", XSHELL_CONFIG_FILE);
             } else {
                 fprintf(stderr, "Warning: Failed to load XShell config from current directory\n");
             }
         } else {
             /* Config doesn't exist anywhere, create it in home directory with defaults */
-            printf("Creating default XShell config at %s\n", home_path);
+            config_note("Creating default XShell config at %s\n", home_path);
             if (config_save_file(&xshell_config, home_path) != 0) {
                 fprintf(stderr, "Warning: Failed to create XShell config file at %s\n", home_path);
                 result = -1;
@@ -500,20 +512,20 @@ int config_load_all_files(void) {
         if (access(home_path, F_OK) == 0) {
             /* Config exists in home directory - load it (this will override defaults with user settings) */
             if (config_load_file(&xcodex_config, home_path) == 0) {
-                printf("Loaded XCodex config from %s\n", home_path);
+                config_note("Loaded XCodex config from %s\n", home_path);
             } else {
                 fprintf(stderr, "Warning: Failed to load XCodex config from %s\n", home_path);
             }
         } else if (access(XCODEX_CONFIG_FILE, F_OK) == 0) {
             /* Try current directory as fallback */
             if (config_load_file(&xcodex_config, XCODEX_CONFIG_FILE) == 0) {
-                printf("Loaded XCodex config from current directory: %s\n", XCODEX_CONFIG_FILE);
+                config_note("Loaded XCodex config from current directory: %s\n", XCODEX_CONFIG_FILE);
             } else {
                 fprintf(stderr, "Warning: Failed to load XCodex config from current directory\n");
             }
         } else {
             /* Config doesn't exist anywhere, create it in home directory with defaults */
-            printf("Creating default XCodex config at %s\n", home_path);
+            config_note("Creating default XCodex config at %s\n", home_path);
             if (config_save_file(&xcodex_config, home_path) != 0) {
                 fprintf(stderr, "Warning: Failed to create XCodex config file at %s\n", home_path);
                 result = -1;
@@ -524,22 +536,22 @@ int config_load_all_files(void) {
         /* Try current directory as last resort */
         if (access(XSHELL_CONFIG_FILE, F_OK) == 0) {
             if (config_load_file(&xshell_config, XSHELL_CONFIG_FILE) == 0) {
-                printf("Loaded XShell config from current directory: %s\n", XSHELL_CONFIG_FILE);
+                config_note("Loaded XShell config from current directory: %s\n", XSHELL_CONFIG_FILE);
             } else {
                 fprintf(stderr, "Warning: Failed to load XShell config from current directory\n");
             }
         } else {
-            printf("Using default XShell configuration (no config file found)\n");
+            config_note("Using default XShell configuration (no config file found)\n");
         }
         
         if (access(XCODEX_CONFIG_FILE, F_OK) == 0) {
             if (config_load_file(&xcodex_config, XCODEX_CONFIG_FILE) == 0) {
-                printf("Loaded XCodex config from current directory: %s\n", XCODEX_CONFIG_FILE);
+                config_note("Loaded XCodex config from current directory: %s\n", XCODEX_CONFIG_FILE);
             } else {
                 fprintf(stderr, "Warning: Failed to load XCodex config from current directory\n");
             }
         } else {
-            printf("Using default XCodex configuration (no config file found)\n");
+            config_note("Using default XCodex configuration (no config file found)\n");
         }
         result = -1;
     }
@@ -677,7 +689,7 @@ void config_list_available_keys(const char *type) {
         printf("%-20s %-10s %s\n", "Key", "Type", "Description");
         printf("%-20s %-10s %s\n", "---", "----", "-----------");
         printf("%-20s %-10s %s\n", "prompt", "string", "Shell prompt string");
-        printf("%-20s %-10s %s\n", "history_size", "int", "Maximum history entries (currently 100)");
+        printf("%-20s %-10s %s\n", "history_size", "int", "History entries kept in memory (default 10000)");
         printf("%-20s %-10s %s\n", "auto_complete", "bool", "Enable tab auto-completion for commands");
         printf("%-20s %-10s %s\n", "case_sensitive", "bool", "Case sensitive command matching");
         printf("%-20s %-10s %s\n", "color_output", "bool", "Enable colored output in prompt");
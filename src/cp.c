@@ -0,0 +1,532 @@
+#ifndef _WIN32
+#define _GNU_SOURCE // For d_type, futimens() and utimensat()
+#endif
+
+#include "cp.h"
+#include "builtins.h"
+#include "fastcopy.h"
+#include "workpool.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h> // For open, close
+#endif
+
+#define CP_USAGE "Usage: cp [-r] [-p] <source> <destination>\n       cp [-r] [-p] <source>... <directory>\n"
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#define st_atim st_atimespec
+#define st_mtim st_mtimespec
+#endif
+
+// A file queued for the workers
+typedef struct {
+    workpool_item_t item;
+    char *source;
+    char *target;
+} cp_task_t;
+
+// A directory of the copy, finished after everything inside it is written
+typedef struct {
+    char *target;
+    struct stat st; // Of the source directory
+    int created;    // 0 if it existed before, in which case only -p changes it
+} cp_dir_t;
+
+typedef struct {
+    int recursive;  // -r
+    int preserve;   // -p: mode, ownership and times
+    mode_t umask;
+    FILE *err;
+
+    workpool_t pool; // No workers means files are copied by the calling thread
+
+    cp_dir_t *dirs; // In creation order, so parents come before children
+    size_t dir_count;
+    size_t dir_capacity;
+
+    atomic_llong files;
+    atomic_llong bytes;
+    atomic_int failed;
+
+    // Progress line on a terminal
+    pthread_t reporter;
+    int reporting;
+    pthread_mutex_t report_lock;
+    pthread_cond_t report_stop;
+    int report_done;
+} cp_t;
+
+static void cp_error(cp_t *cp, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    // Start on a clean line if the progress line is showing
+    fprintf(cp->err, "%sxsh: cp: ", cp->reporting ? "\r\033[K" : "");
+    vfprintf(cp->err, format, ap);
+    fputc('\n', cp->err);
+    va_end(ap);
+    atomic_store(&cp->failed, 1);
+}
+
+// target/<last component of source>, for copies into a directory
+static char *cp_target_in(const char *target, const char *source) {
+    char *name = strdup(source);
+    if (!name) return NULL;
+    size_t length = strlen(name);
+    while (length > 1 && name[length - 1] == '/') name[--length] = '\0';
+    char *base = strrchr(name, '/');
+    char *path = workpool_path_join(target, base && base[1] ? base + 1 : name);
+    free(name);
+    return path;
+}
+
+// Whether target is source or lies inside it, which would copy the tree into
+// itself forever
+static int cp_inside(const char *source, const char *target) {
+    char source_real[PATH_MAX], target_real[PATH_MAX];
+    if (!realpath(source, source_real)) return 0;
+    if (!realpath(target, target_real)) {
+        // A target that does not exist yet is as deep as its parent
+        char *parent = strdup(target);
+        if (!parent) return 0;
+        char *slash = strrchr(parent, '/');
+        const char *dir = ".";
+        if (slash == parent) {
+            dir = "/";
+        } else if (slash) {
+            *slash = '\0';
+            dir = parent;
+        }
+        char *resolved = realpath(dir, target_real);
+        free(parent);
+        if (!resolved) return 0;
+    }
+    size_t length = strlen(source_real);
+    if (length == 1) return 1; // Everything is inside /
+    return strncmp(target_real, source_real, length) == 0 &&
+           (target_real[length] == '/' || target_real[length] == '\0');
+}
+
+static void cp_preserve_fd(cp_t *cp, int fd, const char *target, const struct stat *st) {
+    struct timespec times[2] = {st->st_atim, st->st_mtim};
+    // Ownership first, as changing it clears the set-user-ID bit; only root
+    // can give a file away, so failing to is not an error
+    if (fchown(fd, st->st_uid, st->st_gid) == -1 && errno != EPERM) {
+        cp_error(cp, "cannot preserve ownership of '%s': %s", target, strerror(errno));
+    }
+    if (fchmod(fd, st->st_mode & 07777) == -1) {
+        cp_error(cp, "cannot preserve mode of '%s': %s", target, strerror(errno));
+    }
+    if (futimens(fd, times) == -1) {
+        cp_error(cp, "cannot preserve times of '%s': %s", target, strerror(errno));
+    }
+}
+
+static void cp_copy_file(cp_t *cp, const char *source, const char *target) {
+    int in_fd = open(source, O_RDONLY | O_CLOEXEC);
+    if (in_fd == -1) {
+        cp_error(cp, "cannot open '%s': %s", source, strerror(errno));
+        return;
+    }
+    struct stat st;
+    if (fstat(in_fd, &st) == -1) {
+        cp_error(cp, "cannot stat '%s': %s", source, strerror(errno));
+        close(in_fd);
+        return;
+    }
+    int out_fd = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+    if (out_fd == -1) {
+        cp_error(cp, "cannot create '%s': %s", target, strerror(errno));
+        close(in_fd);
+        return;
+    }
+
+    long long copied;
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        copied = fastcopy_file(in_fd, out_fd, st.st_size, &cp->bytes);
+    } else {
+        // A device or pipe named on the command line, or a file in /proc
+        // claiming to be empty: copy what reading it gives
+        copied = fastcopy_fd(in_fd, out_fd);
+        if (copied > 0) atomic_fetch_add(&cp->bytes, copied);
+    }
+    if (copied == -1) {
+        cp_error(cp, "error copying '%s' to '%s': %s", source, target, strerror(errno));
+    } else if (cp->preserve) {
+        cp_preserve_fd(cp, out_fd, target, &st);
+    }
+    if (close(out_fd) == -1 && copied != -1) {
+        cp_error(cp, "error writing '%s': %s", target, strerror(errno));
+    }
+    close(in_fd);
+    atomic_fetch_add(&cp->files, 1);
+}
+
+static void cp_copy_link(cp_t *cp, const char *source, const char *target) {
+    char link[PATH_MAX];
+    ssize_t length = readlink(source, link, sizeof(link) - 1);
+    if (length == -1) {
+        cp_error(cp, "cannot read symbolic link '%s': %s", source, strerror(errno));
+        return;
+    }
+    link[length] = '\0';
+    if (symlink(link, target) == -1 &&
+        (errno != EEXIST || unlink(target) == -1 || symlink(link, target) == -1)) {
+        cp_error(cp, "cannot create symbolic link '%s': %s", target, strerror(errno));
+        return;
+    }
+    struct stat st;
+    if (cp->preserve && lstat(source, &st) == 0) {
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        if (lchown(target, st.st_uid, st.st_gid) == -1 && errno != EPERM) {
+            cp_error(cp, "cannot preserve ownership of '%s': %s", target, strerror(errno));
+        }
+        utimensat(AT_FDCWD, target, times, AT_SYMLINK_NOFOLLOW);
+    }
+    atomic_fetch_add(&cp->files, 1);
+}
+
+static void cp_run(void *context, void *local, workpool_item_t *item) {
+    (void)local;
+    cp_task_t *task = (cp_task_t *)item;
+    cp_copy_file(context, task->source, task->target);
+    free(task->source);
+    free(task->target);
+    free(task);
+}
+
+// Copy a file, on a worker if there are any. Takes ownership of the paths.
+static void cp_submit(cp_t *cp, char *source, char *target) {
+    cp_task_t *task = cp->pool.worker_count > 0 ? malloc(sizeof(cp_task_t)) : NULL;
+    if (!task) {
+        cp_copy_file(cp, source, target);
+        free(source);
+        free(target);
+        return;
+    }
+    task->source = source;
+    task->target = target;
+    workpool_submit(&cp->pool, &task->item);
+}
+
+static void cp_copy_dir(cp_t *cp, const char *source, const char *target, const struct stat *st) {
+    // Created private and writable; cp_finish_dirs() gives it its mode
+    int created = 1;
+    if (mkdir(target, 0700) == -1) {
+        int mkdir_errno = errno;
+        struct stat existing;
+        if (mkdir_errno != EEXIST || stat(target, &existing) == -1 || !S_ISDIR(existing.st_mode)) {
+            cp_error(cp, "cannot create directory '%s': %s", target, strerror(mkdir_errno));
+            return;
+        }
+        created = 0;
+    }
+    if (created || cp->preserve) {
+        if (cp->dir_count == cp->dir_capacity) {
+            size_t capacity = cp->dir_capacity ? cp->dir_capacity * 2 : 64;
+            cp_dir_t *dirs = realloc(cp->dirs, capacity * sizeof(cp_dir_t));
+            if (dirs) {
+                cp->dirs = dirs;
+                cp->dir_capacity = capacity;
+            }
+        }
+        char *path = cp->dir_count < cp->dir_capacity ? strdup(target) : NULL;
+        if (path) {
+            cp->dirs[cp->dir_count++] = (cp_dir_t){path, *st, created};
+        }
+    }
+
+    DIR *dir = opendir(source);
+    if (!dir) {
+        cp_error(cp, "cannot open directory '%s': %s", source, strerror(errno));
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+        char *child_source = workpool_path_join(source, name);
+        char *child_target = workpool_path_join(target, name);
+        if (!child_source || !child_target) {
+            cp_error(cp, "allocation error");
+            free(child_source);
+            free(child_target);
+            break;
+        }
+
+        // The entry's type spares a stat for everything but directories,
+        // whose mode and times are needed
+        unsigned char type = entry->d_type;
+        struct stat child_st;
+        if (type == DT_UNKNOWN || type == DT_DIR) {
+            if (lstat(child_source, &child_st) == -1) {
+                cp_error(cp, "cannot stat '%s': %s", child_source, strerror(errno));
+                free(child_source);
+                free(child_target);
+                continue;
+            }
+            type = S_ISDIR(child_st.st_mode) ? DT_DIR : S_ISREG(child_st.st_mode) ? DT_REG :
+                   S_ISLNK(child_st.st_mode) ? DT_LNK : DT_UNKNOWN;
+        }
+
+        if (type == DT_REG) {
+            cp_submit(cp, child_source, child_target);
+            continue;
+        }
+        if (type == DT_DIR) {
+            cp_copy_dir(cp, child_source, child_target, &child_st);
+        } else if (type == DT_LNK) {
+            cp_copy_link(cp, child_source, child_target);
+        } else {
+            cp_error(cp, "skipping special file '%s'", child_source);
+        }
+        free(child_source);
+        free(child_target);
+    }
+    closedir(dir);
+}
+
+// Give the directories their modes and times, deepest first, once the
+// workers have stopped writing into them
+static void cp_finish_dirs(cp_t *cp) {
+    for (size_t i = cp->dir_count; i-- > 0;) {
+        cp_dir_t *dir = &cp->dirs[i];
+        if (cp->preserve) {
+            struct timespec times[2] = {dir->st.st_atim, dir->st.st_mtim};
+            if (chown(dir->target, dir->st.st_uid, dir->st.st_gid) == -1 && errno != EPERM) {
+                cp_error(cp, "cannot preserve ownership of '%s': %s", dir->target, strerror(errno));
+            }
+            if (chmod(dir->target, dir->st.st_mode & 07777) == -1 ||
+                utimensat(AT_FDCWD, dir->target, times, 0) == -1) {
+                cp_error(cp, "cannot preserve attributes of '%s': %s", dir->target, strerror(errno));
+            }
+        } else if (dir->created && chmod(dir->target, dir->st.st_mode & 0777 & ~cp->umask) == -1) {
+            cp_error(cp, "cannot set mode of '%s': %s", dir->target, strerror(errno));
+        }
+        free(dir->target);
+    }
+    free(cp->dirs);
+}
+
+static double cp_elapsed(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Rewrite one progress line until the copy is done
+static void *cp_report(void *arg) {
+    cp_t *cp = arg;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long wait_ms = CP_PROGRESS_DELAY_MS;
+    int shown = 0;
+
+    pthread_mutex_lock(&cp->report_lock);
+    while (!cp->report_done) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += wait_ms / 1000;
+        deadline.tv_nsec += (wait_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&cp->report_stop, &cp->report_lock, &deadline);
+        if (cp->report_done) break;
+
+        double mb = atomic_load(&cp->bytes) / (1024.0 * 1024.0);
+        double seconds = cp_elapsed(&start);
+        fprintf(cp->err, "\rxsh: cp: %lld files, %.1f MB, %.1f MB/s\033[K", atomic_load(&cp->files), mb,
+                seconds > 0 ? mb / seconds : 0.0);
+        fflush(cp->err);
+        shown = 1;
+        wait_ms = CP_PROGRESS_INTERVAL_MS;
+    }
+    pthread_mutex_unlock(&cp->report_lock);
+    if (shown) {
+        fprintf(cp->err, "\r\033[K");
+        fflush(cp->err);
+    }
+    return NULL;
+}
+
+int xsh_cp(char **args) {
+    FILE *out = xsh_builtin_stdout();
+    cp_t cp;
+    memset(&cp, 0, sizeof(cp));
+    cp.err = xsh_builtin_stderr();
+
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *flag = args[i] + 1; *flag; flag++) {
+            if (*flag == 'r' || *flag == 'R') {
+                cp.recursive = 1;
+            } else if (*flag == 'p') {
+                cp.preserve = 1;
+            } else {
+                fprintf(cp.err, "xsh: cp: invalid option -- '%c'\n" CP_USAGE, *flag);
+                xsh_builtin_set_status(2);
+                return 1;
+            }
+        }
+    }
+    int count = 0;
+    while (args[i + count]) count++;
+    if (count < 2) {
+        fprintf(cp.err, "xsh: cp: missing source or destination file\n" CP_USAGE);
+        xsh_builtin_set_status(2);
+        return 1;
+    }
+    char **sources = &args[i];
+    int source_count = count - 1;
+    const char *target = args[i + source_count];
+    struct stat target_st;
+    int into_dir = stat(target, &target_st) == 0 && S_ISDIR(target_st.st_mode);
+    if (source_count > 1 && !into_dir) {
+        fprintf(cp.err, "xsh: cp: target '%s' is not a directory\n", target);
+        xsh_builtin_set_status(1);
+        return 1;
+    }
+
+    cp.umask = umask(0);
+    umask(cp.umask);
+    workpool_init(&cp.pool, cp_run, &cp);
+    pthread_mutex_init(&cp.report_lock, NULL);
+    pthread_cond_init(&cp.report_stop, NULL);
+
+    // Workers only pay off for a tree; single files are copied right here
+    struct stat st;
+    for (int s = 0; cp.recursive && s < source_count && cp.pool.worker_count == 0; s++) {
+        if (lstat(sources[s], &st) == 0 && S_ISDIR(st.st_mode)) {
+            // Twice the CPUs, as a worker spends most of its time waiting on the disk
+            long workers = sysconf(_SC_NPROCESSORS_ONLN) * 2;
+            workpool_start(&cp.pool, workers < CP_WORKERS_MIN ? CP_WORKERS_MIN : workers);
+        }
+    }
+    if (xsh_interactive && isatty(fileno(cp.err))) {
+        cp.reporting = pthread_create(&cp.reporter, NULL, cp_report, &cp) == 0;
+    }
+
+    for (int s = 0; s < source_count; s++) {
+        const char *source = sources[s];
+        // Without -r, symbolic links are followed like any other file
+        if ((cp.recursive ? lstat(source, &st) : stat(source, &st)) == -1) {
+            cp_error(&cp, "cannot stat '%s': %s", source, strerror(errno));
+            continue;
+        }
+        char *dest = into_dir ? cp_target_in(target, source) : strdup(target);
+        if (!dest) {
+            cp_error(&cp, "allocation error");
+            break;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (!cp.recursive) {
+                cp_error(&cp, "-r not specified; omitting directory '%s'", source);
+            } else if (cp_inside(source, dest)) {
+                cp_error(&cp, "cannot copy a directory, '%s', into itself, '%s'", source, dest);
+            } else {
+                cp_copy_dir(&cp, source, dest, &st);
+            }
+            free(dest);
+        } else if (S_ISLNK(st.st_mode)) {
+            cp_copy_link(&cp, source, dest);
+            free(dest);
+        } else {
+            struct stat dest_st;
+            char *source_copy = strdup(source);
+            if (stat(dest, &dest_st) == 0 && dest_st.st_dev == st.st_dev && dest_st.st_ino == st.st_ino) {
+                cp_error(&cp, "'%s' and '%s' are the same file", source, dest);
+                free(source_copy);
+                free(dest);
+            } else if (!source_copy) {
+                cp_error(&cp, "allocation error");
+                free(dest);
+            } else {
+                cp_submit(&cp, source_copy, dest);
+            }
+        }
+    }
+
+    workpool_stop(&cp.pool);
+    cp_finish_dirs(&cp);
+    if (cp.reporting) {
+        pthread_mutex_lock(&cp.report_lock);
+        cp.report_done = 1;
+        pthread_cond_signal(&cp.report_stop);
+        pthread_mutex_unlock(&cp.report_lock);
+        pthread_join(cp.reporter, NULL);
+        cp.reporting = 0;
+    }
+    pthread_mutex_destroy(&cp.report_lock);
+    pthread_cond_destroy(&cp.report_stop);
+
+    int failed = atomic_load(&cp.failed);
+    if (!failed) {
+        if (source_count == 1 && !S_ISDIR(st.st_mode)) {
+            fprintf(out, "Copied '%s' to '%s'\n", sources[0], target);
+        } else {
+            fprintf(out, "Copied %lld files (%.1f MB) to '%s'\n", atomic_load(&cp.files),
+                    atomic_load(&cp.bytes) / (1024.0 * 1024.0), target);
+        }
+    }
+    xsh_builtin_set_status(failed ? 1 : 0);
+    return 1;
+}
+
+#else // _WIN32
+
+// One file at a time through a buffer; no -r or -p
+int xsh_cp(char **args) {
+    FILE *err = xsh_builtin_stderr();
+    if (args[1] == NULL || args[2] == NULL || args[3] != NULL || args[1][0] == '-') {
+        fprintf(err, "xsh: cp: only 'cp <source_file> <destination_file>' is supported on Windows\n");
+        xsh_builtin_set_status(2);
+        return 1;
+    }
+    int in_fd = open(args[1], O_RDONLY | O_BINARY);
+    if (in_fd == -1) {
+        fprintf(err, "xsh: cp: cannot open '%s': %s\n", args[1], strerror(errno));
+        xsh_builtin_set_status(1);
+        return 1;
+    }
+    int out_fd = open(args[2], O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (out_fd == -1) {
+        fprintf(err, "xsh: cp: cannot create '%s': %s\n", args[2], strerror(errno));
+        close(in_fd);
+        xsh_builtin_set_status(1);
+        return 1;
+    }
+    long long copied = fastcopy_file(in_fd, out_fd, 0, NULL);
+    int copy_errno = errno;
+    close(in_fd);
+    if (close(out_fd) == -1 || copied == -1) {
+        fprintf(err, "xsh: cp: error copying '%s' to '%s': %s\n", args[1], args[2], strerror(copy_errno));
+        xsh_builtin_set_status(1);
+        return 1;
+    }
+    printf("Copied '%s' to '%s'\n", args[1], args[2]);
+    xsh_builtin_set_status(0);
+    return 1;
+}
+
+#endif
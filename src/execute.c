@@ -1,5 +1,12 @@
+#ifndef _WIN32
+#define _GNU_SOURCE // For wait4() and pipe2()
+#endif
+
 #include "execute.h"
 #include "builtins.h"
+#include "launch.h"
+#include "jobs.h"
+#include "parser.h"
 #include "xsh.h"
 #include <stdlib.h>
 #include <string.h>
@@ -24,8 +31,11 @@
 #endif
 #else
 #include <sys/wait.h>
+#include <sys/resource.h> // For struct rusage
+#include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #endif
 
 // Global variables to save original file descriptors
@@ -36,6 +46,36 @@ static int original_stderr = -1;
 // Global variable to track last command exit status
 int last_command_exit_status = 0;
 
+int shell_exit_requested = 0;
+
+// Resource usage of the children reaped for the current command line
+command_usage_t last_command_usage;
+
+pipeline_stat_t last_pipeline_stat;
+int last_pipeline_stat_current = 0;
+
+void reset_command_usage(void) {
+    memset(&last_command_usage, 0, sizeof(last_command_usage));
+    last_pipeline_stat_current = 0;
+}
+
+#ifdef _WIN32
+// Add a finished process's CPU times to last_command_usage. Windows has no
+// cheap equivalent of ru_maxrss or context switch counts, so those stay zero.
+static void add_process_usage_windows(HANDLE process) {
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (!GetProcessTimes(process, &creation_time, &exit_time, &kernel_time, &user_time)) return;
+    
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernel_time.dwLowDateTime;
+    kernel.HighPart = kernel_time.dwHighDateTime;
+    user.LowPart = user_time.dwLowDateTime;
+    user.HighPart = user_time.dwHighDateTime;
+    last_command_usage.user_time_us += (long)(user.QuadPart / 10); // 100ns units
+    last_command_usage.sys_time_us += (long)(kernel.QuadPart / 10);
+}
+#endif
+
 // Create a new command structure
 command_t *create_command(void) {
     command_t *cmd = malloc(sizeof(command_t));
@@ -97,263 +137,11 @@ void free_pipeline(pipeline_t *pipeline) {
 
 // Check if a string contains shell operators
 int contains_operators(const char *str) {
-    return (strstr(str, "|") || strstr(str, "&&") || strstr(str, "||") || 
+    return (strstr(str, "|") || strstr(str, "&") || strstr(str, "||") || 
             strstr(str, ">") || strstr(str, "<") || strstr(str, ">>") || 
             strstr(str, "2>") || strstr(str, ";"));
 }
 
-// Parse redirection operators and update command
-int parse_redirection(command_t *cmd, char *token, char *next_token) {
-    if (strcmp(token, "<") == 0) {
-        if (!next_token) {
-            fprintf(stderr, "xsh: syntax error: expected filename after '<'\n");
-            return -1;
-        }
-        cmd->input_redir.type = REDIR_IN;
-        cmd->input_redir.filename = strdup(next_token);
-        return 1; // Consumed next token
-    } else if (strcmp(token, ">") == 0) {
-        if (!next_token) {
-            fprintf(stderr, "xsh: syntax error: expected filename after '>'\n");
-            return -1;
-        }
-        cmd->output_redir.type = REDIR_OUT;
-        cmd->output_redir.filename = strdup(next_token);
-        return 1;
-    } else if (strcmp(token, ">>") == 0) {
-        if (!next_token) {
-            fprintf(stderr, "xsh: syntax error: expected filename after '>>'\n");
-            return -1;
-        }
-        cmd->output_redir.type = REDIR_APPEND;
-        cmd->output_redir.filename = strdup(next_token);
-        return 1;
-    } else if (strcmp(token, "2>") == 0) {
-        if (!next_token) {
-            fprintf(stderr, "xsh: syntax error: expected filename after '2>'\n");
-            return -1;
-        }
-        cmd->error_redir.type = REDIR_ERR;
-        cmd->error_redir.filename = strdup(next_token);
-        return 1;
-    }
-    return 0; // Not a redirection operator
-}
-
-// Enhanced tokenization function that handles operators
-char **tokenize_with_operators(char *line, int *token_count) {
-    int bufsize = 64;
-    int position = 0;
-    char **tokens = malloc(bufsize * sizeof(char*));
-    
-    if (!tokens) {
-        fprintf(stderr, "xsh: allocation error\n");
-        return NULL;
-    }
-    
-    char *line_copy = strdup(line);
-    char *ptr = line_copy;
-    
-    while (*ptr) {
-        // Skip whitespace
-        while (*ptr && (*ptr == ' ' || *ptr == '\t' || *ptr == '\n' || *ptr == '\r')) {
-            ptr++;
-        }
-        
-        if (!*ptr) break;
-        
-        char *start = ptr;
-        
-        // Handle quoted strings
-        if (*ptr == '"' || *ptr == '\'') {
-            char quote = *ptr++;
-            start = ptr;
-            while (*ptr && *ptr != quote) ptr++;
-            if (*ptr == quote) {
-                *ptr = '\0';
-                tokens[position] = strdup(start);
-                ptr++;
-            } else {
-                fprintf(stderr, "xsh: unterminated quote\n");
-                free(tokens);
-                free(line_copy);
-                return NULL;
-            }
-        }
-        // Handle multi-character operators
-        else if (strncmp(ptr, "&&", 2) == 0) {
-            tokens[position] = strdup("&&");
-            ptr += 2;
-        }
-        else if (strncmp(ptr, "||", 2) == 0) {
-            tokens[position] = strdup("||");
-            ptr += 2;
-        }
-        else if (strncmp(ptr, ">>", 2) == 0) {
-            tokens[position] = strdup(">>");
-            ptr += 2;
-        }
-        else if (strncmp(ptr, "2>", 2) == 0) {
-            tokens[position] = strdup("2>");
-            ptr += 2;
-        }
-        // Handle single-character operators
-        else if (*ptr == '|' || *ptr == '<' || *ptr == '>' || *ptr == ';') {
-            char op[2] = {*ptr, '\0'};
-            tokens[position] = strdup(op);
-            ptr++;
-        }
-        // Handle regular words
-        else {
-            start = ptr;
-            while (*ptr && !isspace(*ptr) && *ptr != '|' && *ptr != '<' && 
-                   *ptr != '>' && *ptr != ';' && strncmp(ptr, "&&", 2) != 0 && 
-                   strncmp(ptr, "||", 2) != 0 && strncmp(ptr, ">>", 2) != 0 && 
-                   strncmp(ptr, "2>", 2) != 0) {
-                ptr++;
-            }
-            
-            if (ptr > start) {
-                int len = ptr - start;
-                char *word = malloc(len + 1);
-                strncpy(word, start, len);
-                word[len] = '\0';
-                tokens[position] = word;
-            } else {
-                continue;
-            }
-        }
-        
-        position++;
-        
-        // Resize if needed
-        if (position >= bufsize) {
-            bufsize *= 2;
-            tokens = realloc(tokens, bufsize * sizeof(char*));
-            if (!tokens) {
-                fprintf(stderr, "xsh: allocation error\n");
-                free(line_copy);
-                return NULL;
-            }
-        }
-    }
-    
-    tokens[position] = NULL;
-    *token_count = position;
-    free(line_copy);
-    return tokens;
-}
-
-// Parse command line into pipeline structure
-pipeline_t *parse_command_line(char **tokens, int token_count) {
-    if (!tokens || token_count == 0) return NULL;
-    
-    pipeline_t *pipeline = malloc(sizeof(pipeline_t));
-    if (!pipeline) {
-        fprintf(stderr, "xsh: allocation error for pipeline\n");
-        return NULL;
-    }
-    
-    pipeline->commands = NULL;
-    command_t *current_cmd = NULL;
-    command_t *last_cmd = NULL;
-    
-    int i = 0;
-    while (i < token_count) {
-        // Create new command
-        current_cmd = create_command();
-        if (!current_cmd) {
-            free_pipeline(pipeline);
-            return NULL;
-        }
-        
-        // Link to pipeline
-        if (!pipeline->commands) {
-            pipeline->commands = current_cmd;
-        } else {
-            last_cmd->next = current_cmd;
-        }
-        
-        // Parse arguments for current command
-        int arg_count = 0;
-        int arg_capacity = 16;
-        current_cmd->args = malloc(arg_capacity * sizeof(char*));
-        
-        if (!current_cmd->args) {
-            fprintf(stderr, "xsh: allocation error for args\n");
-            free_pipeline(pipeline);
-            return NULL;
-        }
-        
-        // Parse tokens for this command until we hit an operator
-        while (i < token_count) {
-            char *token = tokens[i];
-            char *next_token = (i + 1 < token_count) ? tokens[i + 1] : NULL;
-            
-            // Check for operators
-            if (strcmp(token, "|") == 0) {
-                current_cmd->operator = CMD_PIPE;
-                i++;
-                break;
-            } else if (strcmp(token, "&&") == 0) {
-                current_cmd->operator = CMD_AND;
-                i++;
-                break;
-            } else if (strcmp(token, "||") == 0) {
-                current_cmd->operator = CMD_OR;
-                i++;
-                break;
-            } else if (strcmp(token, ";") == 0) {
-                current_cmd->operator = CMD_SEMICOLON;
-                i++;
-                break;
-            }
-            // Check for redirections
-            else {
-                int redir_result = parse_redirection(current_cmd, token, next_token);
-                if (redir_result == -1) {
-                    free_pipeline(pipeline);
-                    return NULL;
-                } else if (redir_result == 1) {
-                    // Consumed redirection operator and filename
-                    i += 2;
-                    continue;
-                }
-                
-                // Regular argument
-                if (arg_count >= arg_capacity - 1) {
-                    arg_capacity *= 2;
-                    current_cmd->args = realloc(current_cmd->args, arg_capacity * sizeof(char*));
-                    if (!current_cmd->args) {
-                        fprintf(stderr, "xsh: allocation error for args realloc\n");
-                        free_pipeline(pipeline);
-                        return NULL;
-                    }
-                }
-                
-                current_cmd->args[arg_count] = strdup(token);
-                arg_count++;
-                i++;
-            }
-        }
-        
-        // Null-terminate args array
-        current_cmd->args[arg_count] = NULL;
-        
-        // If no operator was found, this is the last command
-        if (i >= token_count) {
-            current_cmd->operator = CMD_SIMPLE;
-        }
-        
-        last_cmd = current_cmd;
-        
-        // Break if we've processed all tokens
-        if (i >= token_count) break;
-    }
-    
-    return pipeline;
-}
-
 // Setup file redirections for a command
 int setup_redirections(command_t *cmd) {
     // Save original file descriptors
@@ -501,12 +289,11 @@ char *find_executable_windows(const char *program) {
 int execute_piped_commands_windows(command_t *commands) {
     if (!commands) return -1;
     
-    // Count commands in pipeline
-    int cmd_count = 0;
+    // Count commands in pipeline; it ends at the first non-pipe operator
+    int cmd_count = 1;
     command_t *cmd = commands;
-    while (cmd) {
+    for (; cmd->operator == CMD_PIPE && cmd->next; cmd = cmd->next) {
         cmd_count++;
-        cmd = cmd->next;
     }
     
     if (cmd_count == 1) {
@@ -611,6 +398,9 @@ int execute_piped_commands_windows(command_t *commands) {
     }
     
     WaitForMultipleObjects(cmd_count, process_handles, TRUE, INFINITE);
+    for (int i = 0; i < cmd_count; i++) {
+        add_process_usage_windows(processes[i].hProcess);
+    }
     
     // Get exit code from last process
     DWORD exit_code = 0;
@@ -705,6 +495,7 @@ int execute_single_command_windows(command_t *cmd) {
     
     // Wait for process to complete
     WaitForSingleObject(pi.hProcess, INFINITE);
+    add_process_usage_windows(pi.hProcess);
     
     // Get exit code
     DWORD exit_code = 0;
@@ -727,187 +518,470 @@ int execute_single_command_windows(command_t *cmd) {
 #ifndef _WIN32
 // POSIX-specific execution functions
 
-// Execute a single command with POSIX
-int execute_single_command_posix(command_t *cmd) {
-    if (!cmd || !cmd->args || !cmd->args[0]) return -1;
+// Open the redirection targets of cmd, close-on-exec, so a launched child can
+// take them over as its standard streams. Only streams selected by the
+// input/output flags are opened; error redirection always applies. fds[i] is
+// set for each opened stream and left alone otherwise. On failure the error
+// is reported and everything opened here is closed again.
+static int open_redirections_posix(command_t *cmd, int fds[3], int input, int output) {
+    int opened[3] = {-1, -1, -1};
+    const char *failed = NULL;
+    
+    if (input && cmd->input_redir.type == REDIR_IN) {
+        opened[0] = open(cmd->input_redir.filename, O_RDONLY | O_CLOEXEC);
+        if (opened[0] == -1) failed = "xsh: input redirection";
+    }
     
-    pid_t pid = fork();
-    if (pid == 0) {
-        // Child process
-        if (setup_redirections(cmd) == -1) {
-            exit(1);
+    if (!failed && output && cmd->output_redir.type == REDIR_OUT) {
+        opened[1] = open(cmd->output_redir.filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (opened[1] == -1) failed = "xsh: output redirection";
+    } else if (!failed && output && cmd->output_redir.type == REDIR_APPEND) {
+        opened[1] = open(cmd->output_redir.filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (opened[1] == -1) failed = "xsh: append redirection";
+    }
+    
+    if (!failed && cmd->error_redir.type == REDIR_ERR) {
+        opened[2] = open(cmd->error_redir.filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (opened[2] == -1) failed = "xsh: error redirection";
+    }
+    
+    if (failed) {
+        perror(failed);
+        for (int i = 0; i < 3; i++) {
+            if (opened[i] != -1) close(opened[i]);
         }
-        
-        if (execvp(cmd->args[0], cmd->args) == -1) {
-            perror("xsh");
-            exit(1);
+        return -1;
+    }
+    
+    for (int i = 0; i < 3; i++) {
+        if (opened[i] != -1) fds[i] = opened[i];
+    }
+    return 0;
+}
+
+// Close the descriptors open_redirections_posix() put in fds, keeping the
+// ones that were there before (pipe ends, -1 for inherited streams)
+static void close_redirections_posix(const int fds[3], const int before[3]) {
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] != before[i]) close(fds[i]);
+    }
+}
+
+// Command line text of the commands from start to end, for job listings and
+// the history records of jobs
+static char *command_text(command_t *start, command_t *end) {
+    size_t size = 1;
+    for (command_t *cmd = start; cmd; cmd = cmd->next) {
+        for (int i = 0; cmd->args && cmd->args[i]; i++) {
+            size += strlen(cmd->args[i]) + 1;
         }
-    } else if (pid > 0) {
-        // Parent process
-        int status;
-        waitpid(pid, &status, 0);
-        restore_redirections();
+        if (cmd->input_redir.filename) size += strlen(cmd->input_redir.filename) + 4;
+        if (cmd->output_redir.filename) size += strlen(cmd->output_redir.filename) + 5;
+        if (cmd->error_redir.filename) size += strlen(cmd->error_redir.filename) + 5;
+        size += 4; // Operator
+        if (cmd == end) break;
+    }
+    
+    char *text = malloc(size);
+    if (!text) return NULL;
+    text[0] = '\0';
+    for (command_t *cmd = start; cmd; cmd = cmd->next) {
+        for (int i = 0; cmd->args && cmd->args[i]; i++) {
+            if (text[0]) strcat(text, " ");
+            strcat(text, cmd->args[i]);
+        }
+        if (cmd->input_redir.type == REDIR_IN) {
+            strcat(text, " < ");
+            strcat(text, cmd->input_redir.filename);
+        }
+        if (cmd->output_redir.type == REDIR_OUT || cmd->output_redir.type == REDIR_APPEND) {
+            strcat(text, cmd->output_redir.type == REDIR_OUT ? " > " : " >> ");
+            strcat(text, cmd->output_redir.filename);
+        }
+        if (cmd->error_redir.type == REDIR_ERR) {
+            strcat(text, " 2> ");
+            strcat(text, cmd->error_redir.filename);
+        }
+        if (cmd == end) break;
         
-        if (WIFEXITED(status)) {
-            last_command_exit_status = WEXITSTATUS(status);
-            return WEXITSTATUS(status);
-        } else {
-            last_command_exit_status = 1;
-            return 1;
+        switch (cmd->operator) {
+            case CMD_PIPE: strcat(text, " |"); break;
+            case CMD_AND: strcat(text, " &&"); break;
+            case CMD_OR: strcat(text, " ||"); break;
+            case CMD_SEMICOLON: strcat(text, ";"); break;
+            case CMD_BACKGROUND: strcat(text, " &"); break;
+            default: break;
+        }
+    }
+    return text;
+}
+
+// Start one external command as a foreground job, for job_run() to wait for
+static job_t *start_process_job(char *const args[], const int fds[3], const char *text) {
+    job_t *job = job_create(text, 1, 0);
+    if (!job) return NULL;
+    
+    pid_t pid = launch_process(args, fds, job_process_group(job));
+    if (pid == -1) {
+        perror("xsh");
+    }
+    job_set_process(job, 0, pid, args[0]);
+    return job;
+}
+
+// Execute a single command with POSIX
+int execute_single_command_posix(command_t *cmd) {
+    if (!cmd || !cmd->args || !cmd->args[0]) return -1;
+    
+    int fds[3] = {-1, -1, -1};
+    const int inherited[3] = {-1, -1, -1};
+    if (open_redirections_posix(cmd, fds, 1, 1) == -1) {
+        last_command_exit_status = 1;
+        return 1;
+    }
+    
+    char *text = command_text(cmd, cmd);
+    job_t *job = start_process_job(cmd->args, fds, text ? text : cmd->args[0]);
+    free(text);
+    close_redirections_posix(fds, inherited);
+    
+    last_command_exit_status = job ? job_run(job) : 1;
+    return last_command_exit_status;
+}
+
+static char **copy_args(char **args) {
+    int count = 0;
+    while (args[count]) count++;
+    
+    char **copy = malloc((count + 1) * sizeof(char*));
+    if (!copy) return NULL;
+    for (int i = 0; i < count; i++) {
+        copy[i] = strdup(args[i]);
+        if (!copy[i]) {
+            while (i > 0) free(copy[--i]);
+            free(copy);
+            return NULL;
         }
+    }
+    copy[count] = NULL;
+    return copy;
+}
+
+static void free_args(char **args) {
+    if (!args) return;
+    for (int i = 0; args[i]; i++) {
+        free(args[i]);
+    }
+    free(args);
+}
+
+// A threadable builtin running as a pipeline stage on a worker thread. The
+// stage owns a copy of its arguments: when the job is stopped, the thread can
+// outlive the command line it came from.
+typedef struct {
+    command_t *cmd; // Only used while the pipeline is started
+    char **args;
+    int fds[3];     // Descriptors the stage owns, or -1 for the shell's own stream
+    int status;
+    int started;
+    pthread_t thread;
+    job_t *job;
+    int index;      // Stage number within the job
+} builtin_stage_t;
+
+typedef struct {
+    int count;
+    builtin_stage_t stage[];
+} builtin_stages_t;
+
+// Job finish callback: the stage threads have reported back, so join them
+static void finish_builtin_stages(void *data) {
+    builtin_stages_t *stages = data;
+    for (int i = 0; i < stages->count; i++) {
+        if (stages->stage[i].started) pthread_join(stages->stage[i].thread, NULL);
+        free_args(stages->stage[i].args);
+    }
+    free(stages);
+}
+
+// Wrap a stage descriptor in a stream, or fall back to the shell's stream
+static FILE *builtin_stage_stream(int fd, const char *mode, FILE *shell_stream) {
+    if (fd == -1) return shell_stream;
+    FILE *stream = fdopen(fd, mode);
+    if (!stream) close(fd);
+    return stream;
+}
+
+static void *run_builtin_stage(void *arg) {
+    builtin_stage_t *stage = arg;
+    FILE *in = builtin_stage_stream(stage->fds[0], "r", stdin);
+    FILE *out = builtin_stage_stream(stage->fds[1], "w", stdout);
+    FILE *err = builtin_stage_stream(stage->fds[2], "w", stderr);
+    
+    if (in && out && err) {
+        xsh_builtin_set_streams(in, out, err);
+        xsh_builtin_set_written(-1);
+        xsh_execute_builtin(stage->args);
+        stage->status = xsh_builtin_status();
+        xsh_builtin_set_streams(NULL, NULL, NULL);
     } else {
-        perror("xsh: fork");
-        return -1;
+        perror("xsh: pipeline stream");
+        stage->status = 1;
     }
     
-    return 0;
+    // Closing the stage's pipe ends is what lets its neighbours see EOF
+    if (in && in != stdin) fclose(in);
+    if (out && out != stdout) fclose(out);
+    else if (out) fflush(stdout);
+    if (err && err != stderr) fclose(err);
+    
+    // SIGPIPE is blocked on this thread, so writing to a closed pipe only
+    // failed with EPIPE; discard the pending signal before the thread ends
+    sigset_t pending;
+    if (sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE)) {
+        sigset_t pipe_set;
+        int sig;
+        sigemptyset(&pipe_set);
+        sigaddset(&pipe_set, SIGPIPE);
+        sigwait(&pipe_set, &sig);
+    }
+    
+    job_thread_done(stage->job, stage->index, stage->status, xsh_builtin_written());
+    return NULL;
 }
 
-// Execute piped commands with POSIX
-int execute_piped_commands_posix(command_t *commands) {
+// Execute piped commands with POSIX as one job. External commands are
+// launched with posix_spawn and threadable builtins (cat, grep, echo, ...)
+// run on worker threads of the shell that read and write the pipes directly.
+// Only other builtins still fork, since they may change the shell's state.
+// A background job forks every builtin, so none runs next to the prompt.
+int execute_piped_commands_posix(command_t *commands, int background) {
     if (!commands) return -1;
     
-    // Count commands
-    int cmd_count = 0;
+    // Count commands; the pipeline ends at the first non-pipe operator
+    int cmd_count = 1;
     command_t *cmd = commands;
-    while (cmd) {
+    for (; cmd->operator == CMD_PIPE && cmd->next; cmd = cmd->next) {
         cmd_count++;
-        cmd = cmd->next;
     }
     
-    if (cmd_count == 1) {
+    if (cmd_count == 1 && !background) {
         return execute_single_command_posix(commands);
     }
     
-    // Create pipes
-    int pipes[cmd_count - 1][2];
+    // Create pipes. They are close-on-exec from the start so each child keeps
+    // only the two ends installed as its stdin and stdout.
+    int pipes[cmd_count][2]; // The last one is unused
     for (int i = 0; i < cmd_count - 1; i++) {
-        if (pipe(pipes[i]) == -1) {
+        if (pipe2(pipes[i], O_CLOEXEC) == -1) {
             perror("xsh: pipe");
+            for (int j = 0; j < i; j++) {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
             return -1;
         }
     }
     
-    // Execute commands
-    pid_t pids[cmd_count];
-    cmd = commands;
+    builtin_stages_t *stages = calloc(1, sizeof(builtin_stages_t) + cmd_count * sizeof(builtin_stage_t));
+    char *text = command_text(commands, cmd);
+    job_t *job = stages ? job_create(text ? text : commands->args[0], cmd_count, background) : NULL;
+    free(text);
+    if (!job) {
+        free(stages);
+        for (int i = 0; i < cmd_count - 1; i++) {
+            close(pipes[i][0]);
+            close(pipes[i][1]);
+        }
+        last_command_exit_status = 1;
+        return 1;
+    }
+    stages->count = cmd_count;
+    job_set_finish(job, finish_builtin_stages, stages);
     
+    // Start the processes first. A forked builtin closes every pipe end it
+    // inherits, which must happen before worker threads take theirs over.
+    // A command that cannot be started counts as exiting with status 1, as
+    // if its child had failed to exec.
+    cmd = commands;
     for (int i = 0; i < cmd_count; i++) {
-        pids[i] = fork();
+        int fds[3] = {
+            i > 0 ? pipes[i-1][0] : -1,             // Read from previous pipe
+            i < cmd_count - 1 ? pipes[i][1] : -1,   // Write to next pipe
+            -1
+        };
+        const int piped[3] = {fds[0], fds[1], fds[2]};
         
-        if (pids[i] == 0) {
-            // Child process
-            
-            // Setup pipes
-            if (i > 0) {
-                // Not first command, read from previous pipe
-                dup2(pipes[i-1][0], STDIN_FILENO);
-            }
-            
-            if (i < cmd_count - 1) {
-                // Not last command, write to next pipe
-                dup2(pipes[i][1], STDOUT_FILENO);
-            }
-            
-            // Close all pipe file descriptors
-            for (int j = 0; j < cmd_count - 1; j++) {
-                close(pipes[j][0]);
-                close(pipes[j][1]);
-            }
-            
-            // Setup redirections for this command
-            if (i == 0 && cmd->input_redir.type != REDIR_NONE) {
-                // First command input redirection
-                if (cmd->input_redir.type == REDIR_IN) {
-                    int fd = open(cmd->input_redir.filename, O_RDONLY);
-                    if (fd == -1) {
-                        perror("xsh: input redirection");
-                        exit(1);
-                    }
-                    dup2(fd, STDIN_FILENO);
-                    close(fd);
+        if (!background && xsh_builtin_is_threadable(cmd->args[0])) {
+            stages->stage[i].cmd = cmd; // Started below
+            cmd = cmd->next;
+            continue;
+        }
+        
+        // Input redirection applies to the first command, output to the last
+        if (open_redirections_posix(cmd, fds, i == 0, i == cmd_count - 1) == -1) {
+            cmd = cmd->next;
+            continue;
+        }
+        
+        // Without job control a background job must not compete with the
+        // shell for the terminal, so it reads from /dev/null instead
+        if (background && i == 0 && fds[0] == -1 && !jobs_control_enabled()) {
+            fds[0] = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+        
+        pid_t pgid = job_process_group(job);
+        pid_t pid;
+        if (xsh_builtin_exists(cmd->args[0])) {
+            fflush(stdout); // Or the child writes the shell's buffered output again
+            pid = fork();
+            if (pid == 0) {
+                // Child process: install the streams, drop every pipe end.
+                // A builtin that waits for children of its own (parallel)
+                // needs its own SIGCHLD pipe.
+                job_child_setup(pgid);
+                jobs_init_subshell();
+                for (int s = 0; s < 3; s++) {
+                    if (fds[s] != -1) dup2(fds[s], s);
                 }
-            }
-            
-            if (i == cmd_count - 1) {
-                // Last command output redirection
-                if (cmd->output_redir.type == REDIR_OUT) {
-                    int fd = open(cmd->output_redir.filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                    if (fd == -1) {
-                        perror("xsh: output redirection");
-                        exit(1);
-                    }
-                    dup2(fd, STDOUT_FILENO);
-                    close(fd);
-                } else if (cmd->output_redir.type == REDIR_APPEND) {
-                    int fd = open(cmd->output_redir.filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
-                    if (fd == -1) {
-                        perror("xsh: append redirection");
-                        exit(1);
-                    }
-                    dup2(fd, STDOUT_FILENO);
-                    close(fd);
+                for (int j = 0; j < cmd_count - 1; j++) {
+                    close(pipes[j][0]);
+                    close(pipes[j][1]);
                 }
-            }
-            
-            // Error redirection for any command
-            if (cmd->error_redir.type == REDIR_ERR) {
-                int fd = open(cmd->error_redir.filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                if (fd == -1) {
-                    perror("xsh: error redirection");
-                    exit(1);
+                
+                // stdin may still buffer input the shell read ahead; read the
+                // new descriptor through a fresh stream instead
+                if (fds[0] != -1) {
+                    xsh_builtin_set_streams(fdopen(STDIN_FILENO, "r"), NULL, NULL);
                 }
-                dup2(fd, STDERR_FILENO);
-                close(fd);
+                xsh_execute_builtin(cmd->args);
+                exit(xsh_builtin_status());
+            } else if (pid < 0) {
+                perror("xsh: fork");
             }
-            
-            // Execute command
-            if (xsh_builtin_exists(cmd->args[0])) {
-                // Built-in command in pipeline
-                int result = xsh_execute_builtin(cmd->args);
-                // Convert shell return value to exit code
-                exit(result == 0 ? 0 : 0); // Built-in commands return 0 for success when they don't exit shell
-            } else {
-                // External command
-                if (execvp(cmd->args[0], cmd->args) == -1) {
-                    perror("xsh");
-                    exit(1);
-                }
+        } else {
+            // External command
+            pid = launch_process(cmd->args, fds, pgid);
+            if (pid == -1) {
+                perror("xsh");
             }
-        } else if (pids[i] < 0) {
-            perror("xsh: fork");
-            return -1;
         }
+        job_set_process(job, i, pid, cmd->args[0]);
+        close_redirections_posix(fds, piped);
         
         cmd = cmd->next;
     }
     
-    // Parent process: close all pipe file descriptors
+    // Hand the threadable builtins their pipe ends and start them. Their
+    // threads block SIGPIPE, so a reader that exits early makes the writes
+    // fail instead of killing the shell.
+    sigset_t pipe_set, saved_mask;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &saved_mask);
+    
+    for (int i = 0; i < cmd_count; i++) {
+        builtin_stage_t *stage = &stages->stage[i];
+        if (!stage->cmd) continue;
+        
+        stage->job = job;
+        stage->index = i;
+        stage->status = 1;
+        stage->fds[0] = i > 0 ? pipes[i-1][0] : -1;
+        stage->fds[1] = i < cmd_count - 1 ? pipes[i][1] : -1;
+        stage->fds[2] = -1;
+        if (i > 0) pipes[i-1][0] = -1; // Owned by the stage now
+        if (i < cmd_count - 1) pipes[i][1] = -1;
+        
+        // Only the ends of the pipeline redirect stdin and stdout, where there
+        // is no pipe end to replace
+        stage->args = copy_args(stage->cmd->args);
+        if (stage->args && open_redirections_posix(stage->cmd, stage->fds, i == 0, i == cmd_count - 1) == 0) {
+            if (pthread_create(&stage->thread, NULL, run_builtin_stage, stage) == 0) {
+                stage->started = 1;
+                job_set_thread(job, i, stage->args[0]);
+                continue;
+            }
+            fprintf(stderr, "xsh: cannot start pipeline thread for '%s'\n", stage->cmd->args[0]);
+        }
+        for (int s = 0; s < 3; s++) {
+            if (stage->fds[s] != -1) close(stage->fds[s]);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &saved_mask, NULL);
+    
+    // Parent process: close the pipe ends no stage took over
     for (int i = 0; i < cmd_count - 1; i++) {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+        if (pipes[i][0] != -1) close(pipes[i][0]);
+        if (pipes[i][1] != -1) close(pipes[i][1]);
     }
     
-    // Wait for all children
-    int last_status = 0;
-    for (int i = 0; i < cmd_count; i++) {
-        int status;
-        waitpid(pids[i], &status, 0);
-        if (i == cmd_count - 1) { // Last command determines overall exit status
-            if (WIFEXITED(status)) {
-                last_status = WEXITSTATUS(status);
-            } else {
-                last_status = 1;
+    // Wait for the job unless it runs in the background. The last command
+    // determines the overall status.
+    last_command_exit_status = job_run(job);
+    return last_command_exit_status;
+}
+
+// Run an and-or list of several pipelines in the background: a forked copy
+// of the shell runs the list as a single job
+static int execute_background_list_posix(command_t *start, command_t *end) {
+    char *text = command_text(start, end);
+    job_t *job = job_create(text ? text : start->args[0], 1, 1);
+    free(text);
+    if (!job) return 1;
+    
+    pid_t pgid = job_process_group(job);
+    int job_control = jobs_control_enabled();
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        job_child_setup(pgid);
+        jobs_init_subshell();
+        if (!job_control) {
+            int fd = open("/dev/null", O_RDONLY);
+            if (fd != -1) {
+                dup2(fd, STDIN_FILENO);
+                close(fd);
             }
         }
+        
+        // The child's copy of the chain ends with this list
+        end->next = NULL;
+        end->operator = CMD_SIMPLE;
+        pipeline_t list = {start, 0};
+        int status = execute_pipeline(&list);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status);
+    } else if (pid < 0) {
+        perror("xsh: fork");
     }
     
-    last_command_exit_status = last_status;
-    return last_status;
+    job_set_process(job, 0, pid, NULL);
+    return job_run(job);
 }
 
 #endif // !_WIN32
 
+// Last command of the pipeline starting at cmd (cmd itself if it has no pipe)
+static command_t *pipeline_end(command_t *cmd) {
+    while (cmd->next && cmd->operator == CMD_PIPE) {
+        cmd = cmd->next;
+    }
+    return cmd;
+}
+
+// Last command of the and-or list (pipelines joined by && and ||) starting
+// at cmd
+static command_t *and_or_list_end(command_t *cmd) {
+    command_t *end = pipeline_end(cmd);
+    while ((end->operator == CMD_AND || end->operator == CMD_OR) && end->next) {
+        end = pipeline_end(end->next);
+    }
+    return end;
+}
+
 // Main pipeline execution function
 int execute_pipeline(pipeline_t *pipeline) {
     if (!pipeline || !pipeline->commands) return -1;
@@ -915,47 +989,81 @@ int execute_pipeline(pipeline_t *pipeline) {
     command_t *cmd = pipeline->commands;
     int overall_status = 0;
     
-    while (cmd) {
+    while (cmd && !shell_exit_requested) {
+        command_t *last = cmd; // Last command run in this step
+        
+        // An and-or list ending in & runs as a background job, and the next
+        // list starts right away
+        command_t *list_end = and_or_list_end(cmd);
+        if (list_end->operator == CMD_BACKGROUND) {
+            if (!cmd->args || !cmd->args[0]) {
+                fprintf(stderr, "xsh: syntax error near unexpected token '&'\n");
+                last_command_exit_status = 2;
+                return 2;
+            }
+#ifdef _WIN32
+            fprintf(stderr, "xsh: job control is not supported on Windows; running '%s' in the foreground\n",
+                    cmd->args[0]);
+#else
+            if (pipeline_end(cmd) == list_end) {
+                overall_status = execute_piped_commands_posix(cmd, 1);
+            } else {
+                overall_status = execute_background_list_posix(cmd, list_end);
+            }
+            last_command_exit_status = overall_status;
+            cmd = list_end->next;
+            continue;
+#endif
+        }
+        
         // Check if this is a pipeline (has pipe operator)
         if (cmd->operator == CMD_PIPE) {
             // Find the end of the pipeline
             command_t *pipe_start = cmd;
-            command_t *pipe_end = cmd;
-            while (pipe_end->next && pipe_end->operator == CMD_PIPE) {
-                pipe_end = pipe_end->next;
-            }
+            command_t *pipe_end = pipeline_end(cmd);
             
             // Execute the piped commands
 #ifdef _WIN32
             overall_status = execute_piped_commands_windows(pipe_start);
 #else
-            overall_status = execute_piped_commands_posix(pipe_start);
+            overall_status = execute_piped_commands_posix(pipe_start, 0);
 #endif
             
-            // Move to the command after the pipeline
-            cmd = pipe_end->next;
+            last = pipe_end;
         } else {
             // Single command or start of new pipeline
             
             // Check if it's a built-in command first
             if (cmd->args && cmd->args[0] && xsh_builtin_exists(cmd->args[0])) {
-                // Setup redirections for built-in
+                // Setup redirections for built-in. Most builtins run without
+                // any, so only then save the descriptors they replace.
                 int saved_stdin = -1, saved_stdout = -1, saved_stderr = -1;
+                int redirected = cmd->input_redir.type != REDIR_NONE ||
+                                 cmd->output_redir.type != REDIR_NONE ||
+                                 cmd->error_redir.type != REDIR_NONE;
                 
                 // Save original descriptors
-                saved_stdin = dup(STDIN_FILENO);
-                saved_stdout = dup(STDOUT_FILENO);
-                saved_stderr = dup(STDERR_FILENO);
+                if (redirected) {
+                    saved_stdin = dup(STDIN_FILENO);
+                    saved_stdout = dup(STDOUT_FILENO);
+                    saved_stderr = dup(STDERR_FILENO);
+                }
                 
-                if (setup_redirections(cmd) == 0) {
-                    int builtin_result = xsh_execute_builtin(cmd->args);
-                    // Convert built-in return value (0 = exit, 1 = continue) to exit status
-                    overall_status = (builtin_result == 0) ? 0 : 0; // Built-in success
+                if (!redirected || setup_redirections(cmd) == 0) {
+                    // The return value only says whether to keep the shell
+                    // running; the builtin reports its exit status separately
+                    xsh_execute_builtin(cmd->args);
+                    overall_status = xsh_builtin_status();
                 } else {
                     overall_status = 1; // Setup error
                 }
                 
-                // Restore redirections
+                // Restore redirections, after writing out what the builtin
+                // buffered for the redirected streams
+                if (redirected) {
+                    fflush(stdout);
+                    fflush(stderr);
+                }
                 if (saved_stdin != -1) {
                     dup2(saved_stdin, STDIN_FILENO);
                     close(saved_stdin);
@@ -977,123 +1085,23 @@ int execute_pipeline(pipeline_t *pipeline) {
 #endif
             }
             
-            // Handle command operators
-            if (cmd->operator == CMD_AND && overall_status != 0) {
-                // Command failed, skip until next non-AND command
-                while (cmd->next && cmd->next->operator == CMD_AND) {
-                    cmd = cmd->next;
-                }
-                if (cmd->next) cmd = cmd->next;
-            } else if (cmd->operator == CMD_OR && overall_status == 0) {
-                // Command succeeded, skip until next non-OR command
-                while (cmd->next && cmd->next->operator == CMD_OR) {
-                    cmd = cmd->next;
-                }
-                if (cmd->next) cmd = cmd->next;
-            } else {
-                cmd = cmd->next;
-            }
         }
         
         last_command_exit_status = overall_status;
         
-        // For semicolon, continue regardless of status
-        // For && and ||, the logic is handled above
-    }
-    
-    return overall_status;
-}
-
-// Main execution function - updated to handle advanced features
-int xsh_launch(char **args) {
-    if (!args || !args[0]) return 1;
-    
-    // Reconstruct the command line to check for operators
-    size_t total_len = 0;
-    for (int i = 0; args[i]; i++) {
-        total_len += strlen(args[i]) + 1;
-    }
-    
-    char *line = malloc(total_len);
-    if (!line) return 1;
-    
-    strcpy(line, args[0]);
-    for (int i = 1; args[i]; i++) {
-        strcat(line, " ");
-        strcat(line, args[i]);
-    }
-    
-    // Check if the line contains operators
-    if (!contains_operators(line)) {
-        free(line);
-        // Simple command, use original logic for built-ins
-        if (xsh_builtin_exists(args[0])) {
-            return xsh_execute_builtin(args);
-        }
-        
-        // External command
-#ifdef _WIN32
-        command_t *cmd = create_command();
-        if (!cmd) return 1;
-        
-        // Copy args
-        int arg_count = 0;
-        while (args[arg_count]) arg_count++;
-        
-        cmd->args = malloc((arg_count + 1) * sizeof(char*));
-        if (!cmd->args) {
-            free_command(cmd);
-            return 1;
-        }
-        
-        for (int i = 0; i < arg_count; i++) {
-            cmd->args[i] = strdup(args[i]);
-        }
-        cmd->args[arg_count] = NULL;
-        
-        int result = execute_single_command_windows(cmd);
-        free_command(cmd);
-        return (result == 0) ? 1 : 1; // Continue shell loop
-#else
-        // POSIX simple execution
-        pid_t pid = fork();
-        if (pid == 0) {
-            if (execvp(args[0], args) == -1) {
-                perror("xsh");
-            }
-            exit(EXIT_FAILURE);
-        } else if (pid > 0) {
-            int status;
-            waitpid(pid, &status, 0);
-            if (WIFEXITED(status)) {
-                last_command_exit_status = WEXITSTATUS(status);
+        // Handle command operators. A failed && or a successful || skips the
+        // following commands (pipelines count as one) joined by the same
+        // operator; for semicolon, continue regardless of status.
+        cmd = last->next;
+        if ((last->operator == CMD_AND && overall_status != 0) ||
+            (last->operator == CMD_OR && overall_status == 0)) {
+            while (cmd) {
+                command_t *skipped = pipeline_end(cmd);
+                cmd = skipped->next;
+                if (skipped->operator != last->operator) break;
             }
-        } else {
-            perror("xsh: fork");
         }
-        return 1; // Continue shell loop
-#endif
     }
     
-    // Complex command with operators
-    int token_count;
-    char **tokens = tokenize_with_operators(line, &token_count);
-    free(line);
-    
-    if (!tokens) return 1;
-    
-    pipeline_t *pipeline = parse_command_line(tokens, token_count);
-    
-    // Free tokens
-    for (int i = 0; i < token_count; i++) {
-        free(tokens[i]);
-    }
-    free(tokens);
-    
-    if (!pipeline) return 1;
-    
-    int result = execute_pipeline(pipeline);
-    free_pipeline(pipeline);
-    
-    return 1; // Continue shell loop
+    return overall_status;
 }
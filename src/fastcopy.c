@@ -0,0 +1,217 @@
+#ifdef __linux__
+#define _GNU_SOURCE // For copy_file_range() and splice()
+#endif
+
+#include "fastcopy.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <malloc.h> // For _aligned_malloc()
+#else
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h> // For FICLONE
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+
+typedef ssize_t (*kernel_copy_t)(int in_fd, int out_fd, size_t length);
+
+static ssize_t copy_range(int in_fd, int out_fd, size_t length) {
+    return copy_file_range(in_fd, NULL, out_fd, NULL, length, 0);
+}
+
+static ssize_t copy_splice(int in_fd, int out_fd, size_t length) {
+    return splice(in_fd, NULL, out_fd, NULL, length, SPLICE_F_MOVE | SPLICE_F_MORE);
+}
+
+static ssize_t copy_sendfile(int in_fd, int out_fd, size_t length) {
+    return sendfile(out_fd, in_fd, NULL, length);
+}
+
+// Copy with one kernel call until the end of input. Returns 0 when done, -1
+// on error and 1 if the kernel cannot copy between these descriptors this
+// way (an O_APPEND output, a filesystem without support, ...), in which case
+// the next way picks up at the offsets the copy reached.
+static int kernel_copy(kernel_copy_t copy, int in_fd, int out_fd, long long *copied) {
+    for (;;) {
+        ssize_t n = copy(in_fd, out_fd, FASTCOPY_CHUNK);
+        if (n > 0) {
+            *copied += n;
+        } else if (n == 0) {
+            return 0;
+        } else if (errno != EINTR) {
+            return (errno == EINVAL || errno == ENOSYS || errno == EXDEV ||
+                    errno == EOPNOTSUPP || errno == EBADF) ? 1 : -1;
+        }
+    }
+}
+#endif
+
+void *fastcopy_buffer(size_t size) {
+#ifdef _WIN32
+    return _aligned_malloc(size, FASTCOPY_ALIGN);
+#else
+    void *buffer;
+    return posix_memalign(&buffer, FASTCOPY_ALIGN, size) == 0 ? buffer : NULL;
+#endif
+}
+
+void fastcopy_buffer_free(void *buffer) {
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+// Copy through a buffer in user space
+static long long buffer_copy(int in_fd, int out_fd, long long copied) {
+    char *buffer = fastcopy_buffer(FASTCOPY_BUFSIZE);
+    if (!buffer) return -1;
+
+    for (;;) {
+        ssize_t n = read(in_fd, buffer, FASTCOPY_BUFSIZE);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            copied = -1;
+            break;
+        }
+        for (ssize_t done = 0; done < n;) {
+            ssize_t written = write(out_fd, buffer + done, n - done);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                fastcopy_buffer_free(buffer);
+                return -1;
+            }
+            done += written;
+        }
+        copied += n;
+    }
+    fastcopy_buffer_free(buffer);
+    return copied;
+}
+
+long long fastcopy_fd(int in_fd, int out_fd) {
+    long long copied = 0;
+#ifdef __linux__
+    struct stat in_stat, out_stat;
+    if (fstat(in_fd, &in_stat) == -1 || fstat(out_fd, &out_stat) == -1) return -1;
+
+    // Files in /proc and /sys claim to be empty; only read() sees their data
+    int in_file = S_ISREG(in_stat.st_mode) && in_stat.st_size > 0;
+    int status = 1;
+    if (in_file && S_ISREG(out_stat.st_mode)) {
+        status = kernel_copy(copy_range, in_fd, out_fd, &copied);
+    }
+    if (status == 1 && (S_ISFIFO(in_stat.st_mode) || S_ISFIFO(out_stat.st_mode))) {
+        status = kernel_copy(copy_splice, in_fd, out_fd, &copied);
+    }
+    if (status == 1 && in_file) {
+        status = kernel_copy(copy_sendfile, in_fd, out_fd, &copied);
+    }
+    if (status != 1) return status == 0 ? copied : -1;
+#endif
+    return buffer_copy(in_fd, out_fd, copied);
+}
+
+long long fastcopy_to_stream(int in_fd, FILE *out) {
+    if (fflush(out) == EOF) return -1;
+    return fastcopy_fd(in_fd, fileno(out));
+}
+
+#ifndef _WIN32
+// Copy bytes [offset, end) of in_fd to the same offsets of out_fd. Clears
+// *use_range once copy_file_range() is refused, so later extents go
+// straight to the buffer.
+static int copy_extent(int in_fd, int out_fd, off_t offset, off_t end, atomic_llong *progress,
+                       int *use_range, char **buffer) {
+    while (offset < end) {
+        size_t length = end - offset > FASTCOPY_FILE_CHUNK ? FASTCOPY_FILE_CHUNK : (size_t)(end - offset);
+        ssize_t n;
+#ifdef __linux__
+        if (*use_range) {
+            loff_t in_offset = offset, out_offset = offset;
+            n = copy_file_range(in_fd, &in_offset, out_fd, &out_offset, length, 0);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS || errno == EXDEV ||
+                          errno == EOPNOTSUPP || errno == EBADF)) {
+                *use_range = 0;
+                continue;
+            }
+        } else
+#endif
+        {
+            if (!*buffer && !(*buffer = fastcopy_buffer(FASTCOPY_BUFSIZE))) return -1;
+            if (length > FASTCOPY_BUFSIZE) length = FASTCOPY_BUFSIZE;
+            n = pread(in_fd, *buffer, length, offset);
+            for (ssize_t done = 0; n > 0 && done < n;) {
+                ssize_t written = pwrite(out_fd, *buffer + done, n - done, offset + done);
+                if (written < 0 && errno != EINTR) return -1;
+                if (written > 0) done += written;
+            }
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break; // The source shrank under us
+        offset += n;
+        if (progress) atomic_fetch_add(progress, n);
+    }
+    return 0;
+}
+#endif
+
+long long fastcopy_file(int in_fd, int out_fd, long long size, atomic_llong *progress) {
+#ifdef _WIN32
+    long long copied = buffer_copy(in_fd, out_fd, 0);
+    if (copied > 0 && progress) atomic_fetch_add(progress, copied);
+    return copied;
+#else
+#ifdef __linux__
+    if (size > 0 && ioctl(out_fd, FICLONE, in_fd) == 0) {
+        if (progress) atomic_fetch_add(progress, size);
+        return size;
+    }
+#endif
+    struct stat in_stat;
+    if (fstat(in_fd, &in_stat) == -1) return -1;
+    int use_range = 1;
+    char *buffer = NULL;
+    int status = 0;
+
+    // Only a file with fewer blocks than its size has holes worth looking for
+    int sparse = 0;
+#ifdef SEEK_DATA
+    sparse = (long long)in_stat.st_blocks * 512 < size;
+#endif
+    if (!sparse) {
+        status = copy_extent(in_fd, out_fd, 0, size, progress, &use_range, &buffer);
+    }
+#ifdef SEEK_DATA
+    for (off_t data = 0; sparse && status == 0 && data < size;) {
+        data = lseek(in_fd, data, SEEK_DATA);
+        if (data == -1) {
+            // ENXIO: only a hole is left. Anything else: the filesystem
+            // cannot tell, so copy the rest as data.
+            if (errno != ENXIO) status = copy_extent(in_fd, out_fd, 0, size, progress, &use_range, &buffer);
+            break;
+        }
+        off_t hole = lseek(in_fd, data, SEEK_HOLE);
+        if (hole == -1 || hole > size) hole = size;
+        status = copy_extent(in_fd, out_fd, data, hole, progress, &use_range, &buffer);
+        data = hole;
+    }
+    // A trailing hole is only a length
+    if (sparse && status == 0 && ftruncate(out_fd, size) == -1) status = -1;
+#endif
+    fastcopy_buffer_free(buffer);
+    return status == 0 ? size : -1;
+#endif
+}
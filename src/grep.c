@@ -0,0 +1,543 @@
+#ifndef _WIN32
+#define _GNU_SOURCE // For memrchr(), d_type and madvise()
+#endif
+
+#include "grep.h"
+#include "builtins.h"
+#include "memsearch.h"
+#include "workpool.h"
+#include "xregex.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h> // For open, read, close
+#else
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#define GREP_USAGE "Usage: grep [-E|-P|-F] [-i] [-n] [-c] [-l] [-r] <pattern> [file...]\n"
+
+#ifndef _WIN32
+// A file queued for the workers
+typedef struct {
+    workpool_item_t item;
+    char *path;
+} grep_task_t;
+#endif
+
+typedef struct {
+    int line_numbers;  // -n
+    int count_only;    // -c
+    int list_only;     // -l
+    int recursive;     // -r
+    int with_filename; // Prefix lines with the file they are from
+    memsearch_t literal;
+    int prefilter;      // With a regex: whether literal is in every match
+    xregex_t *regex;    // -E or -P, NULL when a literal search will do
+    xregex_dfa_t *dfa;  // The calling thread's matcher; workers have their own
+    FILE *out;
+    FILE *err;
+    atomic_int matched;
+    atomic_int failed;
+    atomic_int output_closed; // Writing failed, so the reader went away
+    atomic_llong written;     // Bytes handed to out
+
+#ifndef _WIN32
+    workpool_t pool; // For -r; no workers means files are searched by the calling thread
+    pthread_mutex_t out_lock; // Held while a file's output is written
+#endif
+} grep_t;
+
+// One file being searched: what is known of it and its pending output
+typedef struct {
+    const char *name;       // Printed before each line, NULL for none
+    xregex_dfa_t *dfa;      // Matcher for g->regex on this thread
+    char *output;
+    size_t output_length;
+    size_t output_capacity;
+    int holds_out_lock;     // Output goes straight out, so other files wait
+    long long line_number;  // Newlines before counted
+    const char *counted;    // How far into the current buffer lines are counted
+    long long count;        // Matching lines
+    int binary;
+    int done;               // Nothing more to learn (-l matched, or binary)
+} grep_file_t;
+
+#if defined(__GLIBC__)
+#define grep_memrchr memrchr
+#else
+static void *grep_memrchr(const void *s, int c, size_t n) {
+    const unsigned char *p = (const unsigned char *)s + n;
+    while (p > (const unsigned char *)s) {
+        if (*--p == (unsigned char)c) return (void *)p;
+    }
+    return NULL;
+}
+#endif
+
+static long long count_newlines(const char *p, const char *end) {
+    long long lines = 0;
+    while (p < end && (p = memchr(p, '\n', end - p))) {
+        lines++;
+        p++;
+    }
+    return lines;
+}
+
+static void grep_lock_output(grep_t *g, grep_file_t *f) {
+#ifndef _WIN32
+    if (g->pool.worker_count > 0 && !f->holds_out_lock) {
+        pthread_mutex_lock(&g->out_lock);
+        f->holds_out_lock = 1;
+    }
+#else
+    (void)g;
+    (void)f;
+#endif
+}
+
+static void grep_write(grep_t *g, const char *data, size_t length) {
+    if (length == 0 || atomic_load(&g->output_closed)) return;
+    if (fwrite(data, 1, length, g->out) != length) {
+        atomic_store(&g->output_closed, 1);
+    } else {
+        atomic_fetch_add(&g->written, (long long)length);
+    }
+}
+
+// Queue output of f. Once more than GREP_OUTPUT_FLUSH is pending, the file
+// takes the output lock and writes from then on.
+static void grep_emit(grep_t *g, grep_file_t *f, const char *data, size_t length) {
+    if (!f->output && (f->output = malloc(GREP_OUTPUT_FLUSH))) f->output_capacity = GREP_OUTPUT_FLUSH;
+    if (f->output_length + length > f->output_capacity) {
+        grep_lock_output(g, f);
+        grep_write(g, f->output, f->output_length);
+        f->output_length = 0;
+        if (length > f->output_capacity) {
+            grep_write(g, data, length);
+            return;
+        }
+    }
+    memcpy(f->output + f->output_length, data, length);
+    f->output_length += length;
+}
+
+static void grep_print_line(grep_t *g, grep_file_t *f, const char *line, const char *line_end) {
+    if (f->name) {
+        grep_emit(g, f, f->name, strlen(f->name));
+        grep_emit(g, f, ":", 1);
+    }
+    if (g->line_numbers) {
+        f->line_number += count_newlines(f->counted, line);
+        f->counted = line;
+        char number[32];
+        int length = snprintf(number, sizeof(number), "%lld:", f->line_number + 1);
+        grep_emit(g, f, number, (size_t)length);
+    }
+    grep_emit(g, f, line, (size_t)(line_end - line));
+    grep_emit(g, f, "\n", 1);
+}
+
+// The next matching line in [p, end), its end in *line_end; NULL if none.
+// A regex only runs on the lines its literal is found in, if it has one.
+static const char *grep_find_line(grep_t *g, grep_file_t *f, const char *p, const char *end,
+                                  const char **line_end) {
+    while (p < end) {
+        const char *line = p, *hit = p;
+        if (!g->regex || g->prefilter) {
+            hit = memsearch_find(&g->literal, p, end);
+            if (!hit) return NULL;
+            line = grep_memrchr(p, '\n', (size_t)(hit - p));
+            line = line ? line + 1 : p;
+        }
+        const char *stop = memchr(hit, '\n', (size_t)(end - hit));
+        if (!stop) stop = end;
+        if (!g->regex || xregex_dfa_match(f->dfa, line, stop)) {
+            *line_end = stop;
+            return line;
+        }
+        p = stop + 1;
+    }
+    return NULL;
+}
+
+// Search the lines in [data, end). With more set, more of the file follows
+// and the lines counted here carry over to it.
+static void grep_lines(grep_t *g, grep_file_t *f, const char *data, const char *end, int more) {
+    const char *p = data;
+    f->counted = data;
+    while (p < end && !f->done && !atomic_load(&g->output_closed)) {
+        const char *line_end;
+        const char *line = grep_find_line(g, f, p, end, &line_end);
+        if (!line) break;
+
+        f->count++;
+        if (g->list_only) {
+            f->done = 1;
+        } else if (!g->count_only) {
+            if (f->binary || memchr(line, '\0', (size_t)(line_end - line))) {
+                f->binary = 1;
+                f->done = 1;
+            } else {
+                grep_print_line(g, f, line, line_end);
+            }
+        }
+        p = line_end + 1;
+    }
+    if (more && g->line_numbers) f->line_number += count_newlines(f->counted, end);
+}
+
+#ifndef _WIN32
+// Search a regular file in place. Returns -1 if it cannot be mapped.
+static int grep_mapped(grep_t *g, grep_file_t *f, int fd, size_t size) {
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return -1;
+    madvise(map, size, MADV_SEQUENTIAL);
+    const char *data = map;
+    f->binary = memchr(data, '\0', size < GREP_BINARY_PROBE ? size : GREP_BINARY_PROBE) != NULL;
+    grep_lines(g, f, data, data + size, 0);
+    munmap(map, size);
+    return 0;
+}
+#endif
+
+// Search what reading fd gives, a chunk of whole lines at a time. Returns
+// -1 with errno set on a read error.
+static int grep_stream(grep_t *g, grep_file_t *f, int fd) {
+    size_t capacity = GREP_CHUNK;
+    char *buffer = malloc(capacity);
+    if (!buffer) return -1;
+    size_t kept = 0; // Start of a line whose end is not read yet
+    int probed = 0;
+    int status = 0;
+
+    while (!f->done && !atomic_load(&g->output_closed)) {
+        if (kept == capacity) {
+            char *bigger = realloc(buffer, capacity * 2);
+            if (!bigger) {
+                status = -1;
+                break;
+            }
+            buffer = bigger;
+            capacity *= 2;
+        }
+        ssize_t n = read(fd, buffer + kept, (unsigned)(capacity - kept));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            status = -1;
+            break;
+        }
+        if (n == 0) {
+            // A last line without a newline
+            if (kept > 0) grep_lines(g, f, buffer, buffer + kept, 0);
+            break;
+        }
+        if (!probed) {
+            size_t probe = (size_t)n < GREP_BINARY_PROBE ? (size_t)n : GREP_BINARY_PROBE;
+            f->binary = memchr(buffer + kept, '\0', probe) != NULL;
+            probed = 1;
+        }
+
+        size_t total = kept + (size_t)n;
+        char *last_newline = grep_memrchr(buffer + kept, '\n', (size_t)n);
+        if (!last_newline) {
+            kept = total;
+            continue;
+        }
+        size_t whole = (size_t)(last_newline + 1 - buffer);
+        grep_lines(g, f, buffer, buffer + whole, 1);
+        kept = total - whole;
+        memmove(buffer, buffer + whole, kept);
+    }
+    free(buffer);
+    return status;
+}
+
+// Report on a searched file and write out its output
+static void grep_finish(grep_t *g, grep_file_t *f, const char *display_name) {
+    if (f->count > 0) atomic_store(&g->matched, 1);
+    if (g->count_only) {
+        char count[32];
+        if (f->name) {
+            grep_emit(g, f, f->name, strlen(f->name));
+            grep_emit(g, f, ":", 1);
+        }
+        int length = snprintf(count, sizeof(count), "%lld\n", f->count);
+        grep_emit(g, f, count, (size_t)length);
+    } else if (g->list_only) {
+        if (f->count > 0) {
+            grep_emit(g, f, display_name, strlen(display_name));
+            grep_emit(g, f, "\n", 1);
+        }
+    } else if (f->binary && f->count > 0) {
+        grep_emit(g, f, "Binary file ", 12);
+        grep_emit(g, f, display_name, strlen(display_name));
+        grep_emit(g, f, " matches\n", 9);
+    }
+
+    grep_lock_output(g, f);
+    grep_write(g, f->output, f->output_length);
+#ifndef _WIN32
+    if (f->holds_out_lock) pthread_mutex_unlock(&g->out_lock);
+#endif
+    free(f->output);
+}
+
+static void grep_path(grep_t *g, const char *path, xregex_dfa_t *dfa) {
+    if (g->regex && !dfa) {
+        fprintf(g->err, "xsh: grep: %s: memory allocation error\n", path);
+        atomic_store(&g->failed, 1);
+        return;
+    }
+#ifdef _WIN32
+    int fd = open(path, O_RDONLY | O_BINARY);
+#else
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+#endif
+    if (fd == -1) {
+        fprintf(g->err, "xsh: grep: %s: %s\n", path, strerror(errno));
+        atomic_store(&g->failed, 1);
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISDIR(st.st_mode)) {
+        fprintf(g->err, "xsh: grep: %s: Is a directory\n", path);
+        atomic_store(&g->failed, 1);
+        close(fd);
+        return;
+    }
+
+    grep_file_t f;
+    memset(&f, 0, sizeof(f));
+    f.name = g->with_filename ? path : NULL;
+    f.dfa = dfa;
+    int status = -1;
+#ifndef _WIN32
+    if (S_ISREG(st.st_mode) && st.st_size > 0) status = grep_mapped(g, &f, fd, (size_t)st.st_size);
+#endif
+    if (status == -1) status = grep_stream(g, &f, fd);
+    if (status == -1) {
+        fprintf(g->err, "xsh: grep: %s: %s\n", path, strerror(errno));
+        atomic_store(&g->failed, 1);
+    }
+    grep_finish(g, &f, path);
+    close(fd);
+}
+
+#ifndef _WIN32
+// Each worker has its own matcher
+static void *grep_worker_start(void *context) {
+    grep_t *g = context;
+    return g->regex ? xregex_dfa_new(g->regex) : NULL;
+}
+
+static void grep_worker_stop(void *context, void *local) {
+    (void)context;
+    xregex_dfa_free(local);
+}
+
+static void grep_run(void *context, void *local, workpool_item_t *item) {
+    grep_t *g = context;
+    grep_task_t *task = (grep_task_t *)item;
+    if (!atomic_load(&g->output_closed)) grep_path(g, task->path, local);
+    free(task->path);
+    free(task);
+}
+
+// Search a file, on a worker if there are any. Takes ownership of path.
+static void grep_submit(grep_t *g, char *path) {
+    grep_task_t *task = g->pool.worker_count > 0 ? malloc(sizeof(grep_task_t)) : NULL;
+    if (!task) {
+        grep_path(g, path, g->dfa);
+        free(path);
+        return;
+    }
+    task->path = path;
+    workpool_submit(&g->pool, &task->item);
+}
+
+// Queue the files under a directory. Symbolic links inside it are not
+// followed, so a link cycle cannot make the walk endless.
+static void grep_walk(grep_t *g, const char *path) {
+    DIR *dir = opendir(path[0] ? path : ".");
+    if (!dir) {
+        fprintf(g->err, "xsh: grep: %s: %s\n", path, strerror(errno));
+        atomic_store(&g->failed, 1);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) && !atomic_load(&g->output_closed)) {
+        const char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+        char *child = workpool_path_join(path, name);
+        if (!child) break;
+
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (lstat(child, &st) == 0) {
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+            }
+        }
+        if (type == DT_REG) {
+            grep_submit(g, child);
+            continue;
+        }
+        if (type == DT_DIR) grep_walk(g, child);
+        free(child);
+    }
+    closedir(dir);
+}
+#endif
+
+// Set up the search: a literal for memsearch, and for -E and -P a regex,
+// compiled once, unless its literal is all it matches. The literal is then
+// a filter, the regex only running on lines it is found in. Returns -1
+// after printing an error.
+static int grep_compile(grep_t *g, const char *pattern, size_t length, char syntax, int fold) {
+    int exact = 1;
+    if (syntax != 'F') {
+        char error[128] = "memory allocation error";
+        char *source = malloc(length + 1);
+        if (source) {
+            memcpy(source, pattern, length);
+            source[length] = '\0';
+            g->regex = xregex_compile(source, fold, syntax == 'P', error, sizeof(error));
+            free(source);
+        }
+        if (!g->regex) {
+            fprintf(g->err, "xsh: grep: %s\n", error);
+            return -1;
+        }
+        pattern = xregex_literal(g->regex, &length, &exact, &fold);
+        g->prefilter = pattern != NULL;
+        if (!exact && !(g->dfa = xregex_dfa_new(g->regex))) goto fail;
+    }
+    if ((exact || g->prefilter) && memsearch_init(&g->literal, pattern, length, fold) != 0) goto fail;
+    if (exact) {
+        xregex_free(g->regex);
+        g->regex = NULL;
+    }
+    return 0;
+
+fail:
+    fprintf(g->err, "xsh: grep: memory allocation error for pattern\n");
+    xregex_dfa_free(g->dfa);
+    xregex_free(g->regex);
+    return -1;
+}
+
+int xsh_grep(char **args) {
+    grep_t g;
+    memset(&g, 0, sizeof(g));
+    g.out = xsh_builtin_stdout();
+    g.err = xsh_builtin_stderr();
+    int ignore_case = 0;
+    char syntax = 'F'; // -F fixed string, -E or -P regex
+
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *flag = args[i] + 1; *flag; flag++) {
+            switch (*flag) {
+            case 'E':
+            case 'P':
+            case 'F': syntax = *flag; break;
+            case 'i': ignore_case = 1; break;
+            case 'n': g.line_numbers = 1; break;
+            case 'c': g.count_only = 1; break;
+            case 'l': g.list_only = 1; break;
+            case 'r':
+            case 'R': g.recursive = 1; break;
+            default:
+                fprintf(g.err, "xsh: grep: unknown option -%c\n" GREP_USAGE, *flag);
+                xsh_builtin_set_status(2);
+                return 1;
+            }
+        }
+    }
+    if (args[i] == NULL) {
+        fprintf(g.err, "xsh: grep: missing pattern\n" GREP_USAGE);
+        xsh_builtin_set_status(2);
+        return 1;
+    }
+
+    const char *pattern = args[i];
+    size_t pattern_length = strlen(pattern);
+    if (grep_compile(&g, pattern, pattern_length, syntax, ignore_case) != 0) {
+        xsh_builtin_set_status(2);
+        return 1;
+    }
+
+    char **files = &args[i + 1];
+    int file_count = 0;
+    while (files[file_count]) file_count++;
+    g.with_filename = file_count > 1 || g.recursive;
+
+    if (file_count == 0 && !g.recursive) {
+        grep_file_t f;
+        memset(&f, 0, sizeof(f));
+        f.dfa = g.dfa;
+        if (grep_stream(&g, &f, fileno(xsh_builtin_stdin())) == -1) {
+            fprintf(g.err, "xsh: grep: (standard input): %s\n", strerror(errno));
+            atomic_store(&g.failed, 1);
+        }
+        grep_finish(&g, &f, "(standard input)");
+    } else if (!g.recursive) {
+        for (int f = 0; f < file_count && !atomic_load(&g.output_closed); f++) grep_path(&g, files[f], g.dfa);
+    } else {
+#ifdef _WIN32
+        fprintf(g.err, "xsh: grep: -r is not supported on Windows\n");
+        atomic_store(&g.failed, 1);
+#else
+        workpool_init(&g.pool, grep_run, &g);
+        g.pool.worker_start = grep_worker_start;
+        g.pool.worker_stop = grep_worker_stop;
+        pthread_mutex_init(&g.out_lock, NULL);
+        // At least two: one searching while another waits on the disk
+        long workers = sysconf(_SC_NPROCESSORS_ONLN);
+        workpool_start(&g.pool, workers < 2 ? 2 : workers);
+
+        // Without files -r searches the working directory, naming files
+        // relative to it
+        static char *here[] = {"", NULL};
+        char **roots = file_count > 0 ? files : here;
+        for (int f = 0; roots[f] && !atomic_load(&g.output_closed); f++) {
+            struct stat st;
+            if (roots[f][0] && stat(roots[f], &st) == -1) {
+                fprintf(g.err, "xsh: grep: %s: %s\n", roots[f], strerror(errno));
+                atomic_store(&g.failed, 1);
+            } else if (!roots[f][0] || S_ISDIR(st.st_mode)) {
+                grep_walk(&g, roots[f]);
+            } else {
+                char *path = strdup(roots[f]);
+                if (path) grep_submit(&g, path);
+            }
+        }
+
+        workpool_stop(&g.pool);
+        pthread_mutex_destroy(&g.out_lock);
+#endif
+    }
+
+    memsearch_free(&g.literal);
+    xregex_dfa_free(g.dfa);
+    xregex_free(g.regex);
+    // A failed write leaves unknown how much of it went out
+    xsh_builtin_set_written(atomic_load(&g.output_closed) ? -1 : atomic_load(&g.written));
+    // 0 if a line matched, 1 if none did, 2 on errors
+    xsh_builtin_set_status(atomic_load(&g.failed) ? 2 : atomic_load(&g.matched) ? 0 : 1);
+    return 1;
+}
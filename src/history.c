@@ -1,6 +1,15 @@
+#ifndef _WIN32
+#define _GNU_SOURCE // For memrchr()
+#endif
+
 #include "history.h"
+#include "config.h" // For history_size
+#include "history_writer.h"
+#include "launch.h" // For launch_set_cloexec
+#include "pipestat.h" // For pipestat_format
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <time.h>
 #include <math.h>
@@ -8,6 +17,8 @@
 #ifdef _WIN32
 #include <direct.h>
 #include <windows.h>
+#include <io.h> // For _commit
+#include <process.h> // For _getpid
 #define getcwd _getcwd
 #define PATH_SEPARATOR "\\"
 
@@ -25,17 +36,66 @@ char* strndup(const char* s, size_t n) {
 }
 
 #else
-#include <unistd.h>
+#include <unistd.h> // For fsync
 #include <pwd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h> // For mmap
 #define PATH_SEPARATOR "/"
 #endif
 
-// Define history array and count here
-char *history[XSH_HISTORY_SIZE];
+// Total number of history entries addressable through history_get()
 int history_count = 0;
 
+// In-memory ring holding the most recent commands. Appending is O(1): once the
+// ring is full the oldest slot is overwritten instead of shifting the array.
+static char **history_ring = NULL;
+static int history_ring_capacity = 0;
+static int history_ring_head = 0;  // Slot of the oldest in-memory entry
+static int history_ring_count = 0; // Number of occupied slots
+
+// Byte offset of every entry in the history file, indexed by history number.
+// Entries that fell out of the ring are paged back in from these offsets.
+static long *history_offsets = NULL;
+static int history_offsets_capacity = 0;
+static FILE *history_fp = NULL; // Read handle for paging and ingesting entries
+
+// Off when the shell runs a script or -c command: those record nothing
+static int history_recording = 1;
+
+void history_set_recording(int enabled) {
+    history_recording = enabled;
+}
+
+// Several sessions append to the same history file. Each one indexes what the
+// others wrote by reading on from the offset it has ingested up to, and learns
+// the offsets of its own entries when the writer reports where they landed.
+static long history_ingested_end = 0;
+static history_file_id_t history_file_id;
+static int *history_pending = NULL; // Our entries not yet seen on disk, oldest first
+static int history_pending_head = 0;
+static int history_pending_count = 0;
+static int history_pending_capacity = 0;
+
+// Scratch list of ranges this session appended, collected while ingesting
+static history_written_range_t *written_ranges = NULL;
+static int written_ranges_capacity = 0;
+
+static void history_ingest_file(int wait);
+static void history_unmap(void);
+
+// Scratch buffer for entries paged in from disk
+static char *history_page_buf = NULL;
+static size_t history_page_bufsize = 0;
+
+// Read-only mapping of the history file for reverse search, remapped when
+// the file has grown since it was last mapped
+static char *history_map = NULL;
+static size_t history_map_size = 0;
+#ifdef _WIN32
+static HANDLE history_map_handle = NULL;
+#endif
+
 // Enhanced history system
 history_entry_t *enhanced_history = NULL;
 int enhanced_history_count = 0;
@@ -51,104 +111,977 @@ command_pattern_t *command_patterns = NULL;
 int command_patterns_count = 0;
 int command_patterns_capacity = 0;
 
-// Recent command context (for pattern learning)
-static char *recent_commands[MAX_COMMAND_CONTEXT];
+// Recent command context (for pattern learning), as interned IDs
+static intern_id_t recent_commands[MAX_COMMAND_CONTEXT];
 static int recent_commands_count = 0;
 
-// Get the path to the history file
-char* get_history_file_path(void) {
-    static char history_path[1024];
+// Stats handle + 1 for each interned string ID (0 = not tracked). Handles are
+// positions in command_stats and stay valid as the array grows, unlike
+// pointers into it.
+static int *command_stats_by_id = NULL;
+static intern_id_t command_stats_by_id_capacity = 0;
+
+// Handles of command_stats sorted by command name, so every command sharing a
+// prefix is one contiguous range found by binary search
+static int *command_prefix_index = NULL;
+static int command_prefix_index_capacity = 0;
+
+// Extract just the command name (first word)
+static void extract_command_name(const char *command, char *cmd_name, size_t size) {
+    size_t cmd_len = strcspn(command, " ");
+    if (cmd_len >= size) cmd_len = size - 1;
+    memcpy(cmd_name, command, cmd_len);
+    cmd_name[cmd_len] = '\0';
+}
+
+// Make room in command_stats_by_id for every ID interned so far
+static int command_stats_by_id_reserve(void) {
+    intern_id_t limit = intern_id_limit();
+    if (limit <= command_stats_by_id_capacity) return 0;
+    
+    intern_id_t new_capacity = command_stats_by_id_capacity ? command_stats_by_id_capacity : 256;
+    while (new_capacity < limit) new_capacity *= 2;
+    int *new_table = realloc(command_stats_by_id, sizeof(int) * new_capacity);
+    if (!new_table) {
+        fprintf(stderr, "xsh: Failed to expand command stats index\n");
+        return -1;
+    }
+    memset(new_table + command_stats_by_id_capacity, 0,
+           sizeof(int) * (new_capacity - command_stats_by_id_capacity));
+    command_stats_by_id = new_table;
+    command_stats_by_id_capacity = new_capacity;
+    return 0;
+}
+
+static void command_stats_index_free(void) {
+    free(command_stats_by_id);
+    command_stats_by_id = NULL;
+    command_stats_by_id_capacity = 0;
+    free(command_prefix_index);
+    command_prefix_index = NULL;
+    command_prefix_index_capacity = 0;
+}
+
+// First position in the prefix index whose command compares >= prefix
+// (or > prefix when past_prefix is set) over the prefix's length
+static int command_prefix_bound(const char *prefix, size_t prefix_len, int past_prefix) {
+    int lo = 0, hi = command_stats_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        int cmp = strncmp(intern_str(command_stats[command_prefix_index[mid]].command), prefix, prefix_len);
+        if (cmp < 0 || (past_prefix && cmp == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Insert a new handle into the prefix index at its sorted position
+static int command_prefix_index_insert(int handle) {
+    if (command_stats_count >= command_prefix_index_capacity) {
+        int new_capacity = command_prefix_index_capacity ? command_prefix_index_capacity * 2 : 256;
+        int *new_index = realloc(command_prefix_index, sizeof(int) * new_capacity);
+        if (!new_index) {
+            fprintf(stderr, "xsh: Failed to expand command prefix index\n");
+            return -1;
+        }
+        command_prefix_index = new_index;
+        command_prefix_index_capacity = new_capacity;
+    }
+    
+    const char *command = intern_str(command_stats[handle].command);
+    int pos = command_prefix_bound(command, strlen(command) + 1, 0);
+    memmove(&command_prefix_index[pos + 1], &command_prefix_index[pos],
+            sizeof(int) * (command_stats_count - pos));
+    command_prefix_index[pos] = handle;
+    return 0;
+}
+
+// Recompute the ranking key after frequency, recency or success rate changed.
+// score(now) = success_rate * frecency * exp(-(now - last_used) / decay), so
+// log(score) = rank_key - now / decay: the now term is shared by every
+// command, and ordering by rank_key never needs a refresh as time passes.
+static void command_stat_refresh_rank(command_stat_t *stat) {
+    double success = stat->success_rate > 0.05 ? stat->success_rate : 0.05;
+    double frecency = stat->frecency > 0 ? stat->frecency : 1e-9;
+    stat->rank_key = log(frecency) + log(success) + (double)stat->last_used / COMMAND_SCORE_DECAY;
+}
+
+static int rank_heap_less(int a, int b) {
+    return command_stats[a].rank_key < command_stats[b].rank_key;
+}
+
+static void rank_heap_sift_down(int *heap, int count, int i) {
+    for (;;) {
+        int smallest = i;
+        int left = 2 * i + 1, right = 2 * i + 2;
+        if (left < count && rank_heap_less(heap[left], heap[smallest])) smallest = left;
+        if (right < count && rank_heap_less(heap[right], heap[smallest])) smallest = right;
+        if (smallest == i) return;
+        int tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// Select the k highest-ranked commands starting with prefix into top, best
+// first. A min-heap of size k over the prefix range keeps this O(m log k).
+static int command_stats_top_k(const char *prefix, int *top, int k) {
+    if (command_stats_count == 0 || k <= 0) return 0;
+    
+    size_t prefix_len = strlen(prefix);
+    int begin = command_prefix_bound(prefix, prefix_len, 0);
+    int end = command_prefix_bound(prefix, prefix_len, 1);
+    
+    int count = 0;
+    double threshold = 0.0; // rank_key of the heap minimum once the heap is full
+    for (int i = begin; i < end; i++) {
+        int handle = command_prefix_index[i];
+        if (count == k && command_stats[handle].rank_key <= threshold) continue;
+        if (count < k) {
+            // Sift up
+            int pos = count++;
+            while (pos > 0 && rank_heap_less(handle, top[(pos - 1) / 2])) {
+                top[pos] = top[(pos - 1) / 2];
+                pos = (pos - 1) / 2;
+            }
+            top[pos] = handle;
+        } else {
+            top[0] = handle;
+            rank_heap_sift_down(top, count, 0);
+        }
+        threshold = command_stats[top[0]].rank_key;
+    }
+    
+    // Pop the heap from the back to leave the best command first
+    for (int n = count - 1; n > 0; n--) {
+        int tmp = top[0];
+        top[0] = top[n];
+        top[n] = tmp;
+        rank_heap_sift_down(top, n, 0);
+    }
+    return count;
+}
+
+// Stats handle for an interned command, or -1 if it is not tracked
+static int command_stats_find_id(intern_id_t id) {
+    if (id == INTERN_NONE || id >= command_stats_by_id_capacity) return -1;
+    return command_stats_by_id[id] - 1;
+}
+
+// Look up the stats handle for a command name, or -1 if it is not tracked
+int command_stats_find(const char *command) {
+    return command_stats_find_id(intern_lookup(command));
+}
+
+// Look up the stats handle for a command name, creating a fresh entry if needed
+int command_stats_intern(const char *command) {
+    intern_id_t id = intern_string(command);
+    if (id == INTERN_NONE) return -1;
+    int handle = command_stats_find_id(id);
+    if (handle >= 0) return handle;
+    
+    if (command_stats_by_id_reserve() != 0) return -1;
+    
+    if (command_stats_count >= command_stats_capacity) {
+        // Expand array
+        int new_capacity = command_stats_capacity ? command_stats_capacity * 2 : 100;
+        command_stat_t *new_stats = realloc(command_stats, sizeof(command_stat_t) * new_capacity);
+        if (!new_stats) {
+            fprintf(stderr, "xsh: Failed to expand command stats array\n");
+            return -1;
+        }
+        command_stats = new_stats;
+        command_stats_capacity = new_capacity;
+    }
+    
+    // The prefix index is filled up to command_stats_count, so insert
+    // before the count grows
+    command_stats[command_stats_count].command = id;
+    if (command_prefix_index_insert(command_stats_count) != 0) {
+        return -1;
+    }
+    
+    time_t now = time(NULL);
+    handle = command_stats_count;
+    command_stat_t *stat = &command_stats[handle];
+    memset(stat, 0, sizeof(*stat));
+    stat->command = id;
+    stat->last_used = now;
+    stat->first_used = now;
+    stat->success_rate = 1.0;
+    command_stats_count++;
+    
+    command_stats_by_id[id] = handle + 1;
+    return handle;
+}
+
+// N-gram store for context-aware completion. Each pattern maps a context of
+// 1..MAX_COMMAND_CONTEXT preceding commands to the command that followed.
+// Two open-addressing indexes share one capacity (slots hold handle + 1):
+//   pattern_index - (context, next command) -> pattern, for O(1) updates
+//   context_index - context -> first pattern of a chain linked through
+//                   next_in_context, answering "what usually comes next"
+// Weights decay with PATTERN_DECAY_HALF_LIFE, and the least-weighted patterns
+// are evicted once MAX_COMMAND_PATTERNS is reached.
+static int *pattern_index = NULL;
+static int *context_index = NULL;
+static int pattern_index_capacity = 0; // Always a power of two
+
+// Contexts and patterns hash their interned IDs, never the strings
+static unsigned long hash_context(const intern_id_t *sequence, int length) {
+    unsigned long hash = 2166136261UL ^ (unsigned long)length;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ sequence[i]) * 16777619UL;
+    }
+    return hash;
+}
+
+static unsigned long hash_pattern(unsigned long context_hash, intern_id_t next_command) {
+    return (context_hash ^ next_command) * 2654435761UL;
+}
+
+static int pattern_context_equals(const command_pattern_t *pattern, const intern_id_t *sequence, int length) {
+    if (pattern->sequence_length != length) return 0;
+    return memcmp(pattern->sequence, sequence, sizeof(intern_id_t) * length) == 0;
+}
+
+// Pattern weight after decaying it to the given time
+static double pattern_weight(const command_pattern_t *pattern, time_t now) {
+    double age = difftime(now, pattern->last_used);
+    if (age <= 0) return pattern->weight;
+    return pattern->weight * pow(0.5, age / PATTERN_DECAY_HALF_LIFE);
+}
+
+// Probe context_index for a context. Returns its slot, or the empty slot it
+// would occupy.
+static unsigned long pattern_context_slot(const intern_id_t *sequence, int length, unsigned long context_hash) {
+    unsigned long mask = pattern_index_capacity - 1;
+    unsigned long slot = context_hash & mask;
+    while (context_index[slot] != 0) {
+        const command_pattern_t *head = &command_patterns[context_index[slot] - 1];
+        if (head->context_hash == context_hash && pattern_context_equals(head, sequence, length)) break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// First pattern learned for a context, or -1
+static int pattern_context_head(const intern_id_t *sequence, int length, unsigned long context_hash) {
+    if (pattern_index_capacity == 0) return -1;
+    return context_index[pattern_context_slot(sequence, length, context_hash)] - 1;
+}
+
+static int pattern_find(const intern_id_t *sequence, int length, unsigned long context_hash,
+                        intern_id_t next_command) {
+    if (pattern_index_capacity == 0) return -1;
+    
+    unsigned long mask = pattern_index_capacity - 1;
+    unsigned long slot = hash_pattern(context_hash, next_command) & mask;
+    while (pattern_index[slot] != 0) {
+        int handle = pattern_index[slot] - 1;
+        const command_pattern_t *pattern = &command_patterns[handle];
+        if (pattern->context_hash == context_hash &&
+            pattern->next_command == next_command &&
+            pattern_context_equals(pattern, sequence, length)) {
+            return handle;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+// Insert a pattern into both indexes, linking it at the head of its context chain
+static void pattern_index_insert(int handle) {
+    command_pattern_t *pattern = &command_patterns[handle];
+    unsigned long mask = pattern_index_capacity - 1;
+    unsigned long slot = hash_pattern(pattern->context_hash, pattern->next_command) & mask;
+    while (pattern_index[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    pattern_index[slot] = handle + 1;
+    
+    slot = pattern_context_slot(pattern->sequence, pattern->sequence_length, pattern->context_hash);
+    pattern->next_in_context = context_index[slot] - 1; // -1 for a new context
+    context_index[slot] = handle + 1;
+}
+
+// Reallocate both indexes and re-insert every pattern. On failure the indexes
+// are dropped, so lookups miss rather than follow stale handles.
+static int pattern_index_rebuild(int new_capacity) {
+    free(pattern_index);
+    free(context_index);
+    pattern_index = calloc(new_capacity, sizeof(int));
+    context_index = calloc(new_capacity, sizeof(int));
+    if (!pattern_index || !context_index) {
+        fprintf(stderr, "xsh: Failed to expand command pattern index\n");
+        free(pattern_index);
+        free(context_index);
+        pattern_index = NULL;
+        context_index = NULL;
+        pattern_index_capacity = 0;
+        return -1;
+    }
+    pattern_index_capacity = new_capacity;
+    for (int i = 0; i < command_patterns_count; i++) {
+        pattern_index_insert(i);
+    }
+    return 0;
+}
+
+static void free_command_patterns(void) {
+    free(command_patterns);
+    command_patterns = NULL;
+    command_patterns_count = 0;
+    command_patterns_capacity = 0;
+    
+    free(pattern_index);
+    free(context_index);
+    pattern_index = NULL;
+    context_index = NULL;
+    pattern_index_capacity = 0;
+}
+
+typedef struct {
+    double weight;
+    int handle;
+} pattern_rank_t;
+
+static int compare_pattern_rank(const void *a, const void *b) {
+    double wa = ((const pattern_rank_t *)a)->weight;
+    double wb = ((const pattern_rank_t *)b)->weight;
+    return (wa > wb) - (wa < wb);
+}
+
+// Evict the least-weighted tenth of the patterns. Evicting in batches keeps
+// the index rebuild amortized over many insertions.
+static void evict_command_patterns(time_t now) {
+    int count = command_patterns_count;
+    pattern_rank_t *ranks = malloc(sizeof(pattern_rank_t) * count);
+    if (!ranks) return;
+    
+    for (int i = 0; i < count; i++) {
+        ranks[i].weight = pattern_weight(&command_patterns[i], now);
+        ranks[i].handle = i;
+    }
+    qsort(ranks, count, sizeof(pattern_rank_t), compare_pattern_rank);
+    
+    int evict = count / 10 > 0 ? count / 10 : 1;
+    for (int i = 0; i < evict && i < count; i++) {
+        command_patterns[ranks[i].handle].next_command = INTERN_NONE;
+    }
+    free(ranks);
+    
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (command_patterns[i].next_command != INTERN_NONE) {
+            command_patterns[kept++] = command_patterns[i];
+        }
+    }
+    command_patterns_count = kept;
+    
+    pattern_index_rebuild(pattern_index_capacity ? pattern_index_capacity : 256);
+}
+
+// Add a new pattern, evicting old ones first if the store is full
+static int pattern_add(const intern_id_t *sequence, int length, unsigned long context_hash,
+                       intern_id_t next_command, int frequency, double weight, time_t last_used) {
+    if (command_patterns_count >= MAX_COMMAND_PATTERNS) {
+        evict_command_patterns(time(NULL));
+    }
+    
+    // Keep the indexes at most half full so probe sequences stay short
+    if ((command_patterns_count + 1) * 2 > pattern_index_capacity) {
+        int new_capacity = pattern_index_capacity ? pattern_index_capacity * 2 : 256;
+        if (pattern_index_rebuild(new_capacity) != 0) return -1;
+    }
     
+    if (command_patterns_count >= command_patterns_capacity) {
+        int new_capacity = command_patterns_capacity ? command_patterns_capacity * 2 : 200;
+        command_pattern_t *new_patterns = realloc(command_patterns, sizeof(command_pattern_t) * new_capacity);
+        if (!new_patterns) {
+            fprintf(stderr, "xsh: Failed to expand command patterns array\n");
+            return -1;
+        }
+        command_patterns = new_patterns;
+        command_patterns_capacity = new_capacity;
+    }
+    
+    int handle = command_patterns_count;
+    command_pattern_t *pattern = &command_patterns[handle];
+    memset(pattern, 0, sizeof(command_pattern_t));
+    pattern->sequence_length = length;
+    memcpy(pattern->sequence, sequence, sizeof(intern_id_t) * length);
+    pattern->next_command = next_command;
+    pattern->frequency = frequency;
+    pattern->weight = weight;
+    pattern->last_used = last_used;
+    pattern->context_hash = context_hash;
+    command_patterns_count++;
+    
+    pattern_index_insert(handle);
+    return handle;
+}
+
+// Recompute each pattern's confidence in a context as its share of the
+// context's decayed weight
+static void update_context_confidence(int head, time_t now) {
+    double total = 0.0;
+    for (int h = head; h >= 0; h = command_patterns[h].next_in_context) {
+        total += pattern_weight(&command_patterns[h], now);
+    }
+    for (int h = head; h >= 0; h = command_patterns[h].next_in_context) {
+        command_patterns[h].confidence = total > 0 ? pattern_weight(&command_patterns[h], now) / total : 0.0;
+    }
+}
+
+// Build the path of a file in the user's home directory
+static char *get_home_file_path(char *path, size_t size, const char *name) {
 #ifdef _WIN32
     char *home = getenv("USERPROFILE");
     if (!home) home = getenv("HOME");
     if (!home) {
         // Fallback to current directory
-        strcpy(history_path, HISTORY_FILE_NAME);
-        return history_path;
+        snprintf(path, size, "%s", name);
+        return path;
     }
-    snprintf(history_path, sizeof(history_path), "%s%s%s", home, PATH_SEPARATOR, HISTORY_FILE_NAME);
+    snprintf(path, size, "%s%s%s", home, PATH_SEPARATOR, name);
 #else
     char *home = getenv("HOME");
     if (!home) {
         struct passwd *pw = getpwuid(getuid());
         home = pw ? pw->pw_dir : ".";
     }
-    snprintf(history_path, sizeof(history_path), "%s/%s", home, HISTORY_FILE_NAME);
+    snprintf(path, size, "%s/%s", home, name);
 #endif
     
-    return history_path;
+    return path;
+}
+
+// Temporary file for rewriting path. Named per process, since several sessions
+// may rewrite the same file at once and the last rename simply wins.
+static char *get_temp_file_path(char *tmp, size_t size, const char *path) {
+#ifdef _WIN32
+    snprintf(tmp, size, "%s.%d.tmp", path, _getpid());
+#else
+    snprintf(tmp, size, "%s.%ld.tmp", path, (long)getpid());
+#endif
+    return tmp;
+}
+
+// Open a history file for reading. Commands the shell launches must not
+// inherit the handle, so it is close-on-exec (not inherited on Windows).
+static FILE *history_open_read(const char *path) {
+#ifdef _WIN32
+    return fopen(path, "rbN");
+#else
+    FILE *fp = fopen(path, "rb");
+    if (fp) launch_set_cloexec(fileno(fp));
+    return fp;
+#endif
+}
+
+// Get the path to the history file
+char* get_history_file_path(void) {
+    static char history_path[1024];
+    return get_home_file_path(history_path, sizeof(history_path), HISTORY_FILE_NAME);
 }
 
 // Get the path to the history metadata file
 char* get_history_metadata_file_path(void) {
     static char metadata_path[1024];
+    return get_home_file_path(metadata_path, sizeof(metadata_path), HISTORY_METADATA_FILE);
+}
+
+// Get the path to the persisted command timing statistics
+char* get_history_stats_file_path(void) {
+    static char stats_path[1024];
+    return get_home_file_path(stats_path, sizeof(stats_path), HISTORY_STATS_FILE);
+}
+
+// Get the path to the learned command patterns file
+char* get_history_patterns_file_path(void) {
+    static char patterns_path[1024];
+    return get_home_file_path(patterns_path, sizeof(patterns_path), HISTORY_PATTERNS_FILE);
+}
+
+// Read one line of arbitrary length from fp into a growable buffer.
+// Returns the line without its trailing newline, or NULL at EOF.
+static char *history_read_line(FILE *fp, char **buf, size_t *bufsize) {
+    size_t len = 0;
+    
+    if (!*buf) {
+        *bufsize = XSH_MAXLINE;
+        *buf = malloc(*bufsize);
+        if (!*buf) return NULL;
+    }
+    
+    while (fgets(*buf + len, (int)(*bufsize - len), fp)) {
+        len += strlen(*buf + len);
+        if (len > 0 && (*buf)[len - 1] == '\n') {
+            (*buf)[len - 1] = '\0';
+            return *buf;
+        }
+        if (len < *bufsize - 1) break; // EOF without trailing newline
+        
+        char *new_buf = realloc(*buf, *bufsize * 2);
+        if (!new_buf) return NULL;
+        *buf = new_buf;
+        *bufsize *= 2;
+    }
     
-#ifdef _WIN32
-    char *home = getenv("USERPROFILE");
-    if (!home) home = getenv("HOME");
-    if (!home) {
-        // Fallback to current directory
-        strcpy(metadata_path, HISTORY_METADATA_FILE);
-        return metadata_path;
+    return len > 0 ? *buf : NULL;
+}
+
+// Allocate the in-memory ring using the configured history_size
+static int history_ring_init(void) {
+    int capacity = config_get_int(&xshell_config, "history_size", XSH_HISTORY_SIZE);
+    if (capacity < 1) capacity = 1;
+    if (capacity > MAX_HISTORY_FILE_SIZE) capacity = MAX_HISTORY_FILE_SIZE;
+    
+    history_ring = calloc(capacity, sizeof(char*));
+    if (!history_ring) {
+        fprintf(stderr, "xsh: Failed to allocate memory for history\n");
+        return -1;
     }
-    snprintf(metadata_path, sizeof(metadata_path), "%s%s%s", home, PATH_SEPARATOR, HISTORY_METADATA_FILE);
-#else
-    char *home = getenv("HOME");
-    if (!home) {
-        struct passwd *pw = getpwuid(getuid());
-        home = pw ? pw->pw_dir : ".";
+    history_ring_capacity = capacity;
+    history_ring_head = 0;
+    history_ring_count = 0;
+    return 0;
+}
+
+// Push an entry into the ring, evicting the oldest one when full
+static void history_ring_push(char *entry) {
+    if (history_ring_count < history_ring_capacity) {
+        history_ring[(history_ring_head + history_ring_count) % history_ring_capacity] = entry;
+        history_ring_count++;
+    } else {
+        free(history_ring[history_ring_head]);
+        history_ring[history_ring_head] = entry;
+        history_ring_head = (history_ring_head + 1) % history_ring_capacity;
     }
-    snprintf(metadata_path, sizeof(metadata_path), "%s/%s", home, HISTORY_METADATA_FILE);
-#endif
-    
-    return metadata_path;
 }
 
-// Add command to basic history array
-void add_to_history(const char *line) {
-    if (!line || strlen(line) == 0) return;
+// Record the file offset of the next history entry (-1 if it is not on disk)
+static int history_offsets_push(long offset) {
+    if (history_count >= history_offsets_capacity) {
+        int new_capacity = history_offsets_capacity ? history_offsets_capacity * 2 : 1024;
+        long *new_offsets = realloc(history_offsets, sizeof(long) * new_capacity);
+        if (!new_offsets) {
+            fprintf(stderr, "xsh: Failed to expand history index\n");
+            return -1;
+        }
+        history_offsets = new_offsets;
+        history_offsets_capacity = new_capacity;
+    }
+    history_offsets[history_count] = offset;
+    return 0;
+}
+
+// History entry by number from the ring or, for older ones, from the history
+// file, without waiting for the writer or taking the file lock. Entries not
+// yet on disk and no longer in the ring give NULL.
+static const char *history_entry_at(int index) {
+    if (index < 0 || index >= history_count) return NULL;
     
-    // Add to basic history array
-    if (history_count < XSH_HISTORY_SIZE) {
-        history[history_count] = strdup(line);
-        if (history[history_count]) {
-            history_count++;
-            
-            // Also update command statistics
-            update_command_stats(line);
+    int first_in_memory = history_count - history_ring_count;
+    if (index >= first_in_memory) {
+        return history_ring[(history_ring_head + (index - first_in_memory)) % history_ring_capacity];
+    }
+    
+    if (!history_fp || history_offsets[index] < 0) return NULL;
+    if (fseek(history_fp, history_offsets[index], SEEK_SET) != 0) return NULL;
+    return history_read_line(history_fp, &history_page_buf, &history_page_bufsize);
+}
+
+// Get history entry by number (0 = oldest). Recent entries come from the ring;
+// older ones are paged in from the history file. The returned string is only
+// valid until the next call and must not be freed.
+const char *history_get(int index) {
+    if (index < 0 || index >= history_count) return NULL;
+    
+    int first_in_memory = history_count - history_ring_count;
+    if (index < first_in_memory && history_fp && history_offsets[index] < 0) {
+        // One of ours still on its way to disk
+        history_writer_flush(HISTORY_WRITER_FLUSH_TIMEOUT_MS);
+        history_ingest_file(1);
+    }
+    return history_entry_at(index);
+}
+
+// Append an entry to the index and the ring, taking ownership of it
+static int history_append_entry(char *entry, long offset) {
+    if (history_offsets_push(offset) != 0) {
+        free(entry);
+        return -1;
+    }
+    history_ring_push(entry);
+    history_count++;
+    return 0;
+}
+
+static int history_pending_push(int index) {
+    if (history_pending_head + history_pending_count >= history_pending_capacity) {
+        // Compact consumed slots before growing
+        memmove(history_pending, history_pending + history_pending_head, sizeof(int) * history_pending_count);
+        history_pending_head = 0;
+        if (history_pending_count >= history_pending_capacity) {
+            int new_capacity = history_pending_capacity ? history_pending_capacity * 2 : 64;
+            int *new_pending = realloc(history_pending, sizeof(int) * new_capacity);
+            if (!new_pending) return -1;
+            history_pending = new_pending;
+            history_pending_capacity = new_capacity;
         }
-    } else {
-        // Shift history array to make room for new entry
-        if (history[0]) free(history[0]);
-        for (int i = 0; i < XSH_HISTORY_SIZE - 1; i++) {
-            history[i] = history[i + 1];
+    }
+    history_pending[history_pending_head + history_pending_count++] = index;
+    return 0;
+}
+
+// Gather the ranges this session appended to target that lie in file_id past
+// from. Called with the file lock held, so every range below the size seen
+// under the lock has already been reported. Returns how many were gathered.
+static int collect_written_ranges(history_writer_target_t target, const history_file_id_t *file_id, long from) {
+    int count = 0;
+    history_written_range_t range;
+    while (history_writer_take_written(target, &range)) {
+        // Ranges in a file another session has since replaced are gone
+        if (!history_file_id_equal(&range.file, file_id) || range.end <= from) continue;
+        if (count >= written_ranges_capacity) {
+            int new_capacity = written_ranges_capacity ? written_ranges_capacity * 2 : 16;
+            history_written_range_t *new_ranges = realloc(written_ranges, sizeof(*new_ranges) * new_capacity);
+            if (!new_ranges) break;
+            written_ranges = new_ranges;
+            written_ranges_capacity = new_capacity;
         }
-        history[XSH_HISTORY_SIZE - 1] = strdup(line);
-        if (history[XSH_HISTORY_SIZE - 1]) {
-            update_command_stats(line);
+        written_ranges[count++] = range;
+    }
+    return count;
+}
+
+// Whether the record at offset was appended by this session. Offsets must be
+// passed in increasing order; cursor tracks the position in written_ranges.
+static int written_by_us(int count, int *cursor, long offset) {
+    while (*cursor < count && written_ranges[*cursor].end <= offset) (*cursor)++;
+    return *cursor < count && written_ranges[*cursor].start <= offset;
+}
+
+// Read the next complete record of fp, stopping at limit. A record without its
+// trailing newline is still being written (or was torn) and is left alone.
+static char *history_read_record(FILE *fp, long offset, long limit, long *next_offset) {
+    if (offset >= limit) return NULL;
+    char *line = history_read_line(fp, &history_page_buf, &history_page_bufsize);
+    if (!line) return NULL;
+    *next_offset = ftell(fp);
+    if (*next_offset > limit || *next_offset - offset <= (long)strlen(line)) return NULL;
+    return line;
+}
+
+// Index the entries appended to the history file since we last looked. Other
+// sessions' entries are added (and counted in the command stats); ours just
+// get their offsets. Called with the file lock held.
+static void history_ingest_locked(void) {
+    if (fseek(history_fp, 0, SEEK_END) != 0) return;
+    long size = ftell(history_fp);
+    int ranges = collect_written_ranges(HISTORY_WRITER_HISTORY, &history_file_id, history_ingested_end);
+    if (size <= history_ingested_end || fseek(history_fp, history_ingested_end, SEEK_SET) != 0) return;
+    
+    int cursor = 0;
+    long offset = history_ingested_end;
+    long next_offset;
+    char *line;
+    while ((line = history_read_record(history_fp, offset, size, &next_offset)) != NULL) {
+        if (written_by_us(ranges, &cursor, offset)) {
+            if (history_pending_count > 0) {
+                history_offsets[history_pending[history_pending_head++]] = offset;
+                history_pending_count--;
+            } else {
+                // Our entry from before a reload; its stats are already counted
+                char *entry = strdup(line);
+                if (entry) history_append_entry(entry, offset);
+            }
+        } else if (line[0] != '\0') {
+            char *entry = strdup(line);
+            if (entry && history_append_entry(entry, offset) == 0) {
+                update_command_stats(line);
+            }
+        }
+        offset = next_offset;
+    }
+    history_ingested_end = offset;
+}
+
+// Open the history file and index every entry in it, keeping the newest in
+// the ring. learn counts the entries in the command stats.
+static int history_index_file(int learn) {
+    char *history_file = get_history_file_path();
+    history_fp = history_open_read(history_file); // Binary: offsets are counted in bytes
+    if (!history_fp) return -1;
+    
+    int locked = (history_file_lock(fileno(history_fp), 0, 1) == 0);
+    memset(&history_file_id, 0, sizeof(history_file_id));
+    history_file_identity(fileno(history_fp), &history_file_id);
+    
+    fseek(history_fp, 0, SEEK_END);
+    long size = ftell(history_fp);
+    fseek(history_fp, 0, SEEK_SET);
+    long offset = 0;
+    long next_offset;
+    char *line;
+    while ((line = history_read_record(history_fp, offset, size, &next_offset)) != NULL) {
+        if (line[0] != '\0') {
+            char *entry = strdup(line);
+            if (entry && history_append_entry(entry, offset) == 0 && learn) {
+                update_command_stats(line);
+            }
         }
+        offset = next_offset;
     }
+    history_ingested_end = offset;
+    
+    // Everything we wrote so far is in the index now
+    collect_written_ranges(HISTORY_WRITER_HISTORY, &history_file_id, size);
+    history_pending_head = 0;
+    history_pending_count = 0;
+    
+    if (locked) history_file_unlock(fileno(history_fp));
+    return history_count;
 }
 
-// Display command history
-void display_history(void) {
-    printf("=== Command History ===\n");
+// Start over from a history file another session replaced (when trimming it)
+static void history_reload_file(void) {
+    history_unmap();
+    if (history_fp) {
+        fclose(history_fp);
+        history_fp = NULL;
+    }
+    for (int i = 0; i < history_ring_count; i++) {
+        free(history_ring[(history_ring_head + i) % history_ring_capacity]);
+    }
+    history_ring_head = 0;
+    history_ring_count = 0;
+    history_count = 0;
+    history_index_file(0);
+}
+
+// Pick up what other sessions appended to the history file. Without wait,
+// skip this round rather than block on a session holding the lock.
+static void history_ingest_file(int wait) {
+    if (!history_fp) return;
+    if (history_file_lock(fileno(history_fp), 0, wait) != 0) return;
+    
+    history_file_id_t current;
+    if (history_path_identity(get_history_file_path(), &current) == 0 &&
+        !history_file_id_equal(&current, &history_file_id)) {
+        history_file_unlock(fileno(history_fp));
+        history_reload_file();
+        return;
+    }
+    
+    history_ingest_locked();
+    history_file_unlock(fileno(history_fp));
+}
+
+// Add command to history: O(1) ring insert plus an append to the history file,
+// which the history writer performs off the prompt path. The entry's offset is
+// learned once the writer reports where it landed.
+void add_to_history(const char *line) {
+    if (!history_recording || !line || strlen(line) == 0) return;
+    if (!history_ring && history_ring_init() != 0) return;
+    
+    // Other sessions' commands run before this one come first
+    history_ingest_file(0);
+    
+    char *entry = strdup(line);
+    if (!entry) return;
+    
+    int index = history_count;
+    if (history_append_entry(entry, -1) != 0) return;
+    
+    size_t len = strlen(line);
+    char *record = malloc(len + 2);
+    if (history_fp && record && history_pending_push(index) == 0) {
+        memcpy(record, line, len);
+        record[len] = '\n';
+        record[len + 1] = '\0';
+        history_writer_submit(HISTORY_WRITER_HISTORY, record, len + 1);
+    } else {
+        free(record);
+    }
+    
+    // Also update command statistics
+    update_command_stats(line);
+}
+
+// Display command history, optionally limited to the most recent entries
+void display_history(int limit) {
+    history_ingest_file(0);
     if (history_count == 0) {
         printf("No commands in history.\n");
         return;
     }
     
-    for (int i = 0; i < history_count; i++) {
-        if (history[i]) {
-            printf("%4d  %s\n", i + 1, history[i]);
+    int start = (limit > 0 && limit < history_count) ? history_count - limit : 0;
+    for (int i = start; i < history_count; i++) {
+        const char *entry = history_get(i);
+        if (entry) {
+            printf("%5d  %s\n", i + 1, entry);
         }
     }
-    printf("\nTotal commands: %d\n", history_count);
+}
+
+static void history_unmap(void) {
+    if (!history_map) return;
+#ifdef _WIN32
+    UnmapViewOfFile(history_map);
+    CloseHandle(history_map_handle);
+    history_map_handle = NULL;
+#else
+    munmap(history_map, history_map_size);
+#endif
+    history_map = NULL;
+    history_map_size = 0;
+}
+
+// Make sure history_map covers the whole history file
+static int history_map_refresh(void) {
+    if (!history_fp) return -1;
+    history_writer_flush(HISTORY_WRITER_FLUSH_TIMEOUT_MS);
+    
+#ifdef _WIN32
+    HANDLE file = (HANDLE)_get_osfhandle(_fileno(history_fp));
+    LARGE_INTEGER file_size;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size)) return -1;
+    size_t size = (size_t)file_size.QuadPart;
+#else
+    struct stat st;
+    if (fstat(fileno(history_fp), &st) != 0) return -1;
+    size_t size = (size_t)st.st_size;
+#endif
+    
+    if (history_map && size == history_map_size) return 0;
+    history_unmap();
+    if (size == 0) return -1;
+    
+#ifdef _WIN32
+    history_map_handle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!history_map_handle) return -1;
+    history_map = MapViewOfFile(history_map_handle, FILE_MAP_READ, 0, 0, 0);
+    if (!history_map) {
+        CloseHandle(history_map_handle);
+        history_map_handle = NULL;
+        return -1;
+    }
+#else
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(history_fp), 0);
+    if (map == MAP_FAILED) return -1;
+    history_map = map;
+#endif
+    history_map_size = size;
+    return 0;
+}
+
+// Bytes in rough order of how often they appear in shell commands. The search
+// anchors on the query byte that ranks latest here (unlisted bytes count as
+// rarest), so memrchr skips over as much text as possible between candidates.
+static const char history_common_bytes[] = " etaoinsrlcdhu-/.mpgfbkvwy=_0123456789";
+
+static size_t history_rare_byte_index(const char *query, size_t len) {
+    size_t best = 0;
+    size_t best_rank = 0;
+    for (size_t i = 0; i < len; i++) {
+        const char *p = strchr(history_common_bytes, query[i]);
+        size_t rank = p ? (size_t)(p - history_common_bytes) + 1 : sizeof(history_common_bytes) + 1;
+        if (rank > best_rank) {
+            best_rank = rank;
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Last occurrence of byte c in the first n bytes of s
+static const char *history_memrchr(const char *s, int c, size_t n) {
+#ifdef __GLIBC__
+    return memrchr(s, c, n); // Vectorized in glibc
+#else
+    while (n > 0) {
+        if (s[--n] == (char)c) return s + n;
+    }
+    return NULL;
+#endif
+}
+
+// Search history backwards for the newest entry containing query.
+// Only entries starting before the position 'before' are considered (-1 for
+// no limit). On success *match receives a copy of the entry, which the caller
+// frees, and the entry's position is returned; pass it as 'before' to
+// continue with older entries, or position + 1 to include it again.
+// Positions are byte offsets into the history file, which is mapped rather
+// than read, or entry numbers if the file is unavailable.
+long history_search_backward(const char *query, long before, char **match) {
+    if (!match) return -1;
+    *match = NULL;
+    
+    size_t query_len = query ? strlen(query) : 0;
+    if (query_len == 0) return -1;
+    
+    if (history_map_refresh() != 0) {
+        // No file: scan the in-memory entries
+        int first_in_memory = history_count - history_ring_count;
+        int index = (before < 0 || before > history_count) ? history_count : (int)before;
+        while (--index >= first_in_memory) {
+            const char *entry = history_get(index);
+            if (entry && strstr(entry, query)) {
+                *match = strdup(entry);
+                return *match ? index : -1;
+            }
+        }
+        return -1;
+    }
+    
+    const char *base = history_map;
+    size_t size = history_map_size;
+    
+    // Entries starting before 'before' may extend to the end of their line
+    size_t limit = size;
+    if (before >= 0 && (size_t)before < size) {
+        if (before == 0) return -1;
+        const char *eol = memchr(base + before - 1, '\n', size - before + 1);
+        limit = eol ? (size_t)(eol - base) : size;
+    }
+    
+    size_t anchor = history_rare_byte_index(query, query_len);
+    size_t hi = limit; // Matches must lie entirely within [0, hi)
+    while (hi >= query_len) {
+        // Candidate starts are [0, hi - query_len]; find the last anchor byte
+        const char *hit = history_memrchr(base + anchor, query[anchor], hi - query_len + 1);
+        if (!hit) break;
+        
+        size_t start = (size_t)(hit - base) - anchor;
+        if (memcmp(base + start, query, query_len) == 0) {
+            const char *line = history_memrchr(base, '\n', start);
+            size_t line_start = line ? (size_t)(line - base) + 1 : 0;
+            const char *eol = memchr(base + start, '\n', size - start);
+            size_t line_end = eol ? (size_t)(eol - base) : size;
+            
+            *match = strndup(base + line_start, line_end - line_start);
+            return *match ? (long)line_start : -1;
+        }
+        hi = start + query_len - 1;
+    }
+    return -1;
 }
 
 // Initialize the history system
 int init_history_system(void) {
+    // Initialize the in-memory history ring
+    if (history_ring_init() != 0) {
+        return -1;
+    }
+    
     // Initialize command stats array
     command_stats_capacity = 100;
     command_stats = malloc(sizeof(command_stat_t) * command_stats_capacity);
@@ -167,19 +1100,11 @@ int init_history_system(void) {
     }
     enhanced_history_count = 0;
     
-    // Initialize command patterns array
-    command_patterns_capacity = 200;
-    command_patterns = malloc(sizeof(command_pattern_t) * command_patterns_capacity);
-    if (!command_patterns) {
-        fprintf(stderr, "xsh: Failed to allocate memory for command patterns\n");
-        return -1;
-    }
+    // Command patterns are allocated as they are learned
     command_patterns_count = 0;
     
     // Initialize recent commands context
-    for (int i = 0; i < MAX_COMMAND_CONTEXT; i++) {
-        recent_commands[i] = NULL;
-    }
+    memset(recent_commands, 0, sizeof(recent_commands));
     recent_commands_count = 0;
     
     // Load history from files
@@ -187,257 +1112,930 @@ int init_history_system(void) {
         fprintf(stderr, "xsh: Warning - Could not load history file\n");
     }
     
+    // Saved timing aggregates and patterns first, so the journal only has to
+    // be replayed for what they do not already cover
+    load_command_timing_stats();
+    load_command_patterns();
+    
     if (load_enhanced_history() < 0) {
         fprintf(stderr, "xsh: Warning - Could not load enhanced history file\n");
     }
     
+    // From here on appends go through the background writer; if its thread
+    // cannot be started they are simply written synchronously
+    history_writer_start();
+    
     return 0;
 }
 
-// Load history from file
+// Load history from file, indexing every entry and keeping the newest in the ring
 int load_history_from_file(void) {
+    // The writer creates the file if needed; it is shared with other sessions
+    if (history_writer_open_target(HISTORY_WRITER_HISTORY, get_history_file_path(), 0) != 0 ||
+        history_index_file(1) < 0) {
+        // History will still work in memory, it just won't persist
+        return -1;
+    }
+    
+    // Calculate initial scores for loaded commands
+    calculate_command_scores();
+    
+    return history_count;
+}
+
+// Save history to file. Entries are appended as they are added, so this only
+// rewrites the file when it has outgrown MAX_HISTORY_FILE_SIZE.
+int save_history_to_file(void) {
     char *history_file = get_history_file_path();
-    FILE *file = fopen(history_file, "r");
     
-    if (!file) {
-        // File doesn't exist yet, this is okay for first run
+    // Everything queued must be on disk and indexed before deciding
+    if (history_writer_flush(HISTORY_WRITER_FLUSH_TIMEOUT_MS) != 0) {
+        fprintf(stderr, "xsh: History writer is behind; not rewriting %s\n", history_file);
+        return -1;
+    }
+    history_ingest_file(1);
+    if (!history_fp || history_count <= MAX_HISTORY_FILE_SIZE) {
         return 0;
     }
     
-    char line[XSH_MAXLINE];
-    while (fgets(line, sizeof(line), file) && history_count < XSH_HISTORY_SIZE) {
-        // Remove newline character
-        size_t len = strlen(line);
-        if (len > 0 && line[len-1] == '\n') {
-            line[len-1] = '\0';
-        }
-        
-        if (strlen(line) > 0) {
-            history[history_count] = strdup(line);
-            if (history[history_count]) {
-                // Update command statistics
-                update_command_stats(line);
-                history_count++;
-            }
+    // Hold the lock across the rewrite so no other session appends to the
+    // old file in between; they reopen the new one once they get the lock
+    int fd = fileno(history_fp);
+    if (history_file_lock(fd, 1, 1) != 0) return -1;
+    history_ingest_locked();
+    
+    char tmp_file[1100];
+    get_temp_file_path(tmp_file, sizeof(tmp_file), history_file);
+    FILE *file = fopen(tmp_file, "wb");
+    
+    if (!file) {
+        fprintf(stderr, "xsh: Cannot write to history file %s\n", history_file);
+        history_file_unlock(fd);
+        return -1;
+    }
+    
+    // Keep the newest entries and rebuild the offset index as we go. With the
+    // lock held, entries are read without history_get(), which could flush
+    // and ingest, and so lock and unlock the file under us.
+    int first = (history_count > MAX_HISTORY_FILE_SIZE) ? history_count - MAX_HISTORY_FILE_SIZE : 0;
+    int kept = 0;
+    for (int i = first; i < history_count; i++) {
+        const char *entry = history_entry_at(i);
+        if (entry) {
+            history_offsets[kept++] = ftell(file);
+            fprintf(file, "%s\n", entry);
         }
     }
     
+    long file_end = ftell(file);
     fclose(file);
+    history_unmap();
+#ifdef _WIN32
+    // Files cannot be replaced while open, so this only succeeds when no
+    // other session has the history open
+    history_file_unlock(fd);
+    fclose(history_fp);
+    history_fp = NULL;
+    remove(history_file);
+#endif
+    if (rename(tmp_file, history_file) != 0) {
+        fprintf(stderr, "xsh: Cannot replace history file %s\n", history_file);
+        remove(tmp_file);
+        if (history_fp) history_file_unlock(fd);
+        return -1;
+    }
+    if (history_fp) {
+        history_file_unlock(fd);
+        fclose(history_fp);
+    }
     
-    // Calculate initial scores for loaded commands
-    calculate_command_scores();
+    // Older paged entries were dropped; the ring is unaffected, just renumber
+    history_count = kept;
+    history_fp = history_open_read(history_file);
+    memset(&history_file_id, 0, sizeof(history_file_id));
+    if (history_fp) history_file_identity(fileno(history_fp), &history_file_id);
+    history_ingested_end = file_end;
+    return 0;
+}
+
+// Append-only journal of executed commands. One line-framed record per command:
+//   <timestamp>\t<exit_code>\t<execution_time_ms>\t<user_us>\t<sys_us>\t<max_rss_kb>\t
+//   <voluntary_switches>\t<involuntary_switches>\t<stages>\t<cwd>\t<command>\n
+// stages is the pipeline's per-stage statistics as pipestat_format() writes
+// them, or - for a single command. Records from before resource accounting
+// lack the four usage fields after execution_time_ms and the max_rss_kb
+// field, and are read with zero usage; records from before pipeline
+// statistics lack the stages field.
+// Tabs, newlines and backslashes inside fields are backslash-escaped. The
+// context of each entry is rebuilt from record order, so it is not stored.
+static FILE *journal_fp = NULL;
+static int journal_record_count = 0; // Records currently in the journal file
+static long journal_ingested_end = 0; // Journal offset read up to, ours or not
+static history_file_id_t journal_file_id;
+
+// Journal offset up to which the saved timing aggregates cover every record.
+// Files from before sessions shared the journal hold a timestamp instead.
+static long timing_stats_watermark = 0;
+static int timing_stats_watermark_is_offset = 1;
+
+// Write a string field with journal escaping
+static void journal_write_field(FILE *fp, const char *field) {
+    for (const char *p = field; *p; p++) {
+        switch (*p) {
+            case '\\': fputs("\\\\", fp); break;
+            case '\t': fputs("\\t", fp); break;
+            case '\n': fputs("\\n", fp); break;
+            case '\r': fputs("\\r", fp); break;
+            default: fputc(*p, fp); break;
+        }
+    }
+}
+
+// Undo journal escaping in place
+static void journal_unescape_field(char *field) {
+    char *out = field;
+    for (char *p = field; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+            *out++ = (*p == 't') ? '\t' : (*p == 'n') ? '\n' : (*p == 'r') ? '\r' : *p;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = '\0';
+}
+
+// Length of a string field once journal-escaped
+static size_t journal_escaped_length(const char *field) {
+    size_t length = 0;
+    for (const char *p = field; *p; p++) {
+        length += (*p == '\\' || *p == '\t' || *p == '\n' || *p == '\r') ? 2 : 1;
+    }
+    return length;
+}
+
+// Copy a field into out with journal escaping, returning the end of the copy
+static char *journal_escape_into(char *out, const char *field) {
+    for (const char *p = field; *p; p++) {
+        switch (*p) {
+            case '\\': *out++ = '\\'; *out++ = '\\'; break;
+            case '\t': *out++ = '\\'; *out++ = 't'; break;
+            case '\n': *out++ = '\\'; *out++ = 'n'; break;
+            case '\r': *out++ = '\\'; *out++ = 'r'; break;
+            default: *out++ = *p; break;
+        }
+    }
+    return out;
+}
+
+// Format an entry as one newline-terminated journal record in a malloc'd buffer
+static char *journal_format_record(const history_entry_t *entry, size_t *length) {
+    char header[192];
+    int header_len = snprintf(header, sizeof(header), "%ld\t%d\t%ld\t%ld\t%ld\t%ld\t%ld\t%ld\t",
+                              (long)entry->timestamp, entry->exit_code, entry->execution_time_ms,
+                              entry->usage.user_time_us, entry->usage.sys_time_us, entry->usage.max_rss_kb,
+                              entry->usage.voluntary_switches, entry->usage.involuntary_switches);
+    if (header_len < 0 || (size_t)header_len >= sizeof(header)) return NULL;
+    
+    const char *cwd = entry->cwd != INTERN_NONE ? intern_str(entry->cwd) : ".";
+    const char *command = intern_str(entry->command);
+    const char *stages = entry->stages != INTERN_NONE ? intern_str(entry->stages) : "-";
+    size_t stages_len = strlen(stages); // Never holds characters to escape
+    size_t total = (size_t)header_len + stages_len + 1 + journal_escaped_length(cwd) + 1 +
+                   journal_escaped_length(command) + 1;
+    char *record = malloc(total + 1);
+    if (!record) return NULL;
+    
+    memcpy(record, header, (size_t)header_len);
+    memcpy(record + header_len, stages, stages_len);
+    record[header_len + stages_len] = '\t';
+    char *p = journal_escape_into(record + header_len + stages_len + 1, cwd);
+    *p++ = '\t';
+    p = journal_escape_into(p, command);
+    *p++ = '\n';
+    *p = '\0';
+    *length = total;
+    return record;
+}
+
+static void journal_write_record(FILE *fp, const history_entry_t *entry) {
+    size_t length;
+    char *record = journal_format_record(entry, &length);
+    if (!record) return;
+    fwrite(record, 1, length, fp);
+    free(record);
+}
+
+// Open the journal. Appends go through the history writer, which shares the
+// file with other sessions; journal_fp only reads what they appended.
+static int journal_open(void) {
+    char *metadata_file = get_history_metadata_file_path();
+    if (history_writer_open_target(HISTORY_WRITER_JOURNAL, metadata_file, HISTORY_JOURNAL_SYNC_INTERVAL) != 0) {
+        return -1;
+    }
+    journal_fp = history_open_read(metadata_file);
+    if (!journal_fp) return -1;
+    memset(&journal_file_id, 0, sizeof(journal_file_id));
+    history_file_identity(fileno(journal_fp), &journal_file_id);
+    return 0;
+}
+
+// Split a journal record into its fields, unescaping cwd and command.
+// Returns 0 for a well-formed record.
+static int journal_parse_record(char *line, time_t *timestamp, int *exit_code, long *execution_time_ms,
+                                command_usage_t *usage, char **stages, char **cwd, char **command) {
+    char *fields[11];
+    int field_count = 0;
+    char *p = line;
+    while (field_count < 11) {
+        fields[field_count++] = p;
+        p = strchr(p, '\t');
+        if (!p) break;
+        *p++ = '\0';
+    }
+    if (field_count != 5 && field_count != 10 && field_count != 11) return -1; // Torn record
+    
+    memset(usage, 0, sizeof(*usage));
+    *stages = (field_count == 11 && strcmp(fields[8], "-") != 0) ? fields[8] : NULL;
+    if (field_count >= 10) {
+        usage->user_time_us = atol(fields[3]);
+        usage->sys_time_us = atol(fields[4]);
+        usage->max_rss_kb = atol(fields[5]);
+        usage->voluntary_switches = atol(fields[6]);
+        usage->involuntary_switches = atol(fields[7]);
+    }
+    *cwd = fields[field_count - 2];
+    *command = fields[field_count - 1];
+    if ((*command)[0] == '\0') return -1; // Empty record
+    
+    journal_unescape_field(*cwd);
+    journal_unescape_field(*command);
+    *timestamp = (time_t)atol(fields[0]);
+    *exit_code = atoi(fields[1]);
+    *execution_time_ms = atol(fields[2]);
+    return 0;
+}
+
+// Append an entry to the in-memory enhanced history, taking its context from
+// the recent commands (which the caller then advances) unless it came from
+// another session
+static history_entry_t *record_enhanced_entry(const char *command, const char *cwd, time_t timestamp,
+                                              int exit_code, long execution_time_ms,
+                                              const command_usage_t *usage, const char *stages,
+                                              int with_context) {
+    // Expand array if needed
+    if (enhanced_history_count >= enhanced_history_capacity) {
+        int new_capacity = enhanced_history_capacity ? enhanced_history_capacity * 2 : 1000;
+        history_entry_t *new_history = realloc(enhanced_history, 
+                                             sizeof(history_entry_t) * new_capacity);
+        if (!new_history) {
+            fprintf(stderr, "xsh: Failed to expand enhanced history array\n");
+            return NULL;
+        }
+        enhanced_history = new_history;
+        enhanced_history_capacity = new_capacity;
+    }
     
-    return history_count;
+    // Add new entry
+    history_entry_t *entry = &enhanced_history[enhanced_history_count];
+    entry->command = intern_string(command);
+    if (entry->command == INTERN_NONE) return NULL;
+    entry->timestamp = timestamp;
+    entry->cwd = intern_string(cwd ? cwd : ".");
+    entry->exit_code = exit_code;
+    entry->execution_time_ms = execution_time_ms;
+    if (usage) {
+        entry->usage = *usage;
+    } else {
+        memset(&entry->usage, 0, sizeof(entry->usage));
+    }
+    entry->stages = stages ? intern_string(stages) : INTERN_NONE;
+    entry->context_count = 0;
+    
+    // Copy recent command context
+    for (int i = 0; with_context && i < recent_commands_count && i < MAX_COMMAND_CONTEXT; i++) {
+        entry->context[entry->context_count++] = recent_commands[i];
+    }
+    
+    enhanced_history_count++;
+    return entry;
 }
 
-// Save history to file
-int save_history_to_file(void) {
-    char *history_file = get_history_file_path();
-    FILE *file = fopen(history_file, "w");
+// Slide a command into the recent command context
+static void push_recent_command(const char *command) {
+    intern_id_t id = intern_string(command);
+    if (id == INTERN_NONE) return;
+    if (recent_commands_count >= MAX_COMMAND_CONTEXT) {
+        // Shift array
+        memmove(recent_commands, recent_commands + 1, sizeof(intern_id_t) * (MAX_COMMAND_CONTEXT - 1));
+        recent_commands[MAX_COMMAND_CONTEXT - 1] = id;
+    } else {
+        recent_commands[recent_commands_count++] = id;
+    }
+}
+
+// Fold in the journal records other sessions appended since we last looked:
+// their commands join the enhanced history and the merged command stats
+// without the journal being read again from the start. Called with the
+// journal lock held.
+static void journal_ingest_locked(void) {
+    if (fseek(journal_fp, 0, SEEK_END) != 0) return;
+    long size = ftell(journal_fp);
+    int ranges = collect_written_ranges(HISTORY_WRITER_JOURNAL, &journal_file_id, journal_ingested_end);
+    if (size <= journal_ingested_end || fseek(journal_fp, journal_ingested_end, SEEK_SET) != 0) return;
+    
+    int cursor = 0;
+    long offset = journal_ingested_end;
+    long next_offset;
+    char *line;
+    while ((line = history_read_record(journal_fp, offset, size, &next_offset)) != NULL) {
+        time_t timestamp;
+        int exit_code;
+        long execution_time_ms;
+        command_usage_t usage;
+        char *stages, *cwd, *command;
+        if (!written_by_us(ranges, &cursor, offset) &&
+            journal_parse_record(line, &timestamp, &exit_code, &execution_time_ms, &usage, &stages, &cwd,
+                                 &command) == 0 &&
+            record_enhanced_entry(command, cwd, timestamp, exit_code, execution_time_ms, &usage, stages, 0)) {
+            learn_from_command_execution(command, (exit_code == 0), execution_time_ms, &usage);
+            journal_record_count++;
+        }
+        offset = next_offset;
+    }
+    journal_ingested_end = offset;
+}
+
+// Pick up other sessions' journal records, skipping this round instead of
+// blocking when wait is 0 and the lock is busy
+static void journal_ingest(int wait) {
+    if (!journal_fp) return;
+    if (history_file_lock(fileno(journal_fp), 0, wait) != 0) return;
+    
+    history_file_id_t current;
+    if (history_path_identity(get_history_metadata_file_path(), &current) == 0 &&
+        !history_file_id_equal(&current, &journal_file_id)) {
+        // Another session compacted the journal after folding in everything
+        // it had; carry on from the end of the new one
+        history_file_unlock(fileno(journal_fp));
+        fclose(journal_fp);
+        journal_fp = history_open_read(get_history_metadata_file_path());
+        if (!journal_fp) return;
+        int locked = (history_file_lock(fileno(journal_fp), 0, 1) == 0);
+        history_file_identity(fileno(journal_fp), &journal_file_id);
+        fseek(journal_fp, 0, SEEK_END);
+        journal_ingested_end = ftell(journal_fp);
+        collect_written_ranges(HISTORY_WRITER_JOURNAL, &journal_file_id, journal_ingested_end);
+        if (locked) history_file_unlock(fileno(journal_fp));
+        return;
+    }
+    
+    journal_ingest_locked();
+    history_file_unlock(fileno(journal_fp));
+}
+
+// Rewrite the journal with only the newest HISTORY_JOURNAL_MAX_RECORDS entries
+// and drop the older ones from memory, keeping startup cost bounded. The
+// journal stays locked throughout so no session appends to the old file.
+static int compact_enhanced_history(void) {
+    // Queued records must land in the old journal before it is replaced
+    if (!journal_fp || history_writer_flush(HISTORY_WRITER_FLUSH_TIMEOUT_MS) != 0) return -1;
     
+    int fd = fileno(journal_fp);
+    if (history_file_lock(fd, 1, 1) != 0) return -1;
+    journal_ingest_locked();
+    
+    char *metadata_file = get_history_metadata_file_path();
+    char tmp_file[1100];
+    get_temp_file_path(tmp_file, sizeof(tmp_file), metadata_file);
+    
+    FILE *file = fopen(tmp_file, "wb");
     if (!file) {
-        fprintf(stderr, "xsh: Cannot write to history file %s\n", history_file);
+        fprintf(stderr, "xsh: Cannot compact enhanced history file %s\n", metadata_file);
+        history_file_unlock(fd);
+        return -1;
+    }
+    
+    int drop = enhanced_history_count > HISTORY_JOURNAL_MAX_RECORDS ?
+               enhanced_history_count - HISTORY_JOURNAL_MAX_RECORDS : 0;
+    for (int i = drop; i < enhanced_history_count; i++) {
+        journal_write_record(file, &enhanced_history[i]);
+    }
+    fflush(file);
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    fsync(fileno(file));
+#endif
+    long file_end = ftell(file);
+    fclose(file);
+    
+#ifdef _WIN32
+    // Files cannot be replaced while open: close ours, and give up if another
+    // session still has the journal open
+    history_file_unlock(fd);
+    fclose(journal_fp);
+    journal_fp = NULL;
+    history_writer_close_target(HISTORY_WRITER_JOURNAL);
+    remove(metadata_file);
+#endif
+    int renamed = (rename(tmp_file, metadata_file) == 0);
+    if (!renamed) {
+        fprintf(stderr, "xsh: Cannot replace enhanced history file %s\n", metadata_file);
+        remove(tmp_file);
+    }
+    if (journal_fp) {
+        history_file_unlock(fd);
+        fclose(journal_fp);
+        journal_fp = NULL;
+    }
+    // Our writer notices the new file on its next append; reopen the reader
+    if (journal_open() != 0) return -1;
+    if (!renamed) {
+        fseek(journal_fp, 0, SEEK_END);
+        journal_ingested_end = ftell(journal_fp);
         return -1;
     }
+    journal_ingested_end = file_end;
     
-    // Write all history entries
-    for (int i = 0; i < history_count; i++) {
-        if (history[i]) {
-            fprintf(file, "%s\n", history[i]);
+    memmove(enhanced_history, enhanced_history + drop,
+            sizeof(history_entry_t) * (enhanced_history_count - drop));
+    enhanced_history_count -= drop;
+    journal_record_count = enhanced_history_count;
+    return 0;
+}
+
+// Value of a "key": line from the old JSON metadata file, which wrote strings
+// without escaping: everything between the quotes after the key, or the
+// number after it
+static const char *legacy_json_value(char *line, const char *key) {
+    char *value = strstr(line, key);
+    if (!value) return NULL;
+    value += strlen(key);
+    while (*value == ' ') value++;
+    size_t length = strlen(value);
+    while (length > 0 && (value[length - 1] == ',' || value[length - 1] == ' ' || value[length - 1] == '\r')) {
+        length--;
+    }
+    if (*value == '"' && length >= 2 && value[length - 1] == '"') {
+        value++;
+        length -= 2;
+    }
+    value[length] = '\0';
+    return value;
+}
+
+// Before the journal, enhanced history was kept as JSON in
+// HISTORY_LEGACY_METADATA_FILE. When there is no journal yet, write the old
+// file's entries into a new one; the old file is left where it is.
+static void import_legacy_metadata(void) {
+    char *metadata_file = get_history_metadata_file_path();
+    FILE *journal = fopen(metadata_file, "rb");
+    if (journal) {
+        fclose(journal);
+        return;
+    }
+    char legacy_path[1024];
+    FILE *legacy = fopen(get_home_file_path(legacy_path, sizeof(legacy_path), HISTORY_LEGACY_METADATA_FILE), "r");
+    if (!legacy) return;
+    
+    char tmp_file[1100];
+    get_temp_file_path(tmp_file, sizeof(tmp_file), metadata_file);
+    FILE *file = fopen(tmp_file, "wb");
+    if (!file) {
+        fclose(legacy);
+        return;
+    }
+    
+    history_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.command = INTERN_NONE;
+    entry.cwd = INTERN_NONE;
+    entry.stages = INTERN_NONE;
+    int imported = 0;
+    char *buf = NULL;
+    size_t bufsize = 0;
+    char *line;
+    while ((line = history_read_line(legacy, &buf, &bufsize)) != NULL) {
+        const char *value;
+        // The command_stats that follow the history hold "command" keys too
+        if (strstr(line, "\"command_stats\":")) break;
+        if ((value = legacy_json_value(line, "\"command\":")) != NULL) {
+            entry.command = *value ? intern_string(value) : INTERN_NONE;
+        } else if ((value = legacy_json_value(line, "\"timestamp\":")) != NULL) {
+            entry.timestamp = (time_t)atol(value);
+        } else if ((value = legacy_json_value(line, "\"cwd\":")) != NULL) {
+            entry.cwd = *value ? intern_string(value) : INTERN_NONE;
+        } else if ((value = legacy_json_value(line, "\"exit_code\":")) != NULL) {
+            entry.exit_code = atoi(value);
+        } else if ((value = legacy_json_value(line, "\"execution_time_ms\":")) != NULL) {
+            entry.execution_time_ms = atol(value);
+        } else if (strchr(line, '}') && entry.command != INTERN_NONE) {
+            journal_write_record(file, &entry);
+            imported++;
+            memset(&entry, 0, sizeof(entry));
+            entry.command = INTERN_NONE;
+            entry.cwd = INTERN_NONE;
+            entry.stages = INTERN_NONE;
         }
     }
+    free(buf);
+    fclose(legacy);
     
+    int failed = (fflush(file) != 0);
     fclose(file);
-    return 0;
+    // Another session starting at the same time may have created the journal
+    // since; theirs is kept rather than replaced
+#ifdef _WIN32
+    if (failed || imported == 0 || rename(tmp_file, metadata_file) != 0) remove(tmp_file);
+#else
+    if (!failed && imported > 0 && link(tmp_file, metadata_file) != 0 && errno != EEXIST) {
+        fprintf(stderr, "xsh: Cannot import %s into %s\n", legacy_path, metadata_file);
+    }
+    remove(tmp_file);
+#endif
 }
 
-// Load enhanced history with metadata from JSON file
+// Load enhanced history by streaming the journal back into history_entry_t
 int load_enhanced_history(void) {
-    char *metadata_file = get_history_metadata_file_path();
-    FILE *file = fopen(metadata_file, "r");
+    import_legacy_metadata();
+    if (journal_open() != 0) {
+        return -1;
+    }
+    
+    // Without a saved pattern store, relearn the patterns from the journal
+    int replay_patterns = (command_patterns_count == 0);
+    
+    int locked = (history_file_lock(fileno(journal_fp), 0, 1) == 0);
+    fseek(journal_fp, 0, SEEK_END);
+    long size = ftell(journal_fp);
+    fseek(journal_fp, 0, SEEK_SET);
+    
+    long offset = 0;
+    long next_offset;
+    char *line;
+    while ((line = history_read_record(journal_fp, offset, size, &next_offset)) != NULL) {
+        time_t timestamp;
+        int exit_code;
+        long execution_time_ms;
+        command_usage_t usage;
+        char *stages, *cwd, *command;
+        if (journal_parse_record(line, &timestamp, &exit_code, &execution_time_ms, &usage, &stages, &cwd,
+                                 &command) == 0 &&
+            record_enhanced_entry(command, cwd, timestamp, exit_code, execution_time_ms, &usage, stages, 1)) {
+            if (replay_patterns) {
+                update_command_patterns(command);
+            }
+            push_recent_command(command);
+            // Timings before the watermark are already in the saved aggregates
+            int measured = timing_stats_watermark_is_offset ? offset >= timing_stats_watermark
+                                                            : timestamp > (time_t)timing_stats_watermark;
+            learn_from_command_execution(command, (exit_code == 0), execution_time_ms,
+                                         measured ? &usage : NULL);
+            journal_record_count++;
+        }
+        offset = next_offset;
+    }
+    journal_ingested_end = offset;
+    if (locked) history_file_unlock(fileno(journal_fp));
+    
+    if (journal_record_count > HISTORY_JOURNAL_MAX_RECORDS + HISTORY_JOURNAL_MAX_RECORDS / 2) {
+        compact_enhanced_history();
+    }
+    
+    return enhanced_history_count;
+}
+
+// Make all journal records durable. Records are appended as commands run, so
+// there is nothing to rewrite here.
+int save_enhanced_history(void) {
+    if (!journal_fp) return -1;
+    return history_writer_sync(HISTORY_WRITER_FLUSH_TIMEOUT_MS);
+}
+
+// Persisted per-command timing aggregates. The first line holds the journal
+// offset up to which every record is folded in; journal records after it are
+// replayed on load. Then one record per command:
+//   <command>\t<runs>\t<mean_ms>\t<m2>\t<user_us>\t<sys_us>\t<max_rss_kb>\t<bucket>:<count> ...\n
+int load_command_timing_stats(void) {
+    FILE *file = fopen(get_history_stats_file_path(), "r");
+    if (!file) return -1;
+    
+    char *line;
+    char *buf = NULL;
+    size_t bufsize = 0;
+    int loaded = 0;
+    
+    line = history_read_line(file, &buf, &bufsize);
+    int has_watermark = 0;
+    if (line && strncmp(line, "journal_offset\t", 15) == 0) {
+        timing_stats_watermark = atol(line + 15);
+        timing_stats_watermark_is_offset = 1;
+        has_watermark = 1;
+    } else if (line && strncmp(line, "watermark\t", 10) == 0) {
+        // Older files recorded the newest timestamp folded in
+        timing_stats_watermark = atol(line + 10);
+        timing_stats_watermark_is_offset = 0;
+        has_watermark = 1;
+    }
+    if (has_watermark) {
+        
+        while ((line = history_read_line(file, &buf, &bufsize)) != NULL) {
+            char *fields[8];
+            int field_count = 0;
+            char *p = line;
+            while (field_count < 8) {
+                fields[field_count++] = p;
+                p = strchr(p, '\t');
+                if (!p) break;
+                *p++ = '\0';
+            }
+            if (field_count != 8) continue; // Skip malformed records
+            
+            journal_unescape_field(fields[0]);
+            int handle = command_stats_intern(fields[0]);
+            if (handle < 0) continue;
+            
+            command_stat_t *stat = &command_stats[handle];
+            stat->measured_executions = atoi(fields[1]);
+            stat->mean_execution_time = strtod(fields[2], NULL);
+            stat->m2_execution_time = strtod(fields[3], NULL);
+            stat->avg_execution_time = (long)(stat->mean_execution_time + 0.5);
+            stat->total_user_time_us = atoll(fields[4]);
+            stat->total_sys_time_us = atoll(fields[5]);
+            stat->max_rss_kb = atol(fields[6]);
+            
+            for (char *bucket = strtok(fields[7], " "); bucket; bucket = strtok(NULL, " ")) {
+                int index;
+                unsigned int count;
+                if (sscanf(bucket, "%d:%u", &index, &count) != 2 || index < 0 || index >= DURATION_BUCKETS) {
+                    continue;
+                }
+                if (!stat->duration_histogram) {
+                    stat->duration_histogram = calloc(DURATION_BUCKETS, sizeof(unsigned int));
+                    if (!stat->duration_histogram) break;
+                }
+                stat->duration_histogram[index] = count;
+            }
+            loaded++;
+        }
+    }
+    free(buf);
+    fclose(file);
+    
+    return loaded;
+}
+
+// Write the timing aggregates to disk, replacing the previous file
+int save_command_timing_stats(void) {
+    char *stats_file = get_history_stats_file_path();
+    char tmp_file[1100];
+    get_temp_file_path(tmp_file, sizeof(tmp_file), stats_file);
     
+    FILE *file = fopen(tmp_file, "w");
     if (!file) {
-        // File doesn't exist yet, this is okay for first run
-        return 0;
+        fprintf(stderr, "xsh: Cannot write to stats file %s\n", stats_file);
+        return -1;
+    }
+    
+    // Everything up to where we have read the journal is folded in, including
+    // records other sessions appended
+    fprintf(file, "journal_offset\t%ld\n", journal_ingested_end);
+    
+    for (int i = 0; i < command_stats_count; i++) {
+        const command_stat_t *stat = &command_stats[i];
+        if (stat->measured_executions == 0) continue;
+        
+        journal_write_field(file, intern_str(stat->command));
+        fprintf(file, "\t%d\t%.6f\t%.6f\t%lld\t%lld\t%ld\t", stat->measured_executions,
+                stat->mean_execution_time, stat->m2_execution_time,
+                stat->total_user_time_us, stat->total_sys_time_us, stat->max_rss_kb);
+        if (stat->duration_histogram) {
+            const char *separator = "";
+            for (int b = 0; b < DURATION_BUCKETS; b++) {
+                if (stat->duration_histogram[b]) {
+                    fprintf(file, "%s%d:%u", separator, b, stat->duration_histogram[b]);
+                    separator = " ";
+                }
+            }
+        }
+        fputc('\n', file);
+    }
+    
+    if (fclose(file) != 0) {
+        remove(tmp_file);
+        return -1;
+    }
+#ifdef _WIN32
+    remove(stats_file);
+#endif
+    if (rename(tmp_file, stats_file) != 0) {
+        fprintf(stderr, "xsh: Cannot replace stats file %s\n", stats_file);
+        remove(tmp_file);
+        return -1;
+    }
+    return 0;
+}
+
+// Load learned patterns. One record per line:
+//   <frequency>\t<weight>\t<last_used>\t<length>\t<context...>\t<next_command>\n
+// with fields escaped like the journal.
+int load_command_patterns(void) {
+    FILE *file = fopen(get_history_patterns_file_path(), "r");
+    if (!file) return -1;
+    
+    char *line;
+    char *buf = NULL;
+    size_t bufsize = 0;
+    while ((line = history_read_line(file, &buf, &bufsize)) != NULL) {
+        char *fields[4 + MAX_COMMAND_CONTEXT + 1];
+        int field_count = 0;
+        char *p = line;
+        while (field_count < (int)(sizeof(fields) / sizeof(fields[0]))) {
+            fields[field_count++] = p;
+            p = strchr(p, '\t');
+            if (!p) break;
+            *p++ = '\0';
+        }
+        
+        int length = field_count >= 4 ? atoi(fields[3]) : 0;
+        if (length < 1 || length > MAX_COMMAND_CONTEXT || field_count != 4 + length + 1) {
+            continue; // Skip malformed records
+        }
+        for (int i = 4; i < field_count; i++) {
+            journal_unescape_field(fields[i]);
+        }
+        
+        intern_id_t sequence[MAX_COMMAND_CONTEXT];
+        int interned = 1;
+        for (int i = 0; i < length; i++) {
+            sequence[i] = intern_string(fields[4 + i]);
+            if (sequence[i] == INTERN_NONE) interned = 0;
+        }
+        intern_id_t next_command = intern_string(fields[4 + length]);
+        if (!interned || next_command == INTERN_NONE) continue;
+        
+        unsigned long context_hash = hash_context(sequence, length);
+        if (pattern_find(sequence, length, context_hash, next_command) >= 0) continue;
+        
+        pattern_add(sequence, length, context_hash, next_command, atoi(fields[0]),
+                    strtod(fields[1], NULL), (time_t)atol(fields[2]));
     }
+    free(buf);
+    fclose(file);
     
-    // Simple JSON parsing for enhanced history
-    // In a production system, you'd want to use a proper JSON library
-    char line[XSH_MAXLINE];
-    while (fgets(line, sizeof(line), file) && enhanced_history_count < enhanced_history_capacity) {
-        // Skip JSON structure lines
-        if (strstr(line, "\"command\":") != NULL) {
-            // Extract command (simple parsing)
-            char *start = strchr(line, '"');
-            if (start) {
-                start = strchr(start + 1, '"');
-                if (start) {
-                    start += 3; // Skip ": "
-                    char *end = strchr(start, '"');
-                    if (end) {
-                        size_t len = end - start;
-                        if (len > 0 && len < 256) {
-                            enhanced_history[enhanced_history_count].command = strndup(start, len);
-                            enhanced_history[enhanced_history_count].timestamp = time(NULL);
-                            enhanced_history[enhanced_history_count].cwd = strdup(".");
-                            enhanced_history[enhanced_history_count].exit_code = 0;
-                            enhanced_history[enhanced_history_count].execution_time_ms = 0;
-                            enhanced_history[enhanced_history_count].context_count = 0;
-                            enhanced_history_count++;
-                        }
-                    }
-                }
-            }
+    // Confidence is derived data, recompute it per context
+    time_t now = time(NULL);
+    for (int i = 0; i < command_patterns_count; i++) {
+        command_pattern_t *pattern = &command_patterns[i];
+        int head = pattern_context_head(pattern->sequence, pattern->sequence_length, pattern->context_hash);
+        if (head == i) {
+            update_context_confidence(head, now);
         }
     }
     
-    fclose(file);
-    return enhanced_history_count;
+    return command_patterns_count;
 }
 
-// Save enhanced history to JSON file
-int save_enhanced_history(void) {
-    char *metadata_file = get_history_metadata_file_path();
-    FILE *file = fopen(metadata_file, "w");
+// Write the pattern store to disk, replacing the previous file
+int save_command_patterns(void) {
+    char *patterns_file = get_history_patterns_file_path();
+    char tmp_file[1100];
+    get_temp_file_path(tmp_file, sizeof(tmp_file), patterns_file);
     
+    FILE *file = fopen(tmp_file, "w");
     if (!file) {
-        fprintf(stderr, "xsh: Cannot write to enhanced history file %s\n", metadata_file);
+        fprintf(stderr, "xsh: Cannot write to patterns file %s\n", patterns_file);
         return -1;
     }
     
-    fprintf(file, "{\n");
-    fprintf(file, "  \"version\": \"1.0\",\n");
-    fprintf(file, "  \"created\": %ld,\n", time(NULL));
-    fprintf(file, "  \"history\": [\n");
-    
-    for (int i = 0; i < enhanced_history_count; i++) {
-        if (enhanced_history[i].command) {
-            fprintf(file, "    {\n");
-            fprintf(file, "      \"command\": \"%s\",\n", enhanced_history[i].command);
-            fprintf(file, "      \"timestamp\": %ld,\n", enhanced_history[i].timestamp);
-            fprintf(file, "      \"cwd\": \"%s\",\n", enhanced_history[i].cwd ? enhanced_history[i].cwd : ".");
-            fprintf(file, "      \"exit_code\": %d,\n", enhanced_history[i].exit_code);
-            fprintf(file, "      \"execution_time_ms\": %ld,\n", enhanced_history[i].execution_time_ms);
-            fprintf(file, "      \"context\": [");
-            for (int j = 0; j < enhanced_history[i].context_count; j++) {
-                if (enhanced_history[i].context[j]) {
-                    fprintf(file, "\"%s\"", enhanced_history[i].context[j]);
-                    if (j < enhanced_history[i].context_count - 1) fprintf(file, ", ");
-                }
-            }
-            fprintf(file, "]\n");
-            fprintf(file, "    }%s\n", (i < enhanced_history_count - 1) ? "," : "");
+    for (int i = 0; i < command_patterns_count; i++) {
+        const command_pattern_t *pattern = &command_patterns[i];
+        fprintf(file, "%d\t%.6f\t%ld\t%d", pattern->frequency, pattern->weight,
+                (long)pattern->last_used, pattern->sequence_length);
+        for (int j = 0; j < pattern->sequence_length; j++) {
+            fputc('\t', file);
+            journal_write_field(file, intern_str(pattern->sequence[j]));
         }
+        fputc('\t', file);
+        journal_write_field(file, intern_str(pattern->next_command));
+        fputc('\n', file);
     }
     
-    fprintf(file, "  ],\n");
-    fprintf(file, "  \"command_stats\": [\n");
-    
-    for (int i = 0; i < command_stats_count; i++) {
-        if (command_stats[i].command) {
-            fprintf(file, "    {\n");
-            fprintf(file, "      \"command\": \"%s\",\n", command_stats[i].command);
-            fprintf(file, "      \"frequency\": %d,\n", command_stats[i].frequency);
-            fprintf(file, "      \"last_used\": %ld,\n", command_stats[i].last_used);
-            fprintf(file, "      \"first_used\": %ld,\n", command_stats[i].first_used);
-            fprintf(file, "      \"score\": %.2f,\n", command_stats[i].score);
-            fprintf(file, "      \"success_rate\": %.2f,\n", command_stats[i].success_rate);
-            fprintf(file, "      \"avg_execution_time\": %ld,\n", command_stats[i].avg_execution_time);
-            fprintf(file, "      \"total_executions\": %d,\n", command_stats[i].total_executions);
-            fprintf(file, "      \"successful_executions\": %d\n", command_stats[i].successful_executions);
-            fprintf(file, "    }%s\n", (i < command_stats_count - 1) ? "," : "");
-        }
+    if (fclose(file) != 0) {
+        remove(tmp_file);
+        return -1;
+    }
+#ifdef _WIN32
+    remove(patterns_file);
+#endif
+    if (rename(tmp_file, patterns_file) != 0) {
+        fprintf(stderr, "xsh: Cannot replace patterns file %s\n", patterns_file);
+        remove(tmp_file);
+        return -1;
     }
-    
-    fprintf(file, "  ]\n");
-    fprintf(file, "}\n");
-    
-    fclose(file);
     return 0;
 }
 
 // Add command to enhanced history with metadata
-void add_to_enhanced_history(const char *command, const char *cwd, int exit_code, long execution_time_ms) {
-    if (!command || strlen(command) == 0) return;
-    
-    // Expand array if needed
-    if (enhanced_history_count >= enhanced_history_capacity) {
-        enhanced_history_capacity *= 2;
-        history_entry_t *new_history = realloc(enhanced_history, 
-                                             sizeof(history_entry_t) * enhanced_history_capacity);
-        if (!new_history) {
-            fprintf(stderr, "xsh: Failed to expand enhanced history array\n");
-            return;
-        }
-        enhanced_history = new_history;
-    }
-    
-    // Add new entry
-    enhanced_history[enhanced_history_count].command = strdup(command);
-    enhanced_history[enhanced_history_count].timestamp = time(NULL);
-    enhanced_history[enhanced_history_count].cwd = cwd ? strdup(cwd) : strdup(".");
-    enhanced_history[enhanced_history_count].exit_code = exit_code;
-    enhanced_history[enhanced_history_count].execution_time_ms = execution_time_ms;
-    enhanced_history[enhanced_history_count].context_count = 0;
-    
-    // Copy recent command context
-    for (int i = 0; i < recent_commands_count && i < MAX_COMMAND_CONTEXT; i++) {
-        if (recent_commands[i]) {
-            enhanced_history[enhanced_history_count].context[i] = strdup(recent_commands[i]);
-            enhanced_history[enhanced_history_count].context_count++;
-        }
-    }
-    
-    enhanced_history_count++;
-    
-    // Update recent commands context
-    if (recent_commands_count >= MAX_COMMAND_CONTEXT) {
-        // Shift array
-        if (recent_commands[0]) free(recent_commands[0]);
-        for (int i = 0; i < MAX_COMMAND_CONTEXT - 1; i++) {
-            recent_commands[i] = recent_commands[i + 1];
+void add_to_enhanced_history(const char *command, const char *cwd, int exit_code, long execution_time_ms,
+                             const command_usage_t *usage, const pipeline_stat_t *stages) {
+    if (!history_recording || !command || strlen(command) == 0) return;
+    
+    // Merge in what other sessions ran since the last command
+    journal_ingest(0);
+    
+    // Per-stage statistics are kept for pipelines only
+    char stages_text[PIPESTAT_TEXT_SIZE];
+    int has_stages = stages && stages->stage_count > 1 &&
+                     pipestat_format(stages, stages_text, sizeof(stages_text)) == 0;
+    history_entry_t *entry = record_enhanced_entry(command, cwd, time(NULL), exit_code, execution_time_ms, usage,
+                                                   has_stages ? stages_text : NULL, 1);
+    if (!entry) return;
+    
+    // Learn the pattern before this command becomes part of the context
+    update_command_patterns(command);
+    push_recent_command(command);
+    
+    // Hand the record to the history writer for appending to the journal
+    if (journal_fp) {
+        size_t length;
+        char *record = journal_format_record(entry, &length);
+        if (record) {
+            history_writer_submit(HISTORY_WRITER_JOURNAL, record, length);
+            journal_record_count++;
         }
-        recent_commands[MAX_COMMAND_CONTEXT - 1] = strdup(command);
-    } else {
-        recent_commands[recent_commands_count] = strdup(command);
-        recent_commands_count++;
     }
     
-    // Update command patterns
-    update_command_patterns(command);
-    
     // Learn from execution
-    learn_from_command_execution(command, (exit_code == 0), execution_time_ms);
+    learn_from_command_execution(command, (exit_code == 0), execution_time_ms, usage);
     
-    // Periodically save enhanced history
-    if (enhanced_history_count % 20 == 0) {
-        save_enhanced_history();
+    // Periodically compact the journal once it has grown well past its limit
+    if (journal_record_count > HISTORY_JOURNAL_MAX_RECORDS + HISTORY_JOURNAL_MAX_RECORDS / 2) {
+        compact_enhanced_history();
     }
 }
 
 // Cleanup the history system
 void cleanup_history_system(void) {
-    // Save history to files before cleanup
-    save_history_to_file();
-    save_enhanced_history();
-    
-    // Free history array
-    for (int i = 0; i < history_count; i++) {
-        if (history[i]) {
-            free(history[i]);
-            history[i] = NULL;
-        }
+    // Let the writer drain, but do not hang the exit on a stalled disk. A
+    // writer stuck past the timeout keeps its files, which are then left open.
+    if (history_writer_stop(HISTORY_WRITER_FLUSH_TIMEOUT_MS) != 0) {
+        fprintf(stderr, "xsh: Warning - History writer timed out; recent history may be lost\n");
+    } else {
+        save_history_to_file();
+        // Fold in the other sessions' records the saved aggregates will cover
+        journal_ingest(1);
+        save_enhanced_history();
+        history_writer_close_target(HISTORY_WRITER_HISTORY);
+        history_writer_close_target(HISTORY_WRITER_JOURNAL);
     }
+    save_command_patterns();
+    save_command_timing_stats();
+    
+    // Free history ring and file index
+    if (history_ring) {
+        for (int i = 0; i < history_ring_count; i++) {
+            free(history_ring[(history_ring_head + i) % history_ring_capacity]);
+        }
+        free(history_ring);
+        history_ring = NULL;
+    }
+    history_ring_capacity = 0;
+    history_ring_head = 0;
+    history_ring_count = 0;
+    
+    free(history_offsets);
+    history_offsets = NULL;
+    history_offsets_capacity = 0;
+    if (history_fp) {
+        fclose(history_fp);
+        history_fp = NULL;
+    }
+    history_ingested_end = 0;
+    free(history_pending);
+    history_pending = NULL;
+    history_pending_head = 0;
+    history_pending_count = 0;
+    history_pending_capacity = 0;
+    free(written_ranges);
+    written_ranges = NULL;
+    written_ranges_capacity = 0;
+    free(history_page_buf);
+    history_page_buf = NULL;
+    history_page_bufsize = 0;
+    history_unmap();
+    
+    // Close the journal
+    if (journal_fp) {
+        fclose(journal_fp);
+        journal_fp = NULL;
+    }
+    journal_record_count = 0;
+    journal_ingested_end = 0;
     
     // Free enhanced history
     if (enhanced_history) {
-        for (int i = 0; i < enhanced_history_count; i++) {
-            if (enhanced_history[i].command) free(enhanced_history[i].command);
-            if (enhanced_history[i].cwd) free(enhanced_history[i].cwd);
-            for (int j = 0; j < enhanced_history[i].context_count; j++) {
-                if (enhanced_history[i].context[j]) free(enhanced_history[i].context[j]);
-            }
-        }
         free(enhanced_history);
         enhanced_history = NULL;
     }
@@ -445,45 +2043,15 @@ void cleanup_history_system(void) {
     // Free command stats
     if (command_stats) {
         for (int i = 0; i < command_stats_count; i++) {
-            if (command_stats[i].command) {
-                free(command_stats[i].command);
-            }
-            if (command_stats[i].common_contexts) {
-                for (int j = 0; j < command_stats[i].context_count; j++) {
-                    if (command_stats[i].common_contexts[j]) {
-                        free(command_stats[i].common_contexts[j]);
-                    }
-                }
-                free(command_stats[i].common_contexts);
-            }
+            free(command_stats[i].duration_histogram);
         }
         free(command_stats);
         command_stats = NULL;
     }
+    command_stats_index_free();
     
-    // Free command patterns
-    if (command_patterns) {
-        for (int i = 0; i < command_patterns_count; i++) {
-            for (int j = 0; j < command_patterns[i].sequence_length; j++) {
-                if (command_patterns[i].sequence[j]) {
-                    free(command_patterns[i].sequence[j]);
-                }
-            }
-            if (command_patterns[i].next_command) {
-                free(command_patterns[i].next_command);
-            }
-        }
-        free(command_patterns);
-        command_patterns = NULL;
-    }
-    
-    // Free recent commands context
-    for (int i = 0; i < recent_commands_count; i++) {
-        if (recent_commands[i]) {
-            free(recent_commands[i]);
-            recent_commands[i] = NULL;
-        }
-    }
+    // Free command patterns and their indexes
+    free_command_patterns();
     
     history_count = 0;
     enhanced_history_count = 0;
@@ -493,187 +2061,223 @@ void cleanup_history_system(void) {
     enhanced_history_capacity = 0;
     command_stats_capacity = 0;
     command_patterns_capacity = 0;
+    
+    // Every record above referred to interned strings; release them last
+    intern_cleanup();
 }
 
 // Enhanced update command statistics for smart completion
 void update_command_stats(const char *command) {
     if (!command || strlen(command) == 0) return;
     
-    // Extract just the command name (first word)
     char cmd_name[256];
-    const char *space = strchr(command, ' ');
-    if (space) {
-        size_t cmd_len = space - command;
-        if (cmd_len >= sizeof(cmd_name)) cmd_len = sizeof(cmd_name) - 1;
-        strncpy(cmd_name, command, cmd_len);
-        cmd_name[cmd_len] = '\0';
-    } else {
-        strncpy(cmd_name, command, sizeof(cmd_name) - 1);
-        cmd_name[sizeof(cmd_name) - 1] = '\0';
-    }
+    extract_command_name(command, cmd_name, sizeof(cmd_name));
     
-    // Find existing command or create new entry
-    int found = -1;
-    for (int i = 0; i < command_stats_count; i++) {
-        if (command_stats[i].command && strcmp(command_stats[i].command, cmd_name) == 0) {
-            found = i;
-            break;
-        }
+    int handle = command_stats_intern(cmd_name);
+    if (handle < 0) return;
+    
+    command_stat_t *stat = &command_stats[handle];
+    if (stat->frequency == 0) {
+        // Newly tracked command counts as one successful execution
+        stat->successful_executions = 1;
     }
     
-    if (found >= 0) {
-        // Update existing command
-        command_stats[found].frequency++;
-        command_stats[found].last_used = time(NULL);
-        command_stats[found].total_executions++;
-    } else {
-        // Add new command
-        if (command_stats_count >= command_stats_capacity) {
-            // Expand array
-            command_stats_capacity *= 2;
-            command_stat_t *new_stats = realloc(command_stats, 
-                                              sizeof(command_stat_t) * command_stats_capacity);
-            if (!new_stats) {
-                fprintf(stderr, "xsh: Failed to expand command stats array\n");
-                return;
-            }
-            command_stats = new_stats;
-        }
-        
-        command_stats[command_stats_count].command = strdup(cmd_name);
-        command_stats[command_stats_count].frequency = 1;
-        command_stats[command_stats_count].last_used = time(NULL);
-        command_stats[command_stats_count].first_used = time(NULL);
-        command_stats[command_stats_count].score = 0.0;
-        command_stats[command_stats_count].success_rate = 1.0;
-        command_stats[command_stats_count].avg_execution_time = 0;
-        command_stats[command_stats_count].common_contexts = NULL;
-        command_stats[command_stats_count].context_count = 0;
-        command_stats[command_stats_count].total_executions = 1;
-        command_stats[command_stats_count].successful_executions = 1;
-        command_stats_count++;
-    }
-}
-
-// Enhanced calculate weighted scores for commands based on frequency, recency, and success rate
+    // Decay the accumulated frecency up to now before counting this use
+    time_t now = time(NULL);
+    stat->frecency = stat->frecency * exp(-difftime(now, stat->last_used) / COMMAND_SCORE_DECAY) + 1.0;
+    stat->frequency++;
+    stat->last_used = now;
+    stat->total_executions++;
+    command_stat_refresh_rank(stat);
+}
+
+// Materialize each command's score as of now: its success-weighted use count
+// with exponential recency decay. Completion ranks by rank_key directly, so
+// this is only needed for display.
 void calculate_command_scores(void) {
-    time_t current_time = time(NULL);
+    double now_key = (double)time(NULL) / COMMAND_SCORE_DECAY;
     
     for (int i = 0; i < command_stats_count; i++) {
         if (!command_stats[i].command) continue;
-        
-        double frequency_score = log(command_stats[i].frequency + 1);
-        double time_diff = difftime(current_time, command_stats[i].last_used);
-        double recency_score = exp(-time_diff / (7 * 24 * 3600)); // Decay over week
-        double success_factor = command_stats[i].success_rate;
-        double age_factor = difftime(current_time, command_stats[i].first_used) / (30 * 24 * 3600); // Age in months
-        
-        // Advanced scoring algorithm
-        command_stats[i].score = frequency_score * (1.0 + recency_score) * success_factor * (1.0 + age_factor * 0.1);
+        command_stats[i].score = exp(command_stats[i].rank_key - now_key);
     }
 }
 
-// Update command patterns for context-aware completion
+// Update command patterns for context-aware completion. Each of the 1..N
+// most recent commands forms a context whose (context, command) n-gram is
+// found or created through the hashed index.
 void update_command_patterns(const char *command) {
     if (!command || strlen(command) == 0 || recent_commands_count == 0) return;
     
-    // Create pattern from recent commands leading to this command
+    intern_id_t next_command = intern_string(command);
+    if (next_command == INTERN_NONE) return;
+    
+    time_t now = time(NULL);
     for (int seq_len = 1; seq_len <= recent_commands_count && seq_len <= MAX_COMMAND_CONTEXT; seq_len++) {
-        // Find existing pattern or create new one
-        int found = -1;
-        for (int i = 0; i < command_patterns_count; i++) {
-            if (command_patterns[i].sequence_length == seq_len &&
-                command_patterns[i].next_command &&
-                strcmp(command_patterns[i].next_command, command) == 0) {
-                
-                // Check if sequence matches
-                int match = 1;
-                for (int j = 0; j < seq_len; j++) {
-                    int idx = recent_commands_count - seq_len + j;
-                    if (idx < 0 || !recent_commands[idx] || !command_patterns[i].sequence[j] ||
-                        strcmp(recent_commands[idx], command_patterns[i].sequence[j]) != 0) {
-                        match = 0;
-                        break;
-                    }
-                }
-                if (match) {
-                    found = i;
-                    break;
-                }
-            }
+        const intern_id_t *sequence = &recent_commands[recent_commands_count - seq_len];
+        unsigned long context_hash = hash_context(sequence, seq_len);
+        
+        int handle = pattern_find(sequence, seq_len, context_hash, next_command);
+        if (handle >= 0) {
+            command_pattern_t *pattern = &command_patterns[handle];
+            pattern->weight = pattern_weight(pattern, now) + 1.0;
+            pattern->frequency++;
+            pattern->last_used = now;
+        } else if (pattern_add(sequence, seq_len, context_hash, next_command, 1, 1.0, now) < 0) {
+            return;
         }
         
-        if (found >= 0) {
-            // Update existing pattern
-            command_patterns[found].frequency++;
-            command_patterns[found].last_used = time(NULL);
-        } else {
-            // Add new pattern
-            if (command_patterns_count >= command_patterns_capacity) {
-                command_patterns_capacity *= 2;
-                command_pattern_t *new_patterns = realloc(command_patterns,
-                                                        sizeof(command_pattern_t) * command_patterns_capacity);
-                if (!new_patterns) {
-                    fprintf(stderr, "xsh: Failed to expand command patterns array\n");
-                    return;
+        update_context_confidence(pattern_context_head(sequence, seq_len, context_hash), now);
+    }
+}
+
+// Append predictions for the current context to completions, longest
+// matching context first and, within a context, by decayed weight
+static void collect_pattern_predictions(const char *input, char **completions, int *completion_count, int limit) {
+    size_t input_len = strlen(input);
+    time_t now = time(NULL);
+    int candidates[MAX_COMPLETION_SUGGESTIONS];
+    double weights[MAX_COMPLETION_SUGGESTIONS];
+    
+    if (limit > MAX_COMPLETION_SUGGESTIONS) limit = MAX_COMPLETION_SUGGESTIONS;
+    
+    int max_len = recent_commands_count < MAX_COMMAND_CONTEXT ? recent_commands_count : MAX_COMMAND_CONTEXT;
+    for (int seq_len = max_len; seq_len >= 1 && *completion_count < limit; seq_len--) {
+        const intern_id_t *sequence = &recent_commands[recent_commands_count - seq_len];
+        int head = pattern_context_head(sequence, seq_len, hash_context(sequence, seq_len));
+        
+        // Keep the best few candidates of this context, sorted by weight
+        int slots = limit - *completion_count;
+        int found = 0;
+        for (int h = head; h >= 0; h = command_patterns[h].next_in_context) {
+            const char *next = intern_str(command_patterns[h].next_command);
+            if (!next || strncmp(next, input, input_len) != 0) continue;
+            
+            int duplicate = 0;
+            for (int j = 0; j < *completion_count; j++) {
+                if (strcmp(completions[j], next) == 0) {
+                    duplicate = 1;
+                    break;
                 }
-                command_patterns = new_patterns;
             }
+            if (duplicate) continue;
             
-            command_patterns[command_patterns_count].sequence_length = seq_len;
-            for (int j = 0; j < seq_len; j++) {
-                int idx = recent_commands_count - seq_len + j;
-                if (idx >= 0 && recent_commands[idx]) {
-                    command_patterns[command_patterns_count].sequence[j] = strdup(recent_commands[idx]);
-                }
+            double weight = pattern_weight(&command_patterns[h], now);
+            if (found == slots && weight <= weights[found - 1]) continue;
+            
+            int pos = (found < slots) ? found++ : slots - 1;
+            while (pos > 0 && weights[pos - 1] < weight) {
+                weights[pos] = weights[pos - 1];
+                candidates[pos] = candidates[pos - 1];
+                pos--;
+            }
+            weights[pos] = weight;
+            candidates[pos] = h;
+        }
+        
+        for (int i = 0; i < found; i++) {
+            char *completion = strdup(intern_str(command_patterns[candidates[i]].next_command));
+            if (completion) {
+                completions[(*completion_count)++] = completion;
             }
-            command_patterns[command_patterns_count].next_command = strdup(command);
-            command_patterns[command_patterns_count].frequency = 1;
-            command_patterns[command_patterns_count].last_used = time(NULL);
-            command_patterns_count++;
         }
     }
 }
 
+// Durations are bucketed HDR-style: values below DURATION_SUB_BUCKETS get a
+// bucket each, then every power of two is split into DURATION_SUB_BUCKETS
+// linear buckets, bounding the relative error at any magnitude.
+static int duration_bucket_index(long ms) {
+    unsigned long value = ms > 0 ? (unsigned long)ms : 0;
+    if (value > 0x7FFFFFFFUL) value = 0x7FFFFFFFUL;
+    if (value < DURATION_SUB_BUCKETS) return (int)value;
+    
+    int magnitude = 0; // floor(log2(value))
+    for (unsigned long v = value; v > 1; v >>= 1) magnitude++;
+    
+    int shift = magnitude - 4; // log2(DURATION_SUB_BUCKETS)
+    return DURATION_SUB_BUCKETS + shift * DURATION_SUB_BUCKETS +
+           (int)((value >> shift) - DURATION_SUB_BUCKETS);
+}
+
+// Representative duration (ms) of a bucket: the middle of its range
+static long duration_bucket_value(int index) {
+    if (index < DURATION_SUB_BUCKETS) return index;
+    
+    int shift = (index - DURATION_SUB_BUCKETS) / DURATION_SUB_BUCKETS;
+    long low = (long)(DURATION_SUB_BUCKETS + (index - DURATION_SUB_BUCKETS) % DURATION_SUB_BUCKETS) << shift;
+    return low + ((1L << shift) - 1) / 2;
+}
+
 // Learn from command execution results
-void learn_from_command_execution(const char *command, int success, long execution_time) {
+void learn_from_command_execution(const char *command, int success, long execution_time,
+                                  const command_usage_t *usage) {
     if (!command || strlen(command) == 0) return;
     
-    // Extract command name
     char cmd_name[256];
-    const char *space = strchr(command, ' ');
-    if (space) {
-        size_t cmd_len = space - command;
-        if (cmd_len >= sizeof(cmd_name)) cmd_len = sizeof(cmd_name) - 1;
-        strncpy(cmd_name, command, cmd_len);
-        cmd_name[cmd_len] = '\0';
-    } else {
-        strncpy(cmd_name, command, sizeof(cmd_name) - 1);
-        cmd_name[sizeof(cmd_name) - 1] = '\0';
+    extract_command_name(command, cmd_name, sizeof(cmd_name));
+    
+    int handle = command_stats_find(cmd_name);
+    if (handle < 0) return;
+    
+    command_stat_t *stat = &command_stats[handle];
+    if (success) {
+        stat->successful_executions++;
+    }
+    stat->total_executions++;
+    stat->success_rate = (double)stat->successful_executions / stat->total_executions;
+    command_stat_refresh_rank(stat);
+    
+    // Fold the timing sample into the running aggregates
+    if (usage) {
+        if (execution_time < 0) execution_time = 0;
+        stat->measured_executions++;
+        double delta = execution_time - stat->mean_execution_time;
+        stat->mean_execution_time += delta / stat->measured_executions;
+        stat->m2_execution_time += delta * (execution_time - stat->mean_execution_time);
+        stat->avg_execution_time = (long)(stat->mean_execution_time + 0.5);
+        
+        if (!stat->duration_histogram) {
+            stat->duration_histogram = calloc(DURATION_BUCKETS, sizeof(unsigned int));
+        }
+        if (stat->duration_histogram) {
+            stat->duration_histogram[duration_bucket_index(execution_time)]++;
+        }
+        
+        stat->total_user_time_us += usage->user_time_us;
+        stat->total_sys_time_us += usage->sys_time_us;
+        if (usage->max_rss_kb > stat->max_rss_kb) {
+            stat->max_rss_kb = usage->max_rss_kb;
+        }
     }
+}
+
+// Sample standard deviation of a command's execution time (ms)
+double command_duration_stddev(const command_stat_t *stat) {
+    if (stat->measured_executions < 2) return 0.0;
+    return sqrt(stat->m2_execution_time / (stat->measured_executions - 1));
+}
+
+// Estimate a percentile (0-100) of a command's execution time (ms) from its
+// histogram; accurate to the bucket width, about 6% of the value
+long command_duration_percentile(const command_stat_t *stat, double percentile) {
+    if (!stat->duration_histogram) return 0;
     
-    // Find command stats
-    for (int i = 0; i < command_stats_count; i++) {
-        if (command_stats[i].command && strcmp(command_stats[i].command, cmd_name) == 0) {
-            if (success) {
-                command_stats[i].successful_executions++;
-            }
-            command_stats[i].total_executions++;
-            command_stats[i].success_rate = (double)command_stats[i].successful_executions / 
-                                          command_stats[i].total_executions;
-            
-            // Update average execution time
-            if (execution_time > 0) {
-                if (command_stats[i].avg_execution_time == 0) {
-                    command_stats[i].avg_execution_time = execution_time;
-                } else {
-                    command_stats[i].avg_execution_time = 
-                        (command_stats[i].avg_execution_time + execution_time) / 2;
-                }
-            }
-            break;
-        }
+    unsigned long total = 0;
+    for (int b = 0; b < DURATION_BUCKETS; b++) {
+        total += stat->duration_histogram[b];
+    }
+    if (total == 0) return 0;
+    
+    unsigned long rank = (unsigned long)ceil(percentile / 100.0 * total);
+    if (rank < 1) rank = 1;
+    
+    unsigned long seen = 0;
+    for (int b = 0; b < DURATION_BUCKETS; b++) {
+        seen += stat->duration_histogram[b];
+        if (seen >= rank) return duration_bucket_value(b);
     }
+    return duration_bucket_value(DURATION_BUCKETS - 1);
 }
 
 // Smart completion engine with multiple strategies
@@ -684,78 +2288,39 @@ char **get_adaptive_completions(const char *input, int *completion_count) {
     char **completions = malloc(sizeof(char*) * MAX_COMPLETION_SUGGESTIONS);
     if (!completions) return NULL;
     
-    // Strategy 1: Exact prefix matching with frequency ranking
-    calculate_command_scores();
-    for (int i = 0; i < command_stats_count && *completion_count < MAX_COMPLETION_SUGGESTIONS / 2; i++) {
-        if (command_stats[i].command && strncmp(command_stats[i].command, input, strlen(input)) == 0) {
-            // Check for duplicates
-            int duplicate = 0;
-            for (int j = 0; j < *completion_count; j++) {
-                if (strcmp(completions[j], command_stats[i].command) == 0) {
-                    duplicate = 1;
-                    break;
-                }
-            }
-            if (!duplicate) {
-                completions[*completion_count] = strdup(command_stats[i].command);
-                (*completion_count)++;
-            }
+    // Strategy 1: Best-ranked commands with this prefix (names are unique)
+    int top[MAX_COMPLETION_SUGGESTIONS / 2];
+    int top_count = command_stats_top_k(input, top, MAX_COMPLETION_SUGGESTIONS / 2);
+    for (int i = 0; i < top_count; i++) {
+        char *completion = strdup(intern_str(command_stats[top[i]].command));
+        if (completion) {
+            completions[(*completion_count)++] = completion;
         }
     }
     
     // Strategy 2: Pattern-based predictions
     if (*completion_count < MAX_COMPLETION_SUGGESTIONS / 2) {
-        for (int i = 0; i < command_patterns_count && *completion_count < MAX_COMPLETION_SUGGESTIONS; i++) {
-            if (command_patterns[i].next_command && 
-                strncmp(command_patterns[i].next_command, input, strlen(input)) == 0) {
-                
-                // Check if current context matches pattern
-                int context_match = 1;
-                if (recent_commands_count >= command_patterns[i].sequence_length) {
-                    for (int j = 0; j < command_patterns[i].sequence_length; j++) {
-                        int idx = recent_commands_count - command_patterns[i].sequence_length + j;
-                        if (idx < 0 || !recent_commands[idx] || !command_patterns[i].sequence[j] ||
-                            strcmp(recent_commands[idx], command_patterns[i].sequence[j]) != 0) {
-                            context_match = 0;
-                            break;
-                        }
-                    }
-                }
-                
-                if (context_match) {
-                    // Check for duplicates
-                    int duplicate = 0;
-                    for (int j = 0; j < *completion_count; j++) {
-                        if (strcmp(completions[j], command_patterns[i].next_command) == 0) {
-                            duplicate = 1;
-                            break;
-                        }
-                    }
-                    if (!duplicate) {
-                        completions[*completion_count] = strdup(command_patterns[i].next_command);
-                        (*completion_count)++;
-                    }
-                }
-            }
-        }
+        collect_pattern_predictions(input, completions, completion_count, MAX_COMPLETION_SUGGESTIONS);
     }
     
-    // Strategy 3: Fill remaining slots with history-based suggestions
+    // Strategy 3: Fill remaining slots with recent history-based suggestions
     if (*completion_count < MAX_COMPLETION_SUGGESTIONS) {
-        for (int i = enhanced_history_count - 1; i >= 0 && *completion_count < MAX_COMPLETION_SUGGESTIONS; i--) {
-            if (enhanced_history[i].command && 
-                strncmp(enhanced_history[i].command, input, strlen(input)) == 0) {
+        int oldest = enhanced_history_count > COMPLETION_HISTORY_SCAN_LIMIT ?
+                     enhanced_history_count - COMPLETION_HISTORY_SCAN_LIMIT : 0;
+        for (int i = enhanced_history_count - 1; i >= oldest && *completion_count < MAX_COMPLETION_SUGGESTIONS; i--) {
+            const char *command = intern_str(enhanced_history[i].command);
+            if (command && strncmp(command, input, strlen(input)) == 0) {
                 
                 // Check for duplicates
                 int duplicate = 0;
                 for (int j = 0; j < *completion_count; j++) {
-                    if (strcmp(completions[j], enhanced_history[i].command) == 0) {
+                    if (strcmp(completions[j], command) == 0) {
                         duplicate = 1;
                         break;
                     }
                 }
                 if (!duplicate) {
-                    completions[*completion_count] = strdup(enhanced_history[i].command);
+                    completions[*completion_count] = strdup(command);
                     (*completion_count)++;
                 }
             }
@@ -773,30 +2338,8 @@ char **get_context_aware_completions(const char *input, int *completion_count) {
     char **completions = malloc(sizeof(char*) * MAX_COMPLETION_SUGGESTIONS);
     if (!completions) return NULL;
     
-    // Look for patterns that match current context
-    for (int i = 0; i < command_patterns_count && *completion_count < MAX_COMPLETION_SUGGESTIONS; i++) {
-        if (!command_patterns[i].next_command) continue;
-        
-        // Check if pattern sequence matches recent commands
-        int context_match = 1;
-        if (recent_commands_count >= command_patterns[i].sequence_length) {
-            for (int j = 0; j < command_patterns[i].sequence_length; j++) {
-                int idx = recent_commands_count - command_patterns[i].sequence_length + j;
-                if (idx < 0 || !recent_commands[idx] || !command_patterns[i].sequence[j] ||
-                    strcmp(recent_commands[idx], command_patterns[i].sequence[j]) != 0) {
-                    context_match = 0;
-                    break;
-                }
-            }
-        } else {
-            context_match = 0;
-        }
-        
-        if (context_match && strncmp(command_patterns[i].next_command, input, strlen(input)) == 0) {
-            completions[*completion_count] = strdup(command_patterns[i].next_command);
-            (*completion_count)++;
-        }
-    }
+    // Look up what followed the current context, longest context first
+    collect_pattern_predictions(input, completions, completion_count, MAX_COMPLETION_SUGGESTIONS);
     
     return completions;
 }
@@ -823,22 +2366,28 @@ char **get_directory_based_suggestions(const char *input, int *completion_count)
     }
 #endif
     
-    // Look for commands that were executed in this directory
-    for (int i = enhanced_history_count - 1; i >= 0 && *completion_count < MAX_COMPLETION_SUGGESTIONS; i--) {
-        if (enhanced_history[i].command && enhanced_history[i].cwd &&
-            strcmp(enhanced_history[i].cwd, current_dir) == 0 &&
-            strncmp(enhanced_history[i].command, input, strlen(input)) == 0) {
+    // Look for commands recently executed in this directory. A directory that
+    // was never interned has no history, and matching IDs means equal paths.
+    intern_id_t cwd = intern_lookup(current_dir);
+    if (cwd == INTERN_NONE) return completions;
+    
+    int oldest = enhanced_history_count > COMPLETION_HISTORY_SCAN_LIMIT ?
+                 enhanced_history_count - COMPLETION_HISTORY_SCAN_LIMIT : 0;
+    for (int i = enhanced_history_count - 1; i >= oldest && *completion_count < MAX_COMPLETION_SUGGESTIONS; i--) {
+        if (enhanced_history[i].cwd != cwd) continue;
+        const char *command = intern_str(enhanced_history[i].command);
+        if (command && strncmp(command, input, strlen(input)) == 0) {
             
             // Check for duplicates
             int duplicate = 0;
             for (int j = 0; j < *completion_count; j++) {
-                if (strcmp(completions[j], enhanced_history[i].command) == 0) {
+                if (strcmp(completions[j], command) == 0) {
                     duplicate = 1;
                     break;
                 }
             }
             if (!duplicate) {
-                completions[*completion_count] = strdup(enhanced_history[i].command);
+                completions[*completion_count] = strdup(command);
                 (*completion_count)++;
             }
         }
@@ -847,6 +2396,54 @@ char **get_directory_based_suggestions(const char *input, int *completion_count)
     return completions;
 }
 
+// qsort comparators: highest score / frequency first
+static int compare_stats_by_score(const void *a, const void *b) {
+    double sa = ((const command_stat_t *)a)->score;
+    double sb = ((const command_stat_t *)b)->score;
+    return (sa < sb) - (sa > sb);
+}
+
+static int compare_stats_by_frequency(const void *a, const void *b) {
+    return ((const command_stat_t *)b)->frequency - ((const command_stat_t *)a)->frequency;
+}
+
+static int compare_stats_by_measured(const void *a, const void *b) {
+    return ((const command_stat_t *)b)->measured_executions - ((const command_stat_t *)a)->measured_executions;
+}
+
+// Memory held by history and analytics data. Records are fixed-size, so
+// everything except the interned strings and histograms is capacity * size.
+static void display_analytics_memory(void) {
+    intern_stats_t strings;
+    intern_get_stats(&strings);
+    
+    size_t histograms = 0;
+    for (int i = 0; i < command_stats_count; i++) {
+        if (command_stats[i].duration_histogram) {
+            histograms += sizeof(unsigned int) * DURATION_BUCKETS;
+        }
+    }
+    size_t entries = sizeof(history_entry_t) * (size_t)enhanced_history_capacity;
+    size_t stats = sizeof(command_stat_t) * (size_t)command_stats_capacity + histograms;
+    size_t stats_index = sizeof(int) * ((size_t)command_stats_by_id_capacity + (size_t)command_prefix_index_capacity);
+    size_t patterns = sizeof(command_pattern_t) * (size_t)command_patterns_capacity;
+    size_t patterns_index = sizeof(int) * 2 * (size_t)pattern_index_capacity;
+    size_t total = strings.arena_bytes + strings.index_bytes + entries + stats + stats_index +
+                   patterns + patterns_index;
+    
+    printf("\n--- Memory ---\n");
+    printf("Interned Strings: %zu (%.1f KB data in %.1f KB arena, %.1f KB index, %zu allocations)\n",
+           strings.strings, strings.string_bytes / 1024.0, strings.arena_bytes / 1024.0,
+           strings.index_bytes / 1024.0, strings.allocations);
+    printf("History Records:  %d x %zu bytes (%.1f KB reserved)\n",
+           enhanced_history_count, sizeof(history_entry_t), entries / 1024.0);
+    printf("Command Stats:    %d x %zu bytes (%.1f KB with histograms, %.1f KB index)\n",
+           command_stats_count, sizeof(command_stat_t), stats / 1024.0, stats_index / 1024.0);
+    printf("Command Patterns: %d x %zu bytes (%.1f KB reserved, %.1f KB index)\n",
+           command_patterns_count, sizeof(command_pattern_t), patterns / 1024.0, patterns_index / 1024.0);
+    printf("Total:            %.1f KB\n", total / 1024.0);
+}
+
 // Analytics and reporting functions
 void display_performance_analytics(void) {
     printf("\n=== XShell Performance Analytics ===\n");
@@ -863,25 +2460,29 @@ void display_performance_analytics(void) {
     if (sorted_commands) {
         memcpy(sorted_commands, command_stats, sizeof(command_stat_t) * command_stats_count);
         
-        // Simple bubble sort by score
-        for (int i = 0; i < command_stats_count - 1; i++) {
-            for (int j = 0; j < command_stats_count - i - 1; j++) {
-                if (sorted_commands[j].score < sorted_commands[j + 1].score) {
-                    command_stat_t temp = sorted_commands[j];
-                    sorted_commands[j] = sorted_commands[j + 1];
-                    sorted_commands[j + 1] = temp;
-                }
-            }
-        }
+        qsort(sorted_commands, command_stats_count, sizeof(command_stat_t), compare_stats_by_score);
         
         int display_count = (command_stats_count < 10) ? command_stats_count : 10;
         for (int i = 0; i < display_count; i++) {
             if (sorted_commands[i].command) {
                 printf("%2d. %-15s (freq: %3d, score: %.2f, success: %.1f%%)\n",
-                       i + 1, sorted_commands[i].command, sorted_commands[i].frequency,
+                       i + 1, intern_str(sorted_commands[i].command), sorted_commands[i].frequency,
                        sorted_commands[i].score, sorted_commands[i].success_rate * 100);
             }
         }
+        
+        // Duration distribution of the most frequently timed commands
+        qsort(sorted_commands, command_stats_count, sizeof(command_stat_t), compare_stats_by_measured);
+        printf("\n--- Execution Times (ms) ---\n");
+        printf("    %-15s %6s %8s %8s %7s %7s %7s\n", "Command", "Runs", "Mean", "StdDev", "p50", "p95", "p99");
+        for (int i = 0; i < command_stats_count && i < 10; i++) {
+            const command_stat_t *stat = &sorted_commands[i];
+            if (!stat->command || stat->measured_executions == 0) break;
+            printf("%2d. %-15s %6d %8.1f %8.1f %7ld %7ld %7ld\n",
+                   i + 1, intern_str(stat->command), stat->measured_executions, stat->mean_execution_time,
+                   command_duration_stddev(stat), command_duration_percentile(stat, 50),
+                   command_duration_percentile(stat, 95), command_duration_percentile(stat, 99));
+        }
         free(sorted_commands);
     }
     
@@ -892,10 +2493,10 @@ void display_performance_analytics(void) {
             printf("Pattern %d (freq: %d): ", i + 1, command_patterns[i].frequency);
             for (int j = 0; j < command_patterns[i].sequence_length; j++) {
                 if (command_patterns[i].sequence[j]) {
-                    printf("%s -> ", command_patterns[i].sequence[j]);
+                    printf("%s -> ", intern_str(command_patterns[i].sequence[j]));
                 }
             }
-            printf("%s\n", command_patterns[i].next_command);
+            printf("%s\n", intern_str(command_patterns[i].next_command));
         }
     }
     
@@ -904,12 +2505,18 @@ void display_performance_analytics(void) {
     int start = (enhanced_history_count > 10) ? enhanced_history_count - 10 : 0;
     for (int i = start; i < enhanced_history_count; i++) {
         if (enhanced_history[i].command) {
-            struct tm *tm_info = localtime(&enhanced_history[i].timestamp);
-            printf("%2d. [%02d:%02d:%02d] %s\n", 
+            const history_entry_t *entry = &enhanced_history[i];
+            struct tm *tm_info = localtime(&entry->timestamp);
+            printf("%2d. [%02d:%02d:%02d] %-20s (wall: %ldms, user: %.1fms, sys: %.1fms, rss: %ldKB, csw: %ld/%ld)\n",
                    i - start + 1, tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec,
-                   enhanced_history[i].command);
+                   intern_str(entry->command), entry->execution_time_ms,
+                   entry->usage.user_time_us / 1000.0, entry->usage.sys_time_us / 1000.0,
+                   entry->usage.max_rss_kb, entry->usage.voluntary_switches,
+                   entry->usage.involuntary_switches);
         }
     }
+    
+    display_analytics_memory();
     printf("\n");
 }
 
@@ -920,25 +2527,37 @@ void display_command_stats(const char *command) {
     }
     
     // Find specific command stats
-    for (int i = 0; i < command_stats_count; i++) {
-        if (command_stats[i].command && strcmp(command_stats[i].command, command) == 0) {
-            printf("\n=== Statistics for '%s' ===\n", command);
-            printf("Frequency: %d\n", command_stats[i].frequency);
-            printf("Success Rate: %.1f%%\n", command_stats[i].success_rate * 100);
-            printf("Average Execution Time: %ldms\n", command_stats[i].avg_execution_time);
-            
-            struct tm *first_tm = localtime(&command_stats[i].first_used);
-            struct tm *last_tm = localtime(&command_stats[i].last_used);
-            printf("First Used: %04d-%02d-%02d %02d:%02d:%02d\n",
-                   first_tm->tm_year + 1900, first_tm->tm_mon + 1, first_tm->tm_mday,
-                   first_tm->tm_hour, first_tm->tm_min, first_tm->tm_sec);
-            printf("Last Used: %04d-%02d-%02d %02d:%02d:%02d\n",
-                   last_tm->tm_year + 1900, last_tm->tm_mon + 1, last_tm->tm_mday,
-                   last_tm->tm_hour, last_tm->tm_min, last_tm->tm_sec);
-            printf("Score: %.2f\n", command_stats[i].score);
-            printf("\n");
-            return;
+    int i = command_stats_find(command);
+    if (i >= 0) {
+        printf("\n=== Statistics for '%s' ===\n", command);
+        printf("Frequency: %d\n", command_stats[i].frequency);
+        printf("Success Rate: %.1f%%\n", command_stats[i].success_rate * 100);
+        printf("Average Execution Time: %ldms\n", command_stats[i].avg_execution_time);
+        if (command_stats[i].measured_executions > 0) {
+            int n = command_stats[i].measured_executions;
+            printf("Execution Time: mean %.1fms, stddev %.1fms over %d runs\n",
+                   command_stats[i].mean_execution_time, command_duration_stddev(&command_stats[i]), n);
+            printf("Percentiles: p50 %ldms, p95 %ldms, p99 %ldms\n",
+                   command_duration_percentile(&command_stats[i], 50),
+                   command_duration_percentile(&command_stats[i], 95),
+                   command_duration_percentile(&command_stats[i], 99));
+            printf("Average CPU Time: %.1fms user, %.1fms sys\n",
+                   command_stats[i].total_user_time_us / 1000.0 / n,
+                   command_stats[i].total_sys_time_us / 1000.0 / n);
+            printf("Peak Memory: %ldKB\n", command_stats[i].max_rss_kb);
         }
+        
+        struct tm *first_tm = localtime(&command_stats[i].first_used);
+        struct tm *last_tm = localtime(&command_stats[i].last_used);
+        printf("First Used: %04d-%02d-%02d %02d:%02d:%02d\n",
+               first_tm->tm_year + 1900, first_tm->tm_mon + 1, first_tm->tm_mday,
+               first_tm->tm_hour, first_tm->tm_min, first_tm->tm_sec);
+        printf("Last Used: %04d-%02d-%02d %02d:%02d:%02d\n",
+               last_tm->tm_year + 1900, last_tm->tm_mon + 1, last_tm->tm_mday,
+               last_tm->tm_hour, last_tm->tm_min, last_tm->tm_sec);
+        printf("Score: %.2f\n", command_stats[i].score);
+        printf("\n");
+        return;
     }
     
     printf("No statistics found for command: %s\n", command);
@@ -948,48 +2567,44 @@ void display_command_stats(const char *command) {
 void clear_analytics_data(void) {
     // Clear command stats
     for (int i = 0; i < command_stats_count; i++) {
-        if (command_stats[i].command) {
-            free(command_stats[i].command);
-        }
-        if (command_stats[i].common_contexts) {
-            for (int j = 0; j < command_stats[i].context_count; j++) {
-                free(command_stats[i].common_contexts[j]);
-            }
-            free(command_stats[i].common_contexts);
-        }
+        free(command_stats[i].duration_histogram);
     }
     free(command_stats);
     command_stats = NULL;
     command_stats_count = 0;
     command_stats_capacity = 0;
+    command_stats_index_free();
     
     // Clear command patterns
-    for (int i = 0; i < command_patterns_count; i++) {
-        for (int j = 0; j < command_patterns[i].sequence_length; j++) {
-            if (command_patterns[i].sequence[j]) {
-                free(command_patterns[i].sequence[j]);
-            }
-        }
-        if (command_patterns[i].next_command) {
-            free(command_patterns[i].next_command);
-        }
-    }
-    free(command_patterns);
-    command_patterns = NULL;
-    command_patterns_count = 0;
-    command_patterns_capacity = 0;
+    free_command_patterns();
     
     // Clear recent commands
-    for (int i = 0; i < recent_commands_count; i++) {
-        if (recent_commands[i]) {
-            free(recent_commands[i]);
-        }
-    }
     recent_commands_count = 0;
     
     printf("Analytics data cleared.\n");
 }
 
+// Move the strings of a completion list into completions, skipping
+// duplicates, and free whatever was not taken along with the list
+static void merge_completions(char **completions, int *match_count, char **extra, int extra_count) {
+    if (!extra) return;
+    
+    for (int i = 0; i < extra_count; i++) {
+        int skip = *match_count >= MAX_COMPLETION_SUGGESTIONS;
+        for (int j = 0; j < *match_count && !skip; j++) {
+            if (strcmp(completions[j], extra[i]) == 0) {
+                skip = 1; // Duplicate
+            }
+        }
+        if (skip) {
+            free(extra[i]);
+        } else {
+            completions[(*match_count)++] = extra[i];
+        }
+    }
+    free(extra);
+}
+
 // Smart completion function - integrates all completion strategies
 char** get_smart_completions(const char *partial, int *match_count) {
     if (!partial || !match_count) return NULL;
@@ -999,58 +2614,22 @@ char** get_smart_completions(const char *partial, int *match_count) {
     if (!completions) return NULL;
     
     // Strategy 1: Use adaptive completions (primary strategy)
-    char **adaptive = get_adaptive_completions(partial, match_count);
-    if (adaptive && *match_count > 0) {
-        for (int i = 0; i < *match_count && i < MAX_COMPLETION_SUGGESTIONS; i++) {
-            completions[i] = strdup(adaptive[i]);
-        }
-        free(adaptive);
-    }
+    int adaptive_count = 0;
+    char **adaptive = get_adaptive_completions(partial, &adaptive_count);
+    merge_completions(completions, match_count, adaptive, adaptive_count);
     
     // Strategy 2: Add context-aware completions if we have space
     if (*match_count < MAX_COMPLETION_SUGGESTIONS) {
         int context_count = 0;
         char **context_completions = get_context_aware_completions(partial, &context_count);
-        if (context_completions) {
-            for (int i = 0; i < context_count && *match_count < MAX_COMPLETION_SUGGESTIONS; i++) {
-                // Check for duplicates
-                int duplicate = 0;
-                for (int j = 0; j < *match_count; j++) {
-                    if (strcmp(completions[j], context_completions[i]) == 0) {
-                        duplicate = 1;
-                        break;
-                    }
-                }
-                if (!duplicate) {
-                    completions[*match_count] = strdup(context_completions[i]);
-                    (*match_count)++;
-                }
-            }
-            free(context_completions);
-        }
+        merge_completions(completions, match_count, context_completions, context_count);
     }
     
     // Strategy 3: Add directory-based suggestions
     if (*match_count < MAX_COMPLETION_SUGGESTIONS) {
         int dir_count = 0;
         char **dir_completions = get_directory_based_suggestions(partial, &dir_count);
-        if (dir_completions) {
-            for (int i = 0; i < dir_count && *match_count < MAX_COMPLETION_SUGGESTIONS; i++) {
-                // Check for duplicates
-                int duplicate = 0;
-                for (int j = 0; j < *match_count; j++) {
-                    if (strcmp(completions[j], dir_completions[i]) == 0) {
-                        duplicate = 1;
-                        break;
-                    }
-                }
-                if (!duplicate) {
-                    completions[*match_count] = strdup(dir_completions[i]);
-                    (*match_count)++;
-                }
-            }
-            free(dir_completions);
-        }
+        merge_completions(completions, match_count, dir_completions, dir_count);
     }
     
     return completions;
@@ -1074,23 +2653,14 @@ char** get_frequent_commands(int *count) {
     
     memcpy(sorted, command_stats, sizeof(command_stat_t) * command_stats_count);
     
-    // Simple bubble sort by frequency
-    for (int i = 0; i < command_stats_count - 1; i++) {
-        for (int j = 0; j < command_stats_count - i - 1; j++) {
-            if (sorted[j].frequency < sorted[j + 1].frequency) {
-                command_stat_t temp = sorted[j];
-                sorted[j] = sorted[j + 1];
-                sorted[j + 1] = temp;
-            }
-        }
-    }
+    qsort(sorted, command_stats_count, sizeof(command_stat_t), compare_stats_by_frequency);
     
     // Return top commands
     int max_return = (command_stats_count < MAX_COMPLETION_SUGGESTIONS) ? 
                      command_stats_count : MAX_COMPLETION_SUGGESTIONS;
     for (int i = 0; i < max_return; i++) {
         if (sorted[i].command) {
-            frequent[*count] = strdup(sorted[i].command);
+            frequent[*count] = strdup(intern_str(sorted[i].command));
             (*count)++;
         }
     }
@@ -1113,7 +2683,7 @@ char** get_recent_commands(int *count) {
     
     for (int i = enhanced_history_count - 1; i >= start; i--) {
         if (enhanced_history[i].command) {
-            recent[*count] = strdup(enhanced_history[i].command);
+            recent[*count] = strdup(intern_str(enhanced_history[i].command));
             (*count)++;
         }
     }
@@ -1129,12 +2699,14 @@ char** get_successful_commands(const char *partial, int *match_count) {
     char **successful = malloc(sizeof(char*) * MAX_COMPLETION_SUGGESTIONS);
     if (!successful) return NULL;
     
-    // Find commands with high success rate that match partial
-    for (int i = 0; i < command_stats_count && *match_count < MAX_COMPLETION_SUGGESTIONS; i++) {
-        if (command_stats[i].command && 
-            command_stats[i].success_rate > 0.8 && // 80% success rate threshold
-            strncmp(command_stats[i].command, partial, strlen(partial)) == 0) {
-            successful[*match_count] = strdup(command_stats[i].command);
+    // Find commands with high success rate within the partial's prefix range
+    size_t partial_len = strlen(partial);
+    int end = command_stats_count ? command_prefix_bound(partial, partial_len, 1) : 0;
+    for (int i = command_stats_count ? command_prefix_bound(partial, partial_len, 0) : 0;
+         i < end && *match_count < MAX_COMPLETION_SUGGESTIONS; i++) {
+        const command_stat_t *stat = &command_stats[command_prefix_index[i]];
+        if (stat->success_rate > 0.8) { // 80% success rate threshold
+            successful[*match_count] = strdup(intern_str(stat->command));
             (*match_count)++;
         }
     }
@@ -1154,21 +2726,18 @@ double calculate_command_relevance_score(const char *command, const char *partia
     }
     
     // Find command in stats for additional scoring
-    for (int i = 0; i < command_stats_count; i++) {
-        if (command_stats[i].command && strcmp(command_stats[i].command, command) == 0) {
-            // Frequency component (0-5 points)
-            score += (command_stats[i].frequency / 100.0) * 5.0;
-            
-            // Success rate component (0-3 points)
-            score += command_stats[i].success_rate * 3.0;
-            
-            // Recency component (0-2 points)
-            time_t now = time(NULL);
-            double days_ago = (now - command_stats[i].last_used) / (24.0 * 3600.0);
-            score += (days_ago < 1.0) ? 2.0 : (days_ago < 7.0) ? 1.0 : 0.0;
-            
-            break;
-        }
+    int i = command_stats_find(command);
+    if (i >= 0) {
+        // Frequency component (0-5 points)
+        score += (command_stats[i].frequency / 100.0) * 5.0;
+        
+        // Success rate component (0-3 points)
+        score += command_stats[i].success_rate * 3.0;
+        
+        // Recency component (0-2 points)
+        time_t now = time(NULL);
+        double days_ago = (now - command_stats[i].last_used) / (24.0 * 3600.0);
+        score += (days_ago < 1.0) ? 2.0 : (days_ago < 7.0) ? 1.0 : 0.0;
     }
     
     return score;
@@ -1192,11 +2761,11 @@ void analyze_command_patterns(void) {
             printf("  Sequence: ");
             for (int j = 0; j < command_patterns[i].sequence_length; j++) {
                 if (command_patterns[i].sequence[j]) {
-                    printf("%s", command_patterns[i].sequence[j]);
+                    printf("%s", intern_str(command_patterns[i].sequence[j]));
                     if (j < command_patterns[i].sequence_length - 1) printf(" -> ");
                 }
             }
-            printf(" -> %s\n", command_patterns[i].next_command);
+            printf(" -> %s\n", intern_str(command_patterns[i].next_command));
             printf("  Confidence: %.1f%%\n", command_patterns[i].confidence * 100);
         }
     }
@@ -1294,17 +2863,18 @@ char** get_time_based_suggestions(int hour_of_day, int *match_count) {
     // Find commands commonly used at this hour
     for (int i = 0; i < enhanced_history_count && *match_count < MAX_COMPLETION_SUGGESTIONS; i++) {
         struct tm *tm_info = localtime(&enhanced_history[i].timestamp);
-        if (tm_info->tm_hour == hour_of_day) {
+        const char *command = intern_str(enhanced_history[i].command);
+        if (command && tm_info->tm_hour == hour_of_day) {
             // Check for duplicates
             int duplicate = 0;
             for (int j = 0; j < *match_count; j++) {
-                if (strcmp(suggestions[j], enhanced_history[i].command) == 0) {
+                if (strcmp(suggestions[j], command) == 0) {
                     duplicate = 1;
                     break;
                 }
             }
-            if (!duplicate && enhanced_history[i].command) {
-                suggestions[*match_count] = strdup(enhanced_history[i].command);
+            if (!duplicate) {
+                suggestions[*match_count] = strdup(command);
                 (*match_count)++;
             }
         }
@@ -0,0 +1,531 @@
+#ifndef _WIN32
+#define _DEFAULT_SOURCE // For fsync(), flock() and clock_gettime()
+#endif
+
+#include "history_writer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h> // For _commit
+#include <sys/stat.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/file.h> // For flock
+#include <sys/stat.h>
+#endif
+
+typedef struct {
+    history_writer_target_t target;
+    char *record;
+    size_t length;
+} history_writer_slot_t;
+
+// Single-producer/single-consumer ring. Only the shell advances queue_tail and
+// only the writer advances queue_head, so handing over a record takes no lock.
+// The writer moves queue_head past a batch once it is written, which is also
+// what history_writer_flush() waits for.
+static history_writer_slot_t queue[HISTORY_WRITER_QUEUE_SIZE];
+static atomic_size_t queue_head;
+static atomic_size_t queue_tail;
+static atomic_int writer_idle;     // Writer is parked waiting for records
+static atomic_int writer_stopping;
+static int writer_running = 0;
+
+// Target files, owned by the writer thread while it runs. Raw descriptors
+// rather than FILE handles, so a writer stuck in write() holds no stdio lock
+// that exit() would block on when flushing streams.
+typedef struct {
+    char path[1024];
+    int fd; // -1 when closed
+    history_file_id_t id;
+    int sync_interval;
+    int unsynced;
+
+    // Ranges appended by this session, handed back to the shell through a
+    // second single-producer/single-consumer ring running the other way
+    history_written_range_t ranges[HISTORY_WRITER_RANGES];
+    atomic_size_t ranges_head;
+    atomic_size_t ranges_tail;
+} history_writer_file_t;
+
+static history_writer_file_t targets[HISTORY_WRITER_TARGETS] = {{.fd = -1}, {.fd = -1}};
+
+// The lock and condition variables are only used to park and wake threads;
+// the queue itself never needs them
+#ifdef _WIN32
+static HANDLE writer_thread = NULL;
+static CRITICAL_SECTION writer_lock;
+static CONDITION_VARIABLE writer_wake;
+static CONDITION_VARIABLE writer_drained;
+#else
+static pthread_t writer_thread;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t writer_drained = PTHREAD_COND_INITIALIZER;
+#endif
+
+static void writer_lock_acquire(void) {
+#ifdef _WIN32
+    EnterCriticalSection(&writer_lock);
+#else
+    pthread_mutex_lock(&writer_lock);
+#endif
+}
+
+static void writer_lock_release(void) {
+#ifdef _WIN32
+    LeaveCriticalSection(&writer_lock);
+#else
+    pthread_mutex_unlock(&writer_lock);
+#endif
+}
+
+// Wake the writer if it is parked
+static void writer_wake_up(void) {
+    if (!atomic_load(&writer_idle)) return;
+    writer_lock_acquire();
+#ifdef _WIN32
+    WakeConditionVariable(&writer_wake);
+#else
+    pthread_cond_signal(&writer_wake);
+#endif
+    writer_lock_release();
+}
+
+int history_file_lock(int fd, int exclusive, int wait) {
+#ifdef _WIN32
+    // Byte-range locks are mandatory on Windows, so lock a byte far past the
+    // end of the file rather than the data itself
+    HANDLE handle = (HANDLE)_get_osfhandle(fd);
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = 0xFFFFFFFE;
+    overlapped.OffsetHigh = 0x7FFFFFFF;
+    DWORD flags = (exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0) | (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY);
+    return LockFileEx(handle, flags, 0, 1, 0, &overlapped) ? 0 : -1;
+#else
+    int operation = (exclusive ? LOCK_EX : LOCK_SH) | (wait ? 0 : LOCK_NB);
+    while (flock(fd, operation) != 0) {
+        if (errno != EINTR) return -1;
+    }
+    return 0;
+#endif
+}
+
+void history_file_unlock(int fd) {
+#ifdef _WIN32
+    OVERLAPPED overlapped;
+    memset(&overlapped, 0, sizeof(overlapped));
+    overlapped.Offset = 0xFFFFFFFE;
+    overlapped.OffsetHigh = 0x7FFFFFFF;
+    UnlockFileEx((HANDLE)_get_osfhandle(fd), 0, 1, 0, &overlapped);
+#else
+    flock(fd, LOCK_UN);
+#endif
+}
+
+int history_file_identity(int fd, history_file_id_t *id) {
+#ifdef _WIN32
+    (void)fd;
+    (void)id;
+    return -1;
+#else
+    struct stat st;
+    if (fstat(fd, &st) != 0) return -1;
+    id->device = (unsigned long long)st.st_dev;
+    id->inode = (unsigned long long)st.st_ino;
+    return 0;
+#endif
+}
+
+int history_path_identity(const char *path, history_file_id_t *id) {
+#ifdef _WIN32
+    (void)path;
+    (void)id;
+    return -1;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    id->device = (unsigned long long)st.st_dev;
+    id->inode = (unsigned long long)st.st_ino;
+    return 0;
+#endif
+}
+
+int history_file_id_equal(const history_file_id_t *a, const history_file_id_t *b) {
+    return a->device == b->device && a->inode == b->inode;
+}
+
+static int target_open_fd(history_writer_file_t *file) {
+#ifdef _WIN32
+    file->fd = _open(file->path, _O_RDWR | _O_APPEND | _O_CREAT | _O_BINARY | _O_NOINHERIT,
+                     _S_IREAD | _S_IWRITE);
+#else
+    // Close-on-exec: launched commands must not inherit the shell's files
+    file->fd = open(file->path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+#endif
+    if (file->fd < 0) return -1;
+    memset(&file->id, 0, sizeof(file->id));
+    history_file_identity(file->fd, &file->id);
+    return 0;
+}
+
+static void target_close_fd(history_writer_file_t *file) {
+    if (file->fd < 0) return;
+#ifdef _WIN32
+    _close(file->fd);
+#else
+    close(file->fd);
+#endif
+    file->fd = -1;
+}
+
+// Write all of buf, retrying short writes
+static int write_all(int fd, const char *buf, size_t length) {
+    while (length > 0) {
+#ifdef _WIN32
+        int written = _write(fd, buf, (unsigned int)length);
+#else
+        ssize_t written = write(fd, buf, length);
+        if (written < 0 && errno == EINTR) continue;
+#endif
+        if (written <= 0) return -1;
+        buf += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+static void target_publish(history_writer_file_t *file, long start, long end) {
+    size_t tail = atomic_load_explicit(&file->ranges_tail, memory_order_relaxed);
+    // The shell collects ranges before every command, so a full ring only
+    // means it is busy; give up after a while rather than stall the writer
+    for (int waited = 0; tail - atomic_load_explicit(&file->ranges_head, memory_order_acquire) >=
+                         HISTORY_WRITER_RANGES; waited++) {
+        if (!writer_running || waited >= HISTORY_WRITER_FLUSH_TIMEOUT_MS) return;
+#ifdef _WIN32
+        Sleep(1);
+#else
+        struct timespec pause = {0, 1000000};
+        nanosleep(&pause, NULL);
+#endif
+    }
+    history_written_range_t *range = &file->ranges[tail & (HISTORY_WRITER_RANGES - 1)];
+    range->file = file->id;
+    range->start = start;
+    range->end = end;
+    atomic_store_explicit(&file->ranges_tail, tail + 1, memory_order_release);
+}
+
+// Append buf to a target under the file lock, shared safely with every other
+// session appending to the same file
+static void target_append(history_writer_target_t target, const char *buf, size_t length) {
+    history_writer_file_t *file = &targets[target];
+    if (file->fd < 0) return;
+    int locked = (history_file_lock(file->fd, 1, 1) == 0);
+
+    // Another session may have trimmed or compacted the file by renaming a
+    // new one over it; appending to the old inode would lose the records
+    history_file_id_t current;
+    if (history_path_identity(file->path, &current) == 0 && !history_file_id_equal(&current, &file->id)) {
+        if (locked) history_file_unlock(file->fd);
+        target_close_fd(file);
+        if (target_open_fd(file) != 0) return;
+        locked = (history_file_lock(file->fd, 1, 1) == 0);
+    }
+
+#ifdef _WIN32
+    long start = _lseek(file->fd, 0, SEEK_END);
+#else
+    long start = (long)lseek(file->fd, 0, SEEK_END);
+#endif
+    // Records are newline-framed; terminate one torn by a session that died
+    // mid-write so it cannot swallow ours
+    if (start > 0) {
+        char last = '\n';
+#ifdef _WIN32
+        if (_lseek(file->fd, start - 1, SEEK_SET) >= 0) _read(file->fd, &last, 1);
+#else
+        if (lseek(file->fd, start - 1, SEEK_SET) >= 0 && read(file->fd, &last, 1) != 1) last = '\n';
+#endif
+        if (last != '\n' && write_all(file->fd, "\n", 1) == 0) start++;
+    }
+
+    if (start >= 0 && write_all(file->fd, buf, length) == 0) {
+        target_publish(file, start, start + (long)length);
+    }
+    if (locked) history_file_unlock(file->fd);
+}
+
+static void target_sync(history_writer_target_t target) {
+    history_writer_file_t *file = &targets[target];
+    if (file->fd < 0) return;
+#ifdef _WIN32
+    _commit(file->fd);
+#else
+    fsync(file->fd);
+#endif
+    file->unsynced = 0;
+}
+
+// Write queue[head, tail) with one write per target, then make it durable
+static void writer_write_batch(size_t head, size_t tail) {
+    for (int target = 0; target < HISTORY_WRITER_TARGETS; target++) {
+        size_t total = 0;
+        for (size_t i = head; i != tail; i++) {
+            history_writer_slot_t *slot = &queue[i & (HISTORY_WRITER_QUEUE_SIZE - 1)];
+            if (slot->target == (history_writer_target_t)target) total += slot->length;
+        }
+        if (total == 0 || targets[target].fd < 0) continue;
+
+        // Coalesce the batch into one write; fall back to one per record
+        char *buf = malloc(total);
+        size_t used = 0;
+        for (size_t i = head; i != tail; i++) {
+            history_writer_slot_t *slot = &queue[i & (HISTORY_WRITER_QUEUE_SIZE - 1)];
+            if (slot->target != (history_writer_target_t)target) continue;
+            if (buf) {
+                memcpy(buf + used, slot->record, slot->length);
+                used += slot->length;
+            } else {
+                target_append((history_writer_target_t)target, slot->record, slot->length);
+            }
+        }
+        if (buf) {
+            target_append((history_writer_target_t)target, buf, used);
+            free(buf);
+        }
+        if (targets[target].sync_interval > 0) {
+            target_sync((history_writer_target_t)target);
+        }
+    }
+
+    for (size_t i = head; i != tail; i++) {
+        history_writer_slot_t *slot = &queue[i & (HISTORY_WRITER_QUEUE_SIZE - 1)];
+        free(slot->record);
+        slot->record = NULL;
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI writer_main(LPVOID arg) {
+#else
+static void *writer_main(void *arg) {
+#endif
+    (void)arg;
+    for (;;) {
+        size_t head = atomic_load_explicit(&queue_head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&queue_tail, memory_order_acquire);
+
+        if (head == tail) {
+            if (atomic_load(&writer_stopping)) break;
+
+            // Announce we are parking before the final check, so a record
+            // submitted in between is either seen here or wakes us
+            writer_lock_acquire();
+            atomic_store(&writer_idle, 1);
+            if (atomic_load(&queue_tail) == head && !atomic_load(&writer_stopping)) {
+#ifdef _WIN32
+                SleepConditionVariableCS(&writer_wake, &writer_lock, INFINITE);
+#else
+                pthread_cond_wait(&writer_wake, &writer_lock);
+#endif
+            }
+            atomic_store(&writer_idle, 0);
+            writer_lock_release();
+            continue;
+        }
+
+        writer_write_batch(head, tail);
+        atomic_store_explicit(&queue_head, tail, memory_order_release);
+
+        writer_lock_acquire();
+#ifdef _WIN32
+        WakeAllConditionVariable(&writer_drained);
+#else
+        pthread_cond_broadcast(&writer_drained);
+#endif
+        writer_lock_release();
+    }
+#ifdef _WIN32
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+int history_writer_start(void) {
+    if (writer_running) return 0;
+    atomic_store(&writer_stopping, 0);
+    atomic_store(&writer_idle, 0);
+
+#ifdef _WIN32
+    static int lock_initialized = 0;
+    if (!lock_initialized) {
+        InitializeCriticalSection(&writer_lock);
+        InitializeConditionVariable(&writer_wake);
+        InitializeConditionVariable(&writer_drained);
+        lock_initialized = 1;
+    }
+    writer_thread = CreateThread(NULL, 0, writer_main, NULL, 0, NULL);
+    if (!writer_thread) return -1;
+#else
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) return -1;
+#endif
+    writer_running = 1;
+    return 0;
+}
+
+int history_writer_active(void) {
+    return writer_running;
+}
+
+// The writer reads target state after acquiring the next record from
+// queue_tail, so changes made while it is drained are visible to it
+int history_writer_open_target(history_writer_target_t target, const char *path, int sync_interval) {
+    if (target < 0 || target >= HISTORY_WRITER_TARGETS) return -1;
+    history_writer_file_t *file = &targets[target];
+    target_close_fd(file);
+    snprintf(file->path, sizeof(file->path), "%s", path);
+    file->sync_interval = sync_interval;
+    file->unsynced = 0;
+    return target_open_fd(file);
+}
+
+void history_writer_close_target(history_writer_target_t target) {
+    if (target < 0 || target >= HISTORY_WRITER_TARGETS) return;
+    if (targets[target].unsynced > 0) target_sync(target);
+    target_close_fd(&targets[target]);
+}
+
+int history_writer_take_written(history_writer_target_t target, history_written_range_t *range) {
+    if (target < 0 || target >= HISTORY_WRITER_TARGETS) return 0;
+    history_writer_file_t *file = &targets[target];
+    size_t head = atomic_load_explicit(&file->ranges_head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&file->ranges_tail, memory_order_acquire)) return 0;
+    *range = file->ranges[head & (HISTORY_WRITER_RANGES - 1)];
+    atomic_store_explicit(&file->ranges_head, head + 1, memory_order_release);
+    return 1;
+}
+
+// Wait until no more than backlog of the records submitted up to tail are
+// still queued. Returns -1 if the writer did not get there within timeout_ms.
+static int writer_wait_drained(size_t tail, size_t backlog, int timeout_ms) {
+    int result = 0;
+    writer_lock_acquire();
+#ifdef _WIN32
+    ULONGLONG deadline = GetTickCount64() + (ULONGLONG)timeout_ms;
+    while (tail - atomic_load_explicit(&queue_head, memory_order_acquire) > backlog) {
+        ULONGLONG now = GetTickCount64();
+        if (now >= deadline) {
+            result = -1;
+            break;
+        }
+        SleepConditionVariableCS(&writer_drained, &writer_lock, (DWORD)(deadline - now));
+    }
+#else
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (tail - atomic_load_explicit(&queue_head, memory_order_acquire) > backlog) {
+        if (pthread_cond_timedwait(&writer_drained, &writer_lock, &deadline) == ETIMEDOUT &&
+            tail - atomic_load(&queue_head) > backlog) {
+            result = -1;
+            break;
+        }
+    }
+#endif
+    writer_lock_release();
+    return result;
+}
+
+void history_writer_submit(history_writer_target_t target, char *record, size_t length) {
+    if (!record) return;
+    if (target < 0 || target >= HISTORY_WRITER_TARGETS) {
+        free(record);
+        return;
+    }
+
+    if (!writer_running) {
+        history_writer_file_t *file = &targets[target];
+        target_append(target, record, length);
+        if (file->sync_interval > 0 && ++file->unsynced >= file->sync_interval) {
+            target_sync(target);
+        }
+        free(record);
+        return;
+    }
+
+    size_t tail = atomic_load_explicit(&queue_tail, memory_order_relaxed);
+    // A full queue means the disk is far behind. Wait a little for space, but
+    // rather than hold up the prompt on a stuck disk, drop the record.
+    if (tail - atomic_load_explicit(&queue_head, memory_order_acquire) >= HISTORY_WRITER_QUEUE_SIZE) {
+        writer_wake_up();
+        if (writer_wait_drained(tail, HISTORY_WRITER_QUEUE_SIZE - 1, HISTORY_WRITER_SUBMIT_TIMEOUT_MS) != 0) {
+            fprintf(stderr, "xsh: history file is not keeping up; a history record was dropped\n");
+            free(record);
+            return;
+        }
+    }
+
+    history_writer_slot_t *slot = &queue[tail & (HISTORY_WRITER_QUEUE_SIZE - 1)];
+    slot->target = target;
+    slot->record = record;
+    slot->length = length;
+    atomic_store(&queue_tail, tail + 1);
+    writer_wake_up();
+}
+
+int history_writer_flush(int timeout_ms) {
+    if (!writer_running) return 0;
+
+    size_t tail = atomic_load_explicit(&queue_tail, memory_order_relaxed);
+    if (atomic_load_explicit(&queue_head, memory_order_acquire) == tail) return 0;
+    writer_wake_up();
+    return writer_wait_drained(tail, 0, timeout_ms);
+}
+
+int history_writer_sync(int timeout_ms) {
+    if (history_writer_flush(timeout_ms) != 0) return -1;
+    for (int target = 0; target < HISTORY_WRITER_TARGETS; target++) {
+        target_sync((history_writer_target_t)target);
+    }
+    return 0;
+}
+
+int history_writer_stop(int timeout_ms) {
+    if (!writer_running) return 0;
+    if (history_writer_flush(timeout_ms) != 0) return -1;
+
+    writer_lock_acquire();
+    atomic_store(&writer_stopping, 1);
+#ifdef _WIN32
+    WakeConditionVariable(&writer_wake);
+#else
+    pthread_cond_signal(&writer_wake);
+#endif
+    writer_lock_release();
+
+#ifdef _WIN32
+    WaitForSingleObject(writer_thread, INFINITE);
+    CloseHandle(writer_thread);
+    writer_thread = NULL;
+#else
+    pthread_join(writer_thread, NULL);
+#endif
+    writer_running = 0;
+    return 0;
+}
@@ -2,10 +2,14 @@
 #include "xsh.h" // For build_prompt, history, etc.
 #include "builtins.h" // For xsh_num_builtins, builtin_str for completion
 #include "history.h" // For enhanced smart completion functions
+#include "cmdhash.h" // For PATH command completion
+#include "jobs.h" // For reaping jobs while waiting for input
 
 #ifdef __linux__ // For termios, read, isatty, STDIN_FILENO
 #include <termios.h>
 #include <unistd.h> 
+#include <poll.h>
+#include <errno.h>
 #endif
 
 #ifdef _WIN32
@@ -22,6 +26,215 @@
 
 // Implementation of input handling functions
 
+// Copy a history entry into the line buffer, growing the buffer if needed
+static char *xsh_load_history_entry(char *buffer, int *bufsize, const char *entry) {
+    int len = strlen(entry);
+    if (len >= *bufsize) {
+        int new_size = len + XSH_RL_BUFSIZE;
+        char *new_buffer = realloc(buffer, new_size);
+        if (!new_buffer) {
+            fprintf(stderr, "xsh: allocation error\n");
+            free(buffer);
+            exit(EXIT_FAILURE);
+        }
+        buffer = new_buffer;
+        *bufsize = new_size;
+    }
+    memcpy(buffer, entry, len + 1);
+    return buffer;
+}
+
+#if defined(_WIN32) || defined(__linux__)
+// Keys read by reverse search that the line editor still has to act on, as
+// the bytes the terminal sent for them
+static unsigned char pending_keys[4];
+static int pending_key_count = 0;
+static int pending_key_next = 0;
+
+static void xsh_unread_keys(const unsigned char *keys, int count) {
+    memcpy(pending_keys, keys, count);
+    pending_key_count = count;
+    pending_key_next = 0;
+}
+
+static int xsh_next_pending_key(void) {
+    if (pending_key_next >= pending_key_count) return -1;
+    return pending_keys[pending_key_next++];
+}
+#endif
+
+#ifdef _WIN32
+// _getch(), after any keys reverse search handed back
+static int xsh_getch(void) {
+    int c = xsh_next_pending_key();
+    return c >= 0 ? c : _getch();
+}
+#endif
+
+#ifdef __linux__
+// Read one byte of terminal input. While waiting, collect the state changes
+// of background jobs so finished ones are reaped without a command being run;
+// they are reported at the next prompt.
+static ssize_t xsh_read_tty_byte(char *ch) {
+    int pending = xsh_next_pending_key();
+    if (pending >= 0) {
+        *ch = (char)pending;
+        return 1;
+    }
+    int event_fd = jobs_event_fd();
+    while (event_fd != -1) {
+        struct pollfd pfds[2] = {{STDIN_FILENO, POLLIN, 0}, {event_fd, POLLIN, 0}};
+        if (poll(pfds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (pfds[1].revents & POLLIN) jobs_reap();
+        if (pfds[0].revents) break;
+    }
+    return read(STDIN_FILENO, ch, 1);
+}
+#endif
+
+#if defined(_WIN32) || defined(__linux__)
+#define SEARCH_KEY_SPECIAL 0x100 // Added to the final code of arrow/extended keys
+
+// Read one key for reverse search, folding arrow and other extended keys into
+// a single SEARCH_KEY_SPECIAL code. Returns -1 on EOF.
+static int xsh_search_read_key(void) {
+#ifdef _WIN32
+    int c = _getch();
+    if (c == EXTENDED_KEY || c == 0) {
+        return SEARCH_KEY_SPECIAL + _getch();
+    }
+    return c;
+#else
+    unsigned char ch;
+    if (read(STDIN_FILENO, &ch, 1) != 1) return -1;
+    if (ch == ESC_SEQUENCE) {
+        // Swallow the rest of an arrow key sequence if one follows immediately
+        struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+        unsigned char seq1, seq2;
+        if (poll(&pfd, 1, 25) > 0 && read(STDIN_FILENO, &seq1, 1) == 1 && seq1 == '[' &&
+            read(STDIN_FILENO, &seq2, 1) == 1) {
+            return SEARCH_KEY_SPECIAL + seq2;
+        }
+    }
+    return ch;
+#endif
+}
+
+// Hand a key that ended reverse search back to the line editor
+static void xsh_search_unread_key(int c) {
+    unsigned char keys[3];
+    int count = 0;
+    if (c >= SEARCH_KEY_SPECIAL) {
+#ifdef _WIN32
+        keys[count++] = EXTENDED_KEY;
+#else
+        keys[count++] = ESC_SEQUENCE;
+        keys[count++] = '[';
+#endif
+        c -= SEARCH_KEY_SPECIAL;
+    }
+    keys[count++] = (unsigned char)c;
+    xsh_unread_keys(keys, count);
+}
+
+// Incremental reverse search through the whole history (Ctrl-R). Each key
+// refines the query and the newest matching entry is shown; Ctrl-R again
+// steps to older matches, and on an empty query searches for the previous
+// query again. Any other key leaves the match in the buffer and is then
+// handled by the line editor, so Enter runs it and an arrow key moves in it;
+// Escape only leaves the search. Returns 0 when a match was put in the
+// buffer, or -1 if there was none or Ctrl-G cancelled.
+static int xsh_reverse_search(char **buffer, int *bufsize) {
+    static char last_query[XSH_MAXLINE];
+    char query[XSH_MAXLINE];
+    size_t query_len = 0;
+    char *match = NULL;
+    long match_pos = -1;
+    int failed = 0;
+    
+    query[0] = '\0';
+    while (1) {
+        printf("\r\x1b[K(%sreverse-i-search)`%s': %s", failed ? "failed " : "", query, match ? match : "");
+        fflush(stdout);
+        
+        int c = xsh_search_read_key();
+        if (c < 0 || c == CTRL_G_KEY) {
+            free(match);
+            return -1;
+        }
+        
+        if (c == CTRL_R_KEY && query_len == 0) {
+            // Search for the previous query again
+            if (!last_query[0]) continue;
+            query_len = strlen(last_query);
+            memcpy(query, last_query, query_len + 1);
+            match_pos = history_search_backward(query, -1, &match);
+            failed = (match == NULL);
+        } else if (c == CTRL_R_KEY) {
+            // Step to the next older entry, skipping repeats of the current one
+            if (!match) continue;
+            char *older = NULL;
+            long pos = match_pos;
+            while ((pos = history_search_backward(query, pos, &older)) >= 0 && strcmp(older, match) == 0) {
+                free(older);
+                older = NULL;
+            }
+            if (older) {
+                free(match);
+                match = older;
+                match_pos = pos;
+            }
+            failed = (older == NULL);
+        } else if (c == 127 || c == '\b') {
+            // A shorter query can match newer entries, so start over
+            if (query_len > 0) query[--query_len] = '\0';
+            free(match);
+            match_pos = history_search_backward(query, -1, &match);
+            failed = (query_len > 0 && !match);
+        } else if (c < SEARCH_KEY_SPECIAL && isprint(c)) {
+            if (query_len >= sizeof(query) - 1) continue;
+            query[query_len++] = (char)c;
+            query[query_len] = '\0';
+            
+            // The shown entry may still match, so search from it inclusively
+            char *found = NULL;
+            long pos = history_search_backward(query, match ? match_pos + 1 : -1, &found);
+            if (found) {
+                free(match);
+                match = found;
+                match_pos = pos;
+            }
+            failed = (found == NULL);
+        } else {
+            if (query_len > 0) memcpy(last_query, query, query_len + 1);
+            if (c != ESC_SEQUENCE) xsh_search_unread_key(c);
+            if (!match) return -1;
+            *buffer = xsh_load_history_entry(*buffer, bufsize, match);
+            free(match);
+            return 0;
+        }
+    }
+}
+
+// Run a reverse search from the line editor and redraw the prompt with the
+// result. The key that ended the search is read next.
+static void xsh_line_reverse_search(char **buffer, int *bufsize, int *position, int *cursor_pos) {
+    if (xsh_reverse_search(buffer, bufsize) == 0) {
+        *position = strlen(*buffer);
+        *cursor_pos = *position;
+    }
+    
+    printf("\r\x1b[K%s%s", build_prompt(), *buffer);
+    for (int i = *position; i > *cursor_pos; i--) {
+        printf("\b");
+    }
+    fflush(stdout);
+}
+#endif
+
 char *xsh_read_line(void){
     int bufsize = XSH_RL_BUFSIZE;
     int position = 0;
@@ -41,11 +254,16 @@ char *xsh_read_line(void){
 
 #ifdef _WIN32
     while (1) {
-        c = _getch(); // Use _getch() to get a character without echoing it
+        c = xsh_getch(); // Use _getch() to get a character without echoing it
+        
+        if (c == CTRL_R_KEY) {
+            xsh_line_reverse_search(&buffer, &bufsize, &position, &cursor_pos);
+            continue;
+        }
         
         // Handle arrow keys (extended keys on Windows)
         if (c == EXTENDED_KEY) {
-            c = _getch(); // Get the actual arrow key code
+            c = xsh_getch(); // Get the actual arrow key code
             
             if (c == ARROW_UP) {
                 // Navigate up in history
@@ -59,13 +277,12 @@ char *xsh_read_line(void){
                         history_index--;
                     }
                     
-                    if (history_index >= 0 && history_index < history_count && history[history_index]) {
+                    if (history_index >= 0 && history_index < history_count && history_get(history_index)) {
                         // Clear current line
                         printf("\r%*s\r", (int)(strlen(build_prompt()) + position), "");
                         
                         // Copy history entry to buffer
-                        strncpy(buffer, history[history_index], bufsize - 1);
-                        buffer[bufsize - 1] = '\0';
+                        buffer = xsh_load_history_entry(buffer, &bufsize, history_get(history_index));
                         position = strlen(buffer);
                         cursor_pos = position;
                         
@@ -82,13 +299,12 @@ char *xsh_read_line(void){
                     if (history_index < history_count - 1) {
                         history_index++;
                         
-                        if (history[history_index]) {
+                        if (history_get(history_index)) {
                             // Clear current line
                             printf("\r%*s\r", (int)(strlen(build_prompt()) + position), "");
                             
                             // Copy history entry to buffer
-                            strncpy(buffer, history[history_index], bufsize - 1);
-                            buffer[bufsize - 1] = '\0';
+                            buffer = xsh_load_history_entry(buffer, &bufsize, history_get(history_index));
                             position = strlen(buffer);
                             cursor_pos = position;
                             
@@ -324,7 +540,7 @@ char *xsh_read_line(void){
     while (1) {
         if (is_tty) {
             char ch;
-            ssize_t n = read(STDIN_FILENO, &ch, 1); // Read one character
+            ssize_t n = xsh_read_tty_byte(&ch); // Read one character
             if (n <= 0) { // Error or EOF
                 if (is_tty) tcsetattr(STDIN_FILENO, TCSANOW, &old_tio); // Restore terminal
                 buffer[position] = '\0';
@@ -341,11 +557,16 @@ char *xsh_read_line(void){
                 return buffer;
             }
         }
+        
+        if (c == CTRL_R_KEY && is_tty) {
+            xsh_line_reverse_search(&buffer, &bufsize, &position, &cursor_pos);
+            continue;
+        }
 
         // Handle arrow keys (escape sequences on Linux)
         if (c == ESC_SEQUENCE && is_tty) {
             char seq1, seq2;
-            if (read(STDIN_FILENO, &seq1, 1) == 1 && seq1 == '[' && read(STDIN_FILENO, &seq2, 1) == 1) {
+            if (xsh_read_tty_byte(&seq1) == 1 && seq1 == '[' && xsh_read_tty_byte(&seq2) == 1) {
                 if (seq2 == ARROW_UP) {
                     // Navigate up in history
                     if (history_count > 0) {
@@ -358,13 +579,12 @@ char *xsh_read_line(void){
                             history_index--;
                         }
                         
-                        if (history_index >= 0 && history_index < history_count && history[history_index]) {
+                        if (history_index >= 0 && history_index < history_count && history_get(history_index)) {
                             // Clear current line
                             printf("\r%*s\r", (int)(strlen(build_prompt()) + position), "");
                             
                             // Copy history entry to buffer
-                            strncpy(buffer, history[history_index], bufsize - 1);
-                            buffer[bufsize - 1] = '\0';
+                            buffer = xsh_load_history_entry(buffer, &bufsize, history_get(history_index));
                             position = strlen(buffer);
                             cursor_pos = position;
                             
@@ -382,13 +602,12 @@ char *xsh_read_line(void){
                         if (history_index < history_count - 1) {
                             history_index++;
                             
-                            if (history[history_index]) {
+                            if (history_get(history_index)) {
                                 // Clear current line
                                 printf("\r%*s\r", (int)(strlen(build_prompt()) + position), "");
                                 
                                 // Copy history entry to buffer
-                                strncpy(buffer, history[history_index], bufsize - 1);
-                                buffer[bufsize - 1] = '\0';
+                                buffer = xsh_load_history_entry(buffer, &bufsize, history_get(history_index));
                                 position = strlen(buffer);
                                 cursor_pos = position;
                                 
@@ -867,21 +1086,58 @@ char** find_matches(const char* partial, int* match_count) {
         }
     }
     
+    // Then executables on PATH, enumerated from the command hash
+    if (is_command_completion && *match_count < 10) {
+        int command_count = cmdhash_fill();
+        for (int i = 0; i < command_count && *match_count < MAX_COMPLETION_SUGGESTIONS; i++) {
+            const char *command = cmdhash_name(i);
+            if (strncmp(partial, command, partial_len) != 0) continue;
+
+            int duplicate = 0;
+            for (int j = 0; j < *match_count; j++) {
+                if (strcmp(matches[j], command) == 0) {
+                    duplicate = 1;
+                    break;
+                }
+            }
+            if (duplicate) continue;
+
+            matches[*match_count] = strdup(command);
+            if (!matches[*match_count]) {
+                fprintf(stderr, "xsh: strdup error\n");
+                exit(EXIT_FAILURE);
+            }
+            (*match_count)++;
+
+            if (*match_count >= bufsize) {
+                bufsize += XSH_TOK_BUFSIZE;
+                matches = realloc(matches, bufsize * sizeof(char*));
+                if (!matches) {
+                    fprintf(stderr, "xsh: allocation error in find_matches\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+    }
+
     // Add command history as fallback (only if we have few matches and it looks like a command)
     if (*match_count < 5 && is_command_completion) {
-        for (int i = 0; i < history_count; i++) {
-            if (strncmp(partial, history[i], partial_len) == 0) {
+        // Walk newest first and stop once we have enough suggestions
+        for (int i = history_count - 1; i >= 0 && *match_count < MAX_COMPLETION_SUGGESTIONS; i--) {
+            const char *entry = history_get(i);
+            if (!entry) break; // Reached entries that are no longer available
+            if (strncmp(partial, entry, partial_len) == 0) {
                 // Avoid duplicating matches already found
                 int duplicate = 0;
                 for (int j = 0; j < *match_count; j++) {
-                    if (strcmp(matches[j], history[i]) == 0) {
+                    if (strcmp(matches[j], entry) == 0) {
                         duplicate = 1;
                         break;
                     }
                 }
                 if (duplicate) continue;
 
-                matches[*match_count] = strdup(history[i]);
+                matches[*match_count] = strdup(entry);
                 if (!matches[*match_count]) { 
                     fprintf(stderr, "xsh: strdup error\n"); 
                     exit(EXIT_FAILURE); 
@@ -969,31 +1225,3 @@ char* complete_command(const char* partial) {
     return result;
 }
 
-char **xsh_split_line(char *line) {
-    int bufsize = XSH_TOK_BUFSIZE, position = 0;
-    char **tokens = malloc(bufsize * sizeof(char*));
-    char *token;
-
-    if (!tokens) {
-        fprintf(stderr, "xsh: allocation error\n");
-        exit(EXIT_FAILURE);
-    }
-
-    token = strtok(line, XSH_TOK_DELIM);
-    while (token != NULL) {
-        tokens[position] = token;
-        position++;
-
-        if (position >= bufsize) {
-            bufsize += XSH_TOK_BUFSIZE;
-            tokens = realloc(tokens, bufsize * sizeof(char*));
-            if (!tokens) {
-                fprintf(stderr, "xsh: allocation error\n");
-                exit(EXIT_FAILURE);
-            }
-        }
-        token = strtok(NULL, XSH_TOK_DELIM);
-    }
-    tokens[position] = NULL;
-    return tokens;
-}
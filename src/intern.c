@@ -0,0 +1,177 @@
+#include "intern.h"
+#include "utils.h" // For xsh_hash_bytes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Arena chunk; strings are packed back to back after the header
+typedef struct intern_chunk {
+    struct intern_chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+} intern_chunk_t;
+
+static intern_chunk_t *intern_chunks = NULL; // Newest chunk first
+
+// ID -> string and its hash. ID 0 is reserved for INTERN_NONE.
+static const char **intern_strings = NULL;
+static uint32_t *intern_hashes = NULL;
+static intern_id_t intern_next_id = 1;
+static intern_id_t intern_strings_capacity = 0;
+
+// Open-addressing index keyed by string; slots hold IDs (0 = empty)
+static intern_id_t *intern_index = NULL;
+static uint32_t intern_index_capacity = 0; // Always a power of two
+
+static size_t intern_string_bytes = 0;
+static size_t intern_arena_bytes = 0;
+static size_t intern_allocations = 0;
+
+// Hash of str, with its length in *length
+static uint32_t intern_hash(const char *str, size_t *length) {
+    *length = strlen(str);
+    return (uint32_t)xsh_hash_bytes(str, *length);
+}
+
+// Copy a string into the arena, starting a new chunk when it does not fit
+static char *intern_arena_copy(const char *str, size_t length) {
+    size_t needed = length + 1;
+    if (!intern_chunks || intern_chunks->size - intern_chunks->used < needed) {
+        size_t size = needed > INTERN_CHUNK_SIZE ? needed : INTERN_CHUNK_SIZE;
+        intern_chunk_t *chunk = malloc(sizeof(intern_chunk_t) + size);
+        if (!chunk) return NULL;
+        intern_allocations++;
+        chunk->size = size;
+        chunk->used = 0;
+        chunk->next = intern_chunks;
+        intern_chunks = chunk;
+        intern_arena_bytes += size;
+    }
+    char *copy = intern_chunks->data + intern_chunks->used;
+    memcpy(copy, str, needed);
+    intern_chunks->used += needed;
+    intern_string_bytes += needed;
+    return copy;
+}
+
+static void intern_index_insert(intern_id_t id) {
+    uint32_t mask = intern_index_capacity - 1;
+    uint32_t slot = intern_hashes[id] & mask;
+    while (intern_index[slot] != INTERN_NONE) {
+        slot = (slot + 1) & mask; // Linear probing
+    }
+    intern_index[slot] = id;
+}
+
+static int intern_index_resize(uint32_t new_capacity) {
+    intern_id_t *new_index = calloc(new_capacity, sizeof(intern_id_t));
+    if (!new_index) {
+        fprintf(stderr, "xsh: Failed to expand string index\n");
+        return -1;
+    }
+    intern_allocations++;
+    free(intern_index);
+    intern_index = new_index;
+    intern_index_capacity = new_capacity;
+    for (intern_id_t id = 1; id < intern_next_id; id++) {
+        intern_index_insert(id);
+    }
+    return 0;
+}
+
+static intern_id_t intern_find(const char *str, uint32_t hash) {
+    if (intern_index_capacity == 0) return INTERN_NONE;
+    uint32_t mask = intern_index_capacity - 1;
+    uint32_t slot = hash & mask;
+    while (intern_index[slot] != INTERN_NONE) {
+        intern_id_t id = intern_index[slot];
+        if (intern_hashes[id] == hash && strcmp(intern_strings[id], str) == 0) {
+            return id;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return INTERN_NONE;
+}
+
+intern_id_t intern_lookup(const char *str) {
+    if (!str) return INTERN_NONE;
+    size_t length;
+    return intern_find(str, intern_hash(str, &length));
+}
+
+intern_id_t intern_string(const char *str) {
+    if (!str) return INTERN_NONE;
+    size_t length;
+    uint32_t hash = intern_hash(str, &length);
+    intern_id_t id = intern_find(str, hash);
+    if (id != INTERN_NONE) return id;
+
+    // Keep the index at most half full so probe sequences stay short
+    if ((uint32_t)intern_next_id * 2 > intern_index_capacity) {
+        if (intern_index_resize(intern_index_capacity ? intern_index_capacity * 2 : 1024) != 0) {
+            return INTERN_NONE;
+        }
+    }
+
+    if (intern_next_id >= intern_strings_capacity) {
+        intern_id_t new_capacity = intern_strings_capacity ? intern_strings_capacity * 2 : 512;
+        const char **new_strings = realloc(intern_strings, sizeof(char *) * new_capacity);
+        if (!new_strings) return INTERN_NONE;
+        intern_strings = new_strings;
+        uint32_t *new_hashes = realloc(intern_hashes, sizeof(uint32_t) * new_capacity);
+        if (!new_hashes) return INTERN_NONE;
+        intern_hashes = new_hashes;
+        intern_strings_capacity = new_capacity;
+        intern_allocations += 2;
+        intern_strings[INTERN_NONE] = NULL;
+        intern_hashes[INTERN_NONE] = 0;
+    }
+
+    const char *copy = intern_arena_copy(str, length);
+    if (!copy) return INTERN_NONE;
+
+    id = intern_next_id++;
+    intern_strings[id] = copy;
+    intern_hashes[id] = hash;
+    intern_index_insert(id);
+    return id;
+}
+
+const char *intern_str(intern_id_t id) {
+    if (id == INTERN_NONE || id >= intern_next_id) return NULL;
+    return intern_strings[id];
+}
+
+intern_id_t intern_id_limit(void) {
+    return intern_next_id;
+}
+
+void intern_get_stats(intern_stats_t *stats) {
+    stats->strings = intern_next_id - 1;
+    stats->string_bytes = intern_string_bytes;
+    stats->arena_bytes = intern_arena_bytes;
+    stats->index_bytes = (size_t)intern_strings_capacity * (sizeof(char *) + sizeof(uint32_t)) +
+                         (size_t)intern_index_capacity * sizeof(intern_id_t);
+    stats->allocations = intern_allocations;
+}
+
+void intern_cleanup(void) {
+    while (intern_chunks) {
+        intern_chunk_t *next = intern_chunks->next;
+        free(intern_chunks);
+        intern_chunks = next;
+    }
+    free(intern_strings);
+    free(intern_hashes);
+    free(intern_index);
+    intern_strings = NULL;
+    intern_hashes = NULL;
+    intern_index = NULL;
+    intern_next_id = 1;
+    intern_strings_capacity = 0;
+    intern_index_capacity = 0;
+    intern_string_bytes = 0;
+    intern_arena_bytes = 0;
+    intern_allocations = 0;
+}
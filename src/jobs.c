@@ -0,0 +1,905 @@
+#ifndef _WIN32
+#define _DEFAULT_SOURCE // For wait4() and strsignal()
+#endif
+
+#include "jobs.h"
+#include "builtins.h"
+#include "execute.h" // For last_command_usage
+#include "history.h" // For add_to_enhanced_history
+#include "utils.h"   // For get_monotonic_time_us
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/resource.h> // For struct rusage
+#include <sys/wait.h>
+
+typedef enum {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+} job_state_t;
+
+typedef struct {
+    pid_t pid;              // Process running the stage, 0 if it runs on a shell thread
+    job_state_t state;
+    int status;             // Exit status once done, 128 + signal if killed
+    int signal;             // Signal that stopped or killed the process, 0 if none
+    atomic_int thread_done; // Set by the stage thread once its builtin returned
+    int thread_status;
+    long long end_us;       // When it exited, 0 until then
+    long long cpu_us;       // User plus system time, known once it exited
+    long long bytes_written; // Known once it exited, -1 if unknown
+    char name[PIPESTAT_NAME_SIZE];
+} job_stage_t;
+
+struct job {
+    int id;                    // Job number, shown as [n]
+    pid_t pgid;                // Process group, 0 until the first process starts
+    char *command;
+    char cwd[XSH_MAXLINE];     // Working directory it was started in, for history
+    int background;
+    int detached;              // Outlived its command line; records itself in history
+    int disowned;              // Hidden by disown; still reaped, but never reported
+    job_state_t reported;      // State last shown to the user
+    unsigned long last_use;    // Orders the current (+) and previous (-) jobs
+    long long start_time_us;
+    command_usage_t usage;     // Summed over the stage processes reaped so far
+    struct termios tmodes;     // Terminal modes the job had when it stopped
+    int has_tmodes;
+    int stage_count;
+    job_stage_t *stages;
+    void (*finish)(void *data);
+    void *finish_data;
+    struct job *next;
+};
+
+static job_t *job_list = NULL;       // Ordered by job number
+static job_t *foreground_job = NULL; // Job the shell is waiting for
+static unsigned long job_use_counter = 0;
+static int job_detached = 0;
+
+static int job_control = 0;
+static int shell_terminal = STDIN_FILENO;
+static pid_t shell_pgid = 0;
+static pid_t original_pgid = 0;
+static struct termios shell_tmodes;
+
+// SIGCHLD self-pipe: the handler and stage threads write a byte, the shell
+// polls the read end and drains it before reaping
+static int event_pipe[2] = {-1, -1};
+
+// Signals an interactive shell ignores so they only reach the foreground job
+static const int job_control_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU};
+#define JOB_CONTROL_SIGNAL_COUNT (int)(sizeof(job_control_signals) / sizeof(job_control_signals[0]))
+
+static void jobs_wake(void) {
+    if (event_pipe[1] != -1) {
+        char byte = 0;
+        ssize_t ignored = write(event_pipe[1], &byte, 1); // A full pipe is already readable
+        (void)ignored;
+    }
+}
+
+static void on_sigchld(int sig) {
+    (void)sig;
+    int saved_errno = errno;
+    jobs_wake();
+    errno = saved_errno;
+}
+
+static int jobs_open_event_pipe(void) {
+    if (pipe(event_pipe) == -1) {
+        perror("xsh: jobs");
+        event_pipe[0] = event_pipe[1] = -1;
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(event_pipe[i], F_SETFL, fcntl(event_pipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(event_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigchld;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &sa, NULL);
+    return 0;
+}
+
+void jobs_init(void) {
+    jobs_open_event_pipe();
+
+    // Scripts and -c commands run their jobs without job control, like
+    // any other program run from the terminal
+    if (!xsh_interactive || !isatty(shell_terminal)) return;
+
+    // Started in the background of another shell: wait to be foregrounded
+    while (tcgetpgrp(shell_terminal) != (original_pgid = getpgrp())) {
+        kill(-original_pgid, SIGTTIN);
+    }
+
+    for (int i = 0; i < JOB_CONTROL_SIGNAL_COUNT; i++) {
+        signal(job_control_signals[i], SIG_IGN);
+    }
+
+    // Take a process group of our own and the terminal with it
+    shell_pgid = getpid();
+    if (original_pgid != shell_pgid && setpgid(shell_pgid, shell_pgid) == -1) {
+        perror("xsh: setpgid");
+        for (int i = 0; i < JOB_CONTROL_SIGNAL_COUNT; i++) {
+            signal(job_control_signals[i], SIG_DFL);
+        }
+        return;
+    }
+    tcsetpgrp(shell_terminal, shell_pgid);
+    tcgetattr(shell_terminal, &shell_tmodes);
+    job_control = 1;
+}
+
+void jobs_init_subshell(void) {
+    // The jobs belong to the parent; only drop the references
+    job_list = NULL;
+    foreground_job = NULL;
+    job_control = 0;
+    if (event_pipe[0] != -1) close(event_pipe[0]);
+    if (event_pipe[1] != -1) close(event_pipe[1]);
+    jobs_open_event_pipe();
+}
+
+int jobs_control_enabled(void) {
+    return job_control;
+}
+
+int jobs_event_fd(void) {
+    return event_pipe[0];
+}
+
+int jobs_take_detached(void) {
+    int detached = job_detached;
+    job_detached = 0;
+    return detached;
+}
+
+static void usage_add_rusage(command_usage_t *usage, const struct rusage *ru) {
+    usage->user_time_us += ru->ru_utime.tv_sec * 1000000L + ru->ru_utime.tv_usec;
+    usage->sys_time_us += ru->ru_stime.tv_sec * 1000000L + ru->ru_stime.tv_usec;
+    if (ru->ru_maxrss > usage->max_rss_kb) {
+        usage->max_rss_kb = ru->ru_maxrss;
+    }
+    usage->voluntary_switches += ru->ru_nvcsw;
+    usage->involuntary_switches += ru->ru_nivcsw;
+}
+
+void jobs_add_usage(const struct rusage *ru) {
+    usage_add_rusage(&last_command_usage, ru);
+}
+
+static void usage_add(command_usage_t *total, const command_usage_t *usage) {
+    total->user_time_us += usage->user_time_us;
+    total->sys_time_us += usage->sys_time_us;
+    if (usage->max_rss_kb > total->max_rss_kb) {
+        total->max_rss_kb = usage->max_rss_kb;
+    }
+    total->voluntary_switches += usage->voluntary_switches;
+    total->involuntary_switches += usage->involuntary_switches;
+}
+
+job_t *job_create(const char *command, int stage_count, int background) {
+    job_t *job = calloc(1, sizeof(job_t));
+    if (job) {
+        job->stages = calloc(stage_count, sizeof(job_stage_t));
+        job->command = strdup(command ? command : "");
+    }
+    if (!job || !job->stages || !job->command) {
+        fprintf(stderr, "xsh: allocation error for job\n");
+        if (job) {
+            free(job->stages);
+            free(job->command);
+            free(job);
+        }
+        return NULL;
+    }
+
+    job->stage_count = stage_count;
+    job->background = background;
+    job->reported = JOB_RUNNING;
+    job->start_time_us = get_monotonic_time_us();
+    if (!getcwd(job->cwd, sizeof(job->cwd))) job->cwd[0] = '\0';
+    for (int i = 0; i < stage_count; i++) {
+        job->stages[i].state = JOB_DONE;
+        job->stages[i].status = 1;
+        job->stages[i].bytes_written = -1;
+        atomic_init(&job->stages[i].thread_done, 0);
+    }
+    return job;
+}
+
+pid_t job_process_group(const job_t *job) {
+    return job_control ? job->pgid : -1;
+}
+
+// Keep a stage's command name, without its directory, for pipestat
+static void job_set_stage_name(job_t *job, int stage, const char *command) {
+    if (!command) return;
+    const char *slash = strrchr(command, '/');
+    snprintf(job->stages[stage].name, sizeof(job->stages[stage].name), "%s", slash ? slash + 1 : command);
+}
+
+#ifdef __linux__
+// Bytes written by a process so far, from /proc/<pid>/io; -1 if it cannot
+// be read
+static long long proc_bytes_written(const char *path) {
+    char buf[512];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    const char *wchar = strstr(buf, "wchar: ");
+    return wchar ? atoll(wchar + 7) : -1;
+}
+#endif
+
+void job_set_process(job_t *job, int stage, pid_t pid, const char *command) {
+    job_set_stage_name(job, stage, command);
+    if (pid <= 0) return; // Not started: stays done with status 1
+    job->stages[stage].pid = pid;
+    job->stages[stage].state = JOB_RUNNING;
+    if (job_control) {
+        if (job->pgid == 0) job->pgid = pid;
+        setpgid(pid, job->pgid); // Also done in the child; whichever runs first wins
+    }
+}
+
+void job_set_thread(job_t *job, int stage, const char *command) {
+    job_set_stage_name(job, stage, command);
+    job->stages[stage].pid = 0;
+    job->stages[stage].state = JOB_RUNNING;
+}
+
+void job_thread_done(job_t *job, int stage, int status, long long bytes_written) {
+    // Measured here, on the stage's own thread
+    job_stage_t *done = &job->stages[stage];
+    done->thread_status = status;
+    done->end_us = get_monotonic_time_us();
+    struct timespec cpu;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu) == 0) {
+        done->cpu_us = cpu.tv_sec * 1000000LL + cpu.tv_nsec / 1000;
+    }
+    // Not the thread's io accounting: splice() and sendfile() leave it out
+    done->bytes_written = bytes_written;
+    atomic_store(&done->thread_done, 1);
+    jobs_wake();
+}
+
+void job_set_finish(job_t *job, void (*finish)(void *data), void *data) {
+    job->finish = finish;
+    job->finish_data = data;
+}
+
+void job_child_setup(pid_t pgid) {
+    if (pgid >= 0) setpgid(0, pgid);
+    for (int i = 0; i < JOB_CONTROL_SIGNAL_COUNT; i++) {
+        signal(job_control_signals[i], SIG_DFL);
+    }
+    signal(SIGCHLD, SIG_DFL);
+}
+
+// Collect every state change of the job's stages without blocking
+static void job_update(job_t *job) {
+    for (int i = 0; i < job->stage_count; i++) {
+        job_stage_t *stage = &job->stages[i];
+        if (stage->state == JOB_DONE) continue;
+
+        if (stage->pid == 0) {
+            if (atomic_load(&stage->thread_done)) {
+                stage->state = JOB_DONE;
+                stage->status = stage->thread_status;
+            }
+            continue;
+        }
+
+#ifdef __linux__
+        // An exited child keeps its io accounting until it is reaped
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(P_PID, stage->pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == stage->pid) {
+            char path[64];
+            snprintf(path, sizeof(path), "/proc/%d/io", (int)stage->pid);
+            stage->bytes_written = proc_bytes_written(path);
+        }
+#endif
+
+        int status;
+        struct rusage usage;
+        pid_t result;
+        while ((result = wait4(stage->pid, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) != 0) {
+            if (result == -1) {
+                if (errno == EINTR) continue;
+                stage->state = JOB_DONE; // Reaped elsewhere; nothing more to learn
+                break;
+            }
+            if (WIFSTOPPED(status)) {
+                stage->state = JOB_STOPPED;
+                stage->signal = WSTOPSIG(status);
+                // A foreground process can touch the terminal in the moment
+                // before the shell hands it over; let it carry on
+                if (job == foreground_job && (stage->signal == SIGTTIN || stage->signal == SIGTTOU)) {
+                    kill(job->pgid > 0 ? -job->pgid : stage->pid, SIGCONT);
+                    stage->state = JOB_RUNNING;
+                }
+            } else if (WIFCONTINUED(status)) {
+                stage->state = JOB_RUNNING;
+            } else {
+                stage->state = JOB_DONE;
+                if (WIFSIGNALED(status)) {
+                    stage->signal = WTERMSIG(status);
+                    stage->status = 128 + stage->signal;
+                } else {
+                    stage->signal = 0;
+                    stage->status = WEXITSTATUS(status);
+                }
+                stage->end_us = get_monotonic_time_us();
+                stage->cpu_us = usage.ru_utime.tv_sec * 1000000LL + usage.ru_utime.tv_usec +
+                                usage.ru_stime.tv_sec * 1000000LL + usage.ru_stime.tv_usec;
+                usage_add_rusage(&job->usage, &usage);
+                break;
+            }
+        }
+    }
+}
+
+// A job is stopped once none of its processes runs; stage threads cannot be
+// stopped and keep going until they block on a pipe
+static job_state_t job_state(const job_t *job) {
+    int running = 0, stopped = 0, threads = 0;
+    for (int i = 0; i < job->stage_count; i++) {
+        const job_stage_t *stage = &job->stages[i];
+        if (stage->state == JOB_RUNNING) {
+            if (stage->pid > 0) running++;
+            else threads++;
+        } else if (stage->state == JOB_STOPPED) {
+            stopped++;
+        }
+    }
+    if (stopped && !running) return JOB_STOPPED;
+    return (running || threads) ? JOB_RUNNING : JOB_DONE;
+}
+
+// The last stage decides a job's exit status, as for a pipeline
+static int job_exit_status(const job_t *job) {
+    return job->stages[job->stage_count - 1].status;
+}
+
+static int job_stop_signal(const job_t *job) {
+    for (int i = 0; i < job->stage_count; i++) {
+        if (job->stages[i].state == JOB_STOPPED) return job->stages[i].signal;
+    }
+    return SIGTSTP;
+}
+
+void jobs_reap(void) {
+    if (event_pipe[0] != -1) {
+        char buf[64];
+        while (read(event_pipe[0], buf, sizeof(buf)) > 0) {
+            // Drain before reaping, so a change that races the reap wakes us again
+        }
+    }
+    for (job_t *job = job_list; job; job = job->next) {
+        job_update(job);
+    }
+}
+
+// Block until a child or stage thread changes state
+static void jobs_wait_event(void) {
+    if (event_pipe[0] == -1) {
+        usleep(10000);
+        return;
+    }
+    struct pollfd pfd = {event_pipe[0], POLLIN, 0};
+    while (poll(&pfd, 1, -1) == -1 && errno == EINTR) {
+        // Retry
+    }
+}
+
+static void job_remove(job_t *job) {
+    for (job_t **link = &job_list; *link; link = &(*link)->next) {
+        if (*link == job) {
+            *link = job->next;
+            break;
+        }
+    }
+    if (job_list == NULL) job_use_counter = 0;
+    free(job->stages);
+    free(job->command);
+    free(job);
+}
+
+static void job_stat(const job_t *job, pipeline_stat_t *stat) {
+    stat->stage_count = job->stage_count;
+    for (int i = 0; i < job->stage_count && i < PIPESTAT_MAX_STAGES; i++) {
+        const job_stage_t *stage = &job->stages[i];
+        stage_stat_t *out = &stat->stages[i];
+        out->status = stage->status;
+        out->wall_us = stage->end_us ? stage->end_us - job->start_time_us : 0;
+        out->cpu_us = stage->cpu_us;
+        out->bytes_written = stage->bytes_written;
+        memcpy(out->name, stage->name, sizeof(out->name));
+    }
+}
+
+// Hand a finished job's usage and stages to its command line, or record it
+// in history itself if it outlived the line, then drop it
+static void job_finished(job_t *job) {
+    if (job->finish) job->finish(job->finish_data);
+
+    if (!job->detached) {
+        usage_add(&last_command_usage, &job->usage);
+        job_stat(job, &last_pipeline_stat);
+        last_pipeline_stat_current = 1;
+    } else if (!job->disowned) {
+        long execution_time_ms = (long)((get_monotonic_time_us() - job->start_time_us) / 1000);
+        pipeline_stat_t stat;
+        job_stat(job, &stat);
+        add_to_enhanced_history(job->command, job->cwd, job_exit_status(job), execution_time_ms, &job->usage,
+                                &stat);
+    }
+    job_remove(job);
+}
+
+static void job_detach(job_t *job) {
+    if (!job->detached) {
+        job->detached = 1;
+        job_detached = 1;
+    }
+}
+
+// Whether job a is a better pick than b for the current job: stopped jobs
+// come first, then the most recently used
+static int job_ranks_before(const job_t *a, const job_t *b) {
+    if (!b) return 1;
+    int a_stopped = job_state(a) == JOB_STOPPED;
+    int b_stopped = job_state(b) == JOB_STOPPED;
+    if (a_stopped != b_stopped) return a_stopped;
+    return a->last_use > b->last_use;
+}
+
+// Current (+) and previous (-) jobs
+static void job_markers(job_t **current, job_t **previous) {
+    *current = *previous = NULL;
+    for (job_t *job = job_list; job; job = job->next) {
+        if (job->disowned) continue;
+        if (job_ranks_before(job, *current)) {
+            *previous = *current;
+            *current = job;
+        } else if (job_ranks_before(job, *previous)) {
+            *previous = job;
+        }
+    }
+}
+
+static const char *job_state_text(const job_t *job, job_state_t state, char *buf, size_t size) {
+    if (state == JOB_RUNNING) return "Running";
+    if (state == JOB_STOPPED) {
+        switch (job_stop_signal(job)) {
+            case SIGTTIN: return "Stopped (tty input)";
+            case SIGTTOU: return "Stopped (tty output)";
+            case SIGSTOP: return "Stopped (signal)";
+            default: return "Stopped";
+        }
+    }
+    const job_stage_t *last = &job->stages[job->stage_count - 1];
+    if (last->signal) return strsignal(last->signal);
+    if (last->status == 0) return "Done";
+    snprintf(buf, size, "Exit %d", last->status);
+    return buf;
+}
+
+static void job_print(const job_t *job, int show_pid) {
+    job_t *current, *previous;
+    job_markers(&current, &previous);
+    char marker = job == current ? '+' : (job == previous ? '-' : ' ');
+
+    char buf[32];
+    job_state_t state = job_state(job);
+    const char *text = job_state_text(job, state, buf, sizeof(buf));
+    const char *suffix = (state == JOB_RUNNING && job->background) ? " &" : "";
+    if (show_pid) {
+        pid_t pid = job->pgid;
+        for (int i = 0; !pid && i < job->stage_count; i++) pid = job->stages[i].pid;
+        printf("[%d]%c %-6ld %-22s %s%s\n", job->id, marker, (long)pid, text, job->command, suffix);
+    } else {
+        printf("[%d]%c  %-22s  %s%s\n", job->id, marker, text, job->command, suffix);
+    }
+}
+
+void jobs_notify(void) {
+    jobs_reap();
+    job_t *job = job_list;
+    while (job) {
+        job_t *next = job->next;
+        job_state_t state = job_state(job);
+        if (state != job->reported) {
+            if (state != JOB_RUNNING && !job->disowned && xsh_interactive) job_print(job, 0);
+            job->reported = state;
+        }
+        if (state == JOB_DONE) job_finished(job);
+        job = next;
+    }
+    fflush(stdout);
+}
+
+// Wait in the foreground, with the terminal if there is job control, until
+// the job finishes or stops. resume continues a stopped job first.
+static int job_wait_foreground(job_t *job, int resume) {
+    foreground_job = job;
+    int terminal = job_control && job->pgid > 0;
+    if (terminal) {
+        if (job->has_tmodes) tcsetattr(shell_terminal, TCSADRAIN, &job->tmodes);
+        tcsetpgrp(shell_terminal, job->pgid);
+    }
+    if (resume) {
+        for (int i = 0; i < job->stage_count; i++) {
+            job_stage_t *stage = &job->stages[i];
+            if (stage->state != JOB_STOPPED) continue;
+            stage->state = JOB_RUNNING;
+            if (job->pgid <= 0) kill(stage->pid, SIGCONT);
+        }
+        if (job->pgid > 0) kill(-job->pgid, SIGCONT);
+    }
+
+    for (;;) {
+        jobs_reap();
+        if (job_state(job) != JOB_RUNNING) break;
+        jobs_wait_event();
+    }
+
+    if (terminal) {
+        tcsetpgrp(shell_terminal, shell_pgid);
+        job->has_tmodes = tcgetattr(shell_terminal, &job->tmodes) == 0;
+        tcsetattr(shell_terminal, TCSADRAIN, &shell_tmodes);
+    }
+    foreground_job = NULL;
+
+    if (job_state(job) == JOB_STOPPED) {
+        job->background = 0;
+        job->last_use = ++job_use_counter;
+        job->reported = JOB_STOPPED;
+        job_detach(job);
+        printf("\n");
+        job_print(job, 0);
+        fflush(stdout);
+        return 128 + job_stop_signal(job);
+    }
+
+    int status = job_exit_status(job);
+    job_finished(job);
+    return status;
+}
+
+int job_run(job_t *job) {
+    // Number it one past the highest job in use, and keep the list ordered
+    job_t **link = &job_list;
+    int id = 1;
+    while (*link) {
+        id = (*link)->id + 1;
+        link = &(*link)->next;
+    }
+    job->id = id;
+    *link = job;
+    job->last_use = ++job_use_counter;
+
+    if (!job->background) {
+        return job_wait_foreground(job, 0);
+    }
+
+    job_detach(job);
+    if (!xsh_interactive) return 0;
+    pid_t last_pid = 0;
+    for (int i = 0; i < job->stage_count; i++) {
+        if (job->stages[i].pid > 0) last_pid = job->stages[i].pid;
+    }
+    if (last_pid > 0) {
+        printf("[%d] %ld\n", job->id, (long)last_pid);
+    } else {
+        printf("[%d]\n", job->id); // Nothing could be started
+    }
+    fflush(stdout);
+    return 0;
+}
+
+void jobs_cleanup(void) {
+    // Stopped jobs would never be resumed once the shell is gone, so hang
+    // them up like a closing terminal would. Jobs whose stage threads still
+    // run keep their memory until exit.
+    jobs_reap();
+    job_t *job = job_list;
+    while (job) {
+        job_t *next = job->next;
+        if (job_state(job) == JOB_STOPPED && job->pgid > 0) {
+            killpg(job->pgid, SIGHUP);
+            killpg(job->pgid, SIGCONT);
+        }
+        int threads = 0;
+        for (int i = 0; i < job->stage_count; i++) {
+            if (job->stages[i].pid == 0 && job->stages[i].state == JOB_RUNNING) threads = 1;
+        }
+        if (!threads) {
+            if (job->finish) job->finish(job->finish_data);
+            job_remove(job);
+        }
+        job = next;
+    }
+
+    // Give the terminal back to the group we were started from
+    if (job_control && original_pgid != shell_pgid) {
+        tcsetpgrp(shell_terminal, original_pgid);
+    }
+    job_control = 0;
+}
+
+// Resolve a job spec: %n or n, %+ / %% / none for the current job, %- for
+// the previous one, %prefix or %?substring of the command
+static job_t *job_find(const char *spec, const char *builtin) {
+    job_t *current, *previous;
+    job_markers(&current, &previous);
+
+    job_t *found = NULL;
+    if (!spec || strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+        found = current;
+    } else if (strcmp(spec, "%-") == 0) {
+        found = previous;
+    } else {
+        const char *p = spec[0] == '%' ? spec + 1 : spec;
+        char *end;
+        long id = strtol(p, &end, 10);
+        if (*p && *end == '\0') {
+            for (job_t *job = job_list; job; job = job->next) {
+                if (job->id == id && !job->disowned) found = job;
+            }
+        } else if (spec[0] == '%') {
+            int contains = *p == '?';
+            if (contains) p++;
+            for (job_t *job = job_list; job; job = job->next) {
+                if (job->disowned) continue;
+                int match = contains ? strstr(job->command, p) != NULL
+                                     : strncmp(job->command, p, strlen(p)) == 0;
+                if (!match) continue;
+                if (found) {
+                    fprintf(stderr, "xsh: %s: %s: ambiguous job spec\n", builtin, spec);
+                    return NULL;
+                }
+                found = job;
+            }
+        }
+    }
+
+    if (!found) {
+        fprintf(stderr, "xsh: %s: %s: no such job\n", builtin, spec ? spec : "current");
+    }
+    return found;
+}
+
+// List jobs: -l adds process ids, -p prints only the process ids
+int xsh_jobs(char **args) {
+    int show_pid = 0, pids_only = 0;
+    int i = 1;
+    for (; args[i] && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "-l") == 0) {
+            show_pid = 1;
+        } else if (strcmp(args[i], "-p") == 0) {
+            pids_only = 1;
+        } else {
+            fprintf(stderr, "xsh: jobs: %s: invalid option\n", args[i]);
+            xsh_builtin_set_status(2);
+            return 1;
+        }
+    }
+
+    jobs_reap();
+    job_t *selected = NULL;
+    if (args[i]) {
+        selected = job_find(args[i], "jobs");
+        if (!selected) {
+            xsh_builtin_set_status(1);
+            return 1;
+        }
+    }
+
+    job_t *job = job_list;
+    while (job) {
+        job_t *next = job->next;
+        if (!job->disowned && (!selected || job == selected)) {
+            job_state_t state = job_state(job);
+            if (pids_only) {
+                printf("%ld\n", (long)(job->pgid ? job->pgid : job->stages[0].pid));
+            } else {
+                job_print(job, show_pid);
+            }
+            job->reported = state;
+            if (state == JOB_DONE) job_finished(job); // Shown now, not again at the prompt
+        }
+        job = next;
+    }
+    return 1;
+}
+
+// Continue a job in the foreground and wait for it
+int xsh_fg(char **args) {
+    jobs_reap();
+    job_t *job = job_find(args[1], "fg");
+    if (!job) {
+        xsh_builtin_set_status(1);
+        return 1;
+    }
+
+    printf("%s\n", job->command);
+    fflush(stdout);
+    job->background = 0;
+    job->last_use = ++job_use_counter;
+    xsh_builtin_set_status(job_wait_foreground(job, 1));
+    return 1;
+}
+
+// Continue stopped jobs in the background
+int xsh_bg(char **args) {
+    jobs_reap();
+    // Without arguments, the current job
+    int spec_count = 0;
+    while (args[spec_count + 1]) spec_count++;
+    for (int i = 1; i <= (spec_count ? spec_count : 1); i++) {
+        job_t *job = job_find(args[i], "bg");
+        if (!job) {
+            xsh_builtin_set_status(1);
+            continue;
+        }
+        if (job_state(job) != JOB_STOPPED) {
+            fprintf(stderr, "xsh: bg: job %d already in background\n", job->id);
+            continue;
+        }
+
+        for (int s = 0; s < job->stage_count; s++) {
+            job_stage_t *stage = &job->stages[s];
+            if (stage->state != JOB_STOPPED) continue;
+            stage->state = JOB_RUNNING;
+            if (job->pgid <= 0) kill(stage->pid, SIGCONT);
+        }
+        if (job->pgid > 0) kill(-job->pgid, SIGCONT);
+        job->background = 1;
+        job->reported = JOB_RUNNING;
+        job->last_use = ++job_use_counter;
+
+        job_t *current, *previous;
+        job_markers(&current, &previous);
+        printf("[%d]%c %s &\n", job->id, job == current ? '+' : (job == previous ? '-' : ' '), job->command);
+    }
+    return 1;
+}
+
+// Wait until a job finishes or stops, without giving it the terminal
+static int job_wait_quietly(job_t *job) {
+    for (;;) {
+        jobs_reap();
+        job_state_t state = job_state(job);
+        if (state == JOB_STOPPED) return 128 + job_stop_signal(job);
+        if (state == JOB_DONE) break;
+        jobs_wait_event();
+    }
+    int status = job_exit_status(job);
+    job_finished(job);
+    return status;
+}
+
+// Wait for the given jobs or process ids, or for every job
+int xsh_wait(char **args) {
+    int status = 0;
+    if (!args[1]) {
+        job_t *job = job_list;
+        while (job) {
+            // Waiting can finish and free other jobs too, so restart each time
+            job_t *next = job->next;
+            if (job_state(job) == JOB_RUNNING) {
+                job_wait_quietly(job);
+                job = job_list;
+                continue;
+            }
+            job = next;
+        }
+        xsh_builtin_set_status(0);
+        return 1;
+    }
+
+    for (int i = 1; args[i]; i++) {
+        job_t *job = NULL;
+        if (args[i][0] == '%') {
+            job = job_find(args[i], "wait");
+            if (!job) {
+                status = 127;
+                continue;
+            }
+        } else {
+            char *end;
+            long pid = strtol(args[i], &end, 10);
+            if (*end != '\0' || pid <= 0) {
+                fprintf(stderr, "xsh: wait: %s: not a pid or valid job spec\n", args[i]);
+                status = 2;
+                continue;
+            }
+            for (job_t *candidate = job_list; candidate && !job; candidate = candidate->next) {
+                for (int s = 0; s < candidate->stage_count; s++) {
+                    if (candidate->stages[s].pid == pid) job = candidate;
+                }
+            }
+            if (!job) {
+                fprintf(stderr, "xsh: wait: pid %ld is not a child of this shell\n", pid);
+                status = 127;
+                continue;
+            }
+        }
+        status = job_wait_quietly(job);
+    }
+    xsh_builtin_set_status(status);
+    return 1;
+}
+
+// Remove jobs from the table: they are no longer listed or reported
+int xsh_disown(char **args) {
+    jobs_reap();
+    if (args[1] && strcmp(args[1], "-a") == 0) {
+        for (job_t *job = job_list; job; job = job->next) {
+            job->disowned = 1;
+        }
+        return 1;
+    }
+
+    int spec_count = 0;
+    while (args[spec_count + 1]) spec_count++;
+    for (int i = 1; i <= (spec_count ? spec_count : 1); i++) {
+        job_t *job = job_find(args[i], "disown");
+        if (!job) {
+            xsh_builtin_set_status(1);
+            continue;
+        }
+        job->disowned = 1;
+    }
+    return 1;
+}
+
+#else // _WIN32
+
+// Windows commands run through CreateProcess without process groups or
+// SIGCHLD, so there is no job control: & runs in the foreground
+
+void jobs_init(void) {}
+void jobs_init_subshell(void) {}
+void jobs_cleanup(void) {}
+int jobs_control_enabled(void) { return 0; }
+int jobs_event_fd(void) { return -1; }
+void jobs_reap(void) {}
+void jobs_notify(void) {}
+int jobs_take_detached(void) { return 0; }
+
+static int jobs_unsupported(char **args) {
+    fprintf(stderr, "xsh: %s: job control is not supported on Windows\n", args[0]);
+    xsh_builtin_set_status(1);
+    return 1;
+}
+
+int xsh_jobs(char **args) { return jobs_unsupported(args); }
+int xsh_fg(char **args) { return jobs_unsupported(args); }
+int xsh_bg(char **args) { return jobs_unsupported(args); }
+int xsh_wait(char **args) { return jobs_unsupported(args); }
+int xsh_disown(char **args) { return jobs_unsupported(args); }
+
+#endif // _WIN32
@@ -0,0 +1,116 @@
+#include "launch.h"
+#include "cmdhash.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// Spawn the executable at path. One the kernel cannot run (ENOEXEC, such as a
+// script without a #! line) is run by /bin/sh instead, as execvp does.
+static int spawn_path(pid_t *pid, const char *path, posix_spawn_file_actions_t *actions,
+                      posix_spawnattr_t *attr, char *const args[]) {
+    int err = posix_spawn(pid, path, actions, attr, args, environ);
+    if (err != ENOEXEC) return err;
+
+    size_t count = 0;
+    while (args[count]) count++;
+    char **shell_args = malloc((count + 2) * sizeof(char *));
+    if (!shell_args) return ENOMEM;
+    shell_args[0] = "/bin/sh";
+    shell_args[1] = (char *)path;
+    memcpy(shell_args + 2, args + 1, count * sizeof(char *)); // args[1..] and the NULL
+    err = posix_spawn(pid, "/bin/sh", actions, attr, shell_args, environ);
+    free(shell_args);
+    return err;
+}
+
+// Give the child default dispositions for the signals an interactive shell
+// ignores (ignored signals survive exec) and an empty signal mask, and put it
+// in process group pgid if that is not -1
+static int launch_attributes(posix_spawnattr_t *attr, pid_t pgid) {
+    static const int shell_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE};
+    sigset_t defaults, mask;
+    sigemptyset(&defaults);
+    sigemptyset(&mask);
+    for (size_t i = 0; i < sizeof(shell_signals) / sizeof(shell_signals[0]); i++) {
+        sigaddset(&defaults, shell_signals[i]);
+    }
+
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    int err = posix_spawnattr_setsigdefault(attr, &defaults);
+    if (err == 0) err = posix_spawnattr_setsigmask(attr, &mask);
+    if (err == 0 && pgid >= 0) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        err = posix_spawnattr_setpgroup(attr, pgid);
+    }
+    if (err == 0) err = posix_spawnattr_setflags(attr, flags);
+    return err;
+}
+
+pid_t launch_process(char *const args[], const int fds[3], pid_t pgid) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    int err = posix_spawn_file_actions_init(&actions);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    err = posix_spawnattr_init(&attr);
+    if (err != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        errno = err;
+        return -1;
+    }
+    err = launch_attributes(&attr, pgid);
+
+    // Install the child's standard streams. dup2 clears close-on-exec on the
+    // copy, so pipe ends and redirection targets opened close-on-exec by the
+    // shell survive exactly where they are installed and nowhere else. A
+    // descriptor already on its own number still gets the dup2: posix_spawn
+    // then clears close-on-exec on it in place.
+    for (int i = 0; i < 3 && err == 0; i++) {
+        if (fds && fds[i] >= 0) {
+            err = posix_spawn_file_actions_adddup2(&actions, fds[i], i);
+        }
+    }
+
+    // Names with a directory part are run as given; bare names go through
+    // the command hash instead of posix_spawnp's exec attempt per PATH entry
+    pid_t pid = -1;
+    if (err == 0) {
+        if (strchr(args[0], '/')) {
+            err = spawn_path(&pid, args[0], &actions, &attr, args);
+        } else {
+            const char *path = cmdhash_lookup(args[0], 1);
+            err = path ? spawn_path(&pid, path, &actions, &attr, args) : ENOENT;
+            if (err == ENOENT && path) {
+                // The remembered executable is gone; resolve the name again
+                cmdhash_forget(args[0]);
+                path = cmdhash_lookup(args[0], 1);
+                if (path) err = spawn_path(&pid, path, &actions, &attr, args);
+            }
+        }
+    }
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+int launch_set_cloexec(int fd) {
+    int flags = fcntl(fd, F_GETFD);
+    if (flags == -1) return -1;
+    return fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+}
+#endif
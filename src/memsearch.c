@@ -0,0 +1,158 @@
+#include "memsearch.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MEMSEARCH_RARE 150 // Bytes this rare (upper case and rarer) are left to memchr()
+
+#define F(c) (c >= 'A' && c <= 'Z' ? c + 32 : c)
+#define F4(c) F(c), F(c + 1), F(c + 2), F(c + 3)
+#define F16(c) F4(c), F4(c + 4), F4(c + 8), F4(c + 12)
+const unsigned char memsearch_fold_table[256] = {
+    F16(0),   F16(16),  F16(32),  F16(48),  F16(64),  F16(80),  F16(96),  F16(112),
+    F16(128), F16(144), F16(160), F16(176), F16(192), F16(208), F16(224), F16(240),
+};
+#undef F16
+#undef F4
+#undef F
+
+// How common a byte is in text and logs; higher is more common
+static int byte_frequency(unsigned char c) {
+    static const char common[] = " etaoinsrhldcumfpgwyb.,-0123456789:/_=\"'()[]kvxjqz\t";
+    const char *hit = memchr(common, c, sizeof(common) - 1);
+    if (hit) return 255 - (int)(hit - common);
+    if (c >= 'A' && c <= 'Z') return 150;
+    if (c >= 0x20 && c < 0x7f) return 100;
+    return c == '\n' ? 0 : 10; // A needle byte that is a newline is as good as absent
+}
+
+int memsearch_init(memsearch_t *search, const char *needle, size_t length, int fold) {
+    memset(search, 0, sizeof(*search));
+    search->needle = malloc(length + 1);
+    if (!search->needle) return -1;
+    search->length = length;
+    search->fold = fold;
+    for (size_t i = 0; i < length; i++) {
+        search->needle[i] = fold ? MEMSEARCH_FOLD(needle[i]) : (unsigned char)needle[i];
+    }
+    search->needle[length] = '\0';
+    if (length == 0) return 0;
+
+    // The rarest byte, then the rarest at another offset. A folded letter
+    // counts as its more common case.
+    int best[2] = {1000, 1000};
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = search->needle[i];
+        int frequency = byte_frequency(c);
+        if (fold && c >= 'a' && c <= 'z' && byte_frequency(c - 32) > frequency) frequency = byte_frequency(c - 32);
+        if (frequency < best[0]) {
+            best[1] = best[0];
+            search->rare_offset[1] = search->rare_offset[0];
+            best[0] = frequency;
+            search->rare_offset[0] = i;
+        } else if (frequency < best[1]) {
+            best[1] = frequency;
+            search->rare_offset[1] = i;
+        }
+    }
+    if (length == 1) search->rare_offset[1] = 0;
+    search->rare_frequency = best[0];
+
+    for (int c = 0; c < 256; c++) search->skip[c] = length;
+    for (size_t i = 0; i + 1 < length; i++) {
+        search->skip[search->needle[i]] = length - 1 - i;
+        if (fold && search->needle[i] >= 'a' && search->needle[i] <= 'z') {
+            search->skip[search->needle[i] - 32] = length - 1 - i;
+        }
+    }
+    return 0;
+}
+
+void memsearch_free(memsearch_t *search) {
+    free(search->needle);
+    search->needle = NULL;
+}
+
+static int matches_at(const memsearch_t *search, const unsigned char *at) {
+    if (!search->fold) return memcmp(at, search->needle, search->length) == 0;
+    for (size_t i = 0; i < search->length; i++) {
+        if (MEMSEARCH_FOLD(at[i]) != search->needle[i]) return 0;
+    }
+    return 1;
+}
+
+#ifdef __SSE2__
+static const char *find_pair(const memsearch_t *search, const unsigned char *h, size_t n) {
+    size_t last = n - search->length; // Last position the needle fits at
+    size_t offset0 = search->rare_offset[0], offset1 = search->rare_offset[1];
+    unsigned char c0 = search->needle[offset0], c1 = search->needle[offset1];
+    // Folded letters are looked for in both cases
+    unsigned char u0 = search->fold && c0 >= 'a' && c0 <= 'z' ? c0 - 32 : c0;
+    unsigned char u1 = search->fold && c1 >= 'a' && c1 <= 'z' ? c1 - 32 : c1;
+    __m128i lower0 = _mm_set1_epi8((char)c0), upper0 = _mm_set1_epi8((char)u0);
+    __m128i lower1 = _mm_set1_epi8((char)c1), upper1 = _mm_set1_epi8((char)u1);
+
+    size_t i = 0;
+    for (; i + 16 <= last + 1; i += 16) {
+        __m128i at0 = _mm_loadu_si128((const __m128i *)(h + i + offset0));
+        __m128i at1 = _mm_loadu_si128((const __m128i *)(h + i + offset1));
+        __m128i hit0 = _mm_or_si128(_mm_cmpeq_epi8(at0, lower0), _mm_cmpeq_epi8(at0, upper0));
+        __m128i hit1 = _mm_or_si128(_mm_cmpeq_epi8(at1, lower1), _mm_cmpeq_epi8(at1, upper1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(hit0, hit1));
+        while (mask) {
+            size_t at = i + (size_t)__builtin_ctz(mask);
+            if (matches_at(search, h + at)) return (const char *)(h + at);
+            mask &= mask - 1;
+        }
+    }
+    for (; i <= last; i++) {
+        unsigned char b0 = h[i + offset0], b1 = h[i + offset1];
+        if ((b0 == c0 || b0 == u0) && (b1 == c1 || b1 == u1) && matches_at(search, h + i)) {
+            return (const char *)(h + i);
+        }
+    }
+    return NULL;
+}
+#endif
+
+// The rarest byte with memchr(), then the whole needle around it
+static const char *find_rare(const memsearch_t *search, const unsigned char *h, size_t n) {
+    size_t offset = search->rare_offset[0];
+    const unsigned char *p = h + offset;
+    const unsigned char *stop = h + n - search->length + offset + 1;
+    while (p < stop && (p = memchr(p, search->needle[offset], stop - p))) {
+        if (memcmp(p - offset, search->needle, search->length) == 0) return (const char *)(p - offset);
+        p++;
+    }
+    return NULL;
+}
+
+#ifndef __SSE2__
+static const char *find_horspool(const memsearch_t *search, const unsigned char *h, size_t n) {
+    size_t last = search->length - 1;
+    for (size_t i = 0; i + last < n; i += search->skip[h[i + last]]) {
+        if (MEMSEARCH_FOLD(h[i + last]) == search->needle[last] && matches_at(search, h + i)) {
+            return (const char *)(h + i);
+        }
+    }
+    return NULL;
+}
+#endif
+
+const char *memsearch_find(const memsearch_t *search, const char *haystack, const char *end) {
+    size_t n = (size_t)(end - haystack);
+    if (search->length == 0) return haystack;
+    if (n < search->length) return NULL;
+    const unsigned char *h = (const unsigned char *)haystack;
+    if (!search->fold && (search->length == 1 || search->rare_frequency <= MEMSEARCH_RARE)) {
+        return find_rare(search, h, n);
+    }
+#ifdef __SSE2__
+    return find_pair(search, h, n);
+#else
+    return search->fold ? find_horspool(search, h, n) : find_rare(search, h, n);
+#endif
+}
@@ -0,0 +1,575 @@
+#ifndef _WIN32
+#define _GNU_SOURCE // For wait4() and pipe2()
+#endif
+
+#include "parallel.h"
+#include "builtins.h"
+#include "execute.h"
+#include "jobs.h"
+#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include "launch.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h> // For struct rusage
+#include <sys/wait.h>
+
+#define PARALLEL_READ_CHUNK 16384
+
+// Output captured from one stream of a job
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} parallel_buffer_t;
+
+// A started job, kept after it finishes until its output is printed
+typedef struct parallel_job {
+    long sequence;             // Position of its input, from 0
+    char *command;             // Command text, for the failure summary
+    int status;                // Exit status, 128 + signal if killed
+    parallel_buffer_t out;
+    parallel_buffer_t err;
+    struct parallel_job *next; // Next finished job held back by -k
+} parallel_job_t;
+
+typedef struct {
+    pid_t pid;
+    int fds[2];          // Read ends of the stdout and stderr pipes, -1 at EOF
+    parallel_job_t *job; // NULL if the slot is free
+} parallel_slot_t;
+
+typedef struct {
+    char **template;     // Command words, ended by ::: or NULL
+    int template_count;
+    int has_placeholder; // Some word contains {}
+    int through_shell;   // Operators or a builtin: run in a forked copy of the shell
+    int reparse;         // Operators: the words are parsed again as a command line
+    int keep_order;      // -k: print in input order, not as jobs finish
+    int null_fd;         // Stdin of the jobs
+
+    char **inputs;       // Words after :::, or NULL to read input_file
+    FILE *input_file;
+    long next_sequence;
+    long next_printed;         // Sequence -k prints next
+    parallel_job_t *held;      // Finished jobs waiting for -k, by sequence
+    int halted;                // Start no more jobs (interrupted or out of resources)
+
+    long failed;
+    char *failed_commands[PARALLEL_FAILURES_LISTED];
+    int failed_status[PARALLEL_FAILURES_LISTED];
+} parallel_t;
+
+static int buffer_reserve(parallel_buffer_t *buffer, size_t extra) {
+    if (buffer->length + extra <= buffer->capacity) return 0;
+    size_t capacity = buffer->capacity ? buffer->capacity : PARALLEL_READ_CHUNK;
+    while (capacity < buffer->length + extra) capacity *= 2;
+    char *data = realloc(buffer->data, capacity);
+    if (!data) return -1;
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 0;
+}
+
+// Read what the pipe has into the buffer; returns 0 at end of file
+static int buffer_read(parallel_buffer_t *buffer, int fd) {
+    if (buffer_reserve(buffer, PARALLEL_READ_CHUNK) != 0) {
+        // Out of memory: keep draining so the job can finish
+        char discard[PARALLEL_READ_CHUNK];
+        ssize_t n = read(fd, discard, sizeof(discard));
+        return n > 0 || (n == -1 && errno == EINTR);
+    }
+    ssize_t n = read(fd, buffer->data + buffer->length, PARALLEL_READ_CHUNK);
+    if (n > 0) {
+        buffer->length += n;
+        return 1;
+    }
+    return n == -1 && errno == EINTR;
+}
+
+static void free_words(char **words) {
+    if (!words) return;
+    for (int i = 0; words[i]; i++) {
+        free(words[i]);
+    }
+    free(words);
+}
+
+// Next input, or NULL once they are exhausted. Blank lines are skipped.
+static char *parallel_next_input(parallel_t *p) {
+    if (p->inputs) {
+        return *p->inputs ? strdup(*p->inputs++) : NULL;
+    }
+
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &size, p->input_file)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+        if (length > 0) return line;
+    }
+    free(line);
+    return NULL;
+}
+
+// Copy of word with every {} replaced by input
+static char *parallel_substitute(const char *word, const char *input) {
+    size_t input_length = strlen(input);
+    size_t length = 0;
+    for (const char *c = word; *c; c++) {
+        if (c[0] == '{' && c[1] == '}') {
+            length += input_length;
+            c++;
+        } else {
+            length++;
+        }
+    }
+
+    char *result = malloc(length + 1);
+    if (!result) return NULL;
+    char *out = result;
+    for (const char *c = word; *c; c++) {
+        if (c[0] == '{' && c[1] == '}') {
+            memcpy(out, input, input_length);
+            out += input_length;
+            c++;
+        } else {
+            *out++ = *c;
+        }
+    }
+    *out = '\0';
+    return result;
+}
+
+// Words of the command for one input: the template with {} replaced, or the
+// input appended if the template has no {}
+static char **parallel_build_args(const parallel_t *p, const char *input) {
+    int count = p->template_count + (p->has_placeholder ? 0 : 1);
+    char **args = calloc(count + 1, sizeof(char *));
+    if (!args) return NULL;
+    for (int i = 0; i < p->template_count; i++) {
+        args[i] = parallel_substitute(p->template[i], input);
+        if (!args[i]) {
+            free_words(args);
+            return NULL;
+        }
+    }
+    if (!p->has_placeholder && !(args[count - 1] = strdup(input))) {
+        free_words(args);
+        return NULL;
+    }
+    return args;
+}
+
+// Input quoted for the parser, so that operators and quotes in it stay
+// text: 'input', with each ' in it written as '"'"'
+static char *parallel_quote(const char *input) {
+    size_t length = 3;
+    for (const char *c = input; *c; c++) {
+        length += *c == '\'' ? 5 : 1;
+    }
+    char *quoted = malloc(length);
+    if (!quoted) return NULL;
+    char *out = quoted;
+    *out++ = '\'';
+    for (const char *c = input; *c; c++) {
+        if (*c == '\'') {
+            memcpy(out, "'\"'\"'", 5);
+            out += 5;
+        } else {
+            *out++ = *c;
+        }
+    }
+    *out++ = '\'';
+    *out = '\0';
+    return quoted;
+}
+
+static char *join_words(char **words) {
+    size_t length = 1;
+    for (int i = 0; words[i]; i++) {
+        length += strlen(words[i]) + 1;
+    }
+    char *text = malloc(length);
+    if (!text) return NULL;
+    text[0] = '\0';
+    for (int i = 0; words[i]; i++) {
+        if (i > 0) strcat(text, " ");
+        strcat(text, words[i]);
+    }
+    return text;
+}
+
+// Run a job in a forked copy of the shell: the command line through the
+// executor if there is one, otherwise the builtin named by args[0]
+static pid_t parallel_fork_shell(const char *command, char **args, const int fds[3]) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    job_child_setup(-1);
+    jobs_init_subshell();
+    for (int s = 0; s < 3; s++) {
+        dup2(fds[s], s);
+    }
+    // stdin may still buffer input the shell read ahead
+    xsh_builtin_set_streams(fdopen(STDIN_FILENO, "r"), NULL, NULL);
+
+    int status = 1;
+    if (command) {
+        arena_t arena = ARENA_INIT;
+        pipeline_t *pipeline = parse_line(&arena, command);
+        if (pipeline) status = execute_pipeline(pipeline);
+    } else {
+        xsh_execute_builtin(args);
+        status = xsh_builtin_status();
+    }
+    fflush(stdout);
+    fflush(stderr);
+    _exit(status);
+}
+
+static void parallel_print(parallel_job_t *job) {
+    FILE *out = xsh_builtin_stdout();
+    FILE *err = xsh_builtin_stderr();
+    if (job->out.length) {
+        fwrite(job->out.data, 1, job->out.length, out);
+        fflush(out);
+    }
+    if (job->err.length) {
+        fwrite(job->err.data, 1, job->err.length, err);
+        fflush(err);
+    }
+    free(job->out.data);
+    free(job->err.data);
+    free(job->command);
+    free(job);
+}
+
+// Account for a finished job and print it, now or when its turn comes
+static void parallel_finish(parallel_t *p, parallel_job_t *job) {
+    if (job->status != 0) {
+        if (p->failed < PARALLEL_FAILURES_LISTED) {
+            p->failed_commands[p->failed] = strdup(job->command);
+            p->failed_status[p->failed] = job->status;
+        }
+        p->failed++;
+    }
+
+    if (!p->keep_order) {
+        parallel_print(job);
+        return;
+    }
+
+    parallel_job_t **link = &p->held;
+    while (*link && (*link)->sequence < job->sequence) {
+        link = &(*link)->next;
+    }
+    job->next = *link;
+    *link = job;
+    while (p->held && p->held->sequence == p->next_printed) {
+        parallel_job_t *next = p->held->next;
+        parallel_print(p->held);
+        p->held = next;
+        p->next_printed++;
+    }
+}
+
+// Start the job for one input in a free slot. A job that cannot be started
+// is finished at once as failed.
+static void parallel_start(parallel_t *p, parallel_slot_t *slot, const char *input) {
+    parallel_job_t *job = calloc(1, sizeof(parallel_job_t));
+    char **args = parallel_build_args(p, input);
+    if (!job || !args || !(job->command = join_words(args))) {
+        fprintf(stderr, "xsh: parallel: allocation error\n");
+        free(job);
+        free_words(args);
+        p->halted = 1;
+        return;
+    }
+    job->sequence = p->next_sequence++;
+
+    // Parsed again, the input goes in quoted so it cannot add commands
+    char *line = NULL;
+    if (p->reparse) {
+        char *quoted = parallel_quote(input);
+        char **words = quoted ? parallel_build_args(p, quoted) : NULL;
+        line = words ? join_words(words) : NULL;
+        free(quoted);
+        free_words(words);
+    }
+
+    int out_pipe[2] = {-1, -1};
+    int err_pipe[2] = {-1, -1};
+    pid_t pid = -1;
+    if (p->reparse && !line) {
+        fprintf(stderr, "xsh: parallel: allocation error\n");
+        p->halted = 1;
+    } else if (pipe2(out_pipe, O_CLOEXEC) == -1 || pipe2(err_pipe, O_CLOEXEC) == -1) {
+        perror("xsh: parallel: pipe");
+        p->halted = 1;
+    } else {
+        int fds[3] = {p->null_fd, out_pipe[1], err_pipe[1]};
+        if (p->through_shell) {
+            pid = parallel_fork_shell(line, args, fds);
+            if (pid == -1) perror("xsh: parallel: fork");
+        } else {
+            pid = launch_process(args, fds, -1);
+            if (pid == -1) {
+                int error = errno;
+                if (buffer_reserve(&job->err, strlen(args[0]) + 64) == 0) {
+                    job->err.length = sprintf(job->err.data, "xsh: %s: %s\n", args[0], strerror(error));
+                }
+                job->status = error == ENOENT ? 127 : 126;
+            }
+        }
+    }
+    free_words(args);
+    free(line);
+    if (out_pipe[1] != -1) close(out_pipe[1]);
+    if (err_pipe[1] != -1) close(err_pipe[1]);
+
+    if (pid == -1) {
+        if (out_pipe[0] != -1) close(out_pipe[0]);
+        if (err_pipe[0] != -1) close(err_pipe[0]);
+        if (job->status == 0) job->status = 1;
+        parallel_finish(p, job);
+        return;
+    }
+    slot->pid = pid;
+    slot->fds[0] = out_pipe[0];
+    slot->fds[1] = err_pipe[0];
+    slot->job = job;
+}
+
+// Wait for output from the running jobs and buffer it. Jobs that closed
+// both pipes are about to exit, so the SIGCHLD pipe is watched as well.
+static void parallel_wait(parallel_slot_t *slots, int slot_count, struct pollfd *pfds, int *owners) {
+    int count = 0;
+    int exiting = 0;
+    for (int s = 0; s < slot_count; s++) {
+        if (!slots[s].job) continue;
+        if (slots[s].fds[0] == -1 && slots[s].fds[1] == -1) exiting = 1;
+        for (int f = 0; f < 2; f++) {
+            if (slots[s].fds[f] == -1) continue;
+            pfds[count].fd = slots[s].fds[f];
+            pfds[count].events = POLLIN;
+            pfds[count].revents = 0;
+            owners[count++] = s * 2 + f;
+        }
+    }
+    int event_fd = jobs_event_fd();
+    if (exiting && event_fd != -1) {
+        pfds[count].fd = event_fd;
+        pfds[count].events = POLLIN;
+        pfds[count].revents = 0;
+        owners[count++] = -1;
+    }
+    if (count == 0 && !exiting) return;
+
+    // Without the SIGCHLD pipe, check on exiting jobs every 10 ms
+    if (poll(pfds, count, exiting && event_fd == -1 ? 10 : -1) == -1) {
+        if (errno != EINTR) perror("xsh: parallel: poll");
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!pfds[i].revents) continue;
+        if (owners[i] == -1) {
+            jobs_reap(); // Drains the pipe; parallel_collect then reaps ours
+            continue;
+        }
+        parallel_slot_t *slot = &slots[owners[i] / 2];
+        int f = owners[i] % 2;
+        parallel_buffer_t *buffer = f == 0 ? &slot->job->out : &slot->job->err;
+        if (!buffer_read(buffer, slot->fds[f])) {
+            close(slot->fds[f]);
+            slot->fds[f] = -1;
+        }
+    }
+}
+
+// Reap the jobs whose output is complete; returns how many finished
+static int parallel_collect(parallel_t *p, parallel_slot_t *slots, int slot_count) {
+    int finished = 0;
+    for (int s = 0; s < slot_count; s++) {
+        parallel_slot_t *slot = &slots[s];
+        if (!slot->job || slot->fds[0] != -1 || slot->fds[1] != -1) continue;
+
+        int status;
+        struct rusage usage;
+        pid_t result = wait4(slot->pid, &status, WNOHANG, &usage);
+        if (result == 0 || (result == -1 && errno == EINTR)) continue;
+        if (result == -1) {
+            slot->job->status = 1;
+        } else {
+            jobs_add_usage(&usage);
+            if (WIFSIGNALED(status)) {
+                slot->job->status = 128 + WTERMSIG(status);
+                // Ctrl-C reached the jobs: let the running ones finish only
+                if (WTERMSIG(status) == SIGINT) p->halted = 1;
+            } else {
+                slot->job->status = WEXITSTATUS(status);
+            }
+        }
+        parallel_finish(p, slot->job);
+        slot->job = NULL;
+        slot->pid = 0;
+        finished++;
+    }
+    return finished;
+}
+
+static void parallel_summary(parallel_t *p) {
+    if (p->failed == 0) return;
+    FILE *err = xsh_builtin_stderr();
+    fprintf(err, "xsh: parallel: %ld of %ld jobs failed\n", p->failed, p->next_sequence);
+    long listed = p->failed < PARALLEL_FAILURES_LISTED ? p->failed : PARALLEL_FAILURES_LISTED;
+    for (long i = 0; i < listed; i++) {
+        fprintf(err, "  exit %-3d %s\n", p->failed_status[i],
+                p->failed_commands[i] ? p->failed_commands[i] : "?");
+        free(p->failed_commands[i]);
+    }
+    if (p->failed > listed) {
+        fprintf(err, "  ... and %ld more\n", p->failed - listed);
+    }
+}
+
+// Run a command for every input, a bounded number at a time
+int xsh_parallel(char **args) {
+    parallel_t p;
+    memset(&p, 0, sizeof(p));
+    long slot_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (slot_count < 1) slot_count = 1;
+    if (slot_count > PARALLEL_MAX_SLOTS) slot_count = PARALLEL_MAX_SLOTS;
+    const char *input_path = NULL;
+
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(args[i], "-k") == 0) {
+            p.keep_order = 1;
+        } else if (strncmp(args[i], "-j", 2) == 0) {
+            const char *value = args[i][2] ? args[i] + 2 : args[++i];
+            char *end = NULL;
+            slot_count = value ? strtol(value, &end, 10) : 0;
+            if (!value || *end != '\0' || slot_count < 1 || slot_count > PARALLEL_MAX_SLOTS) {
+                fprintf(stderr, "xsh: parallel: -j takes a job count from 1 to %d\n", PARALLEL_MAX_SLOTS);
+                xsh_builtin_set_status(2);
+                return 1;
+            }
+        } else if (strcmp(args[i], "-a") == 0) {
+            input_path = args[++i];
+            if (!input_path) {
+                fprintf(stderr, "xsh: parallel: -a: option requires an argument\n");
+                xsh_builtin_set_status(2);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "xsh: parallel: %s: invalid option\n", args[i]);
+            xsh_builtin_set_status(2);
+            return 1;
+        }
+    }
+
+    p.template = &args[i];
+    while (args[i] && strcmp(args[i], ":::") != 0) {
+        if (strstr(args[i], "{}")) p.has_placeholder = 1;
+        p.template_count++;
+        i++;
+    }
+    if (p.template_count == 0) {
+        fprintf(stderr, "xsh: parallel: missing command\n");
+        xsh_builtin_set_status(2);
+        return 1;
+    }
+    if (args[i]) {
+        if (input_path) {
+            fprintf(stderr, "xsh: parallel: -a and ::: cannot be combined\n");
+            xsh_builtin_set_status(2);
+            return 1;
+        }
+        p.inputs = &args[i + 1];
+    } else if (input_path) {
+        p.input_file = fopen(input_path, "r");
+        if (!p.input_file) {
+            fprintf(stderr, "xsh: parallel: %s: %s\n", input_path, strerror(errno));
+            xsh_builtin_set_status(1);
+            return 1;
+        }
+    } else {
+        p.input_file = xsh_builtin_stdin();
+    }
+
+    // Template words end at :::, so join a NULL-terminated copy of them
+    char **words = calloc(p.template_count + 1, sizeof(char *));
+    char *text = NULL;
+    if (words) {
+        memcpy(words, p.template, p.template_count * sizeof(char *));
+        text = join_words(words);
+    }
+    parallel_slot_t *slots = calloc(slot_count, sizeof(parallel_slot_t));
+    struct pollfd *pfds = calloc(slot_count * 2 + 1, sizeof(struct pollfd)); // And the SIGCHLD pipe
+    int *owners = calloc(slot_count * 2 + 1, sizeof(int));
+    p.null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (!text || !slots || !pfds || !owners || p.null_fd == -1) {
+        fprintf(stderr, "xsh: parallel: %s\n", p.null_fd == -1 ? strerror(errno) : "allocation error");
+        p.halted = 1;
+    } else {
+        p.reparse = contains_operators(text);
+        p.through_shell = p.reparse || xsh_builtin_exists(p.template[0]);
+    }
+    free(words);
+    free(text);
+
+    // Keep every slot busy until the inputs run out
+    int running = 0;
+    int exhausted = 0;
+    for (;;) {
+        for (int s = 0; s < slot_count && !exhausted && !p.halted; s++) {
+            while (!slots[s].job && !exhausted && !p.halted) {
+                char *input = parallel_next_input(&p);
+                if (!input) {
+                    exhausted = 1;
+                    break;
+                }
+                parallel_start(&p, &slots[s], input);
+                free(input);
+                if (slots[s].job) running++;
+            }
+        }
+        if (running == 0) break;
+        parallel_wait(slots, slot_count, pfds, owners);
+        running -= parallel_collect(&p, slots, slot_count);
+    }
+
+    parallel_summary(&p);
+    if (p.null_fd != -1) close(p.null_fd);
+    if (input_path && p.input_file) fclose(p.input_file);
+    free(slots);
+    free(pfds);
+    free(owners);
+    xsh_builtin_set_status(p.failed || p.halted ? 1 : 0);
+    return 1;
+}
+
+#else // _WIN32
+
+int xsh_parallel(char **args) {
+    fprintf(stderr, "xsh: %s: not supported on Windows\n", args[0]);
+    xsh_builtin_set_status(1);
+    return 1;
+}
+
+#endif // _WIN32
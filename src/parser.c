@@ -0,0 +1,322 @@
+#include "parser.h"
+#include "utils.h" // For xsh_hash_bytes
+#include <stdio.h>
+#include <string.h>
+
+// Character classes for the lexer; 0 = part of a word
+enum {
+    CHAR_WORD = 0,
+    CHAR_SPACE,
+    CHAR_OPERATOR, // Starts an operator: | & ; < >
+    CHAR_QUOTE,
+    CHAR_END
+};
+
+static const unsigned char char_class[256] = {
+    ['\0'] = CHAR_END,
+    [' '] = CHAR_SPACE, ['\t'] = CHAR_SPACE, ['\n'] = CHAR_SPACE,
+    ['\v'] = CHAR_SPACE, ['\f'] = CHAR_SPACE, ['\r'] = CHAR_SPACE,
+    ['|'] = CHAR_OPERATOR, ['&'] = CHAR_OPERATOR, [';'] = CHAR_OPERATOR,
+    ['<'] = CHAR_OPERATOR, ['>'] = CHAR_OPERATOR,
+    ['"'] = CHAR_QUOTE, ['\''] = CHAR_QUOTE
+};
+
+void lexer_init(lexer_t *lexer, const char *line) {
+    lexer->pos = line;
+}
+
+static token_t make_token(token_type_t type, const char *start, size_t length) {
+    token_t token = {type, start, length, 0};
+    return token;
+}
+
+token_t lexer_next(lexer_t *lexer) {
+    const char *p = lexer->pos;
+    while (char_class[(unsigned char)*p] == CHAR_SPACE) p++;
+
+    token_t token;
+    switch (*p) {
+    case '\0':
+        token = make_token(TOKEN_END, p, 0);
+        break;
+    case '|':
+        token = p[1] == '|' ? make_token(TOKEN_OR, p, 2) : make_token(TOKEN_PIPE, p, 1);
+        break;
+    case '&':
+        token = p[1] == '&' ? make_token(TOKEN_AND, p, 2) : make_token(TOKEN_BACKGROUND, p, 1);
+        break;
+    case '>':
+        token = p[1] == '>' ? make_token(TOKEN_REDIR_APPEND, p, 2) : make_token(TOKEN_REDIR_OUT, p, 1);
+        break;
+    case '<':
+        token = make_token(TOKEN_REDIR_IN, p, 1);
+        break;
+    case ';':
+        token = make_token(TOKEN_SEMICOLON, p, 1);
+        break;
+    default: {
+        if (p[0] == '2' && p[1] == '>') {
+            token = make_token(TOKEN_REDIR_ERR, p, 2);
+            break;
+        }
+        // Word: plain text and quoted parts up to an unquoted space or operator
+        const char *start = p;
+        int quoted = 0;
+        for (;;) {
+            int class = char_class[(unsigned char)*p];
+            if (class == CHAR_WORD) {
+                p++;
+            } else if (class == CHAR_QUOTE) {
+                const char *end = strchr(p + 1, *p);
+                if (!end) {
+                    lexer->pos = start + strlen(start);
+                    return make_token(TOKEN_ERROR, start, lexer->pos - start);
+                }
+                p = end + 1;
+                quoted = 1;
+            } else {
+                break;
+            }
+        }
+        token = make_token(TOKEN_WORD, start, p - start);
+        token.quoted = quoted;
+        lexer->pos = p;
+        return token;
+    }
+    }
+    lexer->pos = p + token.length;
+    return token;
+}
+
+typedef struct {
+    lexer_t lexer;
+    token_t token;      // Current token
+    arena_t *arena;
+    pipeline_t *pipeline;
+    command_t *last;    // Last command parsed
+    command_t **link;   // Where the next command goes
+} parser_t;
+
+static void parser_advance(parser_t *parser) {
+    parser->token = lexer_next(&parser->lexer);
+}
+
+// Report the current token as unexpected
+static int parser_error(parser_t *parser) {
+    const token_t *token = &parser->token;
+    if (token->type == TOKEN_END) {
+        fprintf(stderr, "xsh: syntax error: unexpected end of line\n");
+    } else if (token->type == TOKEN_ERROR) {
+        fprintf(stderr, "xsh: unterminated quote\n");
+    } else {
+        fprintf(stderr, "xsh: syntax error near unexpected token '%.*s'\n",
+                (int)token->length, token->start);
+    }
+    return -1;
+}
+
+static int parser_out_of_memory(void) {
+    fprintf(stderr, "xsh: allocation error\n");
+    return -1;
+}
+
+// Copy a word token into the arena, without its quotes
+static char *parse_word(parser_t *parser, const token_t *token) {
+    if (!token->quoted) {
+        return arena_strndup(parser->arena, token->start, token->length);
+    }
+    char *word = arena_alloc(parser->arena, token->length + 1);
+    if (!word) return NULL;
+    char *out = word;
+    char quote = '\0';
+    for (size_t i = 0; i < token->length; i++) {
+        char c = token->start[i];
+        if (quote ? c == quote : (c == '"' || c == '\'')) {
+            quote = quote ? '\0' : c;
+        } else {
+            *out++ = c;
+        }
+    }
+    *out = '\0';
+    return word;
+}
+
+// Field of cmd a redirection token sets, with its type; NULL if the token
+// is not a redirection
+static redirection_t *token_redirection(command_t *cmd, token_type_t type, redir_type_t *redir) {
+    switch (type) {
+    case TOKEN_REDIR_IN:     *redir = REDIR_IN;     return &cmd->input_redir;
+    case TOKEN_REDIR_OUT:    *redir = REDIR_OUT;    return &cmd->output_redir;
+    case TOKEN_REDIR_APPEND: *redir = REDIR_APPEND; return &cmd->output_redir;
+    case TOKEN_REDIR_ERR:    *redir = REDIR_ERR;    return &cmd->error_redir;
+    default:                 *redir = REDIR_NONE;   return NULL;
+    }
+}
+
+// command := (word | redirection)+
+static int parse_command(parser_t *parser) {
+    token_type_t type = parser->token.type;
+    if (type != TOKEN_WORD && (type < TOKEN_REDIR_IN || type > TOKEN_REDIR_ERR)) {
+        return parser_error(parser);
+    }
+
+    command_t *cmd = arena_alloc(parser->arena, sizeof(command_t));
+    int arg_capacity = 8;
+    char **args = arena_alloc(parser->arena, arg_capacity * sizeof(char *));
+    if (!cmd || !args) return parser_out_of_memory();
+    memset(cmd, 0, sizeof(command_t));
+    cmd->input_redir.type = REDIR_NONE;
+    cmd->output_redir.type = REDIR_NONE;
+    cmd->error_redir.type = REDIR_NONE;
+    cmd->operator = CMD_SIMPLE;
+
+    int arg_count = 0;
+    for (;;) {
+        redir_type_t redir;
+        redirection_t *target = token_redirection(cmd, parser->token.type, &redir);
+        if (target) {
+            parser_advance(parser);
+            if (parser->token.type != TOKEN_WORD) return parser_error(parser);
+            target->type = redir;
+            target->filename = parse_word(parser, &parser->token);
+            if (!target->filename) return parser_out_of_memory();
+        } else if (parser->token.type == TOKEN_WORD) {
+            if (arg_count + 1 >= arg_capacity) {
+                char **grown = arena_alloc(parser->arena, arg_capacity * 2 * sizeof(char *));
+                if (!grown) return parser_out_of_memory();
+                memcpy(grown, args, arg_count * sizeof(char *));
+                args = grown;
+                arg_capacity *= 2;
+            }
+            args[arg_count] = parse_word(parser, &parser->token);
+            if (!args[arg_count]) return parser_out_of_memory();
+            arg_count++;
+        } else {
+            break;
+        }
+        parser_advance(parser);
+    }
+    args[arg_count] = NULL;
+    cmd->args = args;
+
+    *parser->link = cmd;
+    parser->link = &cmd->next;
+    parser->last = cmd;
+    parser->pipeline->command_count++;
+    return 0;
+}
+
+// pipeline := command ('|' command)*
+static int parse_pipeline(parser_t *parser) {
+    if (parse_command(parser) != 0) return -1;
+    while (parser->token.type == TOKEN_PIPE) {
+        parser->last->operator = CMD_PIPE;
+        parser_advance(parser);
+        if (parse_command(parser) != 0) return -1;
+    }
+    return 0;
+}
+
+// and_or := pipeline (('&&' | '||') pipeline)*
+static int parse_and_or(parser_t *parser) {
+    if (parse_pipeline(parser) != 0) return -1;
+    while (parser->token.type == TOKEN_AND || parser->token.type == TOKEN_OR) {
+        parser->last->operator = parser->token.type == TOKEN_AND ? CMD_AND : CMD_OR;
+        parser_advance(parser);
+        if (parse_pipeline(parser) != 0) return -1;
+    }
+    return 0;
+}
+
+// list := and_or ((';' | '&') and_or)* (';' | '&')?
+static int parse_list(parser_t *parser) {
+    if (parse_and_or(parser) != 0) return -1;
+    while (parser->token.type == TOKEN_SEMICOLON || parser->token.type == TOKEN_BACKGROUND) {
+        int background = parser->token.type == TOKEN_BACKGROUND;
+        parser->last->operator = background ? CMD_BACKGROUND : CMD_SEMICOLON;
+        parser_advance(parser);
+        if (parser->token.type == TOKEN_END) {
+            // A trailing ; ends the line; a trailing & still sends the last
+            // list to the background
+            if (!background) parser->last->operator = CMD_SIMPLE;
+            break;
+        }
+        if (parse_and_or(parser) != 0) return -1;
+    }
+    return parser->token.type == TOKEN_END ? 0 : parser_error(parser);
+}
+
+pipeline_t *parse_line(arena_t *arena, const char *line) {
+    parser_t parser;
+    parser.arena = arena;
+    parser.last = NULL;
+    parser.pipeline = arena_alloc(arena, sizeof(pipeline_t));
+    if (!parser.pipeline) {
+        parser_out_of_memory();
+        return NULL;
+    }
+    parser.pipeline->commands = NULL;
+    parser.pipeline->command_count = 0;
+    parser.link = &parser.pipeline->commands;
+
+    lexer_init(&parser.lexer, line);
+    parser_advance(&parser);
+    if (parser.token.type == TOKEN_END) return parser.pipeline;
+    return parse_list(&parser) == 0 ? parser.pipeline : NULL;
+}
+
+// --- Parse cache ---
+
+typedef struct {
+    const char *line;     // Copy in the entry's arena
+    pipeline_t *pipeline; // NULL if the entry is empty
+    unsigned long last_use;
+    arena_t arena;
+} parse_cache_entry_t;
+
+static parse_cache_entry_t parse_cache[PARSE_CACHE_ENTRIES];
+// Line hashes of the entries, apart so a lookup scans one small array
+static unsigned long long parse_cache_hashes[PARSE_CACHE_ENTRIES];
+static unsigned long parse_cache_clock = 0;
+
+pipeline_t *parse_cached(const char *line) {
+    unsigned long long hash = xsh_hash_bytes(line, strlen(line));
+    for (int i = 0; i < PARSE_CACHE_ENTRIES; i++) {
+        if (parse_cache_hashes[i] != hash) continue;
+        parse_cache_entry_t *entry = &parse_cache[i];
+        if (entry->pipeline && strcmp(entry->line, line) == 0) {
+            entry->last_use = ++parse_cache_clock;
+            return entry->pipeline;
+        }
+    }
+
+    // Parse into the least recently used entry, reusing its memory
+    parse_cache_entry_t *victim = &parse_cache[0];
+    for (int i = 1; i < PARSE_CACHE_ENTRIES && victim->pipeline; i++) {
+        if (!parse_cache[i].pipeline || parse_cache[i].last_use < victim->last_use) {
+            victim = &parse_cache[i];
+        }
+    }
+    arena_reset(&victim->arena);
+    victim->pipeline = NULL;
+    char *copy = arena_strndup(&victim->arena, line, strlen(line));
+    if (!copy) {
+        parser_out_of_memory();
+        return NULL;
+    }
+    pipeline_t *pipeline = parse_line(&victim->arena, copy);
+    if (!pipeline) return NULL;
+
+    parse_cache_hashes[victim - parse_cache] = hash;
+    victim->line = copy;
+    victim->pipeline = pipeline;
+    victim->last_use = ++parse_cache_clock;
+    return pipeline;
+}
+
+void parse_cache_cleanup(void) {
+    for (int i = 0; i < PARSE_CACHE_ENTRIES; i++) {
+        arena_free(&parse_cache[i].arena);
+        parse_cache[i].pipeline = NULL;
+    }
+}
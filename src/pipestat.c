@@ -0,0 +1,217 @@
+#include "pipestat.h"
+#include "builtins.h" // For the builtin streams and status
+#include "history.h"  // For enhanced_history
+#include "intern.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PIPESTAT_HISTORY_DEFAULT 10 // Pipelines pipestat -h lists by default
+
+int pipestat_format(const pipeline_stat_t *stat, char *text, size_t size) {
+    int measured = stat->stage_count < PIPESTAT_MAX_STAGES ? stat->stage_count : PIPESTAT_MAX_STAGES;
+    size_t used = 0;
+    int n = snprintf(text, size, "%d:", stat->stage_count);
+    if (n < 0 || (size_t)n >= size) return -1;
+    used = n;
+
+    for (int i = 0; i < measured; i++) {
+        const stage_stat_t *stage = &stat->stages[i];
+        char name[PIPESTAT_NAME_SIZE];
+        size_t length = 0;
+        for (const char *p = stage->name; *p && length < sizeof(name) - 1; p++) {
+            name[length++] = (*p == ' ' || *p == ',' || *p == '\t' || *p == '\n') ? '_' : *p;
+        }
+        name[length] = '\0';
+
+        n = snprintf(text + used, size - used, "%s%d,%lld,%lld,%lld,%s", i > 0 ? " " : "",
+                     stage->status, stage->wall_us, stage->cpu_us, stage->bytes_written, name);
+        if (n < 0 || (size_t)n >= size - used) return -1;
+        used += n;
+    }
+    return 0;
+}
+
+int pipestat_parse(const char *text, pipeline_stat_t *stat) {
+    memset(stat, 0, sizeof(*stat));
+    char *end;
+    long count = strtol(text, &end, 10);
+    if (end == text || *end != ':' || count < 1) return -1;
+    stat->stage_count = (int)count;
+    int measured = count < PIPESTAT_MAX_STAGES ? (int)count : PIPESTAT_MAX_STAGES;
+
+    const char *p = end + 1;
+    for (int i = 0; i < measured; i++) {
+        stage_stat_t *stage = &stat->stages[i];
+        int name_start = 0;
+        if (sscanf(p, "%d,%lld,%lld,%lld,%n", &stage->status, &stage->wall_us, &stage->cpu_us,
+                   &stage->bytes_written, &name_start) != 4 || name_start == 0) {
+            return -1;
+        }
+        p += name_start;
+        size_t length = strcspn(p, " ");
+        if (length >= sizeof(stage->name)) length = sizeof(stage->name) - 1;
+        memcpy(stage->name, p, length);
+        stage->name[length] = '\0';
+        p += strcspn(p, " ");
+        if (*p == ' ') p++;
+    }
+    return 0;
+}
+
+int pipestat_bottleneck(const pipeline_stat_t *stat) {
+    int measured = stat->stage_count < PIPESTAT_MAX_STAGES ? stat->stage_count : PIPESTAT_MAX_STAGES;
+    if (measured < 2) return -1;
+    int busiest = -1;
+    double busiest_ratio = 0;
+    for (int i = 0; i < measured; i++) {
+        const stage_stat_t *stage = &stat->stages[i];
+        if (stage->cpu_us <= 0 || stage->wall_us <= 0) continue;
+        // Of two stages as busy as each other, the one with more CPU time
+        double ratio = (double)stage->cpu_us / (double)stage->wall_us;
+        if (busiest == -1 || ratio > busiest_ratio ||
+            (ratio == busiest_ratio && stage->cpu_us > stat->stages[busiest].cpu_us)) {
+            busiest = i;
+            busiest_ratio = ratio;
+        }
+    }
+    return busiest;
+}
+
+// Byte count with a binary unit, into buf
+static const char *pipestat_bytes(long long bytes, char *buf, size_t size) {
+    static const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+    if (bytes < 0) return "-";
+    double value = (double)bytes;
+    int unit = 0;
+    while (value >= 1024 && unit < 4) {
+        value /= 1024;
+        unit++;
+    }
+    if (unit == 0) {
+        snprintf(buf, size, "%lld B", bytes);
+    } else {
+        snprintf(buf, size, "%.1f %s", value, units[unit]);
+    }
+    return buf;
+}
+
+// Share of its wall time a stage spent on a CPU, in percent
+static int pipestat_busy(const stage_stat_t *stage) {
+    if (stage->wall_us <= 0) return 0;
+    long long busy = stage->cpu_us * 100 / stage->wall_us;
+    return busy > 100 ? 100 : (int)busy;
+}
+
+static void pipestat_print_stages(FILE *out, const pipeline_stat_t *stat) {
+    int measured = stat->stage_count < PIPESTAT_MAX_STAGES ? stat->stage_count : PIPESTAT_MAX_STAGES;
+    int bottleneck = pipestat_bottleneck(stat);
+    fprintf(out, "%5s  %-16s %6s %10s %10s %10s %5s %11s\n",
+            "Stage", "Command", "Status", "Wall ms", "CPU ms", "Stall ms", "Busy", "Written");
+    for (int i = 0; i < measured; i++) {
+        const stage_stat_t *stage = &stat->stages[i];
+        long long stall_us = stage->wall_us > stage->cpu_us ? stage->wall_us - stage->cpu_us : 0;
+        char bytes[32];
+        fprintf(out, "%5d  %-16.16s %6d %10.1f %10.1f %10.1f %4d%% %11s%s\n", i + 1,
+                stage->name[0] ? stage->name : "-", stage->status, stage->wall_us / 1000.0,
+                stage->cpu_us / 1000.0, stall_us / 1000.0, pipestat_busy(stage),
+                pipestat_bytes(stage->bytes_written, bytes, sizeof(bytes)),
+                i == bottleneck ? "  <- bottleneck" : "");
+    }
+    if (stat->stage_count > measured) {
+        fprintf(out, "(%d more stages not measured)\n", stat->stage_count - measured);
+    }
+}
+
+// Pipelines recorded in enhanced history, newest last, with the stage that
+// held each one back
+static int pipestat_history(FILE *out, int count) {
+    int first = enhanced_history_count;
+    for (int found = 0; first > 0 && found < count; ) {
+        if (enhanced_history[--first].stages != INTERN_NONE) found++;
+    }
+
+    int listed = 0;
+    for (int i = first; i < enhanced_history_count; i++) {
+        const history_entry_t *entry = &enhanced_history[i];
+        pipeline_stat_t stat;
+        if (entry->stages == INTERN_NONE || pipestat_parse(intern_str(entry->stages), &stat) != 0) continue;
+
+        char when[32];
+        struct tm *tm_info = localtime(&entry->timestamp);
+        if (!tm_info || strftime(when, sizeof(when), "%Y-%m-%d %H:%M", tm_info) == 0) {
+            snprintf(when, sizeof(when), "-");
+        }
+        int bottleneck = pipestat_bottleneck(&stat);
+        fprintf(out, "%s  %7.1f ms  %s\n", when, (double)entry->execution_time_ms, intern_str(entry->command));
+        if (bottleneck >= 0) {
+            const stage_stat_t *stage = &stat.stages[bottleneck];
+            fprintf(out, "    bottleneck: stage %d (%s), %d%% busy, %.1f ms CPU; statuses", bottleneck + 1,
+                    stage->name[0] ? stage->name : "-", pipestat_busy(stage), stage->cpu_us / 1000.0);
+        } else {
+            fprintf(out, "    statuses");
+        }
+        int measured = stat.stage_count < PIPESTAT_MAX_STAGES ? stat.stage_count : PIPESTAT_MAX_STAGES;
+        for (int s = 0; s < measured; s++) {
+            fprintf(out, " %d", stat.stages[s].status);
+        }
+        fprintf(out, "\n");
+        listed++;
+    }
+    if (listed == 0) {
+        fprintf(out, "No pipelines in history.\n");
+    }
+    return listed;
+}
+
+int xsh_pipestat(char **args) {
+    FILE *out = xsh_builtin_stdout();
+    FILE *err = xsh_builtin_stderr();
+    int statuses_only = 0;
+    int history_limit = 0; // Pipelines to list from history, 0 for the last one
+
+    for (int i = 1; args[i]; i++) {
+        if (strcmp(args[i], "-s") == 0) {
+            statuses_only = 1;
+        } else if (strcmp(args[i], "-h") == 0) {
+            history_limit = PIPESTAT_HISTORY_DEFAULT;
+            if (args[i + 1] && args[i + 1][0] != '-') {
+                history_limit = atoi(args[++i]);
+                if (history_limit <= 0) {
+                    fprintf(err, "xsh: pipestat: invalid count '%s'\n", args[i]);
+                    xsh_builtin_set_status(2);
+                    return 1;
+                }
+            }
+        } else {
+            fprintf(err, "xsh: pipestat: unknown option '%s'\nUsage: pipestat [-s] [-h [count]]\n", args[i]);
+            xsh_builtin_set_status(2);
+            return 1;
+        }
+    }
+
+    if (history_limit > 0) {
+        pipestat_history(out, history_limit);
+        xsh_builtin_set_status(0);
+        return 1;
+    }
+
+    const pipeline_stat_t *stat = &last_pipeline_stat;
+    if (stat->stage_count == 0) {
+        fprintf(err, "xsh: pipestat: no command has finished yet\n");
+        xsh_builtin_set_status(1);
+        return 1;
+    }
+    if (statuses_only) {
+        int measured = stat->stage_count < PIPESTAT_MAX_STAGES ? stat->stage_count : PIPESTAT_MAX_STAGES;
+        for (int i = 0; i < measured; i++) {
+            fprintf(out, "%s%d", i > 0 ? " " : "", stat->stages[i].status);
+        }
+        fprintf(out, "\n");
+    } else {
+        pipestat_print_stages(out, stat);
+    }
+    xsh_builtin_set_status(0);
+    return 1;
+}
@@ -3,7 +3,6 @@
 #include "history.h" // For history_count
 #include <stdio.h>
 #include <string.h>
-#include <ctype.h> // For tolower
 
 #ifdef _WIN32
 #include <windows.h> // For Sleep(), GetUserName(), FindFirstFile, etc.
@@ -15,6 +14,7 @@
 #include <pwd.h>     // For getpwuid()
 #include <dirent.h>  // For opendir, readdir, closedir
 #include <sys/stat.h> // For lstat, S_ISDIR
+#include <time.h>    // For clock_gettime()
 #endif
 
 // Implementation of utility functions
@@ -31,6 +31,20 @@ void print_slow(const char *text, unsigned int delay_ms) {
     }
 }
 
+long long get_monotonic_time_us(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (long long)(counter.QuadPart / frequency.QuadPart) * 1000000LL +
+           (long long)(counter.QuadPart % frequency.QuadPart) * 1000000LL / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+#endif
+}
+
 char* build_prompt(void) {
     static char prompt[XSH_MAXLINE];
     
@@ -178,50 +192,6 @@ char* build_prompt(void) {
     }
 }
 
-// Helper function for case-insensitive strstr
-char *strcasestr_custom(const char *haystack, const char *needle) {
-    if (!haystack || !needle) return NULL;
-    if (!*needle) return (char *)haystack; // Empty needle matches everything
-
-    while (*haystack) {
-        const char *h_ptr = haystack;
-        const char *n_ptr = needle;
-        // Compare characters case-insensitively
-        while (*h_ptr && *n_ptr && (tolower((unsigned char)*h_ptr) == tolower((unsigned char)*n_ptr))) {
-            h_ptr++;
-            n_ptr++;
-        }
-        // If needle is exhausted, it\'s a match
-        if (!*n_ptr) {
-            return (char *)haystack; // Return start of match in original haystack
-        }
-        haystack++; // Move to next character in haystack
-    }
-    return NULL; // No match found
-}
-
-// Helper function to process a single stream (file or stdin) for grep
-void process_grep_stream(FILE *fp, const char *pattern, int case_insensitive, const char *filename_to_print) {
-    char line[XSH_MAXLINE];
-
-    while (fgets(line, sizeof(line), fp)) {
-        char *match_found = NULL;
-        if (case_insensitive) {
-            match_found = strcasestr_custom(line, pattern);
-        } else {
-            match_found = strstr(line, pattern);
-        }
-
-        if (match_found) {
-            if (filename_to_print) { // Only print filename if it's provided (i.e., multiple files mode)
-                printf("%s:", filename_to_print);
-            }
-            fputs(line, stdout);
-        }
-    }
-    printf("\n");
-}
-
 // Function to recursively remove files and directories
 int remove_recursively_internal(const char *path) {
 #ifndef _WIN32 // POSIX implementation
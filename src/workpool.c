@@ -0,0 +1,86 @@
+#include "workpool.h"
+#include <stdlib.h>
+#include <string.h>
+
+char *workpool_path_join(const char *dir, const char *name) {
+    size_t dir_length = strlen(dir);
+    size_t name_length = strlen(name);
+    int slash = dir_length > 0 && dir[dir_length - 1] != '/';
+    char *path = malloc(dir_length + slash + name_length + 1);
+    if (!path) return NULL;
+    memcpy(path, dir, dir_length);
+    if (slash) path[dir_length] = '/';
+    memcpy(path + dir_length + slash, name, name_length + 1);
+    return path;
+}
+
+#ifndef _WIN32
+static void *workpool_worker(void *arg) {
+    workpool_t *pool = arg;
+    void *local = pool->worker_start ? pool->worker_start(pool->context) : NULL;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->head && !pool->stopping) pthread_cond_wait(&pool->queued, &pool->lock);
+        workpool_item_t *item = pool->head;
+        if (item) {
+            pool->head = item->next;
+            if (!pool->head) pool->tail = NULL;
+            if (pool->queue_length-- == WORKPOOL_QUEUE_LIMIT) pthread_cond_signal(&pool->drained);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if (!item) break;
+
+        pool->run(pool->context, local, item);
+    }
+    if (pool->worker_stop) pool->worker_stop(pool->context, local);
+    return NULL;
+}
+
+void workpool_init(workpool_t *pool, workpool_run_t run, void *context) {
+    memset(pool, 0, sizeof(*pool));
+    pool->run = run;
+    pool->context = context;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->queued, NULL);
+    pthread_cond_init(&pool->drained, NULL);
+}
+
+int workpool_start(workpool_t *pool, long count) {
+    if (count > WORKPOOL_WORKERS_MAX) count = WORKPOOL_WORKERS_MAX;
+    while (pool->worker_count < count &&
+           pthread_create(&pool->workers[pool->worker_count], NULL, workpool_worker, pool) == 0) {
+        pool->worker_count++;
+    }
+    return pool->worker_count;
+}
+
+int workpool_submit(workpool_t *pool, workpool_item_t *item) {
+    if (pool->worker_count == 0) return -1;
+    item->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->queue_length >= WORKPOOL_QUEUE_LIMIT) pthread_cond_wait(&pool->drained, &pool->lock);
+    if (pool->tail) {
+        pool->tail->next = item;
+    } else {
+        pool->head = item;
+    }
+    pool->tail = item;
+    pool->queue_length++;
+    pthread_cond_signal(&pool->queued);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+void workpool_stop(workpool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->queued);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->worker_count; i++) pthread_join(pool->workers[i], NULL);
+    pool->worker_count = 0;
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->queued);
+    pthread_cond_destroy(&pool->drained);
+}
+#endif
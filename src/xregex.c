@@ -0,0 +1,852 @@
+#include "xregex.h"
+#include "memsearch.h"
+#include "utils.h" // For xsh_hash_bytes
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t bits[4];
+} byte_class_t;
+
+#define CLASS_HAS(class, c) (((class)->bits[(c) >> 6] >> ((c) & 63)) & 1)
+#define CLASS_ADD(class, c) ((class)->bits[(c) >> 6] |= (uint64_t)1 << ((c) & 63))
+
+// Parse tree
+typedef enum { NODE_EMPTY, NODE_CLASS, NODE_BOL, NODE_EOL, NODE_CONCAT, NODE_ALT, NODE_REPEAT } node_type_t;
+
+typedef struct {
+    node_type_t type;
+    int left, right;  // Children of CONCAT and ALT; REPEAT uses left
+    int min, max;     // REPEAT bounds, max -1 for no limit
+    int class_index;  // CLASS
+    int literal;      // CLASS from a single character: the byte, lower case if folded; else -1
+} node_t;
+
+// NFA: CHAR consumes a byte of its class, SPLIT goes to out and to out1
+// (if not -1), BOL and EOL pass only at the start or end of the line
+typedef enum { NFA_CHAR, NFA_SPLIT, NFA_BOL, NFA_EOL, NFA_MATCH } nfa_type_t;
+
+typedef struct {
+    nfa_type_t type;
+    int out, out1;
+    int class_index;
+} nfa_state_t;
+
+struct xregex {
+    byte_class_t *classes;
+    int class_count, class_capacity;
+    nfa_state_t *states;
+    int state_count, state_capacity;
+    int start;
+    char literal[XREGEX_LITERAL_MAX];
+    size_t literal_length;
+    int literal_exact;
+    int literal_fold;
+};
+
+typedef struct {
+    const char *p;
+    xregex_t *re;
+    node_t *nodes;
+    int node_count, node_capacity;
+    int fold, pcre;
+    int anchored; // The tree has a ^ or $
+    char *error;
+    size_t error_size;
+    int failed;
+} parser_t;
+
+static void fail(parser_t *parser, const char *format, ...) {
+    if (parser->failed) return;
+    parser->failed = 1;
+    va_list ap;
+    va_start(ap, format);
+    vsnprintf(parser->error, parser->error_size, format, ap);
+    va_end(ap);
+}
+
+static int new_class(parser_t *parser) {
+    xregex_t *re = parser->re;
+    if (re->class_count == re->class_capacity) {
+        int capacity = re->class_capacity ? re->class_capacity * 2 : 16;
+        byte_class_t *classes = realloc(re->classes, capacity * sizeof(*classes));
+        if (!classes) {
+            fail(parser, "out of memory");
+            return -1;
+        }
+        re->classes = classes;
+        re->class_capacity = capacity;
+    }
+    memset(&re->classes[re->class_count], 0, sizeof(byte_class_t));
+    return re->class_count++;
+}
+
+static int new_node(parser_t *parser, node_type_t type, int left, int right) {
+    if (parser->failed) return -1;
+    if (parser->node_count == parser->node_capacity) {
+        int capacity = parser->node_capacity ? parser->node_capacity * 2 : 64;
+        node_t *nodes = realloc(parser->nodes, capacity * sizeof(*nodes));
+        if (!nodes) {
+            fail(parser, "out of memory");
+            return -1;
+        }
+        parser->nodes = nodes;
+        parser->node_capacity = capacity;
+    }
+    node_t *node = &parser->nodes[parser->node_count];
+    memset(node, 0, sizeof(*node));
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    node->class_index = -1;
+    node->literal = -1;
+    return parser->node_count++;
+}
+
+// Give every letter in the class its other case
+static void fold_class(byte_class_t *class) {
+    for (int c = 'a'; c <= 'z'; c++) {
+        if (CLASS_HAS(class, c) || CLASS_HAS(class, c - 32)) {
+            CLASS_ADD(class, c);
+            CLASS_ADD(class, c - 32);
+        }
+    }
+}
+
+static int class_node(parser_t *parser, const byte_class_t *class) {
+    int index = new_class(parser);
+    int node = new_node(parser, NODE_CLASS, -1, -1);
+    if (index < 0 || node < 0) return -1;
+    parser->re->classes[index] = *class;
+    if (parser->fold) fold_class(&parser->re->classes[index]);
+    parser->nodes[node].class_index = index;
+    return node;
+}
+
+static int literal_node(parser_t *parser, unsigned char c) {
+    byte_class_t class = {{0}};
+    CLASS_ADD(&class, c);
+    int node = class_node(parser, &class);
+    if (node >= 0) parser->nodes[node].literal = parser->fold ? MEMSEARCH_FOLD(c) : c;
+    return node;
+}
+
+static int is_word(int c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static int is_space(int c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// [:name:] inside a bracket expression; ASCII only, whatever the locale
+static int add_named_class(byte_class_t *class, const char *name, size_t length) {
+    static const char *names[] = {"alpha", "digit", "alnum", "upper", "lower", "space",
+                                  "blank", "punct", "print", "graph", "cntrl", "xdigit"};
+    int which = -1;
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+        if (strlen(names[i]) == length && memcmp(names[i], name, length) == 0) which = i;
+    }
+    if (which < 0) return -1;
+    for (int c = 0; c < 128; c++) {
+        int upper = c >= 'A' && c <= 'Z', lower = c >= 'a' && c <= 'z', digit = c >= '0' && c <= '9';
+        int graph = c > 0x20 && c < 0x7f;
+        int in = 0;
+        switch (which) {
+            case 0: in = upper || lower; break;
+            case 1: in = digit; break;
+            case 2: in = upper || lower || digit; break;
+            case 3: in = upper; break;
+            case 4: in = lower; break;
+            case 5: in = is_space(c); break;
+            case 6: in = c == ' ' || c == '\t'; break;
+            case 7: in = graph && !upper && !lower && !digit; break;
+            case 8: in = graph || c == ' '; break;
+            case 9: in = graph; break;
+            case 10: in = c < 0x20 || c == 0x7f; break;
+            case 11: in = digit || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); break;
+        }
+        if (in) CLASS_ADD(class, c);
+    }
+    return 0;
+}
+
+// \d \w \s and their upper-case negations; returns 0 if letter is none of them
+static int add_escape_class(byte_class_t *class, char letter) {
+    byte_class_t set = {{0}};
+    switch (letter | 0x20) {
+        case 'd':
+            for (int c = '0'; c <= '9'; c++) CLASS_ADD(&set, c);
+            break;
+        case 'w':
+            for (int c = 0; c < 128; c++) {
+                if (is_word(c)) CLASS_ADD(&set, c);
+            }
+            break;
+        case 's':
+            for (int c = 0; c < 128; c++) {
+                if (is_space(c)) CLASS_ADD(&set, c);
+            }
+            break;
+        default:
+            return 0;
+    }
+    int negate = letter >= 'A' && letter <= 'Z';
+    for (int i = 0; i < 4; i++) class->bits[i] |= negate ? ~set.bits[i] : set.bits[i];
+    return 1;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') return (c | 0x20) - 'a' + 10;
+    return -1;
+}
+
+// A backslash escape standing for one byte, the parser past it; -1 on error
+static int escaped_byte(parser_t *parser) {
+    char c = *parser->p++;
+    switch (c) {
+        case 't': return '\t';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        case 'a': return '\a';
+        case 'e': return 0x1b;
+        case 'x': {
+            int value = 0, digits = 0;
+            while (digits < 2 && hex_value(*parser->p) >= 0) {
+                value = value * 16 + hex_value(*parser->p++);
+                digits++;
+            }
+            if (digits == 0) fail(parser, "\\x needs hex digits");
+            return digits ? value : -1;
+        }
+    }
+    if ((c >= '1' && c <= '9')) {
+        fail(parser, "back-references are not supported");
+        return -1;
+    }
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+        fail(parser, "unsupported escape \\%c", c);
+        return -1;
+    }
+    return (unsigned char)c; // \. \* \\ and the like
+}
+
+static int parse_bracket(parser_t *parser) {
+    byte_class_t class = {{0}};
+    parser->p++; // [
+    int negate = *parser->p == '^';
+    if (negate) parser->p++;
+    int first = 1;
+    while (*parser->p && (*parser->p != ']' || first)) {
+        first = 0;
+        int low;
+        if (parser->p[0] == '[' && parser->p[1] == ':') {
+            const char *name = parser->p + 2;
+            const char *close = strstr(name, ":]");
+            if (!close || add_named_class(&class, name, close - name) < 0) {
+                fail(parser, "unknown character class");
+                return -1;
+            }
+            parser->p = close + 2;
+            continue;
+        }
+        if (*parser->p == '\\' && parser->p[1]) {
+            if (add_escape_class(&class, parser->p[1])) {
+                parser->p += 2;
+                continue;
+            }
+            parser->p++;
+            low = escaped_byte(parser);
+            if (low < 0) return -1;
+        } else {
+            low = (unsigned char)*parser->p++;
+        }
+        int high = low;
+        if (parser->p[0] == '-' && parser->p[1] && parser->p[1] != ']') {
+            parser->p++;
+            if (*parser->p == '\\' && parser->p[1]) {
+                parser->p++;
+                high = escaped_byte(parser);
+                if (high < 0) return -1;
+            } else {
+                high = (unsigned char)*parser->p++;
+            }
+            if (high < low) {
+                fail(parser, "invalid range %c-%c", low, high);
+                return -1;
+            }
+        }
+        for (int c = low; c <= high; c++) CLASS_ADD(&class, c);
+    }
+    if (*parser->p != ']') {
+        fail(parser, "missing ]");
+        return -1;
+    }
+    parser->p++;
+    if (parser->fold) fold_class(&class);
+    if (negate) {
+        for (int i = 0; i < 4; i++) class.bits[i] = ~class.bits[i];
+        class.bits[0] &= ~((uint64_t)1 << '\n');
+    }
+    return class_node(parser, &class);
+}
+
+static int parse_alternation(parser_t *parser, int depth);
+
+static int parse_atom(parser_t *parser, int depth) {
+    char c = *parser->p;
+    if (c == '(') {
+        parser->p++;
+        if (parser->p[0] == '?') {
+            if (parser->p[1] == 'i' && parser->p[2] == ')') {
+                parser->fold = 1; // (?i) folds case from here on
+                parser->p += 3;
+                return new_node(parser, NODE_EMPTY, -1, -1);
+            }
+            if (parser->p[1] != ':') {
+                fail(parser, "unsupported group (?%c", parser->p[1]);
+                return -1;
+            }
+            parser->p += 2;
+        }
+        int inner = parse_alternation(parser, depth + 1);
+        if (inner < 0) return -1;
+        if (*parser->p != ')') {
+            fail(parser, "missing )");
+            return -1;
+        }
+        parser->p++;
+        return inner;
+    }
+    if (c == '[') return parse_bracket(parser);
+    parser->p++;
+    if (c == '.') {
+        byte_class_t class;
+        memset(&class, 0xff, sizeof(class));
+        class.bits[0] &= ~((uint64_t)1 << '\n');
+        return class_node(parser, &class);
+    }
+    if (c == '^') {
+        parser->anchored = 1;
+        return new_node(parser, NODE_BOL, -1, -1);
+    }
+    if (c == '$') {
+        parser->anchored = 1;
+        return new_node(parser, NODE_EOL, -1, -1);
+    }
+    if (c == '\\') {
+        if (!*parser->p) {
+            fail(parser, "trailing backslash");
+            return -1;
+        }
+        byte_class_t class = {{0}};
+        if (add_escape_class(&class, *parser->p)) {
+            parser->p++;
+            return class_node(parser, &class);
+        }
+        int byte = escaped_byte(parser);
+        return byte < 0 ? -1 : literal_node(parser, (unsigned char)byte);
+    }
+    return literal_node(parser, (unsigned char)c); // Including a * or { with nothing to repeat
+}
+
+// {m}, {m,} or {m,n} at parser->p; returns 0 and leaves p alone if it is
+// not one, so the { is taken literally as GNU grep does
+static int parse_bound(parser_t *parser, int *min, int *max) {
+    const char *p = parser->p + 1;
+    if (*p < '0' || *p > '9') return 0;
+    long low = strtol(p, (char **)&p, 10), high = low;
+    if (*p == ',') {
+        p++;
+        high = -1;
+        if (*p >= '0' && *p <= '9') high = strtol(p, (char **)&p, 10);
+    }
+    if (*p != '}') return 0;
+    if (low > XREGEX_MAX_REPEAT || high > XREGEX_MAX_REPEAT) {
+        fail(parser, "repetition count over %d", XREGEX_MAX_REPEAT);
+        return -1;
+    }
+    if (high >= 0 && high < low) {
+        fail(parser, "invalid repetition {%ld,%ld}", low, high);
+        return -1;
+    }
+    *min = (int)low;
+    *max = (int)high;
+    parser->p = p + 1;
+    return 1;
+}
+
+static int parse_repeat(parser_t *parser, int depth) {
+    int node = parse_atom(parser, depth);
+    while (node >= 0) {
+        int min, max;
+        char c = *parser->p;
+        if (c == '*') {
+            min = 0;
+            max = -1;
+            parser->p++;
+        } else if (c == '+') {
+            min = 1;
+            max = -1;
+            parser->p++;
+        } else if (c == '?') {
+            min = 0;
+            max = 1;
+            parser->p++;
+        } else if (c == '{') {
+            int bound = parse_bound(parser, &min, &max);
+            if (bound < 0) return -1;
+            if (bound == 0) break;
+        } else {
+            break;
+        }
+        // Lazy and possessive forms match the same lines
+        if (parser->pcre && (*parser->p == '?' || *parser->p == '+')) parser->p++;
+        int repeat = new_node(parser, NODE_REPEAT, node, -1);
+        if (repeat < 0) return -1;
+        parser->nodes[repeat].min = min;
+        parser->nodes[repeat].max = max;
+        node = repeat;
+    }
+    return node;
+}
+
+static int parse_concatenation(parser_t *parser, int depth) {
+    int node = -1;
+    while (*parser->p && *parser->p != '|' && (*parser->p != ')' || depth == 0)) {
+        int next = parse_repeat(parser, depth);
+        if (next < 0) return -1;
+        node = node < 0 ? next : new_node(parser, NODE_CONCAT, node, next);
+        if (node < 0) return -1;
+    }
+    return node < 0 ? new_node(parser, NODE_EMPTY, -1, -1) : node;
+}
+
+static int parse_alternation(parser_t *parser, int depth) {
+    int node = parse_concatenation(parser, depth);
+    while (node >= 0 && *parser->p == '|') {
+        parser->p++;
+        int next = parse_concatenation(parser, depth);
+        if (next < 0) return -1;
+        node = new_node(parser, NODE_ALT, node, next);
+    }
+    return node;
+}
+
+static int nfa_add(parser_t *parser, nfa_type_t type, int out, int out1, int class_index) {
+    xregex_t *re = parser->re;
+    if (parser->failed) return -1;
+    if (re->state_count == XREGEX_MAX_STATES) {
+        fail(parser, "pattern too large");
+        return -1;
+    }
+    if (re->state_count == re->state_capacity) {
+        int capacity = re->state_capacity ? re->state_capacity * 2 : 64;
+        nfa_state_t *states = realloc(re->states, capacity * sizeof(*states));
+        if (!states) {
+            fail(parser, "out of memory");
+            return -1;
+        }
+        re->states = states;
+        re->state_capacity = capacity;
+    }
+    re->states[re->state_count] = (nfa_state_t){type, out, out1, class_index};
+    return re->state_count++;
+}
+
+// The NFA for a node followed by the states from next on, built back to
+// front so repeats can simply be built again; returns its entry state
+static int compile_node(parser_t *parser, int index, int next) {
+    if (parser->failed) return -1;
+    node_t node = parser->nodes[index];
+    switch (node.type) {
+        case NODE_EMPTY:
+            return next;
+        case NODE_CLASS:
+            return nfa_add(parser, NFA_CHAR, next, -1, node.class_index);
+        case NODE_BOL:
+            return nfa_add(parser, NFA_BOL, next, -1, -1);
+        case NODE_EOL:
+            return nfa_add(parser, NFA_EOL, next, -1, -1);
+        case NODE_CONCAT:
+            return compile_node(parser, node.left, compile_node(parser, node.right, next));
+        case NODE_ALT: {
+            int left = compile_node(parser, node.left, next);
+            int right = compile_node(parser, node.right, next);
+            return nfa_add(parser, NFA_SPLIT, left, right, -1);
+        }
+        case NODE_REPEAT: {
+            int entry = next;
+            if (node.max < 0) {
+                int loop = nfa_add(parser, NFA_SPLIT, -1, next, -1);
+                int body = compile_node(parser, node.left, loop);
+                if (body < 0) return -1;
+                parser->re->states[loop].out = body;
+                entry = loop;
+            } else {
+                for (int i = node.min; i < node.max && entry >= 0; i++) {
+                    entry = nfa_add(parser, NFA_SPLIT, compile_node(parser, node.left, entry), next, -1);
+                }
+            }
+            for (int i = 0; i < node.min && entry >= 0; i++) entry = compile_node(parser, node.left, entry);
+            return entry;
+        }
+    }
+    return -1;
+}
+
+// What a node tells about literals: exact if it only ever matches the
+// string exact; prefix and suffix are literals every match starts or ends
+// with, and required one every match contains. All are truncated to
+// XREGEX_LITERAL_MAX, which keeps each true.
+typedef struct {
+    int exact;
+    unsigned char exact_s[XREGEX_LITERAL_MAX], prefix[XREGEX_LITERAL_MAX];
+    unsigned char suffix[XREGEX_LITERAL_MAX], required[XREGEX_LITERAL_MAX];
+    size_t exact_n, prefix_n, suffix_n, required_n;
+} literal_info_t;
+
+static void set_all(literal_info_t *info, const unsigned char *s, size_t n) {
+    memcpy(info->exact_s, s, n);
+    memcpy(info->prefix, s, n);
+    memcpy(info->suffix, s, n);
+    memcpy(info->required, s, n);
+    info->exact_n = info->prefix_n = info->suffix_n = info->required_n = n;
+}
+
+// Two literals joined, keeping the front or the back if it is too long
+static size_t join(unsigned char *to, const unsigned char *a, size_t a_n, const unsigned char *b, size_t b_n,
+                   int keep_back) {
+    unsigned char both[2 * XREGEX_LITERAL_MAX];
+    if (a_n) memcpy(both, a, a_n);
+    if (b_n) memcpy(both + a_n, b, b_n);
+    size_t n = a_n + b_n, kept = n > XREGEX_LITERAL_MAX ? XREGEX_LITERAL_MAX : n;
+    memcpy(to, keep_back ? both + n - kept : both, kept);
+    return kept;
+}
+
+static literal_info_t analyze(const parser_t *parser, int index) {
+    literal_info_t info;
+    memset(&info, 0, sizeof(info));
+    const node_t *node = &parser->nodes[index];
+    switch (node->type) {
+        case NODE_EMPTY:
+        case NODE_BOL:
+        case NODE_EOL:
+            info.exact = 1;
+            break;
+        case NODE_CLASS:
+            if (node->literal >= 0) {
+                unsigned char c = (unsigned char)node->literal;
+                info.exact = 1;
+                set_all(&info, &c, 1);
+            }
+            break;
+        case NODE_CONCAT: {
+            literal_info_t left = analyze(parser, node->left), right = analyze(parser, node->right);
+            if (left.exact && right.exact && left.exact_n + right.exact_n <= XREGEX_LITERAL_MAX) {
+                info.exact = 1;
+                info.exact_n = join(info.exact_s, left.exact_s, left.exact_n, right.exact_s, right.exact_n, 0);
+            }
+            if (left.exact) {
+                info.prefix_n = join(info.prefix, left.exact_s, left.exact_n, right.prefix, right.prefix_n, 0);
+            } else {
+                info.prefix_n = join(info.prefix, left.prefix, left.prefix_n, NULL, 0, 0);
+            }
+            if (right.exact) {
+                info.suffix_n = join(info.suffix, left.suffix, left.suffix_n, right.exact_s, right.exact_n, 1);
+            } else {
+                info.suffix_n = join(info.suffix, right.suffix, right.suffix_n, NULL, 0, 1);
+            }
+            // The longest of either side's and the literal across the join
+            unsigned char across[XREGEX_LITERAL_MAX];
+            size_t across_n = join(across, left.suffix, left.suffix_n, right.prefix, right.prefix_n, 0);
+            const unsigned char *best = across;
+            size_t best_n = across_n;
+            if (left.required_n > best_n) {
+                best = left.required;
+                best_n = left.required_n;
+            }
+            if (right.required_n > best_n) {
+                best = right.required;
+                best_n = right.required_n;
+            }
+            memcpy(info.required, best, best_n);
+            info.required_n = best_n;
+            break;
+        }
+        case NODE_ALT: {
+            literal_info_t left = analyze(parser, node->left), right = analyze(parser, node->right);
+            if (left.exact && right.exact && left.exact_n == right.exact_n &&
+                memcmp(left.exact_s, right.exact_s, left.exact_n) == 0) {
+                info = left;
+            }
+            break;
+        }
+        case NODE_REPEAT:
+            if (node->min >= 1) {
+                info = analyze(parser, node->left);
+                if (node->min != 1 || node->max != 1) info.exact = 0;
+            }
+            break;
+    }
+    return info;
+}
+
+xregex_t *xregex_compile(const char *pattern, int fold, int pcre, char *error, size_t error_size) {
+    xregex_t *re = calloc(1, sizeof(*re));
+    if (!re) {
+        snprintf(error, error_size, "out of memory");
+        return NULL;
+    }
+    parser_t parser = {.p = pattern, .re = re, .fold = fold, .pcre = pcre, .error = error, .error_size = error_size};
+    int root = parse_alternation(&parser, 0);
+    if (root >= 0 && *parser.p) fail(&parser, "unexpected %c", *parser.p);
+    if (!parser.failed) {
+        int match = nfa_add(&parser, NFA_MATCH, -1, -1, -1);
+        re->start = compile_node(&parser, root, match);
+    }
+    if (!parser.failed) {
+        literal_info_t info = analyze(&parser, root);
+        memcpy(re->literal, info.required, info.required_n);
+        re->literal_length = info.required_n;
+        // A (?i) part way leaves some of the literal folded and some not
+        re->literal_fold = parser.fold;
+        re->literal_exact = info.exact && !parser.anchored && parser.fold == fold;
+    }
+    free(parser.nodes);
+    if (parser.failed) {
+        xregex_free(re);
+        return NULL;
+    }
+    return re;
+}
+
+void xregex_free(xregex_t *re) {
+    if (!re) return;
+    free(re->classes);
+    free(re->states);
+    free(re);
+}
+
+const char *xregex_literal(const xregex_t *re, size_t *length, int *exact, int *fold) {
+    *length = re->literal_length;
+    *exact = re->literal_exact;
+    *fold = re->literal_fold;
+    return re->literal_length || re->literal_exact ? re->literal : NULL;
+}
+
+// A DFA state: the NFA states it stands for (only CHAR, EOL and MATCH,
+// sorted)
+typedef struct {
+    int *set;
+    int count;
+    unsigned char matched;    // A match has been seen
+    unsigned char end_accept; // The line matches if it ends here
+    unsigned char dead;       // No match can follow
+} dfa_state_t;
+
+#define DFA_FINAL (1 << 30)
+#define DFA_INDEX (DFA_FINAL - 1)
+
+struct xregex_dfa {
+    const xregex_t *re;
+    dfa_state_t *states;
+    int count;
+    // 256 transitions per state: the next state, or'd with DFA_FINAL if
+    // it is matched or dead, so matching loads one int a byte; -1 where
+    // not built yet
+    int *next;
+    int *table; // Open addressing from a state's set to its index + 1
+    int table_size;
+    int initial;
+    unsigned flushes;
+    // Scratch for closures
+    int *stack, *seeds, *found;
+    unsigned *mark;
+    unsigned generation;
+};
+
+xregex_dfa_t *xregex_dfa_new(const xregex_t *re) {
+    xregex_dfa_t *dfa = calloc(1, sizeof(*dfa));
+    if (!dfa) return NULL;
+    dfa->re = re;
+    dfa->initial = -1;
+    dfa->table_size = 2 * XREGEX_DFA_STATES;
+    dfa->states = malloc(XREGEX_DFA_STATES * sizeof(*dfa->states));
+    dfa->next = malloc(XREGEX_DFA_STATES * 256 * sizeof(int));
+    dfa->table = calloc(dfa->table_size, sizeof(*dfa->table));
+    dfa->stack = malloc((3 * re->state_count + 2) * sizeof(int)); // Each state pushes two at most, plus seeds
+    dfa->seeds = malloc((re->state_count + 1) * sizeof(int));
+    dfa->found = malloc(re->state_count * sizeof(int));
+    dfa->mark = calloc(re->state_count, sizeof(unsigned));
+    if (!dfa->states || !dfa->next || !dfa->table || !dfa->stack || !dfa->seeds || !dfa->found || !dfa->mark) {
+        xregex_dfa_free(dfa);
+        return NULL;
+    }
+    return dfa;
+}
+
+static void dfa_flush(xregex_dfa_t *dfa) {
+    for (int i = 0; i < dfa->count; i++) free(dfa->states[i].set);
+    dfa->count = 0;
+    dfa->initial = -1;
+    dfa->flushes++;
+    memset(dfa->table, 0, dfa->table_size * sizeof(*dfa->table));
+}
+
+void xregex_dfa_free(xregex_dfa_t *dfa) {
+    if (!dfa) return;
+    if (dfa->states) dfa_flush(dfa);
+    free(dfa->states);
+    free(dfa->next);
+    free(dfa->table);
+    free(dfa->stack);
+    free(dfa->seeds);
+    free(dfa->found);
+    free(dfa->mark);
+    free(dfa);
+}
+
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// The states reachable from seeds without consuming a byte, into found,
+// sorted; BOL and EOL are passed through only when allowed
+static int closure(xregex_dfa_t *dfa, const int *seeds, int seed_count, int at_bol, int at_eol) {
+    const nfa_state_t *states = dfa->re->states;
+    if (++dfa->generation == 0) {
+        memset(dfa->mark, 0, dfa->re->state_count * sizeof(unsigned));
+        dfa->generation = 1;
+    }
+    int depth = 0, count = 0;
+    for (int i = 0; i < seed_count; i++) dfa->stack[depth++] = seeds[i];
+    while (depth > 0) {
+        int id = dfa->stack[--depth];
+        if (id < 0 || dfa->mark[id] == dfa->generation) continue;
+        dfa->mark[id] = dfa->generation;
+        const nfa_state_t *state = &states[id];
+        switch (state->type) {
+            case NFA_SPLIT:
+                if (state->out1 >= 0) dfa->stack[depth++] = state->out1;
+                dfa->stack[depth++] = state->out;
+                break;
+            case NFA_BOL:
+                if (at_bol) dfa->stack[depth++] = state->out;
+                break;
+            case NFA_EOL:
+                if (at_eol) {
+                    dfa->stack[depth++] = state->out;
+                } else {
+                    dfa->found[count++] = id;
+                }
+                break;
+            default:
+                dfa->found[count++] = id;
+                break;
+        }
+    }
+    qsort(dfa->found, count, sizeof(int), compare_ints);
+    return count;
+}
+
+static unsigned hash_set(const int *set, int count) {
+    return (unsigned)xsh_hash_bytes(set, (size_t)count * sizeof(int));
+}
+
+// The DFA state for the closure in dfa->found, added if new
+static int dfa_state(xregex_dfa_t *dfa, int count) {
+    unsigned slot = hash_set(dfa->found, count) % dfa->table_size;
+    for (; dfa->table[slot]; slot = (slot + 1) % dfa->table_size) {
+        dfa_state_t *state = &dfa->states[dfa->table[slot] - 1];
+        if (state->count == count && memcmp(state->set, dfa->found, count * sizeof(int)) == 0) {
+            return dfa->table[slot] - 1;
+        }
+    }
+    if (dfa->count == XREGEX_DFA_STATES) {
+        // Start over rather than grow without bound; found is untouched
+        dfa_flush(dfa);
+        slot = hash_set(dfa->found, count) % dfa->table_size;
+    }
+    int *set = malloc((count ? count : 1) * sizeof(int));
+    if (!set) return -1;
+    memcpy(set, dfa->found, count * sizeof(int));
+
+    const nfa_state_t *states = dfa->re->states;
+    int index = dfa->count++;
+    dfa_state_t *state = &dfa->states[index];
+    state->set = set;
+    state->count = count;
+    memset(dfa->next + (size_t)index * 256, 0xff, 256 * sizeof(int));
+    state->matched = 0;
+    state->dead = count == 0;
+    int eols = 0;
+    for (int i = 0; i < count; i++) {
+        if (states[set[i]].type == NFA_MATCH) state->matched = 1;
+        if (states[set[i]].type == NFA_EOL) dfa->seeds[eols++] = set[i];
+    }
+    dfa->table[slot] = index + 1;
+
+    // Whether the line ending here gets past a $ to a match
+    state->end_accept = state->matched;
+    if (!state->matched && eols > 0) {
+        int reached = closure(dfa, dfa->seeds, eols, 0, 1);
+        for (int i = 0; i < reached; i++) {
+            if (states[dfa->found[i]].type == NFA_MATCH) state->end_accept = 1;
+        }
+    }
+    return index;
+}
+
+static int dfa_initial(xregex_dfa_t *dfa) {
+    if (dfa->initial < 0) dfa->initial = dfa_state(dfa, closure(dfa, &dfa->re->start, 1, 1, 0));
+    return dfa->initial;
+}
+
+// Build the transition from state on byte c, returned as it is stored. A
+// match may start at any byte, so the start state joins every step.
+static int dfa_step(xregex_dfa_t *dfa, int from, unsigned char c) {
+    const nfa_state_t *states = dfa->re->states;
+    const dfa_state_t *state = &dfa->states[from];
+    int count = 0;
+    for (int i = 0; i < state->count; i++) {
+        const nfa_state_t *nfa = &states[state->set[i]];
+        if (nfa->type == NFA_CHAR && CLASS_HAS(&dfa->re->classes[nfa->class_index], c)) {
+            dfa->seeds[count++] = nfa->out;
+        }
+    }
+    dfa->seeds[count++] = dfa->re->start;
+    unsigned flushes = dfa->flushes;
+    int to = dfa_state(dfa, closure(dfa, dfa->seeds, count, 0, 0));
+    if (to < 0) return -1;
+    if (dfa->states[to].matched || dfa->states[to].dead) to |= DFA_FINAL;
+    // A flush has freed from; the transition is built again next time
+    if (dfa->flushes == flushes) dfa->next[(size_t)from * 256 + c] = to;
+    return to;
+}
+
+int xregex_dfa_match(xregex_dfa_t *dfa, const char *line, const char *end) {
+    int s = dfa_initial(dfa);
+    if (s < 0) return 0;
+    if (dfa->states[s].matched || dfa->states[s].dead) return dfa->states[s].matched;
+    const unsigned char *p = (const unsigned char *)line, *stop = (const unsigned char *)end;
+    const int *row = dfa->next + (size_t)s * 256;
+    for (; p < stop; p++) {
+        int to = row[*p];
+        if (to & ~DFA_INDEX) {
+            if (to < 0 && (to = dfa_step(dfa, s, *p)) < 0) return 0;
+            if (to & DFA_FINAL) return dfa->states[to & DFA_INDEX].matched;
+        }
+        s = to;
+        row = dfa->next + (size_t)s * 256;
+    }
+    return dfa->states[s].end_accept;
+}